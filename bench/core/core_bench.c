@@ -0,0 +1,304 @@
+/*
+ * Microbenchmarks for the in-memory namespace (source/vtfs_core.c), built in
+ * userspace by `make core-bench`. Flags and output follow Google Benchmark:
+ *
+ *   core_bench [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>]
+ *              [--benchmark_format=console|json]
+ *
+ * Each benchmark runs with a few tree sizes (the /N suffix) and repeats its
+ * timed loop with more iterations until it lasts at least min_time; the
+ * reported time is per iteration. Setup and teardown are not timed.
+ */
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vtfs_core.h"
+
+#define FILES_PER_DIR 100
+#define APPEND_CHUNK 4096
+#define APPEND_LIMIT (16 << 20)
+#define MAX_ITERATIONS 1000000000UL
+#define DIR_INO_BASE 100000000
+
+struct bench_state {
+  long arg;
+  size_t iterations;
+  double started_ns;
+  double elapsed_ns;
+};
+
+struct benchmark {
+  const char* name;
+  void (*run)(struct bench_state* state);
+  long args[4];
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Like state.ResumeTiming() and state.PauseTiming()
+static void bench_resume(struct bench_state* state) {
+  state->started_ns = now_ns();
+}
+
+static void bench_pause(struct bench_state* state) {
+  state->elapsed_ns += now_ns() - state->started_ns;
+}
+
+static unsigned long next_random(unsigned long* seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  return *seed;
+}
+
+static void file_name(char* buf, size_t size, const char* prefix, long i) {
+  snprintf(buf, size, "%s%ld", prefix, i);
+}
+
+// count regular files spread over directories of FILES_PER_DIR; file inos
+// start at 1000, directory inos at DIR_INO_BASE
+static void build_tree(struct vtfs_dir* root, long count) {
+  struct vtfs_dir* dir = root;
+  char name[32];
+
+  vtfs_init_dir(root);
+  for (long i = 0; i < count; i++) {
+    if (i % FILES_PER_DIR == 0 && i > 0) {
+      file_name(name, sizeof(name), "d", i / FILES_PER_DIR);
+      dir = vtfs_create_file(root, name, S_IFDIR | 0755, DIR_INO_BASE + i / FILES_PER_DIR)->dir_data;
+    }
+    file_name(name, sizeof(name), "f", i);
+    vtfs_create_file(dir, name, S_IFREG | 0644, 1000 + i);
+  }
+}
+
+// Create and remove one name in a directory of N entries
+static void bm_create_remove(struct bench_state* state) {
+  struct vtfs_dir dir;
+  char name[32];
+
+  vtfs_init_dir(&dir);
+  for (long i = 0; i < state->arg; i++) {
+    file_name(name, sizeof(name), "f", i);
+    vtfs_create_file(&dir, name, S_IFREG | 0644, 1000 + i);
+  }
+
+  bench_resume(state);
+  for (size_t i = 0; i < state->iterations; i++) {
+    vtfs_create_file(&dir, "new", S_IFREG | 0644, 1);
+    vtfs_remove_file(&dir, "new");
+  }
+  bench_pause(state);
+
+  vtfs_cleanup_dir(&dir);
+}
+
+// Look up existing names in a directory of N entries
+static void bm_find_file(struct bench_state* state) {
+  struct vtfs_dir dir;
+  char names[64][32];
+  unsigned long seed = 42;
+
+  vtfs_init_dir(&dir);
+  for (long i = 0; i < state->arg; i++) {
+    file_name(names[0], sizeof(names[0]), "f", i);
+    vtfs_create_file(&dir, names[0], S_IFREG | 0644, 1000 + i);
+  }
+  for (int i = 0; i < 64; i++) {
+    file_name(names[i], sizeof(names[i]), "f", next_random(&seed) % state->arg);
+  }
+
+  bench_resume(state);
+  for (size_t i = 0; i < state->iterations; i++) {
+    down_read(&dir.sem);
+    if (!vtfs_find_file(&dir, names[i % 64])) {
+      abort();
+    }
+    up_read(&dir.sem);
+  }
+  bench_pause(state);
+
+  vtfs_cleanup_dir(&dir);
+}
+
+// Inode lookup, what every VFS call starts with, in a tree of N files
+static void bm_find_by_ino(struct bench_state* state) {
+  struct vtfs_dir root;
+  unsigned long seed = 42;
+  ino_t inos[64];
+
+  build_tree(&root, state->arg);
+  for (int i = 0; i < 64; i++) {
+    inos[i] = 1000 + next_random(&seed) % state->arg;
+  }
+
+  bench_resume(state);
+  for (size_t i = 0; i < state->iterations; i++) {
+    if (!vtfs_find_file_by_ino(&root, inos[i % 64])) {
+      abort();
+    }
+  }
+  bench_pause(state);
+
+  vtfs_cleanup_dir(&root);
+}
+
+// Add and drop a hard link in a tree of N files; both update every link
+static void bm_link_unlink(struct bench_state* state) {
+  struct vtfs_dir root;
+  struct vtfs_file* target;
+
+  build_tree(&root, state->arg);
+  target = vtfs_find_file_by_ino(&root, 1000 + state->arg / 2);
+
+  bench_resume(state);
+  for (size_t i = 0; i < state->iterations; i++) {
+    vtfs_link_file(&root, &root, "link", target);
+    vtfs_unlink_file(&root, &root, "link", target->ino, NULL);
+  }
+  bench_pause(state);
+
+  vtfs_cleanup_dir(&root);
+}
+
+// Append 4 KiB to a file in a tree of N files, as RAM mode writes do
+static void bm_append(struct bench_state* state) {
+  struct vtfs_dir root;
+  struct vtfs_file* file;
+
+  build_tree(&root, state->arg);
+  file = vtfs_find_file_by_ino(&root, 1000 + state->arg - 1);
+
+  bench_resume(state);
+  for (size_t i = 0; i < state->iterations; i++) {
+    if (file->data_size >= APPEND_LIMIT) {
+      bench_pause(state);
+      vtfs_resize_data(&root, file, 0);
+      bench_resume(state);
+    }
+    if (vtfs_resize_data(&root, file, file->data_size + APPEND_CHUNK) != 0) {
+      abort();
+    }
+    memset(file->data + file->data_size - APPEND_CHUNK, 'x', APPEND_CHUNK);
+  }
+  bench_pause(state);
+
+  vtfs_cleanup_dir(&root);
+}
+
+// Free a tree of N files, as umount does
+static void bm_cleanup(struct bench_state* state) {
+  struct vtfs_dir root;
+
+  for (size_t i = 0; i < state->iterations; i++) {
+    build_tree(&root, state->arg);
+    bench_resume(state);
+    vtfs_cleanup_dir(&root);
+    bench_pause(state);
+  }
+}
+
+static const struct benchmark benchmarks[] = {
+  {"BM_CreateRemove", bm_create_remove, {10, 100, 1000, 10000}},
+  {"BM_FindFile", bm_find_file, {10, 100, 1000, 10000}},
+  {"BM_FindByIno", bm_find_by_ino, {100, 1000, 10000, 100000}},
+  {"BM_LinkUnlink", bm_link_unlink, {100, 1000, 10000, 100000}},
+  {"BM_Append", bm_append, {1, 100, 10000, 100000}},
+  {"BM_Cleanup", bm_cleanup, {100, 1000, 10000, 100000}},
+};
+
+// Grows the iteration count until one run lasts min_time, as Google Benchmark does
+static void run_one(const struct benchmark* bm, long arg, double min_time_ns, struct bench_state* state) {
+  size_t iterations = 1;
+
+  for (;;) {
+    state->arg = arg;
+    state->iterations = iterations;
+    state->elapsed_ns = 0;
+    bm->run(state);
+    if (state->elapsed_ns >= min_time_ns || iterations >= MAX_ITERATIONS) {
+      return;
+    }
+
+    double factor = state->elapsed_ns > 0 ? min_time_ns * 1.4 / state->elapsed_ns : 10;
+    if (factor > 10) {
+      factor = 10;
+    }
+    if (factor < 2) {
+      factor = 2;
+    }
+    iterations = (size_t)(iterations * factor);
+    if (iterations > MAX_ITERATIONS) {
+      iterations = MAX_ITERATIONS;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  const char* filter = ".";
+  const char* format = "console";
+  double min_time = 0.5;
+  regex_t regex;
+  int printed = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--benchmark_filter=", 19)) {
+      filter = argv[i] + 19;
+    } else if (!strncmp(argv[i], "--benchmark_min_time=", 21)) {
+      min_time = atof(argv[i] + 21);
+    } else if (!strncmp(argv[i], "--benchmark_format=", 19)) {
+      format = argv[i] + 19;
+    } else {
+      fprintf(stderr, "Usage: %s [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>] "
+              "[--benchmark_format=console|json]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (regcomp(&regex, filter, REG_EXTENDED | REG_NOSUB) != 0) {
+    fprintf(stderr, "Invalid filter: %s\n", filter);
+    return 2;
+  }
+
+  int json = !strcmp(format, "json");
+  if (json) {
+    printf("{\n  \"benchmarks\": [");
+  } else {
+    printf("%-28s %15s %12s\n", "Benchmark", "Time", "Iterations");
+    printf("-------------------------------------------------------------\n");
+  }
+
+  for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+    for (int a = 0; a < 4; a++) {
+      struct bench_state state;
+      char name[64];
+
+      snprintf(name, sizeof(name), "%s/%ld", benchmarks[b].name, benchmarks[b].args[a]);
+      if (regexec(&regex, name, 0, NULL, 0) != 0) {
+        continue;
+      }
+
+      run_one(&benchmarks[b], benchmarks[b].args[a], min_time * 1e9, &state);
+      double per_iteration = state.elapsed_ns / state.iterations;
+      if (json) {
+        printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"real_time\": %.3f, \"time_unit\": \"ns\"}",
+               printed ? "," : "", name, state.iterations, per_iteration);
+      } else {
+        printf("%-28s %12.1f ns %12zu\n", name, per_iteration, state.iterations);
+      }
+      fflush(stdout);
+      printed++;
+    }
+  }
+
+  if (json) {
+    printf("\n  ]\n}\n");
+  }
+  regfree(&regex);
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * libFuzzer harness for the in-memory namespace (source/vtfs_core.c), built
+ * by `make core-fuzz` with clang, AddressSanitizer and UBSan:
+ *
+ *   bench/core/core_fuzz -max_total_time=60 corpus/
+ *
+ * The input is a list of operations, three bytes each: op, directory and
+ * name (or inode, or size). Names come from a small alphabet so that
+ * collisions, links and non-empty directories are common. After every
+ * operation the tree is checked: names unique per directory, every entry of
+ * an inode sharing one buffer, size and link count, and the link count
+ * equal to the number of entries. Everything is freed at the end, so leaks
+ * and double frees of shared buffers show up under ASan.
+ *
+ * Built with -DVTFS_FUZZ_MAIN (make core-fuzz-replay) it runs the files given
+ * on the command line instead, for compilers without libFuzzer.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vtfs_core.h"
+
+#define MAX_OPS 512
+#define MAX_ENTRIES 2048
+#define NAMES 8
+
+enum fuzz_op {
+  FUZZ_CREATE,
+  FUZZ_MKDIR,
+  FUZZ_LINK,
+  FUZZ_UNLINK,
+  FUZZ_RMDIR,
+  FUZZ_RESIZE,
+  FUZZ_STALE,
+  FUZZ_OP_COUNT,
+};
+
+struct fuzz_entry {
+  struct vtfs_dir* parent;
+  struct vtfs_file* file;
+};
+
+struct fuzz_tree {
+  struct vtfs_dir root;
+  struct vtfs_dir* dirs[MAX_ENTRIES];
+  size_t dir_count;
+  struct fuzz_entry entries[MAX_ENTRIES];
+  size_t entry_count;
+  ino_t next_ino;
+};
+
+static void walk(struct fuzz_tree* tree, struct vtfs_dir* dir) {
+  struct vtfs_file* file;
+
+  if (tree->dir_count < MAX_ENTRIES) {
+    tree->dirs[tree->dir_count++] = dir;
+  }
+  list_for_each_entry(file, &dir->files, list) {
+    if (tree->entry_count < MAX_ENTRIES) {
+      tree->entries[tree->entry_count].parent = dir;
+      tree->entries[tree->entry_count].file = file;
+      tree->entry_count++;
+    }
+    if (file->dir_data) {
+      walk(tree, file->dir_data);
+    }
+  }
+}
+
+static void refresh(struct fuzz_tree* tree) {
+  tree->dir_count = 0;
+  tree->entry_count = 0;
+  walk(tree, &tree->root);
+}
+
+static void check(struct fuzz_tree* tree) {
+  for (size_t i = 0; i < tree->entry_count; i++) {
+    struct vtfs_file* a = tree->entries[i].file;
+    unsigned int links = 0;
+
+    if (S_ISDIR(a->mode) != (a->dir_data != NULL)) {
+      abort();
+    }
+    if (a->data_size > 0 && !a->data) {
+      abort();
+    }
+    for (size_t j = 0; j < tree->entry_count; j++) {
+      struct vtfs_file* b = tree->entries[j].file;
+      if (i != j && tree->entries[i].parent == tree->entries[j].parent && !strcmp(a->name, b->name)) {
+        abort();
+      }
+      if (b->ino == a->ino) {
+        if (b->data != a->data || b->data_size != a->data_size || b->nlink != a->nlink) {
+          abort();
+        }
+        links++;
+      }
+    }
+    if (links != a->nlink) {
+      abort();
+    }
+  }
+}
+
+static void run_op(struct fuzz_tree* tree, const uint8_t* op) {
+  struct vtfs_dir* dir = tree->dirs[op[1] % tree->dir_count];
+  char name[2] = {'a' + op[2] % NAMES, '\0'};
+  struct vtfs_file* file;
+
+  switch (op[0] % FUZZ_OP_COUNT) {
+  case FUZZ_CREATE:
+    vtfs_create_file(dir, name, S_IFREG | 0644, tree->next_ino++);
+    break;
+  case FUZZ_MKDIR:
+    vtfs_create_file(dir, name, S_IFDIR | 0755, tree->next_ino++);
+    break;
+  case FUZZ_LINK:
+    if (tree->entry_count == 0) {
+      break;
+    }
+    file = tree->entries[op[2] % tree->entry_count].file;
+    name[0] = 'a' + op[2] / tree->entry_count % NAMES;
+    // As vtfs_link, which refuses directories
+    if (!S_ISDIR(file->mode)) {
+      vtfs_link_file(&tree->root, dir, name, file);
+    }
+    break;
+  case FUZZ_UNLINK:
+    down_read(&dir->sem);
+    file = vtfs_find_file(dir, name);
+    up_read(&dir->sem);
+    if (file && !S_ISDIR(file->mode)) {
+      vtfs_unlink_file(&tree->root, dir, name, file->ino, NULL);
+    }
+    break;
+  case FUZZ_RMDIR:
+    vtfs_remove_dir(dir, name, NULL);
+    break;
+  case FUZZ_RESIZE:
+    if (tree->entry_count == 0) {
+      break;
+    }
+    file = tree->entries[op[1] % tree->entry_count].file;
+    if (!S_ISDIR(file->mode) && vtfs_resize_data(&tree->root, file, op[2] * 37) == 0 && file->data) {
+      memset(file->data, op[2], file->data_size);
+    }
+    break;
+  case FUZZ_STALE:
+    vtfs_mark_all_stale(&tree->root);
+    break;
+  }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static struct fuzz_tree tree;
+
+  vtfs_init_dir(&tree.root);
+  tree.next_ino = 200;
+  refresh(&tree);
+
+  for (size_t i = 0; i + 3 <= size && i / 3 < MAX_OPS; i += 3) {
+    run_op(&tree, data + i);
+    refresh(&tree);
+    check(&tree);
+  }
+
+  vtfs_cleanup_dir(&tree.root);
+  return 0;
+}
+
+#ifdef VTFS_FUZZ_MAIN
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    FILE* f = fopen(argv[i], "rb");
+    uint8_t* buf;
+    long size;
+
+    if (!f) {
+      perror(argv[i]);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size ? size : 1);
+    if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+      perror(argv[i]);
+      return 1;
+    }
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, size);
+    free(buf);
+    printf("%s: ok\n", argv[i]);
+  }
+  return 0;
+}
+#endif
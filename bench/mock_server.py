@@ -0,0 +1,456 @@
+#!/usr/bin/env python3
+"""In-memory stand-in for the VTFS server, for benchmarking the kernel client.
+
+Speaks the same /api/* protocol as VtfsApiController: every response is
+an 8-byte big-endian status code followed by the payload, with the same
+payload formats and error codes (2 no such inode, 17 name exists,
+22 invalid range, 39 directory not empty, 304 not modified, 116 stale
+change feed cursor). State lives in one process and is lost on exit;
+there is no database, so measurements only reflect the client, the
+network stack and whatever is injected:
+
+    --latency MS          added to every request; METHOD=MS for one method
+    --jitter MS           uniform random extra delay in [0, MS)
+    --bandwidth RATE      cap on request and response bodies, e.g. 100M
+                          (bytes per second, K/M/G suffixes)
+    --error-rate P        fraction of requests answered with status 1
+    --drop-rate P         fraction of connections closed without a response
+    --seed N              makes jitter and injected failures repeatable
+
+The kernel module always connects to 127.0.0.1:8080, so stop the real
+server first:
+
+    python3 bench/mock_server.py --latency 0.5 --jitter 0.2 --bandwidth 1G
+    sudo bench/run_bench.sh --modes server
+
+Reads ignore accept=lz4 and answer uncompressed, which the client accepts;
+writes with enc=lz4 are decompressed.
+"""
+
+import argparse
+import base64
+import random
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+ROOT_INO = 100
+FIRST_INO = 200
+DIR_FLAG = 0o040000
+NOT_MODIFIED = 304
+STALE = 116
+MAX_EVENTS_PER_TOKEN = 10000
+MAX_POLL_TIMEOUT_MS = 60000
+# Chunk size for paced responses under --bandwidth
+PACE_CHUNK = 64 * 1024
+
+
+class Inode:
+    def __init__(self, ino, mode):
+        self.ino = ino
+        self.mode = mode
+        self.nlink = 1
+        self.version = 1
+        self.data = bytearray()
+
+    @property
+    def is_dir(self):
+        return self.mode & DIR_FLAG != 0
+
+
+class Namespace:
+    """Everything one token sees: inodes, directory entries and its change feed."""
+
+    def __init__(self, lock):
+        self.inodes = {ROOT_INO: Inode(ROOT_INO, DIR_FLAG | 0o777)}
+        self.dirs = {ROOT_INO: {}}
+        self.last_ino = FIRST_INO - 1
+        self.events = []
+        self.last_seq = 0
+        # Shares the store lock, so a poller cannot miss an event between
+        # looking at the feed and starting to wait
+        self.changed = threading.Condition(lock)
+
+    def publish(self, op, inode, parent_ino=0, name=""):
+        # Called with the store lock held
+        self.last_seq += 1
+        self.events.append((self.last_seq, op, inode.ino, parent_ino, inode.mode,
+                            len(inode.data), inode.version, name))
+        if len(self.events) > MAX_EVENTS_PER_TOKEN:
+            del self.events[0]
+        self.changed.notify_all()
+
+    def collect(self, since, limit):
+        """Returns (cursor, stale, events), like ChangeFeedService.collect."""
+        if since < 0:
+            return self.last_seq, False, []
+        oldest = self.events[0][0] if self.events else self.last_seq + 1
+        if since > self.last_seq or since + 1 < oldest:
+            return self.last_seq, True, []
+        result = [e for e in self.events if e[0] > since][:limit]
+        return (result[-1][0] if result else since), False, result
+
+
+class Store:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.tokens = {}
+        self.requests = 0
+        self.injected_errors = 0
+        self.dropped = 0
+
+    def namespace(self, token):
+        ns = self.tokens.get(token)
+        if ns is None:
+            ns = self.tokens[token] = Namespace(self.lock)
+        return ns
+
+
+class Failure(Exception):
+    def __init__(self, code, payload=b""):
+        super().__init__(code)
+        self.code = code
+        self.payload = payload
+
+
+def lz4_decompress(src, raw_len):
+    """Decodes one raw LZ4 block, the format the kernel crypto API produces."""
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+        literals = token >> 4
+        if literals == 15:
+            while True:
+                b = src[i]
+                i += 1
+                literals += b
+                if b != 255:
+                    break
+        out += src[i:i + literals]
+        i += literals
+        if i >= len(src):
+            break
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        match = token & 15
+        if match == 15:
+            while True:
+                b = src[i]
+                i += 1
+                match += b
+                if b != 255:
+                    break
+        match += 4
+        start = len(out) - offset
+        if offset == 0 or start < 0:
+            raise ValueError("bad LZ4 match offset")
+        for k in range(match):
+            out.append(out[start + k])
+    if len(out) != raw_len:
+        raise ValueError(f"decompressed {len(out)} bytes, expected {raw_len}")
+    return bytes(out)
+
+
+class Api:
+    """Handlers by method name. Each returns the payload or raises Failure."""
+
+    def __init__(self, store):
+        self.store = store
+
+    def _inode(self, ns, ino, code=2):
+        inode = ns.inodes.get(ino)
+        if inode is None:
+            raise Failure(code)
+        return inode
+
+    def _file(self, ns, ino):
+        inode = self._inode(ns, ino)
+        if inode.is_dir:
+            raise Failure(2)
+        return inode
+
+    def _add_entry(self, ns, parent_ino, name, inode):
+        entries = ns.dirs.setdefault(parent_ino, {})
+        if name in entries:
+            raise Failure(17)
+        entries[name] = inode.ino
+
+    def list(self, ns, q, body):
+        lines = []
+        for name, ino in ns.dirs.get(int(q["parent_ino"]), {}).items():
+            inode = ns.inodes[ino]
+            lines.append(f"{ino},{name},{inode.mode},{len(inode.data)},{inode.version}\n")
+        return "".join(lines).encode()
+
+    def create(self, ns, q, body, mode=None):
+        parent_ino = int(q["parent_ino"])
+        name = q["name"]
+        if name in ns.dirs.get(parent_ino, {}):
+            raise Failure(17)
+        ns.last_ino += 1
+        inode = Inode(ns.last_ino, mode if mode is not None else int(q["mode"]))
+        self._add_entry(ns, parent_ino, name, inode)
+        ns.inodes[inode.ino] = inode
+        if inode.is_dir:
+            ns.dirs[inode.ino] = {}
+        ns.publish("create", inode, parent_ino, name)
+        return f"{inode.ino},{inode.mode}\n".encode()
+
+    def mkdir(self, ns, q, body):
+        return self.create(ns, q, body, (int(q["mode"]) & 0o777) | DIR_FLAG)
+
+    def read(self, ns, q, body):
+        inode = self._file(ns, int(q["ino"]))
+        offset = int(q["offset"])
+        length = int(q["length"])
+        size = len(inode.data)
+        if "version" in q and int(q["version"]) == inode.version:
+            raise Failure(NOT_MODIFIED, struct.pack(">qqq", inode.version, size, 0))
+        start = min(offset, size)
+        end = min(offset + length, size)
+        return struct.pack(">qqq", inode.version, size, 0) + bytes(inode.data[start:end])
+
+    def write(self, ns, q, body):
+        inode = self._file(ns, int(q["ino"]))
+        if body is None:
+            data = base64.b64decode(q["data"])
+        elif q.get("enc", "none") == "lz4":
+            data = lz4_decompress(body, int(q["raw_len"]))
+        else:
+            data = body
+        self._put(inode, int(q["offset"]), data)
+        ns.publish("write", inode)
+        return f"{inode.version}\n".encode()
+
+    def _put(self, inode, offset, data):
+        end = offset + len(data)
+        if end > len(inode.data):
+            inode.data.extend(bytes(end - len(inode.data)))
+        inode.data[offset:end] = data
+        inode.version += 1
+
+    def copy(self, ns, q, body):
+        src_ino, dst_ino = int(q["src_ino"]), int(q["dst_ino"])
+        src_offset, dst_offset = int(q["src_offset"]), int(q["dst_offset"])
+        length = int(q["length"])
+        if src_offset < 0 or dst_offset < 0 or length < 0:
+            raise Failure(22)
+        if src_ino == dst_ino and src_offset < dst_offset + length and dst_offset < src_offset + length:
+            raise Failure(22)
+        src = self._file(ns, src_ino)
+        dst = self._file(ns, dst_ino)
+        copied = max(0, min(length, len(src.data) - src_offset))
+        if copied:
+            self._put(dst, dst_offset, bytes(src.data[src_offset:src_offset + copied]))
+            ns.publish("write", dst)
+        return f"{dst.version},{copied}\n".encode()
+
+    def _links(self, ns, ino):
+        return [(parent, name) for parent, entries in ns.dirs.items()
+                for name, target in entries.items() if target == ino]
+
+    def delete(self, ns, q, body, missing=2):
+        ino = int(q["ino"])
+        inode = self._inode(ns, ino, missing)
+        if inode.is_dir and ns.dirs.get(ino):
+            raise Failure(missing)
+        for parent, name in self._links(ns, ino):
+            del ns.dirs[parent][name]
+            ns.publish("remove", inode, parent, name)
+        del ns.inodes[ino]
+        ns.dirs.pop(ino, None)
+        return b""
+
+    def rmdir(self, ns, q, body):
+        return self.delete(ns, q, body, missing=39)
+
+    def link(self, ns, q, body):
+        inode = ns.inodes.get(int(q["old_ino"]))
+        if inode is None or inode.is_dir:
+            raise Failure(1)
+        parent_ino = int(q["parent_ino"])
+        if q["name"] in ns.dirs.get(parent_ino, {}):
+            raise Failure(1)
+        self._add_entry(ns, parent_ino, q["name"], inode)
+        inode.nlink += 1
+        ns.publish("link", inode, parent_ino, q["name"])
+        return f"{inode.ino},{inode.nlink}\n".encode()
+
+    def unlink(self, ns, q, body):
+        ino = int(q["ino"])
+        parent, name = int(q["parent_ino"]), q["name"]
+        inode = ns.inodes.get(ino)
+        if inode is None or ns.dirs.get(parent, {}).get(name) != ino:
+            raise Failure(2)
+        del ns.dirs[parent][name]
+        inode.nlink -= 1
+        if inode.nlink <= 0:
+            del ns.inodes[ino]
+        ns.publish("remove", inode, parent, name)
+        return b""
+
+    def stats(self, ns, q, body):
+        return (f"mock_requests={self.store.requests}\n"
+                f"mock_injected_errors={self.store.injected_errors}\n"
+                f"mock_dropped={self.store.dropped}\n"
+                f"mock_tokens={len(self.store.tokens)}\n").encode()
+
+
+def changes(store, token, q):
+    """Long poll; waiting releases the store lock. Returns (code, payload)."""
+    since = int(q["since"])
+    limit = int(q.get("limit", 64))
+    timeout = max(1, min(int(q.get("timeout", 0)), MAX_POLL_TIMEOUT_MS)) / 1000
+    deadline = time.monotonic() + timeout
+    with store.lock:
+        ns = store.namespace(token)
+        while True:
+            cursor, stale, events = ns.collect(since, limit)
+            left = deadline - time.monotonic()
+            if events or stale or since < 0 or left <= 0:
+                break
+            ns.changed.wait(left)
+    lines = [f"{cursor}\n"] + [",".join(str(v) for v in event) + "\n" for event in events]
+    return (STALE if stale else 0), "".join(lines).encode()
+
+
+def parse_rate(text):
+    units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+    if text[-1].upper() in units:
+        return float(text[:-1]) * units[text[-1].upper()]
+    return float(text)
+
+
+def make_handler(args, store, api):
+    rng = random.Random(args.seed)
+    rng_lock = threading.Lock()
+
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *log_args):
+            if args.verbose:
+                super().log_message(fmt, *log_args)
+
+        def do_GET(self):
+            self.handle_api(None)
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", 0))
+            body = self.rfile.read(length)
+            self.pace(len(body))
+            self.handle_api(body)
+
+        def pace(self, nbytes):
+            if args.bandwidth:
+                time.sleep(nbytes / args.bandwidth)
+
+        def handle_api(self, body):
+            url = urlsplit(self.path)
+            method = url.path.rsplit("/", 1)[-1]
+            q = {k: v[0] for k, v in parse_qs(url.query, keep_blank_values=True).items()}
+
+            with rng_lock:
+                delay = args.latency_by_method.get(method, args.latency) / 1000
+                if args.jitter:
+                    delay += rng.uniform(0, args.jitter) / 1000
+                drop = rng.random() < args.drop_rate
+                fail = rng.random() < args.error_rate
+            if delay:
+                time.sleep(delay)
+
+            with store.lock:
+                store.requests += 1
+                if drop:
+                    store.dropped += 1
+                elif fail:
+                    store.injected_errors += 1
+            if drop:
+                self.close_connection = True
+                self.connection.close()
+                return
+            if fail:
+                self.respond(1, b"")
+                return
+
+            try:
+                if method == "changes":
+                    code, payload = changes(store, q.get("token", ""), q)
+                else:
+                    handler = getattr(api, method, None)
+                    if handler is None or method.startswith("_"):
+                        self.send_error(404)
+                        return
+                    with store.lock:
+                        ns = store.namespace(q.get("token", ""))
+                        code, payload = 0, handler(ns, q, body)
+            except Failure as failure:
+                code, payload = failure.code, failure.payload
+            except (KeyError, ValueError):
+                code, payload = 1, b""
+            self.respond(code, payload)
+
+        def respond(self, code, payload):
+            data = struct.pack(">q", code) + payload
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(data)))
+            self.send_header("Connection", "close")
+            self.end_headers()
+            self.close_connection = True
+            if not args.bandwidth:
+                self.wfile.write(data)
+                return
+            for i in range(0, len(data), PACE_CHUNK):
+                chunk = data[i:i + PACE_CHUNK]
+                self.wfile.write(chunk)
+                self.wfile.flush()
+                self.pace(len(chunk))
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--latency", action="append", default=[], metavar="[METHOD=]MS",
+                        help="added delay in milliseconds, for all methods or one")
+    parser.add_argument("--jitter", type=float, default=0.0, metavar="MS")
+    parser.add_argument("--bandwidth", type=parse_rate, default=0, metavar="RATE",
+                        help="bytes per second for bodies, K/M/G suffixes; 0 is unlimited")
+    parser.add_argument("--error-rate", type=float, default=0.0, metavar="P")
+    parser.add_argument("--drop-rate", type=float, default=0.0, metavar="P")
+    parser.add_argument("--seed", type=int, default=None)
+    parser.add_argument("--verbose", action="store_true", help="log every request")
+    args = parser.parse_args()
+
+    args.latency_by_method = {}
+    base = 0.0
+    for item in args.latency:
+        if "=" in item:
+            method, ms = item.split("=", 1)
+            args.latency_by_method[method] = float(ms)
+        else:
+            base = float(item)
+    args.latency = base
+
+    store = Store()
+    server = ThreadingHTTPServer((args.host, args.port), make_handler(args, store, Api(store)))
+    server.daemon_threads = True
+    print(f"Mock VTFS server on {args.host}:{args.port} (latency {args.latency} ms, jitter {args.jitter} ms, "
+          f"bandwidth {args.bandwidth or 'unlimited'}, errors {args.error_rate}, drops {args.drop_rate})",
+          file=sys.stderr)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Builds and compares the JSON reports of bench/run_bench.sh.
+
+    report.py build <results dir> <report.json> [key=value ...]
+    report.py compare <report.json> <baseline.json> [--threshold 10]
+
+`build` reads what run_bench.sh left in the results directory, one
+subdirectory per mode:
+
+    micro.jsonl       one object per line from vtfs_micro
+    fio_<job>.json    fio --output-format=json
+    mount_ms.txt      one mount time in milliseconds per line
+
+and writes a single report:
+
+    {"version": 1,
+     "meta": {"date": ..., "kernel": ..., "commit": ..., "params": {...}},
+     "results": {"ram": {"create": {"ops_per_sec": ..., "p99_us": ...},
+                         "seq_read": {"bw_mib_s": ..., "iops": ..., ...},
+                         "mount": {"p50_ms": ..., "max_ms": ...}},
+                 "server": {...}}}
+
+`compare` prints every metric present in both reports with its change
+and exits with status 1 when any got worse by more than the threshold
+(in percent). Throughput metrics (ops_per_sec, bw_mib_s, iops) are
+better when higher, latencies (*_us, *_ms) when lower.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+
+REPORT_VERSION = 1
+HIGHER_IS_BETTER = ("ops_per_sec", "bw_mib_s", "iops")
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    if not ordered:
+        return 0.0
+    return ordered[min(len(ordered) - 1, int(p * (len(ordered) - 1) + 0.5))]
+
+
+def read_micro(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            entry = json.loads(line)
+            results[entry["test"]] = {
+                "ops_per_sec": entry["ops_per_sec"],
+                "p50_us": entry["p50_us"],
+                "p99_us": entry["p99_us"],
+                "errors": entry["errors"],
+            }
+    return results
+
+
+def read_fio(path):
+    with open(path) as f:
+        data = json.load(f)
+    job = data["jobs"][0]
+    side = job["read"] if job["read"]["io_bytes"] > 0 else job["write"]
+    clat = side.get("clat_ns", {}).get("percentile", {})
+    return {
+        "bw_mib_s": round(side["bw"] / 1024, 2),
+        "iops": round(side["iops"], 1),
+        "p50_us": round(clat.get("50.000000", 0) / 1000, 1),
+        "p99_us": round(clat.get("99.000000", 0) / 1000, 1),
+        "errors": job.get("error", 0),
+    }
+
+
+def read_mount(path):
+    with open(path) as f:
+        times = [float(line) for line in f if line.strip()]
+    return {
+        "p50_ms": round(statistics.median(times), 2) if times else 0.0,
+        "max_ms": round(max(times), 2) if times else 0.0,
+    }
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True,
+                              text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def build(args):
+    results = {}
+    for mode in sorted(os.listdir(args.results)):
+        mode_dir = os.path.join(args.results, mode)
+        if not os.path.isdir(mode_dir):
+            continue
+        mode_results = {}
+        for name in sorted(os.listdir(mode_dir)):
+            path = os.path.join(mode_dir, name)
+            if name == "micro.jsonl":
+                mode_results.update(read_micro(path))
+            elif name.startswith("fio_") and name.endswith(".json"):
+                mode_results[name[len("fio_"):-len(".json")]] = read_fio(path)
+            elif name == "mount_ms.txt":
+                mode_results["mount"] = read_mount(path)
+        results[mode] = mode_results
+
+    params = dict(item.split("=", 1) for item in args.params)
+    report = {
+        "version": REPORT_VERSION,
+        "meta": {
+            "date": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+            "kernel": platform.release(),
+            "host": platform.node(),
+            "commit": git_commit(),
+            "params": params,
+        },
+        "results": results,
+    }
+    with open(args.report, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+    print(f"Report written to {args.report}")
+    return 0
+
+
+def compare(args):
+    with open(args.report) as f:
+        current = json.load(f)
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    if current["meta"].get("params") != baseline["meta"].get("params"):
+        print("Warning: the reports were made with different parameters", file=sys.stderr)
+
+    regressions = 0
+    print(f"{'mode':<8} {'test':<16} {'metric':<12} {'baseline':>12} {'current':>12} {'change':>8}")
+    for mode, tests in sorted(current["results"].items()):
+        for test, metrics in sorted(tests.items()):
+            old_metrics = baseline["results"].get(mode, {}).get(test)
+            if old_metrics is None:
+                continue
+            for metric, value in sorted(metrics.items()):
+                old = old_metrics.get(metric)
+                if metric == "errors" or old is None or old == 0:
+                    continue
+                change = (value - old) / old * 100
+                worse = -change if metric in HIGHER_IS_BETTER else change
+                flag = ""
+                if worse > args.threshold:
+                    flag = "  REGRESSION"
+                    regressions += 1
+                print(f"{mode:<8} {test:<16} {metric:<12} {old:>12.1f} {value:>12.1f} {change:>+7.1f}%{flag}")
+
+    if regressions:
+        print(f"\n{regressions} metric(s) regressed by more than {args.threshold}%")
+        return 1
+    print(f"\nNo regressions beyond {args.threshold}%")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    build_parser = sub.add_parser("build", help="assemble a report from a results directory")
+    build_parser.add_argument("results")
+    build_parser.add_argument("report")
+    build_parser.add_argument("params", nargs="*", help="key=value pairs recorded in meta.params")
+
+    compare_parser = sub.add_parser("compare", help="compare a report against a baseline")
+    compare_parser.add_argument("report")
+    compare_parser.add_argument("baseline")
+    compare_parser.add_argument("--threshold", type=float, default=10.0,
+                                help="percent change counted as a regression (default 10)")
+
+    args = parser.parse_args()
+    return build(args) if args.command == "build" else compare(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
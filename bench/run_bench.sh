@@ -0,0 +1,171 @@
+#!/bin/bash
+# Бенчмарк VTFS в RAM и Server режимах
+# Метаданные (create/stat/unlink, readdir, жесткие ссылки) через vtfs_micro,
+# данные (последовательные и случайные чтение/запись, дозапись) через fio,
+# плюс время монтирования. Результат - JSON отчет (см. bench/report.py).
+#
+# Использование: sudo bench/run_bench.sh [--modes ram,server] [--out файл]
+#                                        [--baseline файл] [--threshold 10]
+#                                        [--mock "параметры mock_server.py"]
+# С --mock server режим работает с bench/mock_server.py вместо настоящего
+# сервера, например: --mock "--latency 0.5 --bandwidth 1G --seed 1"
+# Параметры нагрузки: BENCH_SIZE (64m), BENCH_FILES (1000),
+#                     BENCH_DIR_FILES (5000), BENCH_LINKS (500), BENCH_MOUNTS (5)
+
+set -e
+
+BENCH_DIR="$(cd "$(dirname "$0")" && pwd)"
+REPO_DIR="$(dirname "$BENCH_DIR")"
+MODULE_NAME="vtfs"
+MOUNT_POINT="/mnt/vtfs_bench"
+SERVER_URL="http://127.0.0.1:8080/api"
+
+MODES="ram,server"
+OUT="$REPO_DIR/bench_report.json"
+BASELINE=""
+THRESHOLD=10
+MOCK=""
+MOCK_PID=""
+
+export BENCH_SIZE="${BENCH_SIZE:-64m}"
+BENCH_FILES="${BENCH_FILES:-1000}"
+BENCH_DIR_FILES="${BENCH_DIR_FILES:-5000}"
+BENCH_LINKS="${BENCH_LINKS:-500}"
+BENCH_MOUNTS="${BENCH_MOUNTS:-5}"
+FIO_JOBS="seq_write seq_read rand_write rand_read append"
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --modes) MODES="$2"; shift 2 ;;
+        --out) OUT="$2"; shift 2 ;;
+        --baseline) BASELINE="$2"; shift 2 ;;
+        --threshold) THRESHOLD="$2"; shift 2 ;;
+        --mock) MOCK="$2"; shift 2 ;;
+        *) echo "Неизвестный параметр: $1"; exit 2 ;;
+    esac
+done
+
+RESULTS="$(mktemp -d /tmp/vtfs_bench.XXXXXX)"
+
+cleanup() {
+    if mountpoint -q "$MOUNT_POINT" 2>/dev/null; then
+        umount "$MOUNT_POINT" 2>/dev/null || true
+    fi
+    rmmod "$MODULE_NAME" 2>/dev/null || true
+    if [ -n "$MOCK_PID" ]; then
+        kill "$MOCK_PID" 2>/dev/null || true
+    fi
+    rm -rf "$MOUNT_POINT" "$RESULTS" 2>/dev/null || true
+}
+
+if [ "$EUID" -ne 0 ]; then
+    echo -e "${RED}Требуются права root${NC}"
+    echo "Запустите: sudo $0"
+    exit 1
+fi
+
+if ! command -v fio >/dev/null 2>&1; then
+    echo -e "${RED}fio не найден, установите пакет fio${NC}"
+    exit 1
+fi
+
+trap cleanup EXIT
+
+echo "Компиляция модуля и vtfs_micro..."
+make -C "$REPO_DIR" >/dev/null
+${CC:-cc} -O2 -Wall -o "$BENCH_DIR/vtfs_micro" "$BENCH_DIR/vtfs_micro.c"
+mkdir -p "$MOUNT_POINT"
+insmod "$REPO_DIR/$MODULE_NAME.ko" 2>/dev/null || true
+
+# mount_options <режим>
+mount_options() {
+    if [ "$1" = "ram" ]; then
+        echo 'token='
+    else
+        echo "token=$TOKEN"
+    fi
+}
+
+# run_mode <режим>
+run_mode() {
+    local mode="$1"
+    local out="$RESULTS/$mode"
+    local options
+    options="$(mount_options "$mode")"
+    mkdir -p "$out"
+    
+    echo "[$mode] Время монтирования ($BENCH_MOUNTS раз)..."
+    for _ in $(seq "$BENCH_MOUNTS"); do
+        local start end
+        start=$(date +%s%N)
+        mount -t vtfs none "$MOUNT_POINT" -o "$options"
+        ls "$MOUNT_POINT" >/dev/null
+        end=$(date +%s%N)
+        umount "$MOUNT_POINT"
+        awk "BEGIN { printf \"%.3f\\n\", ($end - $start) / 1000000 }" >> "$out/mount_ms.txt"
+    done
+    
+    mount -t vtfs none "$MOUNT_POINT" -o "$options"
+    
+    echo "[$mode] Метаданные..."
+    mkdir "$MOUNT_POINT/micro"
+    "$BENCH_DIR/vtfs_micro" "$MOUNT_POINT/micro" storm "$BENCH_FILES" >> "$out/micro.jsonl"
+    "$BENCH_DIR/vtfs_micro" "$MOUNT_POINT/micro" readdir "$BENCH_DIR_FILES" >> "$out/micro.jsonl"
+    "$BENCH_DIR/vtfs_micro" "$MOUNT_POINT/micro" link "$BENCH_LINKS" >> "$out/micro.jsonl"
+    rmdir "$MOUNT_POINT/micro"
+    
+    mkdir "$MOUNT_POINT/fio"
+    for job in $FIO_JOBS; do
+        echo "[$mode] fio $job..."
+        (cd "$BENCH_DIR/fio" && VTFS_DIR="$MOUNT_POINT/fio" \
+            fio --output-format=json --output="$out/fio_$job.json" "$job.fio")
+    done
+    rm -rf "$MOUNT_POINT/fio"
+    
+    umount "$MOUNT_POINT"
+    echo -e "${GREEN}✅ [$mode] готово${NC}"
+}
+
+for mode in ${MODES//,/ }; do
+    case "$mode" in
+        ram)
+            run_mode ram
+            ;;
+        server)
+            if [ -n "$MOCK" ]; then
+                echo "Запуск mock сервера: $MOCK"
+                # shellcheck disable=SC2086
+                python3 "$BENCH_DIR/mock_server.py" $MOCK &
+                MOCK_PID=$!
+                for _ in $(seq 50); do
+                    curl -s "$SERVER_URL/list?token=test&parent_ino=100" >/dev/null 2>&1 && break
+                    sleep 0.1
+                done
+            fi
+            if ! curl -s "$SERVER_URL/list?token=test&parent_ino=100" >/dev/null 2>&1; then
+                echo -e "${YELLOW}⚠️  Сервер недоступен, пропускаем server режим${NC}"
+                echo "   Запустите сервер: cd server && mvn spring-boot:run"
+                continue
+            fi
+            TOKEN="bench_$(date +%s)"
+            run_mode server
+            ;;
+        *)
+            echo -e "${RED}Неизвестный режим: $mode${NC}"
+            exit 2
+            ;;
+    esac
+done
+
+python3 "$BENCH_DIR/report.py" build "$RESULTS" "$OUT" \
+    "size=$BENCH_SIZE" "files=$BENCH_FILES" "dir_files=$BENCH_DIR_FILES" \
+    "links=$BENCH_LINKS" "mounts=$BENCH_MOUNTS" "mock=$MOCK"
+
+if [ -n "$BASELINE" ]; then
+    python3 "$BENCH_DIR/report.py" compare "$OUT" "$BASELINE" --threshold "$THRESHOLD"
+fi
@@ -0,0 +1,224 @@
+/*
+ * Metadata microbenchmarks for a mounted vtfs. Each test times every call
+ * separately and prints one JSON object on stdout:
+ *
+ *   {"test": "create", "ops": 1000, "seconds": 0.41, "ops_per_sec": 2439.0,
+ *    "p50_us": 380.1, "p99_us": 912.4, "max_us": 2210.7, "errors": 0}
+ *
+ * Usage: vtfs_micro <dir> <test> [count]
+ *   storm    create, stat and unlink `count` files, one result each
+ *   readdir  list a directory of `count` files, ten times
+ *   link     make `count` hard links to one file, stat them, unlink them
+ *
+ * <dir> must be an empty directory on the mount; it is left empty again.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READDIR_PASSES 10
+
+struct samples {
+  double* us;
+  size_t count;
+  size_t errors;
+  double seconds;
+};
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void samples_init(struct samples* s, size_t capacity) {
+  s->us = calloc(capacity ? capacity : 1, sizeof(double));
+  if (!s->us) {
+    perror("calloc");
+    exit(1);
+  }
+  s->count = 0;
+  s->errors = 0;
+  s->seconds = 0;
+}
+
+static void samples_add(struct samples* s, double started, int ok) {
+  double elapsed = now_us() - started;
+  s->us[s->count++] = elapsed;
+  s->seconds += elapsed / 1e6;
+  if (!ok) {
+    s->errors++;
+  }
+}
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t count, double p) {
+  if (count == 0) {
+    return 0;
+  }
+  size_t index = (size_t)(p * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+static void report(const char* test, struct samples* s) {
+  qsort(s->us, s->count, sizeof(double), compare_double);
+  printf("{\"test\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+         "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"errors\": %zu}\n",
+         test, s->count, s->seconds, s->seconds > 0 ? s->count / s->seconds : 0,
+         percentile(s->us, s->count, 0.50), percentile(s->us, s->count, 0.99),
+         s->count ? s->us[s->count - 1] : 0, s->errors);
+  fflush(stdout);
+  free(s->us);
+}
+
+static void path_of(char* buf, size_t size, const char* dir, const char* prefix, size_t i) {
+  snprintf(buf, size, "%s/%s%06zu", dir, prefix, i);
+}
+
+static int create_file(const char* path) {
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    return 0;
+  }
+  close(fd);
+  return 1;
+}
+
+static void bench_storm(const char* dir, size_t count) {
+  struct samples create, stat_s, unlink_s;
+  char path[4096];
+  struct stat st;
+  
+  samples_init(&create, count);
+  samples_init(&stat_s, count);
+  samples_init(&unlink_s, count);
+  
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "f", i);
+    double started = now_us();
+    samples_add(&create, started, create_file(path));
+  }
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "f", i);
+    double started = now_us();
+    samples_add(&stat_s, started, stat(path, &st) == 0);
+  }
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "f", i);
+    double started = now_us();
+    samples_add(&unlink_s, started, unlink(path) == 0);
+  }
+  
+  report("create", &create);
+  report("stat", &stat_s);
+  report("unlink", &unlink_s);
+}
+
+static void bench_readdir(const char* dir, size_t count) {
+  struct samples passes;
+  char path[4096];
+  char test[64];
+  
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "d", i);
+    if (!create_file(path)) {
+      fprintf(stderr, "create %s: %s\n", path, strerror(errno));
+      exit(1);
+    }
+  }
+  
+  samples_init(&passes, READDIR_PASSES);
+  for (int pass = 0; pass < READDIR_PASSES; pass++) {
+    double started = now_us();
+    size_t seen = 0;
+    DIR* d = opendir(dir);
+    if (d) {
+      while (readdir(d)) {
+        seen++;
+      }
+      closedir(d);
+    }
+    // "." and ".." plus every file
+    samples_add(&passes, started, d && seen >= count + 2);
+  }
+  
+  snprintf(test, sizeof(test), "readdir_%zu", count);
+  report(test, &passes);
+  
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "d", i);
+    unlink(path);
+  }
+}
+
+static void bench_link(const char* dir, size_t count) {
+  struct samples link_s, stat_s, unlink_s;
+  char target[4096];
+  char path[4096];
+  struct stat st;
+  
+  snprintf(target, sizeof(target), "%s/link_target", dir);
+  if (!create_file(target)) {
+    fprintf(stderr, "create %s: %s\n", target, strerror(errno));
+    exit(1);
+  }
+  
+  samples_init(&link_s, count);
+  samples_init(&stat_s, count);
+  samples_init(&unlink_s, count);
+  
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "l", i);
+    double started = now_us();
+    samples_add(&link_s, started, link(target, path) == 0);
+  }
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "l", i);
+    double started = now_us();
+    samples_add(&stat_s, started, stat(path, &st) == 0);
+  }
+  for (size_t i = 0; i < count; i++) {
+    path_of(path, sizeof(path), dir, "l", i);
+    double started = now_us();
+    samples_add(&unlink_s, started, unlink(path) == 0);
+  }
+  unlink(target);
+  
+  report("link", &link_s);
+  report("link_stat", &stat_s);
+  report("link_unlink", &unlink_s);
+}
+
+int main(int argc, char** argv) {
+  size_t count;
+  
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <dir> storm|readdir|link [count]\n", argv[0]);
+    return 2;
+  }
+  count = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+  
+  if (strcmp(argv[2], "storm") == 0) {
+    bench_storm(argv[1], count);
+  } else if (strcmp(argv[2], "readdir") == 0) {
+    bench_readdir(argv[1], count);
+  } else if (strcmp(argv[2], "link") == 0) {
+    bench_link(argv[1], count);
+  } else {
+    fprintf(stderr, "unknown test: %s\n", argv[2]);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,273 @@
+#!/usr/bin/env python3
+"""Captures the VFS calls made on a vtfs mount and replays them on another.
+
+    vtfs_replay.py capture /mnt/vtfs trace.tsv [--entries 262144]
+    vtfs_replay.py replay trace.tsv /mnt/other [--speed 1 | --fast] [--json out.json]
+
+`capture` enables the mount's op ring (debugfs vtfs/<major:minor>/optrace_entries),
+appends everything read from vtfs/<major:minor>/optrace to the trace file until
+Ctrl-C or --duration, then turns the ring off again. Entries the ring
+overwrote before they were read are reported as dropped.
+
+A trace is one tab separated line per call, as the module writes them:
+
+    start_ns pid op ino offset len offset2 flags result latency_ns path path2
+
+with paths relative to the mount root ("-" when not applicable, backslash,
+tab and newline escaped). Only operations and sizes are recorded, never file
+contents, so traces can be shared.
+
+`replay` issues the same calls, in start order, under the target directory:
+with the original spacing (scaled by --speed) or back to back with --fast.
+Lookups and getattr are implied by the path walks of the other calls and
+skipped unless --with-lookups is given; written data is a fixed pattern.
+Prints per-op counts, replay latency next to the recorded one, and how
+many calls returned a different success or error than recorded.
+"""
+
+import argparse
+import errno
+import fcntl
+import json
+import os
+import statistics
+import struct
+import sys
+import time
+
+DEBUGFS = "/sys/kernel/debug/vtfs"
+# ATTR_SIZE from linux/fs.h
+ATTR_SIZE = 1 << 3
+# FICLONERANGE from linux/fs.h: _IOW(0x94, 13, struct file_clone_range)
+FICLONERANGE = 0x4020940D
+POLL_INTERVAL = 0.2
+FIELDS = ("start_ns", "pid", "op", "ino", "offset", "len", "offset2", "flags", "result", "latency_ns",
+          "path", "path2")
+PATTERN = bytes(range(256)) * 256
+
+
+def debugfs_dir(mount):
+    st = os.stat(mount)
+    path = os.path.join(DEBUGFS, f"{os.major(st.st_dev)}:{os.minor(st.st_dev)}")
+    if not os.path.isdir(path):
+        sys.exit(f"{path} not found: is {mount} a vtfs mount and debugfs mounted?")
+    return path
+
+
+def unescape(field):
+    if field == "-":
+        return None
+    out = []
+    i = 0
+    while i < len(field):
+        c = field[i]
+        if c == "\\" and i + 1 < len(field):
+            out.append({"t": "\t", "n": "\n"}.get(field[i + 1], field[i + 1]))
+            i += 2
+        else:
+            out.append(c)
+            i += 1
+    return "".join(out)
+
+
+def parse(line):
+    values = line.rstrip("\n").split("\t")
+    if len(values) != len(FIELDS):
+        return None
+    call = dict(zip(FIELDS, values))
+    for key in ("start_ns", "pid", "ino", "offset", "len", "offset2", "flags", "result", "latency_ns"):
+        call[key] = int(call[key])
+    call["path"] = unescape(call["path"])
+    call["path2"] = unescape(call["path2"])
+    return call
+
+
+def capture(args):
+    directory = debugfs_dir(args.mount)
+    with open(os.path.join(directory, "optrace_entries"), "w") as f:
+        f.write(str(args.entries))
+    print(f"Recording {args.mount} into {args.trace}, Ctrl-C to stop", file=sys.stderr)
+
+    lines = 0
+    deadline = time.monotonic() + args.duration if args.duration else None
+    try:
+        with open(args.trace, "ab") as out, open(os.path.join(directory, "optrace"), "rb") as ring:
+            while deadline is None or time.monotonic() < deadline:
+                chunk = ring.read()
+                if chunk:
+                    out.write(chunk)
+                    lines += chunk.count(b"\n")
+                else:
+                    time.sleep(POLL_INTERVAL)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        with open(os.path.join(directory, "optrace_dropped")) as f:
+            dropped = int(f.read())
+        with open(os.path.join(directory, "optrace_entries"), "w") as f:
+            f.write("0")
+
+    print(f"Captured {lines} calls, {dropped} dropped (raise --entries if nonzero)", file=sys.stderr)
+    return 0
+
+
+class Replayer:
+    def __init__(self, root):
+        self.root = root
+        self.fds = {}
+
+    def resolve(self, path):
+        return os.path.join(self.root, path.lstrip("/"))
+
+    def fd(self, path):
+        fd = self.fds.get(path)
+        if fd is None:
+            fd = self.fds[path] = os.open(self.resolve(path), os.O_RDWR)
+        return fd
+
+    def forget(self, path):
+        fd = self.fds.pop(path, None)
+        if fd is not None:
+            os.close(fd)
+
+    def close(self):
+        for fd in self.fds.values():
+            os.close(fd)
+        self.fds.clear()
+
+    def run(self, call):
+        """Replays one call; returns its result in the module's convention."""
+        op, path = call["op"], call["path"]
+        target = self.resolve(path) if path else None
+        if op in ("lookup", "getattr"):
+            os.lstat(target)
+        elif op == "create":
+            os.close(os.open(target, os.O_CREAT | os.O_WRONLY, call["flags"] & 0o7777))
+        elif op == "mkdir":
+            os.mkdir(target, call["flags"] & 0o7777)
+        elif op == "unlink":
+            self.forget(path)
+            os.unlink(target)
+        elif op == "rmdir":
+            os.rmdir(target)
+        elif op == "link":
+            os.link(self.resolve(call["path2"]), target)
+        elif op == "setattr":
+            if call["flags"] & ATTR_SIZE:
+                os.truncate(target, call["offset"])
+        elif op == "iterate":
+            if call["offset"] == 0:
+                os.listdir(target)
+        elif op == "open":
+            flags = call["flags"] & ~(os.O_CREAT | os.O_EXCL)
+            os.close(os.open(target, flags))
+        elif op == "read":
+            return len(os.pread(self.fd(path), call["len"], call["offset"]))
+        elif op == "write":
+            data = PATTERN[:call["len"]] if call["len"] <= len(PATTERN) else bytes(call["len"])
+            return os.pwrite(self.fd(path), data, call["offset"])
+        elif op == "copy_file_range":
+            return os.copy_file_range(self.fd(call["path2"]), self.fd(path), call["len"],
+                                      call["offset2"], call["offset"])
+        elif op == "remap_file_range":
+            arg = struct.pack("qQQQ", self.fd(call["path2"]), call["offset2"], call["len"], call["offset"])
+            fcntl.ioctl(self.fd(path), FICLONERANGE, arg)
+            return call["len"]
+        return 0
+
+
+def replay(args):
+    calls = []
+    # Names need not be UTF-8; surrogateescape carries their bytes through
+    with open(args.trace, errors="surrogateescape") as f:
+        for line in f:
+            call = parse(line)
+            if call is None or call["path"] is None:
+                continue
+            if call["op"] in ("lookup", "getattr") and not args.with_lookups:
+                continue
+            calls.append(call)
+    calls.sort(key=lambda c: c["start_ns"])
+    if not calls:
+        sys.exit("No replayable calls in the trace")
+
+    replayer = Replayer(args.target)
+    per_op = {}
+    first_ns = calls[0]["start_ns"]
+    started = time.monotonic()
+    try:
+        for call in calls:
+            if not args.fast:
+                due = started + (call["start_ns"] - first_ns) / 1e9 / args.speed
+                delay = due - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+
+            t0 = time.monotonic_ns()
+            try:
+                result = replayer.run(call)
+            except OSError as e:
+                result = -(e.errno or errno.EIO)
+            elapsed = time.monotonic_ns() - t0
+
+            stats = per_op.setdefault(call["op"], {"count": 0, "mismatches": 0, "replay_us": [], "recorded_us": []})
+            stats["count"] += 1
+            stats["replay_us"].append(elapsed / 1000)
+            stats["recorded_us"].append(call["latency_ns"] / 1000)
+            if (result < 0) != (call["result"] < 0):
+                stats["mismatches"] += 1
+    finally:
+        replayer.close()
+    wall = time.monotonic() - started
+
+    report = {"calls": len(calls), "wall_seconds": round(wall, 3),
+              "recorded_seconds": round((calls[-1]["start_ns"] - first_ns) / 1e9, 3), "ops": {}}
+    print(f"{'op':<18} {'count':>8} {'p50_us':>10} {'p99_us':>10} {'rec_p50':>10} {'rec_p99':>10} {'mismatch':>9}")
+    for op, stats in sorted(per_op.items()):
+        replay_us = sorted(stats["replay_us"])
+        recorded_us = sorted(stats["recorded_us"])
+        row = {
+            "count": stats["count"],
+            "p50_us": round(statistics.median(replay_us), 1),
+            "p99_us": round(replay_us[int(0.99 * (len(replay_us) - 1))], 1),
+            "recorded_p50_us": round(statistics.median(recorded_us), 1),
+            "recorded_p99_us": round(recorded_us[int(0.99 * (len(recorded_us) - 1))], 1),
+            "mismatches": stats["mismatches"],
+        }
+        report["ops"][op] = row
+        print(f"{op:<18} {row['count']:>8} {row['p50_us']:>10.1f} {row['p99_us']:>10.1f} "
+              f"{row['recorded_p50_us']:>10.1f} {row['recorded_p99_us']:>10.1f} {row['mismatches']:>9}")
+    print(f"\n{len(calls)} calls in {wall:.2f} s (recorded span {report['recorded_seconds']:.2f} s)")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+            f.write("\n")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    capture_parser = sub.add_parser("capture", help="record the calls made on a mount")
+    capture_parser.add_argument("mount")
+    capture_parser.add_argument("trace")
+    capture_parser.add_argument("--entries", type=int, default=262144, help="ring size (default 262144)")
+    capture_parser.add_argument("--duration", type=float, default=0, help="seconds to record, 0 until Ctrl-C")
+
+    replay_parser = sub.add_parser("replay", help="replay a trace under a directory")
+    replay_parser.add_argument("trace")
+    replay_parser.add_argument("target")
+    timing = replay_parser.add_mutually_exclusive_group()
+    timing.add_argument("--speed", type=float, default=1.0, help="time scale, 2 replays twice as fast")
+    timing.add_argument("--fast", action="store_true", help="no pauses between calls")
+    replay_parser.add_argument("--with-lookups", action="store_true", help="also replay lookup and getattr")
+    replay_parser.add_argument("--json", help="write the summary here")
+
+    args = parser.parse_args()
+    return capture(args) if args.command == "capture" else replay(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
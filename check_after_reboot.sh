@@ -30,13 +30,13 @@ if [ -z "$1" ]; then
     fi
     
     # Получаем список токенов с префиксом test_persistence_ отсортированных по времени (последний = самый новый)
-    TOKENS=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_files WHERE token LIKE 'test_persistence_%' ORDER BY token DESC;" 2>/dev/null | grep -v '^$' | tr -d ' ')
+    TOKENS=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_inodes WHERE token LIKE 'test_persistence_%' ORDER BY token DESC;" 2>/dev/null | grep -v '^$' | tr -d ' ')
     
     if [ -z "$TOKENS" ]; then
         echo -e "${YELLOW}⚠️  Токены с префиксом 'test_persistence_' не найдены${NC}"
         echo ""
         echo "Попытка найти любые токены..."
-        TOKENS=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_files ORDER BY token DESC LIMIT 10;" 2>/dev/null | grep -v '^$' | tr -d ' ')
+        TOKENS=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_inodes ORDER BY token DESC LIMIT 10;" 2>/dev/null | grep -v '^$' | tr -d ' ')
         
         if [ -z "$TOKENS" ]; then
             echo -e "${RED}❌ В базе данных нет токенов${NC}"
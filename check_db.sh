@@ -6,21 +6,23 @@ echo ""
 
 PGPASSWORD=postgres psql -h localhost -U postgres -d vtfs_db << SQL
 \echo '1. Все файлы для токена test_persistence_1765325022:'
-SELECT id, ino, name, parent_ino, mode, nlink FROM vtfs_files 
-WHERE token = 'test_persistence_1765325022' 
-ORDER BY parent_ino, ino;
+SELECT d.ino, d.name, d.parent_ino, i.mode, i.nlink FROM vtfs_dirents d
+JOIN vtfs_inodes i ON i.token = d.token AND i.ino = d.ino
+WHERE d.token = 'test_persistence_1765325022' 
+ORDER BY d.parent_ino, d.ino;
 
 \echo ''
 \echo '2. Статистика по токену:'
 SELECT parent_ino, COUNT(*) as files_count 
-FROM vtfs_files 
+FROM vtfs_dirents 
 WHERE token = 'test_persistence_1765325022'
 GROUP BY parent_ino;
 
 \echo ''
 \echo '3. Данные файлов:'
-SELECT ino, LENGTH(data) as data_length, "offset" 
-FROM vtfs_file_data 
+SELECT ino, block_no, LENGTH(data) as data_length 
+FROM vtfs_file_blocks 
 WHERE token = 'test_persistence_1765325022'
+ORDER BY ino, block_no
 LIMIT 10;
 SQL
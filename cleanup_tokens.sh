@@ -21,7 +21,7 @@ echo ""
 
 # Показываем все токены
 echo -e "${BLUE}Текущие токены в базе данных:${NC}"
-TOKENS=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_files ORDER BY token;" 2>/dev/null | grep -v '^$' | tr -d ' ')
+TOKENS=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_inodes ORDER BY token;" 2>/dev/null | grep -v '^$' | tr -d ' ')
 
 if [ -z "$TOKENS" ]; then
     echo -e "${YELLOW}В базе данных нет токенов${NC}"
@@ -39,7 +39,7 @@ SELECT
     COUNT(*) as files_count,
     SUM(CASE WHEN (mode::integer & 0040000) != 0 THEN 1 ELSE 0 END) as dirs_count,
     SUM(CASE WHEN (mode::integer & 0100000) != 0 THEN 1 ELSE 0 END) as files_count_only
-FROM vtfs_files 
+FROM vtfs_inodes 
 GROUP BY token 
 ORDER BY token;
 SQL
@@ -63,8 +63,12 @@ case $ACTION in
         read -p "Вы уверены? (yes/no): " CONFIRM
         if [ "$CONFIRM" = "yes" ]; then
             PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db <<SQL
-DELETE FROM vtfs_file_data;
-DELETE FROM vtfs_files;
+DELETE FROM vtfs_file_blocks;
+DELETE FROM vtfs_block_extents;
+DELETE FROM vtfs_block_refs;
+DELETE FROM vtfs_blobs;
+DELETE FROM vtfs_dirents;
+DELETE FROM vtfs_inodes;
 SQL
             echo -e "${GREEN}✅ Все токены удалены${NC}"
         else
@@ -72,13 +76,17 @@ SQL
         fi
         ;;
     2)
-        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_files WHERE token LIKE 'test_%';" 2>/dev/null | tr -d ' ')
+        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_inodes WHERE token LIKE 'test_%';" 2>/dev/null | tr -d ' ')
         echo "Будет удалено записей: $COUNT"
         read -p "Продолжить? (yes/no): " CONFIRM
         if [ "$CONFIRM" = "yes" ]; then
             PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db <<SQL
-DELETE FROM vtfs_file_data WHERE token IN (SELECT DISTINCT token FROM vtfs_files WHERE token LIKE 'test_%');
-DELETE FROM vtfs_files WHERE token LIKE 'test_%';
+DELETE FROM vtfs_file_blocks WHERE token LIKE 'test_%';
+DELETE FROM vtfs_block_extents WHERE token LIKE 'test_%';
+DELETE FROM vtfs_block_refs WHERE token LIKE 'test_%';
+DELETE FROM vtfs_blobs WHERE token LIKE 'test_%';
+DELETE FROM vtfs_dirents WHERE token LIKE 'test_%';
+DELETE FROM vtfs_inodes WHERE token LIKE 'test_%';
 SQL
             echo -e "${GREEN}✅ Токены с префиксом 'test_' удалены${NC}"
         else
@@ -86,13 +94,17 @@ SQL
         fi
         ;;
     3)
-        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_files WHERE token LIKE 'test_persistence_%';" 2>/dev/null | tr -d ' ')
+        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_inodes WHERE token LIKE 'test_persistence_%';" 2>/dev/null | tr -d ' ')
         echo "Будет удалено записей: $COUNT"
         read -p "Продолжить? (yes/no): " CONFIRM
         if [ "$CONFIRM" = "yes" ]; then
             PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db <<SQL
-DELETE FROM vtfs_file_data WHERE token IN (SELECT DISTINCT token FROM vtfs_files WHERE token LIKE 'test_persistence_%');
-DELETE FROM vtfs_files WHERE token LIKE 'test_persistence_%';
+DELETE FROM vtfs_file_blocks WHERE token LIKE 'test_persistence_%';
+DELETE FROM vtfs_block_extents WHERE token LIKE 'test_persistence_%';
+DELETE FROM vtfs_block_refs WHERE token LIKE 'test_persistence_%';
+DELETE FROM vtfs_blobs WHERE token LIKE 'test_persistence_%';
+DELETE FROM vtfs_dirents WHERE token LIKE 'test_persistence_%';
+DELETE FROM vtfs_inodes WHERE token LIKE 'test_persistence_%';
 SQL
             echo -e "${GREEN}✅ Токены с префиксом 'test_persistence_' удалены${NC}"
         else
@@ -100,14 +112,18 @@ SQL
         fi
         ;;
     4)
-        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_files WHERE token LIKE 'token=%';" 2>/dev/null | tr -d ' ')
+        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_inodes WHERE token LIKE 'token=%';" 2>/dev/null | tr -d ' ')
         echo "Будет удалено записей: $COUNT"
         echo -e "${YELLOW}Эти токены были созданы из-за старой ошибки парсинга mount options${NC}"
         read -p "Продолжить? (yes/no): " CONFIRM
         if [ "$CONFIRM" = "yes" ]; then
             PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db <<SQL
-DELETE FROM vtfs_file_data WHERE token IN (SELECT DISTINCT token FROM vtfs_files WHERE token LIKE 'token=%');
-DELETE FROM vtfs_files WHERE token LIKE 'token=%';
+DELETE FROM vtfs_file_blocks WHERE token LIKE 'token=%';
+DELETE FROM vtfs_block_extents WHERE token LIKE 'token=%';
+DELETE FROM vtfs_block_refs WHERE token LIKE 'token=%';
+DELETE FROM vtfs_blobs WHERE token LIKE 'token=%';
+DELETE FROM vtfs_dirents WHERE token LIKE 'token=%';
+DELETE FROM vtfs_inodes WHERE token LIKE 'token=%';
 SQL
             echo -e "${GREEN}✅ Токены с префиксом 'token=' удалены${NC}"
         else
@@ -121,7 +137,7 @@ SQL
             exit 1
         fi
         
-        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_files WHERE token = '$TOKEN_TO_DELETE';" 2>/dev/null | tr -d ' ')
+        COUNT=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT COUNT(*) FROM vtfs_inodes WHERE token = '$TOKEN_TO_DELETE';" 2>/dev/null | tr -d ' ')
         if [ "$COUNT" = "0" ]; then
             echo -e "${YELLOW}Токен '$TOKEN_TO_DELETE' не найден${NC}"
             exit 1
@@ -131,8 +147,12 @@ SQL
         read -p "Продолжить? (yes/no): " CONFIRM
         if [ "$CONFIRM" = "yes" ]; then
             PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db <<SQL
-DELETE FROM vtfs_file_data WHERE token = '$TOKEN_TO_DELETE';
-DELETE FROM vtfs_files WHERE token = '$TOKEN_TO_DELETE';
+DELETE FROM vtfs_file_blocks WHERE token = '$TOKEN_TO_DELETE';
+DELETE FROM vtfs_block_extents WHERE token = '$TOKEN_TO_DELETE';
+DELETE FROM vtfs_block_refs WHERE token = '$TOKEN_TO_DELETE';
+DELETE FROM vtfs_blobs WHERE token = '$TOKEN_TO_DELETE';
+DELETE FROM vtfs_dirents WHERE token = '$TOKEN_TO_DELETE';
+DELETE FROM vtfs_inodes WHERE token = '$TOKEN_TO_DELETE';
 SQL
             echo -e "${GREEN}✅ Токен '$TOKEN_TO_DELETE' удален${NC}"
         else
@@ -151,7 +171,7 @@ esac
 
 echo ""
 echo -e "${BLUE}Оставшиеся токены:${NC}"
-REMAINING=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_files ORDER BY token;" 2>/dev/null | grep -v '^$' | tr -d ' ')
+REMAINING=$(PGPASSWORD=vtfs_password psql -h localhost -U vtfs_user -d vtfs_db -t -c "SELECT DISTINCT token FROM vtfs_inodes ORDER BY token;" 2>/dev/null | grep -v '^$' | tr -d ' ')
 if [ -z "$REMAINING" ]; then
     echo -e "${YELLOW}Токенов не осталось${NC}"
 else
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""Throughput and tail latency of the VTFS server against client count.
+
+Creates a small tree under a fresh token, then for each concurrency level
+runs that many clients for a fixed time, each issuing a mix of small
+reads, directory listings and small writes back to back. Prints one row
+per level with request throughput and p50/p99 latency; 503 responses
+from the concurrency limit are counted separately from other errors.
+
+Run it once against the default server and once with the concurrent
+profile to compare:
+
+    python3 concurrency_bench.py --clients 1,8,32,128,512 --duration 15
+
+Python threads share one interpreter, so past a few hundred clients the
+generator itself may saturate; spread it over several processes with
+--processes if the server is still idle.
+"""
+
+import argparse
+import json
+import multiprocessing
+import random
+import struct
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+
+READ_SIZE = 4096
+
+
+def call(base, method, params, body=None):
+    query = "&".join(f"{k}={v}" for k, v in params.items())
+    request = urllib.request.Request(f"{base}/{method}?{query}", data=body, method="POST" if body else "GET")
+    if body:
+        request.add_header("Content-Type", "application/octet-stream")
+    with urllib.request.urlopen(request, timeout=60) as response:
+        payload = response.read()
+    code = struct.unpack(">q", payload[:8])[0]
+    if code != 0:
+        raise RuntimeError(f"{method} failed with error code {code}")
+    return payload[8:]
+
+
+def setup(base, token, files):
+    inos = []
+    data = bytes(range(256)) * (READ_SIZE // 256)
+    for i in range(files):
+        ino = int(call(base, "create", {"token": token, "parent_ino": 100, "name": f"f{i}", "mode": 644})
+                  .split(b",")[0])
+        call(base, "write", {"token": token, "ino": ino, "offset": 0, "enc": "none"}, data)
+        inos.append(ino)
+    return inos
+
+
+def run_level(args, token, inos, clients, seed):
+    """Runs `clients` threads until the deadline; returns raw samples."""
+    latencies = []
+    counts = {"ok": 0, "rejected": 0, "errors": 0}
+    lock = threading.Lock()
+    deadline = time.perf_counter() + args.duration
+    payload = b"x" * args.write_size
+
+    def client(index):
+        rng = random.Random(seed * 100003 + index)
+        local = []
+        ok = rejected = errors = 0
+        while time.perf_counter() < deadline:
+            ino = rng.choice(inos)
+            roll = rng.random()
+            started = time.perf_counter()
+            try:
+                if roll < args.write_ratio:
+                    call(args.url, "write", {"token": token, "ino": ino, "offset": 0, "enc": "none"}, payload)
+                elif roll < args.write_ratio + args.list_ratio:
+                    call(args.url, "list", {"token": token, "parent_ino": 100})
+                else:
+                    call(args.url, "read", {"token": token, "ino": ino, "offset": 0, "length": READ_SIZE})
+            except urllib.error.HTTPError as e:
+                if e.code == 503:
+                    rejected += 1
+                else:
+                    errors += 1
+                continue
+            except Exception:  # noqa: BLE001 - every failure kind counts as an error
+                errors += 1
+                continue
+            local.append(time.perf_counter() - started)
+            ok += 1
+        with lock:
+            latencies.extend(local)
+            counts["ok"] += ok
+            counts["rejected"] += rejected
+            counts["errors"] += errors
+
+    threads = [threading.Thread(target=client, args=(i,)) for i in range(clients)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    return latencies, counts
+
+
+def worker(args, token, inos, clients, seed, queue):
+    queue.put(run_level(args, token, inos, clients, seed))
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def measure(args, token, inos, clients):
+    if args.processes <= 1:
+        latencies, counts = run_level(args, token, inos, clients, 0)
+    else:
+        queue = multiprocessing.Queue()
+        share = [clients // args.processes + (1 if i < clients % args.processes else 0)
+                 for i in range(args.processes)]
+        procs = [multiprocessing.Process(target=worker, args=(args, token, inos, n, i, queue))
+                 for i, n in enumerate(share) if n > 0]
+        for proc in procs:
+            proc.start()
+        latencies, counts = [], {"ok": 0, "rejected": 0, "errors": 0}
+        for _ in procs:
+            part, part_counts = queue.get()
+            latencies.extend(part)
+            for key in counts:
+                counts[key] += part_counts[key]
+        for proc in procs:
+            proc.join()
+
+    row = {"clients": clients, "requests": counts["ok"], "rejected": counts["rejected"],
+           "errors": counts["errors"], "throughput_rps": counts["ok"] / args.duration}
+    if latencies:
+        row.update({
+            "latency_p50_ms": percentile(latencies, 50) * 1000,
+            "latency_p99_ms": percentile(latencies, 99) * 1000,
+            "latency_max_ms": max(latencies) * 1000,
+        })
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--url", default="http://127.0.0.1:8080/api")
+    parser.add_argument("--clients", default="1,8,32,128,512", help="comma-separated concurrency levels")
+    parser.add_argument("--duration", type=float, default=10, help="seconds per level")
+    parser.add_argument("--files", type=int, default=64)
+    parser.add_argument("--write-ratio", type=float, default=0.1)
+    parser.add_argument("--list-ratio", type=float, default=0.2)
+    parser.add_argument("--write-size", type=int, default=512)
+    parser.add_argument("--processes", type=int, default=1, help="client processes to spread threads over")
+    parser.add_argument("--json", help="write the results to this file")
+    args = parser.parse_args()
+
+    token = f"bench_{int(time.time())}"
+    print(f"Creating {args.files} files under token {token}...")
+    inos = setup(args.url, token, args.files)
+
+    print(f"{'clients':>8} {'req/s':>10} {'p50 ms':>9} {'p99 ms':>9} {'max ms':>9} {'503':>7} {'errors':>7}")
+    rows = []
+    for clients in (int(c) for c in args.clients.split(",")):
+        row = measure(args, token, inos, clients)
+        rows.append(row)
+        print(f"{clients:>8} {row['throughput_rps']:>10.1f} {row.get('latency_p50_ms', 0):>9.1f} "
+              f"{row.get('latency_p99_ms', 0):>9.1f} {row.get('latency_max_ms', 0):>9.1f} "
+              f"{row['rejected']:>7} {row['errors']:>7}")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"token": token, "duration_s": args.duration, "levels": rows}, f, indent=2)
+
+    return 1 if any(row["errors"] for row in rows) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""Concurrent large-file read load test for the VTFS server.
+
+Creates a set of large files under a fresh token, then reads them whole
+from many threads at once and reports read latency percentiles and
+throughput. With --pid it also samples the server's heap usage through
+jstat while the reads run.
+
+    python3 read_load_test.py --files 16 --size-mb 64 --clients 32 --pid $(pgrep -f vtfs-server)
+"""
+
+import argparse
+import json
+import struct
+import subprocess
+import sys
+import threading
+import time
+import urllib.request
+
+WRITE_CHUNK = 1024 * 1024
+
+
+def call(base, method, params, body=None):
+    query = "&".join(f"{k}={v}" for k, v in params.items())
+    request = urllib.request.Request(f"{base}/{method}?{query}", data=body, method="POST" if body else "GET")
+    if body:
+        request.add_header("Content-Type", "application/octet-stream")
+    with urllib.request.urlopen(request, timeout=600) as response:
+        payload = response.read()
+    code = struct.unpack(">q", payload[:8])[0]
+    if code != 0:
+        raise RuntimeError(f"{method} failed with error code {code}")
+    return payload[8:]
+
+
+def create_files(base, token, count, size):
+    inos = []
+    chunk = bytes(range(256)) * (WRITE_CHUNK // 256)
+    for i in range(count):
+        ino = int(call(base, "create", {"token": token, "parent_ino": 100, "name": f"big{i}", "mode": 644})
+                  .split(b",")[0])
+        for offset in range(0, size, WRITE_CHUNK):
+            call(base, "write", {"token": token, "ino": ino, "offset": offset, "enc": "none"},
+                 chunk[:min(WRITE_CHUNK, size - offset)])
+        inos.append(ino)
+    return inos
+
+
+class HeapSampler(threading.Thread):
+    """Samples used heap (survivor + eden + old, in KiB) via jstat."""
+
+    def __init__(self, pid, interval):
+        super().__init__(daemon=True)
+        self.pid = pid
+        self.interval = interval
+        self.samples = []
+        self.stopped = threading.Event()
+
+    def run(self):
+        while not self.stopped.is_set():
+            try:
+                out = subprocess.run(["jstat", "-gc", str(self.pid)], capture_output=True, text=True,
+                                     check=True).stdout.split("\n")
+                columns = dict(zip(out[0].split(), out[1].split()))
+                used = sum(float(columns[c]) for c in ("S0U", "S1U", "EU", "OU"))
+                self.samples.append(used)
+            except (OSError, subprocess.CalledProcessError, KeyError, IndexError, ValueError):
+                pass
+            self.stopped.wait(self.interval)
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--url", default="http://127.0.0.1:8080/api")
+    parser.add_argument("--files", type=int, default=8)
+    parser.add_argument("--size-mb", type=int, default=32)
+    parser.add_argument("--clients", type=int, default=16)
+    parser.add_argument("--reads", type=int, default=4, help="reads per client")
+    parser.add_argument("--pid", type=int, help="server pid to sample heap usage from")
+    parser.add_argument("--json", help="write the results to this file")
+    args = parser.parse_args()
+
+    token = f"loadtest_{int(time.time())}"
+    size = args.size_mb * 1024 * 1024
+    print(f"Creating {args.files} files of {args.size_mb} MiB under token {token}...")
+    inos = create_files(args.url, token, args.files, size)
+
+    sampler = HeapSampler(args.pid, 0.2) if args.pid else None
+    if sampler:
+        sampler.start()
+
+    latencies = []
+    errors = []
+    lock = threading.Lock()
+
+    def client(index):
+        for i in range(args.reads):
+            ino = inos[(index + i) % len(inos)]
+            started = time.perf_counter()
+            try:
+                data = call(args.url, "read", {"token": token, "ino": ino, "offset": 0, "length": size})
+                if len(data) != 24 + size:
+                    raise RuntimeError(f"short read: {len(data) - 24} of {size} bytes")
+            except Exception as e:  # noqa: BLE001 - report every failure kind
+                with lock:
+                    errors.append(str(e))
+                continue
+            with lock:
+                latencies.append(time.perf_counter() - started)
+
+    print(f"Reading with {args.clients} concurrent clients, {args.reads} reads each...")
+    started = time.perf_counter()
+    threads = [threading.Thread(target=client, args=(i,)) for i in range(args.clients)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.perf_counter() - started
+
+    if sampler:
+        sampler.stopped.set()
+        sampler.join()
+
+    results = {
+        "files": args.files,
+        "file_size": size,
+        "clients": args.clients,
+        "reads": len(latencies),
+        "errors": len(errors),
+        "throughput_mib_s": len(latencies) * size / elapsed / (1024 * 1024),
+    }
+    if latencies:
+        results.update({
+            "latency_p50_ms": percentile(latencies, 50) * 1000,
+            "latency_p99_ms": percentile(latencies, 99) * 1000,
+            "latency_max_ms": max(latencies) * 1000,
+        })
+    if sampler and sampler.samples:
+        results["heap_used_max_mib"] = max(sampler.samples) / 1024
+        results["heap_used_avg_mib"] = sum(sampler.samples) / len(sampler.samples) / 1024
+
+    for key, value in results.items():
+        print(f"  {key}: {value:.1f}" if isinstance(value, float) else f"  {key}: {value}")
+    for error in errors[:5]:
+        print(f"  error: {error}", file=sys.stderr)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,103 @@
+package com.vtfs.controller;
+
+import jakarta.servlet.AsyncEvent;
+import jakarta.servlet.AsyncListener;
+import jakarta.servlet.FilterChain;
+import jakarta.servlet.ServletException;
+import jakarta.servlet.http.HttpServletRequest;
+import jakarta.servlet.http.HttpServletResponse;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.stereotype.Component;
+import org.springframework.web.filter.OncePerRequestFilter;
+
+import java.io.IOException;
+import java.util.concurrent.Semaphore;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * Bounds the number of API requests doing work at once. With virtual
+ * threads nothing else stops thousands of requests from piling up on the
+ * connection pool; here they wait briefly for a permit and are turned away
+ * with 503 once the queue timeout passes, so overload shows up as fast
+ * rejections instead of every request timing out inside Hikari.
+ *
+ * Change-feed long polls hold no connection while they wait and are not
+ * counted. A limit of 0 disables the filter.
+ */
+@Component
+public class ConcurrencyLimitFilter extends OncePerRequestFilter {
+    private final int maxConcurrent;
+    private final long queueTimeoutMs;
+    private final Semaphore permits;
+    private final AtomicLong rejected = new AtomicLong();
+    
+    public ConcurrencyLimitFilter(@Value("${vtfs.server.max-concurrent-requests:0}") int maxConcurrent,
+                                  @Value("${vtfs.server.queue-timeout-ms:1000}") long queueTimeoutMs) {
+        this.maxConcurrent = maxConcurrent;
+        this.queueTimeoutMs = queueTimeoutMs;
+        this.permits = new Semaphore(Math.max(maxConcurrent, 1), true);
+    }
+    
+    @Override
+    protected boolean shouldNotFilter(HttpServletRequest request) {
+        return maxConcurrent <= 0 || request.getRequestURI().endsWith("/changes");
+    }
+    
+    @Override
+    protected void doFilterInternal(HttpServletRequest request, HttpServletResponse response,
+                                    FilterChain chain) throws ServletException, IOException {
+        try {
+            if (!permits.tryAcquire(queueTimeoutMs, TimeUnit.MILLISECONDS)) {
+                reject(response);
+                return;
+            }
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            reject(response);
+            return;
+        }
+        
+        boolean releaseLater = false;
+        try {
+            chain.doFilter(request, response);
+            // Streamed reads keep working after this thread returns
+            if (request.isAsyncStarted()) {
+                request.getAsyncContext().addListener(new AsyncListener() {
+                    @Override
+                    public void onComplete(AsyncEvent event) {
+                        permits.release();
+                    }
+                    
+                    @Override
+                    public void onTimeout(AsyncEvent event) {}
+                    
+                    @Override
+                    public void onError(AsyncEvent event) {}
+                    
+                    @Override
+                    public void onStartAsync(AsyncEvent event) {}
+                });
+                releaseLater = true;
+            }
+        } finally {
+            if (!releaseLater) {
+                permits.release();
+            }
+        }
+    }
+    
+    private void reject(HttpServletResponse response) {
+        rejected.incrementAndGet();
+        response.setStatus(HttpServletResponse.SC_SERVICE_UNAVAILABLE);
+        response.setHeader("Retry-After", "1");
+    }
+    
+    public int getInFlight() {
+        return maxConcurrent > 0 ? maxConcurrent - permits.availablePermits() : 0;
+    }
+    
+    public long getRejected() {
+        return rejected.get();
+    }
+}
@@ -1,13 +1,20 @@
 package com.vtfs.controller;
 
 import com.vtfs.model.VtfsFile;
+import com.vtfs.service.ChangeFeedService;
+import com.vtfs.service.MetadataCache;
 import com.vtfs.service.VtfsService;
+import com.vtfs.service.WireCodec;
+import com.vtfs.storage.BlockStore;
+import com.vtfs.storage.SegmentCompactor;
 import org.springframework.beans.factory.annotation.Autowired;
 import org.springframework.http.HttpHeaders;
 import org.springframework.http.HttpStatus;
 import org.springframework.http.MediaType;
 import org.springframework.http.ResponseEntity;
 import org.springframework.web.bind.annotation.*;
+import org.springframework.web.context.request.async.DeferredResult;
+import org.springframework.web.servlet.mvc.method.annotation.StreamingResponseBody;
 
 import java.nio.ByteBuffer;
 import java.util.Base64;
@@ -16,10 +23,34 @@ import java.util.List;
 @RestController
 @RequestMapping("/api")
 public class VtfsApiController {
+    // Returned by a conditional read when the client's version is current
+    private static final long NOT_MODIFIED = 304;
+    // Returned by the change feed when the client's cursor is no longer covered
+    private static final long STALE = 116;
+    private static final long MAX_POLL_TIMEOUT_MS = 60000;
     
     @Autowired
     private VtfsService vtfsService;
     
+    @Autowired
+    private ChangeFeedService changeFeed;
+    
+    @Autowired
+    private WireCodec wireCodec;
+    
+    @Autowired
+    private MetadataCache metadataCache;
+    
+    @Autowired
+    private ConcurrencyLimitFilter concurrencyLimit;
+    
+    @Autowired
+    private BlockStore blockStore;
+    
+    // Only present with the segment storage backend
+    @Autowired(required = false)
+    private SegmentCompactor segmentCompactor;
+    
     private ResponseEntity<byte[]> createResponse(long errorCode, byte[] data) {
         ByteBuffer buffer = ByteBuffer.allocate(8 + (data != null ? data.length : 0));
         buffer.putLong(errorCode);
@@ -45,7 +76,8 @@ public class VtfsApiController {
                 sb.append(file.getIno()).append(",")
                   .append(file.getName()).append(",")
                   .append(file.getMode()).append(",")
-                  .append(file.getDataSize()).append("\n");
+                  .append(file.getDataSize()).append(",")
+                  .append(file.getVersion()).append("\n");
             }
             
             return createResponse(0, sb.toString().getBytes());
@@ -72,20 +104,65 @@ public class VtfsApiController {
         }
     }
     
+    private ResponseEntity<StreamingResponseBody> createStreamingResponse(long errorCode, byte[] header,
+                                                                          long bodyLength,
+                                                                          StreamingResponseBody body) {
+        ByteBuffer prefix = ByteBuffer.allocate(8 + header.length);
+        prefix.putLong(errorCode);
+        prefix.put(header);
+        
+        HttpHeaders headers = new HttpHeaders();
+        headers.setContentType(MediaType.APPLICATION_OCTET_STREAM);
+        headers.setContentLength(prefix.capacity() + bodyLength);
+        
+        StreamingResponseBody stream = out -> {
+            out.write(prefix.array());
+            if (body != null) {
+                body.writeTo(out);
+            }
+        };
+        return new ResponseEntity<>(stream, headers, HttpStatus.OK);
+    }
+    
     @GetMapping("/read")
-    public ResponseEntity<byte[]> read(@RequestParam String token,
-                                       @RequestParam Long ino,
-                                       @RequestParam Long offset,
-                                       @RequestParam Long length) {
+    public ResponseEntity<StreamingResponseBody> read(@RequestParam String token,
+                                                      @RequestParam Long ino,
+                                                      @RequestParam Long offset,
+                                                      @RequestParam Long length,
+                                                      @RequestParam(required = false) Long version,
+                                                      @RequestParam(defaultValue = "none") String accept) {
         try {
-            byte[] data = vtfsService.readFile(token, ino, offset, length);
-            if (data == null) {
-                return createResponse(2, null);
+            VtfsService.ReadPlan plan = vtfsService.planRead(token, ino, offset, length, version);
+            if (plan == null) {
+                return createStreamingResponse(2, new byte[0], 0, null);
+            }
+            
+            // Header: [8-byte version][8-byte file size][8-byte raw length],
+            // raw length is 0 unless data is LZ4 compressed
+            ByteBuffer header = ByteBuffer.allocate(24);
+            header.putLong(plan.version());
+            header.putLong(plan.size());
+            
+            if (plan.notModified()) {
+                header.putLong(0);
+                return createStreamingResponse(NOT_MODIFIED, header.array(), 0, null);
+            }
+            
+            if (WireCodec.LZ4.equals(accept) && wireCodec.worthCompressing(plan.length())) {
+                byte[] compressed = wireCodec.compress(
+                    vtfsService.readRange(token, ino, plan.start(), plan.end()));
+                if (compressed != null) {
+                    header.putLong(plan.length());
+                    return createStreamingResponse(0, header.array(), compressed.length,
+                                                   out -> out.write(compressed));
+                }
             }
             
-            return createResponse(0, data);
+            header.putLong(0);
+            return createStreamingResponse(0, header.array(), plan.length(),
+                out -> vtfsService.streamRange(token, ino, plan.start(), plan.end(), out));
         } catch (Exception e) {
-            return createResponse(1, null);
+            return createStreamingResponse(1, new byte[0], 0, null);
         }
     }
     
@@ -95,13 +172,62 @@ public class VtfsApiController {
                                         @RequestParam Long offset,
                                         @RequestParam String data) {
         try {
-            byte[] dataBytes = Base64.getDecoder().decode(data);
-            boolean success = vtfsService.writeFile(token, ino, offset, dataBytes);
-            if (!success) {
+            return writeData(token, ino, offset, Base64.getDecoder().decode(data));
+        } catch (Exception e) {
+            return createResponse(1, null);
+        }
+    }
+    
+    @PostMapping("/write")
+    public ResponseEntity<byte[]> writeBody(@RequestParam String token,
+                                            @RequestParam Long ino,
+                                            @RequestParam Long offset,
+                                            @RequestParam(defaultValue = "none") String enc,
+                                            @RequestParam(required = false) Integer raw_len,
+                                            @RequestBody byte[] body) {
+        try {
+            byte[] dataBytes = body;
+            if (WireCodec.LZ4.equals(enc)) {
+                dataBytes = wireCodec.decompress(body, raw_len);
+            }
+            return writeData(token, ino, offset, dataBytes);
+        } catch (Exception e) {
+            return createResponse(1, null);
+        }
+    }
+    
+    private ResponseEntity<byte[]> writeData(String token, Long ino, Long offset, byte[] dataBytes) {
+        Long version = vtfsService.writeFile(token, ino, offset, dataBytes);
+        if (version == null) {
+            return createResponse(2, null);
+        }
+        
+        return createResponse(0, (version + "\n").getBytes());
+    }
+    
+    @GetMapping("/copy")
+    public ResponseEntity<byte[]> copy(@RequestParam String token,
+                                       @RequestParam Long src_ino,
+                                       @RequestParam Long src_offset,
+                                       @RequestParam Long dst_ino,
+                                       @RequestParam Long dst_offset,
+                                       @RequestParam Long length) {
+        try {
+            if (src_offset < 0 || dst_offset < 0 || length < 0) {
+                return createResponse(22, null);
+            }
+            // Within one file the ranges must not overlap, as for copy_file_range(2)
+            if (src_ino.equals(dst_ino) && src_offset < dst_offset + length && dst_offset < src_offset + length) {
+                return createResponse(22, null);
+            }
+            
+            VtfsService.CopyResult result = vtfsService.copyRange(token, src_ino, src_offset,
+                                                                  dst_ino, dst_offset, length);
+            if (result == null) {
                 return createResponse(2, null);
             }
             
-            return createResponse(0, new byte[0]);
+            return createResponse(0, (result.version() + "," + result.copied() + "\n").getBytes());
         } catch (Exception e) {
             return createResponse(1, null);
         }
@@ -175,9 +301,11 @@ public class VtfsApiController {
     
     @GetMapping("/unlink")
     public ResponseEntity<byte[]> unlink(@RequestParam String token,
-                                          @RequestParam Long ino) {
+                                          @RequestParam Long ino,
+                                          @RequestParam Long parent_ino,
+                                          @RequestParam String name) {
         try {
-            boolean success = vtfsService.unlink(token, ino);
+            boolean success = vtfsService.unlink(token, ino, parent_ino, name);
             if (!success) {
                 return createResponse(2, null);
             }
@@ -187,5 +315,48 @@ public class VtfsApiController {
             return createResponse(1, null);
         }
     }
+    
+    @GetMapping("/changes")
+    public DeferredResult<ResponseEntity<byte[]>> changes(@RequestParam String token,
+                                                          @RequestParam Long since,
+                                                          @RequestParam(defaultValue = "0") Long timeout,
+                                                          @RequestParam(defaultValue = "64") Integer limit) {
+        long timeoutMs = Math.max(1, Math.min(timeout, MAX_POLL_TIMEOUT_MS));
+        DeferredResult<ResponseEntity<byte[]>> result = new DeferredResult<>(
+            timeoutMs, () -> changesResponse(changeFeed.since(token, since, limit)));
+        
+        Object waiter = changeFeed.subscribe(token, since, limit,
+            batch -> result.setResult(changesResponse(batch)));
+        result.onCompletion(() -> changeFeed.cancel(token, waiter));
+        
+        return result;
+    }
+    
+    @GetMapping("/stats")
+    public ResponseEntity<byte[]> stats(@RequestParam(required = false) String token) {
+        try {
+            // Payload: one "name=value" line per counter
+            StringBuilder sb = new StringBuilder();
+            metadataCache.appendStats(sb);
+            sb.append("requests_in_flight=").append(concurrencyLimit.getInFlight()).append("\n");
+            sb.append("requests_rejected=").append(concurrencyLimit.getRejected()).append("\n");
+            if (segmentCompactor != null) {
+                segmentCompactor.appendStats(sb);
+            }
+            blockStore.appendStats(token, sb);
+            return createResponse(0, sb.toString().getBytes());
+        } catch (Exception e) {
+            return createResponse(1, null);
+        }
+    }
+    
+    private ResponseEntity<byte[]> changesResponse(ChangeFeedService.Batch batch) {
+        // Payload: "cursor\n" followed by one line per event
+        StringBuilder sb = new StringBuilder();
+        sb.append(batch.cursor()).append("\n");
+        for (ChangeFeedService.ChangeEvent event : batch.events()) {
+            sb.append(event.toLine());
+        }
+        return createResponse(batch.stale() ? STALE : 0, sb.toString().getBytes());
+    }
 }
-
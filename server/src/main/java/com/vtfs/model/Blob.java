@@ -0,0 +1,73 @@
+package com.vtfs.model;
+
+import jakarta.persistence.*;
+
+import java.io.Serializable;
+import java.util.Objects;
+
+/**
+ * Distinct block contents of a token, keyed by the SHA-256 of the raw
+ * bytes and shared by every block that holds them. Used by the dedup
+ * storage backend; refcount is the number of vtfs_block_refs rows pointing
+ * here.
+ */
+@Entity
+@Table(name = "vtfs_blobs")
+@IdClass(Blob.Key.class)
+public class Blob {
+    public static final short CODEC_NONE = 0;
+    public static final short CODEC_ZSTD = 1;
+    
+    public static class Key implements Serializable {
+        private String token;
+        private String hash;
+        
+        public Key() {}
+        
+        public Key(String token, String hash) {
+            this.token = token;
+            this.hash = hash;
+        }
+        
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) return true;
+            if (!(o instanceof Key key)) return false;
+            return Objects.equals(token, key.token) && Objects.equals(hash, key.hash);
+        }
+        
+        @Override
+        public int hashCode() {
+            return Objects.hash(token, hash);
+        }
+    }
+    
+    @Id
+    private String token;
+    
+    // Hex SHA-256 of the uncompressed contents
+    @Id
+    @Column(length = 64)
+    private String hash;
+    
+    @Column(nullable = false)
+    private Short codec;
+    
+    @Column(nullable = false)
+    private Integer rawLength;
+    
+    @Column(nullable = false, columnDefinition = "BYTEA")
+    private byte[] data;
+    
+    @Column(nullable = false)
+    private Integer refcount;
+    
+    public Blob() {}
+    
+    public String getToken() { return token; }
+    public String getHash() { return hash; }
+    public Short getCodec() { return codec; }
+    public Integer getRawLength() { return rawLength; }
+    public byte[] getData() { return data; }
+    public Integer getRefcount() { return refcount; }
+}
@@ -0,0 +1,72 @@
+package com.vtfs.model;
+
+import jakarta.persistence.*;
+
+import java.io.Serializable;
+import java.util.Objects;
+
+/**
+ * Location of one file block inside a token's segment files, used by the
+ * segment storage backend. Superseded copies of a block stay in the
+ * segments as dead space until they are compacted away.
+ */
+@Entity
+@Table(name = "vtfs_block_extents", indexes = {
+    @Index(name = "idx_extents_token_segment", columnList = "token,segment_no")
+})
+@IdClass(BlockExtent.Key.class)
+public class BlockExtent {
+    public static class Key implements Serializable {
+        private String token;
+        private Long ino;
+        private Long blockNo;
+        
+        public Key() {}
+        
+        public Key(String token, Long ino, Long blockNo) {
+            this.token = token;
+            this.ino = ino;
+            this.blockNo = blockNo;
+        }
+        
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) return true;
+            if (!(o instanceof Key key)) return false;
+            return Objects.equals(token, key.token) && Objects.equals(ino, key.ino)
+                && Objects.equals(blockNo, key.blockNo);
+        }
+        
+        @Override
+        public int hashCode() {
+            return Objects.hash(token, ino, blockNo);
+        }
+    }
+    
+    @Id
+    private String token;
+    
+    @Id
+    private Long ino;
+    
+    @Id
+    private Long blockNo;
+    
+    @Column(nullable = false)
+    private Long segmentNo;
+    
+    @Column(nullable = false)
+    private Long segmentOffset;
+    
+    @Column(nullable = false)
+    private Integer length;
+    
+    public BlockExtent() {}
+    
+    public String getToken() { return token; }
+    public Long getIno() { return ino; }
+    public Long getBlockNo() { return blockNo; }
+    public Long getSegmentNo() { return segmentNo; }
+    public Long getSegmentOffset() { return segmentOffset; }
+    public Integer getLength() { return length; }
+}
@@ -0,0 +1,60 @@
+package com.vtfs.model;
+
+import jakarta.persistence.*;
+
+import java.io.Serializable;
+import java.util.Objects;
+
+/**
+ * Which blob holds one file block, used by the dedup storage backend.
+ */
+@Entity
+@Table(name = "vtfs_block_refs")
+@IdClass(BlockRef.Key.class)
+public class BlockRef {
+    public static class Key implements Serializable {
+        private String token;
+        private Long ino;
+        private Long blockNo;
+        
+        public Key() {}
+        
+        public Key(String token, Long ino, Long blockNo) {
+            this.token = token;
+            this.ino = ino;
+            this.blockNo = blockNo;
+        }
+        
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) return true;
+            if (!(o instanceof Key key)) return false;
+            return Objects.equals(token, key.token) && Objects.equals(ino, key.ino)
+                && Objects.equals(blockNo, key.blockNo);
+        }
+        
+        @Override
+        public int hashCode() {
+            return Objects.hash(token, ino, blockNo);
+        }
+    }
+    
+    @Id
+    private String token;
+    
+    @Id
+    private Long ino;
+    
+    @Id
+    private Long blockNo;
+    
+    @Column(nullable = false, length = 64)
+    private String hash;
+    
+    public BlockRef() {}
+    
+    public String getToken() { return token; }
+    public Long getIno() { return ino; }
+    public Long getBlockNo() { return blockNo; }
+    public String getHash() { return hash; }
+}
@@ -0,0 +1,78 @@
+package com.vtfs.model;
+
+import jakarta.persistence.*;
+
+import java.io.Serializable;
+import java.util.Objects;
+
+/**
+ * A name in a directory. The primary key makes names unique per directory;
+ * several entries may point at the same inode.
+ */
+@Entity
+@Table(name = "vtfs_dirents", indexes = {
+    @Index(name = "idx_dirents_token_ino", columnList = "token,ino")
+})
+@IdClass(Dirent.Key.class)
+public class Dirent {
+    public static class Key implements Serializable {
+        private String token;
+        private Long parentIno;
+        private String name;
+        
+        public Key() {}
+        
+        public Key(String token, Long parentIno, String name) {
+            this.token = token;
+            this.parentIno = parentIno;
+            this.name = name;
+        }
+        
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) return true;
+            if (!(o instanceof Key key)) return false;
+            return Objects.equals(token, key.token) && Objects.equals(parentIno, key.parentIno)
+                && Objects.equals(name, key.name);
+        }
+        
+        @Override
+        public int hashCode() {
+            return Objects.hash(token, parentIno, name);
+        }
+    }
+    
+    @Id
+    private String token;
+    
+    @Id
+    private Long parentIno;
+    
+    @Id
+    @Column(length = 256)
+    private String name;
+    
+    @Column(nullable = false)
+    private Long ino;
+    
+    public Dirent() {}
+    
+    public Dirent(String token, Long parentIno, String name, Long ino) {
+        this.token = token;
+        this.parentIno = parentIno;
+        this.name = name;
+        this.ino = ino;
+    }
+    
+    public String getToken() { return token; }
+    public void setToken(String token) { this.token = token; }
+    
+    public Long getParentIno() { return parentIno; }
+    public void setParentIno(Long parentIno) { this.parentIno = parentIno; }
+    
+    public String getName() { return name; }
+    public void setName(String name) { this.name = name; }
+    
+    public Long getIno() { return ino; }
+    public void setIno(Long ino) { this.ino = ino; }
+}
@@ -1,43 +1,85 @@
 package com.vtfs.model;
 
 import jakarta.persistence.*;
+import org.springframework.data.domain.Persistable;
 
+import java.io.Serializable;
+import java.util.Objects;
+
+/**
+ * One fixed-size block of file contents. Block n covers bytes
+ * [n * BLOCK_SIZE, (n + 1) * BLOCK_SIZE); only the last block of a file may
+ * be shorter, and missing blocks read as zeros.
+ */
 @Entity
-@Table(name = "vtfs_file_data", indexes = {
-    @Index(name = "idx_token_ino", columnList = "token,ino")
-})
-public class FileData {
-    @Id
-    @GeneratedValue(strategy = GenerationType.IDENTITY)
-    private Long id;
+@Table(name = "vtfs_file_blocks")
+@IdClass(FileData.Key.class)
+public class FileData implements Persistable<FileData.Key> {
+    public static final int BLOCK_SIZE = 64 * 1024;
+    
+    public static class Key implements Serializable {
+        private String token;
+        private Long ino;
+        private Long blockNo;
+        
+        public Key() {}
+        
+        public Key(String token, Long ino, Long blockNo) {
+            this.token = token;
+            this.ino = ino;
+            this.blockNo = blockNo;
+        }
+        
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) return true;
+            if (!(o instanceof Key key)) return false;
+            return Objects.equals(token, key.token) && Objects.equals(ino, key.ino)
+                && Objects.equals(blockNo, key.blockNo);
+        }
+        
+        @Override
+        public int hashCode() {
+            return Objects.hash(token, ino, blockNo);
+        }
+    }
     
-    @Column(nullable = false)
+    @Id
     private String token;
     
-    @Column(nullable = false)
+    @Id
     private Long ino;
     
-    @Column(name = "\"offset\"", nullable = false)
-    private Long offset;
+    @Id
+    private Long blockNo;
     
     @Column(nullable = false, columnDefinition = "BYTEA")
     private byte[] data;
     
-    @ManyToOne(fetch = FetchType.LAZY, optional = true)
-    @JoinColumn(name = "file_id", nullable = true)
-    private VtfsFile file;
+    // Lets save() insert new blocks without probing for an existing row
+    @Transient
+    private boolean isNew = true;
     
     public FileData() {}
     
-    public FileData(String token, Long ino, Long offset, byte[] data) {
+    public FileData(String token, Long ino, Long blockNo, byte[] data) {
         this.token = token;
         this.ino = ino;
-        this.offset = offset;
+        this.blockNo = blockNo;
         this.data = data;
     }
     
-    public Long getId() { return id; }
-    public void setId(Long id) { this.id = id; }
+    @PostLoad
+    @PostPersist
+    void markNotNew() {
+        this.isNew = false;
+    }
+    
+    @Override
+    public Key getId() { return new Key(token, ino, blockNo); }
+    
+    @Override
+    public boolean isNew() { return isNew; }
     
     public String getToken() { return token; }
     public void setToken(String token) { this.token = token; }
@@ -45,13 +87,11 @@ public class FileData {
     public Long getIno() { return ino; }
     public void setIno(Long ino) { this.ino = ino; }
     
-    public Long getOffset() { return offset; }
-    public void setOffset(Long offset) { this.offset = offset; }
+    public Long getBlockNo() { return blockNo; }
+    public void setBlockNo(Long blockNo) { this.blockNo = blockNo; }
+    
+    public long getOffset() { return blockNo * (long) BLOCK_SIZE; }
     
     public byte[] getData() { return data; }
     public void setData(byte[] data) { this.data = data; }
-    
-    public VtfsFile getFile() { return file; }
-    public void setFile(VtfsFile file) { this.file = file; }
 }
-
@@ -0,0 +1,105 @@
+package com.vtfs.model;
+
+import jakarta.persistence.*;
+import org.springframework.data.domain.Persistable;
+
+import java.io.Serializable;
+import java.util.Objects;
+
+/**
+ * Per-file attributes shared by every directory entry (hard link) that
+ * points at the file.
+ */
+@Entity
+@Table(name = "vtfs_inodes")
+@IdClass(Inode.Key.class)
+public class Inode implements Persistable<Inode.Key> {
+    public static class Key implements Serializable {
+        private String token;
+        private Long ino;
+        
+        public Key() {}
+        
+        public Key(String token, Long ino) {
+            this.token = token;
+            this.ino = ino;
+        }
+        
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) return true;
+            if (!(o instanceof Key key)) return false;
+            return Objects.equals(token, key.token) && Objects.equals(ino, key.ino);
+        }
+        
+        @Override
+        public int hashCode() {
+            return Objects.hash(token, ino);
+        }
+    }
+    
+    @Id
+    private String token;
+    
+    @Id
+    private Long ino;
+    
+    @Column(nullable = false)
+    private Integer mode;
+    
+    @Column(nullable = false)
+    private Integer nlink = 1;
+    
+    @Column(nullable = false)
+    private Long dataSize = 0L;
+    
+    // Bumped on every content change; clients use it to validate cached data
+    @Column(nullable = false)
+    private Long version = 1L;
+    
+    // Lets save() insert new inodes without probing for an existing row
+    @Transient
+    private boolean isNew = true;
+    
+    public Inode() {}
+    
+    public Inode(String token, Long ino, Integer mode) {
+        this.token = token;
+        this.ino = ino;
+        this.mode = mode;
+    }
+    
+    @PostLoad
+    @PostPersist
+    void markNotNew() {
+        this.isNew = false;
+    }
+    
+    public boolean isDirectory() {
+        return (mode & 0040000) != 0;
+    }
+    
+    @Override
+    public Key getId() { return new Key(token, ino); }
+    
+    @Override
+    public boolean isNew() { return isNew; }
+    
+    public String getToken() { return token; }
+    public void setToken(String token) { this.token = token; }
+    
+    public Long getIno() { return ino; }
+    public void setIno(Long ino) { this.ino = ino; }
+    
+    public Integer getMode() { return mode; }
+    public void setMode(Integer mode) { this.mode = mode; }
+    
+    public Integer getNlink() { return nlink; }
+    public void setNlink(Integer nlink) { this.nlink = nlink; }
+    
+    public Long getDataSize() { return dataSize; }
+    public void setDataSize(Long dataSize) { this.dataSize = dataSize; }
+    
+    public Long getVersion() { return version; }
+    public void setVersion(Long version) { this.version = version; }
+}
@@ -0,0 +1,103 @@
+package com.vtfs.repository;
+
+import com.vtfs.model.Blob;
+import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
+import org.springframework.stereotype.Repository;
+
+import java.util.Collection;
+import java.util.List;
+
+@Repository
+public interface BlobRepository extends JpaRepository<Blob, Blob.Key> {
+    // One row per blob found: hash, codec, raw_length, data; nothing stays managed
+    @Query("SELECT b.hash, b.codec, b.rawLength, b.data FROM Blob b " +
+           "WHERE b.token = :token AND b.hash IN :hashes")
+    List<Object[]> findContents(@Param("token") String token, @Param("hashes") Collection<String> hashes);
+    
+    /**
+     * Stores the contents under their hash with one reference, or adds a
+     * reference if the token already has them.
+     */
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_blobs (token, hash, codec, raw_length, data, refcount) " +
+                   "VALUES (:token, :hash, :codec, :rawLength, :data, 1) " +
+                   "ON CONFLICT (token, hash) DO UPDATE SET refcount = vtfs_blobs.refcount + 1",
+           nativeQuery = true)
+    void addRef(
+        @Param("token") String token,
+        @Param("hash") String hash,
+        @Param("codec") Short codec,
+        @Param("rawLength") Integer rawLength,
+        @Param("data") byte[] data
+    );
+    
+    // Returns the remaining reference count, or null if the blob is gone
+    @Query(value = "UPDATE vtfs_blobs SET refcount = refcount - 1 " +
+                   "WHERE token = :token AND hash = :hash RETURNING refcount",
+           nativeQuery = true)
+    Integer dropRef(@Param("token") String token, @Param("hash") String hash);
+    
+    /**
+     * Removes all block references of the inode and drops the matching blob
+     * references. Returns one row per blob touched: hash, remaining refcount.
+     */
+    @Query(value = "WITH dropped AS (DELETE FROM vtfs_block_refs WHERE token = :token AND ino = :ino RETURNING hash), " +
+                   "counts AS (SELECT hash, COUNT(*) AS n FROM dropped GROUP BY hash) " +
+                   "UPDATE vtfs_blobs b SET refcount = b.refcount - c.n FROM counts c " +
+                   "WHERE b.token = :token AND b.hash = c.hash " +
+                   "RETURNING b.hash, b.refcount",
+           nativeQuery = true)
+    List<Object[]> dropInodeRefs(@Param("token") String token, @Param("ino") Long ino);
+    
+    // Same as dropInodeRefs, limited to blocks [firstBlock, lastBlock]
+    @Query(value = "WITH dropped AS (DELETE FROM vtfs_block_refs WHERE token = :token AND ino = :ino " +
+                   "AND block_no BETWEEN :firstBlock AND :lastBlock RETURNING hash), " +
+                   "counts AS (SELECT hash, COUNT(*) AS n FROM dropped GROUP BY hash) " +
+                   "UPDATE vtfs_blobs b SET refcount = b.refcount - c.n FROM counts c " +
+                   "WHERE b.token = :token AND b.hash = c.hash " +
+                   "RETURNING b.hash, b.refcount",
+           nativeQuery = true)
+    List<Object[]> dropBlockRefs(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
+    );
+    
+    /**
+     * Points dstIno's blocks, moved by shift block numbers, at the blobs of
+     * the source blocks [firstBlock, firstBlock + count) and adds one
+     * reference per copied block. The target references must have been
+     * dropped first.
+     */
+    @Modifying
+    @Query(value = "WITH copied AS (INSERT INTO vtfs_block_refs (token, ino, block_no, hash) " +
+                   "SELECT token, :dstIno, block_no + :shift, hash FROM vtfs_block_refs " +
+                   "WHERE token = :token AND ino = :srcIno AND block_no >= :firstBlock " +
+                   "AND block_no < :firstBlock + :count RETURNING hash), " +
+                   "counts AS (SELECT hash, COUNT(*) AS n FROM copied GROUP BY hash) " +
+                   "UPDATE vtfs_blobs b SET refcount = b.refcount + c.n FROM counts c " +
+                   "WHERE b.token = :token AND b.hash = c.hash",
+           nativeQuery = true)
+    void shareRefs(
+        @Param("token") String token,
+        @Param("srcIno") Long srcIno,
+        @Param("firstBlock") Long firstBlock,
+        @Param("count") Long count,
+        @Param("dstIno") Long dstIno,
+        @Param("shift") Long shift
+    );
+    
+    @Modifying
+    @Query("DELETE FROM Blob b WHERE b.token = :token AND b.hash IN :hashes AND b.refcount <= 0")
+    void deleteUnreferenced(@Param("token") String token, @Param("hashes") Collection<String> hashes);
+    
+    // One row: blobs, raw bytes, stored bytes
+    @Query(value = "SELECT COUNT(*), COALESCE(SUM(raw_length), 0), COALESCE(SUM(length(data)), 0) " +
+                   "FROM vtfs_blobs WHERE token = :token",
+           nativeQuery = true)
+    List<Object[]> uniqueBytes(@Param("token") String token);
+}
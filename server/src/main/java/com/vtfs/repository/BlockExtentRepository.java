@@ -0,0 +1,117 @@
+package com.vtfs.repository;
+
+import com.vtfs.model.BlockExtent;
+import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
+import org.springframework.stereotype.Repository;
+
+import java.util.List;
+
+@Repository
+public interface BlockExtentRepository extends JpaRepository<BlockExtent, BlockExtent.Key> {
+    @Query("SELECT e FROM BlockExtent e WHERE e.token = :token AND e.ino = :ino " +
+           "AND e.blockNo BETWEEN :firstBlock AND :lastBlock ORDER BY e.blockNo")
+    List<BlockExtent> findExtents(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
+    );
+    
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_block_extents (token, ino, block_no, segment_no, segment_offset, length) " +
+                   "VALUES (:token, :ino, :blockNo, :segmentNo, :segmentOffset, :length) " +
+                   "ON CONFLICT (token, ino, block_no) DO UPDATE SET segment_no = EXCLUDED.segment_no, " +
+                   "segment_offset = EXCLUDED.segment_offset, length = EXCLUDED.length",
+           nativeQuery = true)
+    void upsert(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("blockNo") Long blockNo,
+        @Param("segmentNo") Long segmentNo,
+        @Param("segmentOffset") Long segmentOffset,
+        @Param("length") Integer length
+    );
+    
+    @Modifying
+    @Query("DELETE FROM BlockExtent e WHERE e.token = :token AND e.ino = :ino " +
+           "AND e.blockNo BETWEEN :firstBlock AND :lastBlock")
+    void deleteExtents(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
+    );
+    
+    /**
+     * Points dstIno's blocks, moved by shift block numbers, at the segment
+     * bytes of the source blocks [firstBlock, firstBlock + count). Segments
+     * are append-only, so both files can share them. The target extents must
+     * have been deleted first.
+     */
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_block_extents (token, ino, block_no, segment_no, segment_offset, length) " +
+                   "SELECT token, :dstIno, block_no + :shift, segment_no, segment_offset, length " +
+                   "FROM vtfs_block_extents WHERE token = :token AND ino = :srcIno " +
+                   "AND block_no >= :firstBlock AND block_no < :firstBlock + :count",
+           nativeQuery = true)
+    void shareExtents(
+        @Param("token") String token,
+        @Param("srcIno") Long srcIno,
+        @Param("firstBlock") Long firstBlock,
+        @Param("count") Long count,
+        @Param("dstIno") Long dstIno,
+        @Param("shift") Long shift
+    );
+    
+    // One row per segment: segment_no, live bytes, live blocks
+    @Query("SELECT e.segmentNo, SUM(e.length), COUNT(e) FROM BlockExtent e " +
+           "WHERE e.token = :token GROUP BY e.segmentNo")
+    List<Object[]> liveBytesBySegment(@Param("token") String token);
+    
+    List<BlockExtent> findByTokenAndSegmentNoOrderByInoAscBlockNoAsc(String token, Long segmentNo);
+    
+    List<BlockExtent> findByTokenAndInoOrderByBlockNo(String token, Long ino);
+    
+    boolean existsByTokenAndSegmentNo(String token, Long segmentNo);
+    
+    /**
+     * Per inode: ino, blocks, fragments. A fragment is a run of blocks stored
+     * back to back in one segment, so a file read with a single transfer has
+     * one fragment. Only inodes with more than one fragment are returned.
+     */
+    @Query(value = "SELECT ino, COUNT(*), SUM(CASE WHEN prev_segment = segment_no AND prev_end = segment_offset " +
+                   "THEN 0 ELSE 1 END) FROM (" +
+                   "SELECT ino, segment_no, segment_offset, " +
+                   "LAG(segment_no) OVER w AS prev_segment, LAG(segment_offset + length) OVER w AS prev_end " +
+                   "FROM vtfs_block_extents WHERE token = :token " +
+                   "WINDOW w AS (PARTITION BY ino ORDER BY block_no)) runs " +
+                   "GROUP BY ino HAVING SUM(CASE WHEN prev_segment = segment_no AND prev_end = segment_offset " +
+                   "THEN 0 ELSE 1 END) > 1",
+           nativeQuery = true)
+    List<Object[]> fragmentedInodes(@Param("token") String token);
+    
+    /**
+     * Points the block at a compacted copy, unless a write moved it since
+     * the copy was taken. Returns the number of rows changed.
+     */
+    @Modifying
+    @Query("UPDATE BlockExtent e SET e.segmentNo = :newSegment, e.segmentOffset = :newOffset " +
+           "WHERE e.token = :token AND e.ino = :ino AND e.blockNo = :blockNo " +
+           "AND e.segmentNo = :oldSegment AND e.segmentOffset = :oldOffset")
+    int relocate(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("blockNo") Long blockNo,
+        @Param("oldSegment") Long oldSegment,
+        @Param("oldOffset") Long oldOffset,
+        @Param("newSegment") Long newSegment,
+        @Param("newOffset") Long newOffset
+    );
+    
+    @Modifying
+    @Query("DELETE FROM BlockExtent e WHERE e.token = :token AND e.ino = :ino")
+    void deleteByTokenAndIno(@Param("token") String token, @Param("ino") Long ino);
+}
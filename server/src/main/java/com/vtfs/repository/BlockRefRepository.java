@@ -0,0 +1,41 @@
+package com.vtfs.repository;
+
+import com.vtfs.model.BlockRef;
+import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
+import org.springframework.stereotype.Repository;
+
+import java.util.List;
+
+@Repository
+public interface BlockRefRepository extends JpaRepository<BlockRef, BlockRef.Key> {
+    // One row per block: block_no, hash
+    @Query("SELECT r.blockNo, r.hash FROM BlockRef r WHERE r.token = :token AND r.ino = :ino " +
+           "AND r.blockNo BETWEEN :firstBlock AND :lastBlock ORDER BY r.blockNo")
+    List<Object[]> findRefs(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
+    );
+    
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_block_refs (token, ino, block_no, hash) " +
+                   "VALUES (:token, :ino, :blockNo, :hash) " +
+                   "ON CONFLICT (token, ino, block_no) DO UPDATE SET hash = EXCLUDED.hash",
+           nativeQuery = true)
+    void upsert(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("blockNo") Long blockNo,
+        @Param("hash") String hash
+    );
+    
+    // Logical size of the token: every block counted once per reference
+    @Query(value = "SELECT COALESCE(SUM(b.raw_length), 0) FROM vtfs_block_refs r " +
+                   "JOIN vtfs_blobs b ON b.token = r.token AND b.hash = r.hash WHERE r.token = :token",
+           nativeQuery = true)
+    Long logicalBytes(@Param("token") String token);
+}
@@ -0,0 +1,52 @@
+package com.vtfs.repository;
+
+import com.vtfs.model.Dirent;
+import com.vtfs.model.VtfsFile;
+import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
+import org.springframework.stereotype.Repository;
+
+import java.util.List;
+
+@Repository
+public interface DirentRepository extends JpaRepository<Dirent, Dirent.Key> {
+    @Query("SELECT new com.vtfs.model.VtfsFile(d.ino, d.name, d.parentIno, i.mode, i.nlink, i.dataSize, i.version) " +
+           "FROM Dirent d JOIN Inode i ON i.token = d.token AND i.ino = d.ino " +
+           "WHERE d.token = :token AND d.parentIno = :parentIno")
+    List<VtfsFile> listDirectory(@Param("token") String token, @Param("parentIno") Long parentIno);
+    
+    List<Dirent> findByTokenAndIno(String token, Long ino);
+    
+    boolean existsByTokenAndParentIno(String token, Long parentIno);
+    
+    /**
+     * Adds the entry unless the name is taken; the primary key on
+     * (token, parent_ino, name) decides. Returns the number of rows inserted.
+     */
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_dirents (token, parent_ino, name, ino) " +
+                   "VALUES (:token, :parentIno, :name, :ino) ON CONFLICT DO NOTHING",
+           nativeQuery = true)
+    int insertIfAbsent(@Param("token") String token,
+                       @Param("parentIno") Long parentIno,
+                       @Param("name") String name,
+                       @Param("ino") Long ino);
+    
+    /**
+     * Removes the entry if it still names the inode. Returns the number of
+     * rows deleted.
+     */
+    @Modifying
+    @Query("DELETE FROM Dirent d WHERE d.token = :token AND d.parentIno = :parentIno AND d.name = :name " +
+           "AND d.ino = :ino")
+    int deleteEntry(@Param("token") String token,
+                    @Param("parentIno") Long parentIno,
+                    @Param("name") String name,
+                    @Param("ino") Long ino);
+    
+    @Modifying
+    @Query("DELETE FROM Dirent d WHERE d.token = :token AND d.ino = :ino")
+    void deleteByTokenAndIno(@Param("token") String token, @Param("ino") Long ino);
+}
@@ -4,27 +4,98 @@ import com.vtfs.model.FileData;
 import org.springframework.data.jpa.repository.JpaRepository;
 import org.springframework.data.jpa.repository.Modifying;
 import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.jpa.repository.QueryHints;
 import org.springframework.data.repository.query.Param;
 import org.springframework.stereotype.Repository;
+import jakarta.persistence.QueryHint;
+import org.hibernate.jpa.HibernateHints;
 
 import java.util.List;
+import java.util.stream.Stream;
 
 @Repository
-public interface FileDataRepository extends JpaRepository<FileData, Long> {
-    List<FileData> findByTokenAndInoOrderByOffset(String token, Long ino);
+public interface FileDataRepository extends JpaRepository<FileData, FileData.Key> {
+    List<FileData> findByTokenAndInoOrderByBlockNo(String token, Long ino);
     
     @Modifying
     @Query("DELETE FROM FileData fd WHERE fd.token = :token AND fd.ino = :ino")
     void deleteByTokenAndIno(@Param("token") String token, @Param("ino") Long ino);
     
-    @Query(value = "SELECT * FROM vtfs_file_data WHERE token = CAST(:token AS VARCHAR) AND ino = :ino " +
-           "AND \"offset\" < :endOffset AND (\"offset\" + OCTET_LENGTH(data)) > :startOffset " +
-           "ORDER BY \"offset\"", nativeQuery = true)
-    List<FileData> findByTokenAndInoAndOffsetRange(
+    @Modifying
+    @Query("DELETE FROM FileData fd WHERE fd.token = :token AND fd.ino = :ino " +
+           "AND fd.blockNo BETWEEN :firstBlock AND :lastBlock")
+    void deleteBlocks(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
+    );
+    
+    /**
+     * Copies the source blocks [firstBlock, firstBlock + count) to dstIno,
+     * moved by shift block numbers, inside the database. The target blocks
+     * must have been deleted first.
+     */
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_file_blocks (token, ino, block_no, data) " +
+                   "SELECT token, :dstIno, block_no + :shift, data FROM vtfs_file_blocks " +
+                   "WHERE token = :token AND ino = :srcIno AND block_no >= :firstBlock " +
+                   "AND block_no < :firstBlock + :count",
+           nativeQuery = true)
+    void copyBlocks(
+        @Param("token") String token,
+        @Param("srcIno") Long srcIno,
+        @Param("firstBlock") Long firstBlock,
+        @Param("count") Long count,
+        @Param("dstIno") Long dstIno,
+        @Param("shift") Long shift
+    );
+    
+    /**
+     * Writes patch into the block at byte start without reading it first.
+     * A missing block is created as fresh, which must be patch preceded by
+     * start zero bytes; an existing one shorter than start is zero-padded.
+     */
+    @Modifying
+    @Query(value = "INSERT INTO vtfs_file_blocks (token, ino, block_no, data) " +
+                   "VALUES (:token, :ino, :blockNo, :fresh) " +
+                   "ON CONFLICT (token, ino, block_no) DO UPDATE SET data = overlay(" +
+                   "CASE WHEN length(vtfs_file_blocks.data) < :start " +
+                   "THEN vtfs_file_blocks.data || decode(repeat('00', :start - length(vtfs_file_blocks.data)), 'hex') " +
+                   "ELSE vtfs_file_blocks.data END " +
+                   "PLACING :patch FROM :start + 1)",
+           nativeQuery = true)
+    void upsertRange(
         @Param("token") String token,
         @Param("ino") Long ino,
-        @Param("startOffset") Long startOffset,
-        @Param("endOffset") Long endOffset
+        @Param("blockNo") Long blockNo,
+        @Param("start") Integer start,
+        @Param("patch") byte[] patch,
+        @Param("fresh") byte[] fresh
+    );
+    
+    // Served by the (token, ino, block_no) primary key index
+    @Query("SELECT fd FROM FileData fd WHERE fd.token = :token AND fd.ino = :ino " +
+           "AND fd.blockNo BETWEEN :firstBlock AND :lastBlock ORDER BY fd.blockNo")
+    List<FileData> findBlocks(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
+    );
+    
+    // Same range as findBlocks, fetched through a server-side cursor a few
+    // blocks at a time; must be consumed inside a transaction
+    @QueryHints({
+        @QueryHint(name = HibernateHints.HINT_FETCH_SIZE, value = "4"),
+        @QueryHint(name = HibernateHints.HINT_READ_ONLY, value = "true")
+    })
+    @Query("SELECT fd FROM FileData fd WHERE fd.token = :token AND fd.ino = :ino " +
+           "AND fd.blockNo BETWEEN :firstBlock AND :lastBlock ORDER BY fd.blockNo")
+    Stream<FileData> streamBlocks(
+        @Param("token") String token,
+        @Param("ino") Long ino,
+        @Param("firstBlock") Long firstBlock,
+        @Param("lastBlock") Long lastBlock
     );
 }
-
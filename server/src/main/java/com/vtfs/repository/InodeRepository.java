@@ -0,0 +1,43 @@
+package com.vtfs.repository;
+
+import com.vtfs.model.Inode;
+import org.springframework.data.jpa.repository.JpaRepository;
+import org.springframework.data.jpa.repository.Modifying;
+import org.springframework.data.jpa.repository.Query;
+import org.springframework.data.repository.query.Param;
+import org.springframework.stereotype.Repository;
+
+import java.util.List;
+import java.util.Optional;
+
+@Repository
+public interface InodeRepository extends JpaRepository<Inode, Inode.Key> {
+    Optional<Inode> findByTokenAndIno(String token, Long ino);
+    
+    @Query("SELECT MAX(i.ino) FROM Inode i WHERE i.token = :token")
+    Long findMaxInoByToken(@Param("token") String token);
+    
+    /**
+     * Extends the size to cover a write ending at writeEnd and bumps the
+     * version. Returns one row of (version, data_size), or none if the inode
+     * is gone.
+     */
+    @Query(value = "UPDATE vtfs_inodes SET data_size = GREATEST(data_size, :writeEnd), version = version + 1 " +
+                   "WHERE token = :token AND ino = :ino RETURNING version, data_size",
+           nativeQuery = true)
+    List<Object[]> applyWrite(@Param("token") String token,
+                              @Param("ino") Long ino,
+                              @Param("writeEnd") Long writeEnd);
+    
+    // Returns the new link count, or null if the inode is gone
+    @Query(value = "UPDATE vtfs_inodes SET nlink = nlink + :delta " +
+                   "WHERE token = :token AND ino = :ino RETURNING nlink",
+           nativeQuery = true)
+    Integer adjustNlink(@Param("token") String token,
+                        @Param("ino") Long ino,
+                        @Param("delta") Integer delta);
+    
+    @Modifying
+    @Query("DELETE FROM Inode i WHERE i.token = :token AND i.ino = :ino")
+    void deleteByTokenAndIno(@Param("token") String token, @Param("ino") Long ino);
+}
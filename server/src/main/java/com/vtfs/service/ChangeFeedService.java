@@ -0,0 +1,225 @@
+package com.vtfs.service;
+
+import com.vtfs.model.VtfsFile;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.scheduling.annotation.Scheduled;
+import org.springframework.stereotype.Service;
+import org.springframework.transaction.support.TransactionSynchronization;
+import org.springframework.transaction.support.TransactionSynchronizationManager;
+
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.Deque;
+import java.util.List;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.function.Consumer;
+
+/**
+ * Per-token log of namespace and content changes. Clients long-poll it to
+ * invalidate exactly the entries another mount has touched. The log of a
+ * token nobody has polled or changed for vtfs.feed.idle-ms is dropped; a
+ * new one starts past every sequence number handed out before, also across
+ * restarts, so an old cursor reads as stale rather than as a position.
+ */
+@Service
+public class ChangeFeedService {
+    private static final int MAX_EVENTS_PER_TOKEN = 10000;
+    
+    public record ChangeEvent(long seq, String op, long ino, long parentIno, int mode,
+                              long size, long version, String name) {
+        public String toLine() {
+            return seq + "," + op + "," + ino + "," + parentIno + "," + mode + ","
+                + size + "," + version + "," + name + "\n";
+        }
+    }
+    
+    /**
+     * Events after the requested cursor. When stale is set the requested
+     * cursor is no longer covered by the log and the client must resync.
+     */
+    public record Batch(long cursor, boolean stale, List<ChangeEvent> events) {}
+    
+    private static class Waiter {
+        final long since;
+        final int limit;
+        final Consumer<Batch> callback;
+        
+        Waiter(long since, int limit, Consumer<Batch> callback) {
+            this.since = since;
+            this.limit = limit;
+            this.callback = callback;
+        }
+    }
+    
+    private static class Feed {
+        final Deque<ChangeEvent> events = new ArrayDeque<>();
+        final List<Waiter> waiters = new ArrayList<>();
+        long lastSeq;
+        long usedAt = System.nanoTime();
+        // Dropped from feeds; whoever still holds it looks the token up again
+        boolean retired;
+        
+        Feed(long lastSeq) {
+            this.lastSeq = lastSeq;
+        }
+    }
+    
+    private final Map<String, Feed> feeds = new ConcurrentHashMap<>();
+    // Where new feeds start: past the clock at startup and every dropped feed
+    private final AtomicLong seqBase = new AtomicLong(System.currentTimeMillis() * 1000);
+    private final long idleNanos;
+    
+    public ChangeFeedService(@Value("${vtfs.feed.idle-ms:600000}") long idleMs) {
+        this.idleNanos = idleMs * 1_000_000L;
+    }
+    
+    private Feed feed(String token) {
+        return feeds.computeIfAbsent(token, t -> new Feed(seqBase.get()));
+    }
+    
+    /**
+     * Records a change to the given directory entry once the surrounding
+     * transaction commits, so pollers never see uncommitted state.
+     */
+    public void publish(String token, String op, VtfsFile file) {
+        Runnable append = () -> append(token, op, file.getIno(), file.getParentIno(),
+            file.getMode(), file.getDataSize(), file.getVersion(), file.getName());
+        
+        if (TransactionSynchronizationManager.isSynchronizationActive()) {
+            TransactionSynchronizationManager.registerSynchronization(new TransactionSynchronization() {
+                @Override
+                public void afterCommit() {
+                    append.run();
+                }
+            });
+        } else {
+            append.run();
+        }
+    }
+    
+    /**
+     * Calls back with the events after `since` as soon as there are any.
+     * Returns the waiter handle to pass to cancel(), or null if the callback
+     * already ran.
+     */
+    public Object subscribe(String token, long since, int limit, Consumer<Batch> callback) {
+        Batch batch = null;
+        while (batch == null) {
+            Feed feed = feed(token);
+            synchronized (feed) {
+                if (feed.retired) {
+                    continue;
+                }
+                feed.usedAt = System.nanoTime();
+                batch = collect(feed, since, limit);
+                if (batch.events().isEmpty() && !batch.stale() && since >= 0) {
+                    Waiter waiter = new Waiter(since, limit, callback);
+                    feed.waiters.add(waiter);
+                    return waiter;
+                }
+            }
+        }
+        callback.accept(batch);
+        return null;
+    }
+    
+    public void cancel(String token, Object waiter) {
+        Feed feed = feeds.get(token);
+        if (feed == null || waiter == null) {
+            return;
+        }
+        synchronized (feed) {
+            feed.waiters.remove(waiter);
+        }
+    }
+    
+    public Batch since(String token, long since, int limit) {
+        while (true) {
+            Feed feed = feed(token);
+            synchronized (feed) {
+                if (!feed.retired) {
+                    feed.usedAt = System.nanoTime();
+                    return collect(feed, since, limit);
+                }
+            }
+        }
+    }
+    
+    private void append(String token, String op, long ino, long parentIno, int mode,
+                        long size, long version, String name) {
+        List<Waiter> ready = null;
+        List<Batch> batches = new ArrayList<>();
+        while (ready == null) {
+            Feed feed = feed(token);
+            synchronized (feed) {
+                if (feed.retired) {
+                    continue;
+                }
+                feed.usedAt = System.nanoTime();
+                feed.lastSeq++;
+                feed.events.addLast(new ChangeEvent(feed.lastSeq, op, ino, parentIno, mode, size, version, name));
+                if (feed.events.size() > MAX_EVENTS_PER_TOKEN) {
+                    feed.events.removeFirst();
+                }
+                
+                ready = new ArrayList<>(feed.waiters);
+                feed.waiters.clear();
+                for (Waiter waiter : ready) {
+                    batches.add(collect(feed, waiter.since, waiter.limit));
+                }
+            }
+        }
+        
+        for (int i = 0; i < ready.size(); i++) {
+            ready.get(i).callback.accept(batches.get(i));
+        }
+    }
+    
+    /**
+     * Drops the feeds of tokens with no poller waiting and nothing published
+     * or polled for vtfs.feed.idle-ms.
+     */
+    @Scheduled(fixedDelayString = "${vtfs.feed.idle-ms:600000}")
+    public void dropIdleFeeds() {
+        long now = System.nanoTime();
+        feeds.forEach((token, feed) -> {
+            synchronized (feed) {
+                if (!feed.waiters.isEmpty() || now - feed.usedAt < idleNanos) {
+                    return;
+                }
+                feed.retired = true;
+                seqBase.accumulateAndGet(feed.lastSeq, Math::max);
+                feeds.remove(token, feed);
+            }
+        });
+    }
+    
+    private Batch collect(Feed feed, long since, int limit) {
+        // A negative cursor only asks where the feed currently is
+        if (since < 0) {
+            return new Batch(feed.lastSeq, false, List.of());
+        }
+        
+        // The cursor predates the retained log, or comes from a dropped feed or before a restart
+        long oldest = feed.events.isEmpty() ? feed.lastSeq + 1 : feed.events.peekFirst().seq();
+        if (since > feed.lastSeq || since + 1 < oldest) {
+            return new Batch(feed.lastSeq, true, List.of());
+        }
+        
+        List<ChangeEvent> result = new ArrayList<>();
+        long cursor = since;
+        for (ChangeEvent event : feed.events) {
+            if (event.seq() <= since) {
+                continue;
+            }
+            if (result.size() >= limit) {
+                break;
+            }
+            result.add(event);
+            cursor = event.seq();
+        }
+        return new Batch(cursor, false, result);
+    }
+}
@@ -0,0 +1,260 @@
+package com.vtfs.service;
+
+import com.vtfs.model.Inode;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.scheduling.annotation.Scheduled;
+import org.springframework.stereotype.Component;
+import org.springframework.transaction.support.TransactionSynchronization;
+import org.springframework.transaction.support.TransactionSynchronizationManager;
+
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.function.Supplier;
+import java.util.function.UnaryOperator;
+
+/**
+ * In-process cache of inode attributes and directory listings, shared by
+ * all tokens and bounded per region with LRU eviction.
+ *
+ * Assumes this server is the only writer to the database. Every mutation
+ * goes through update(), which empties the entry at once and installs the
+ * new value when the transaction commits; if two updates of the same entry
+ * overlap, it is left empty for the next read to fill. A miss is filled only
+ * if nothing touched the entry between the snapshot taken before the
+ * database read and the fill, so a slow reader cannot put back a value a
+ * writer just replaced.
+ */
+@Component
+public class MetadataCache {
+    public record InodeKey(String token, Long ino) {}
+    
+    public record DirKey(String token, Long parentIno) {}
+    
+    public record CachedInode(Long ino, Integer mode, Integer nlink, Long dataSize, Long version) {
+        public static CachedInode of(Inode inode) {
+            return new CachedInode(inode.getIno(), inode.getMode(), inode.getNlink(),
+                                   inode.getDataSize(), inode.getVersion());
+        }
+        
+        public boolean isDirectory() {
+            return (mode & 0040000) != 0;
+        }
+        
+        public CachedInode withNlink(int nlink) {
+            return new CachedInode(ino, mode, nlink, dataSize, version);
+        }
+        
+        public CachedInode withData(long dataSize, long version) {
+            return new CachedInode(ino, mode, nlink, dataSize, version);
+        }
+    }
+    
+    public static final class Region<K, V> {
+        private static final class Entry<V> {
+            V value;
+            // Value the entry had before the pending updates emptied it
+            V previous;
+            long stamp;
+            int pending;
+            // Set when updates overlapped; none of them can know the final value
+            boolean overlapped;
+        }
+        
+        private final String name;
+        private final int maxEntries;
+        private final LinkedHashMap<K, Entry<V>> entries;
+        // Stamp reported for keys with no entry; raised on every eviction
+        private long evictedStamp;
+        private long nextStamp;
+        private long hits;
+        private long misses;
+        private long evictions;
+        
+        Region(String name, int maxEntries) {
+            this.name = name;
+            this.maxEntries = maxEntries;
+            this.entries = new LinkedHashMap<>(16, 0.75f, true) {
+                @Override
+                protected boolean removeEldestEntry(Map.Entry<K, Entry<V>> eldest) {
+                    if (size() <= Region.this.maxEntries || eldest.getValue().pending > 0) {
+                        return false;
+                    }
+                    evictedStamp = Math.max(evictedStamp, eldest.getValue().stamp);
+                    evictions++;
+                    return true;
+                }
+            };
+        }
+        
+        public synchronized V get(K key) {
+            Entry<V> entry = entries.get(key);
+            if (entry != null && entry.value != null) {
+                hits++;
+                return entry.value;
+            }
+            misses++;
+            return null;
+        }
+        
+        /**
+         * Stamp to pass to fill() after reading the value from the database.
+         */
+        public synchronized long snapshot(K key) {
+            Entry<V> entry = entries.get(key);
+            return entry != null ? entry.stamp : evictedStamp;
+        }
+        
+        public synchronized void fill(K key, V value, long snapshot) {
+            if (maxEntries <= 0) {
+                return;
+            }
+            Entry<V> entry = entries.get(key);
+            long current = entry != null ? entry.stamp : evictedStamp;
+            if (current != snapshot || (entry != null && entry.pending > 0)) {
+                return;
+            }
+            if (entry == null) {
+                entry = new Entry<>();
+                entries.put(key, entry);
+            }
+            entry.value = value;
+            entry.stamp = ++nextStamp;
+        }
+        
+        synchronized long begin(K key) {
+            Entry<V> entry = entries.get(key);
+            if (entry == null) {
+                entry = new Entry<>();
+                entries.put(key, entry);
+            }
+            if (entry.pending > 0) {
+                entry.overlapped = true;
+            } else {
+                entry.previous = entry.value;
+            }
+            entry.value = null;
+            entry.pending++;
+            entry.stamp = ++nextStamp;
+            return entry.stamp;
+        }
+        
+        synchronized void end(K key, long stamp, UnaryOperator<V> change) {
+            Entry<V> entry = entries.get(key);
+            if (entry == null) {
+                return;
+            }
+            entry.pending--;
+            if (change != null && !entry.overlapped && entry.stamp == stamp && maxEntries > 0) {
+                entry.value = change.apply(entry.previous);
+                entry.stamp = ++nextStamp;
+            }
+            if (entry.pending == 0) {
+                entry.previous = null;
+                entry.overlapped = false;
+                if (entry.value == null) {
+                    entries.remove(key);
+                    evictedStamp = Math.max(evictedStamp, entry.stamp);
+                }
+            }
+        }
+        
+        synchronized void appendStats(StringBuilder out) {
+            out.append(name).append("_entries=").append(entries.size()).append("\n");
+            out.append(name).append("_hits=").append(hits).append("\n");
+            out.append(name).append("_misses=").append(misses).append("\n");
+            out.append(name).append("_evictions=").append(evictions).append("\n");
+        }
+    }
+    
+    // Last inode number handed out for a token, and when
+    private static final class InoCounter {
+        long last;
+        long usedAt;
+        
+        InoCounter(long last) {
+            this.last = last;
+        }
+    }
+    
+    private final Region<InodeKey, CachedInode> inodes;
+    private final Region<DirKey, Map<String, Long>> directories;
+    private final Map<String, InoCounter> lastIno = new ConcurrentHashMap<>();
+    private final long inoIdleNanos;
+    
+    public MetadataCache(@Value("${vtfs.cache.max-inodes:100000}") int maxInodes,
+                         @Value("${vtfs.cache.max-directories:10000}") int maxDirectories,
+                         @Value("${vtfs.cache.ino-idle-ms:600000}") long inoIdleMs) {
+        this.inodes = new Region<>("inode_cache", maxInodes);
+        this.directories = new Region<>("dir_cache", maxDirectories);
+        this.inoIdleNanos = inoIdleMs * 1_000_000L;
+    }
+    
+    public Region<InodeKey, CachedInode> inodes() {
+        return inodes;
+    }
+    
+    /**
+     * Cached listings map each name in the directory to its inode number.
+     */
+    public Region<DirKey, Map<String, Long>> directories() {
+        return directories;
+    }
+    
+    /**
+     * Empties the entry now and, once the surrounding transaction commits,
+     * replaces it with change applied to the value it had before. change may
+     * receive null if the entry was not cached, and may return null to leave
+     * it uncached. On rollback the entry simply stays empty.
+     */
+    public <K, V> void update(Region<K, V> region, K key, UnaryOperator<V> change) {
+        long stamp = region.begin(key);
+        if (!TransactionSynchronizationManager.isSynchronizationActive()) {
+            region.end(key, stamp, change);
+            return;
+        }
+        TransactionSynchronizationManager.registerSynchronization(new TransactionSynchronization() {
+            @Override
+            public void afterCompletion(int status) {
+                region.end(key, stamp, status == STATUS_COMMITTED ? change : null);
+            }
+        });
+    }
+    
+    /**
+     * Hands out inode numbers per token without asking the database for the
+     * current maximum every time. Numbers from rolled back creates are lost.
+     */
+    public long allocateIno(String token, Supplier<Long> currentMax) {
+        long[] ino = new long[1];
+        lastIno.compute(token, (t, counter) -> {
+            if (counter == null) {
+                Long max = currentMax.get();
+                counter = new InoCounter(max == null ? 199L : max);
+            }
+            ino[0] = ++counter.last;
+            counter.usedAt = System.nanoTime();
+            return counter;
+        });
+        return ino[0];
+    }
+    
+    /**
+     * Forgets the counters of tokens that created nothing for
+     * vtfs.cache.ino-idle-ms; the next create asks the database again. By
+     * then every create that took a number has long committed or rolled
+     * back, so the maximum it reads covers them.
+     */
+    @Scheduled(fixedDelayString = "${vtfs.cache.ino-idle-ms:600000}")
+    public void dropIdleInoCounters() {
+        long now = System.nanoTime();
+        for (String token : lastIno.keySet()) {
+            lastIno.computeIfPresent(token, (t, counter) -> now - counter.usedAt >= inoIdleNanos ? null : counter);
+        }
+    }
+    
+    public void appendStats(StringBuilder out) {
+        inodes.appendStats(out);
+        directories.appendStats(out);
+    }
+}
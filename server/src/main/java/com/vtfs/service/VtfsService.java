@@ -1,14 +1,26 @@
 package com.vtfs.service;
 
-import com.vtfs.model.FileData;
+import com.vtfs.model.Dirent;
+import com.vtfs.model.Inode;
 import com.vtfs.model.VtfsFile;
-import com.vtfs.repository.FileDataRepository;
-import com.vtfs.repository.VtfsFileRepository;
+import com.vtfs.repository.DirentRepository;
+import com.vtfs.repository.InodeRepository;
+import com.vtfs.service.MetadataCache.CachedInode;
+import com.vtfs.service.MetadataCache.DirKey;
+import com.vtfs.service.MetadataCache.InodeKey;
+import com.vtfs.storage.BlockStore;
 import org.springframework.beans.factory.annotation.Autowired;
 import org.springframework.stereotype.Service;
 import org.springframework.transaction.annotation.Transactional;
 
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.io.UncheckedIOException;
+import java.util.ArrayList;
+import java.util.HashMap;
 import java.util.List;
+import java.util.Map;
 import java.util.Optional;
 
 @Service
@@ -16,27 +28,66 @@ public class VtfsService {
     private static final Long ROOT_INO = 100L;
     
     @Autowired
-    private VtfsFileRepository fileRepository;
+    private InodeRepository inodeRepository;
     
     @Autowired
-    private FileDataRepository dataRepository;
+    private DirentRepository direntRepository;
+    
+    @Autowired
+    private BlockStore blockStore;
+    
+    @Autowired
+    private ChangeFeedService changeFeed;
+    
+    @Autowired
+    private MetadataCache cache;
     
     @Transactional
     public List<VtfsFile> listFiles(String token, Long parentIno) {
-        return fileRepository.findByTokenAndParentIno(token, parentIno);
+        DirKey key = new DirKey(token, parentIno);
+        Map<String, Long> entries = cache.directories().get(key);
+        if (entries != null) {
+            List<VtfsFile> files = new ArrayList<>(entries.size());
+            for (Map.Entry<String, Long> entry : entries.entrySet()) {
+                CachedInode inode = cache.inodes().get(new InodeKey(token, entry.getValue()));
+                if (inode == null) {
+                    files = null;
+                    break;
+                }
+                files.add(toFile(parentIno, entry.getKey(), inode));
+            }
+            if (files != null) {
+                return files;
+            }
+        }
+        
+        long stamp = cache.directories().snapshot(key);
+        List<VtfsFile> files = direntRepository.listDirectory(token, parentIno);
+        Map<String, Long> loaded = new HashMap<>();
+        for (VtfsFile file : files) {
+            loaded.put(file.getName(), file.getIno());
+        }
+        cache.directories().fill(key, Map.copyOf(loaded), stamp);
+        return files;
     }
     
     @Transactional
     public VtfsFile createFile(String token, Long parentIno, String name, Integer mode) {
-        if (fileRepository.existsByTokenAndParentInoAndName(token, parentIno, name)) {
+        Long newIno = cache.allocateIno(token, () -> inodeRepository.findMaxInoByToken(token));
+        
+        // The dirent primary key rejects a duplicate name before anything is written
+        if (direntRepository.insertIfAbsent(token, parentIno, name, newIno) == 0) {
             return null;
         }
+        Inode inode = inodeRepository.save(new Inode(token, newIno, mode));
         
-        Long maxIno = fileRepository.findMaxInoByToken(token);
-        Long newIno = (maxIno == null) ? 200L : maxIno + 1;
+        CachedInode created = CachedInode.of(inode);
+        cache.update(cache.inodes(), new InodeKey(token, newIno), old -> created);
+        cache.update(cache.directories(), new DirKey(token, parentIno), old -> withEntry(old, name, newIno));
         
-        VtfsFile file = new VtfsFile(token, newIno, name, parentIno, mode);
-        return fileRepository.save(file);
+        VtfsFile file = toFile(parentIno, name, created);
+        changeFeed.publish(token, "create", file);
+        return file;
     }
     
     @Transactional
@@ -45,96 +96,165 @@ public class VtfsService {
         return createFile(token, parentIno, name, dirMode);
     }
     
-    @Transactional
-    public byte[] readFile(String token, Long ino, Long offset, Long length) {
-        Optional<VtfsFile> fileOpt = fileRepository.findByTokenAndIno(token, ino);
-        if (fileOpt.isEmpty() || fileOpt.get().isDirectory()) {
+    /**
+     * Range a read will return. When notModified is set the caller's cached
+     * copy is current and the range is empty.
+     */
+    public record ReadPlan(long version, long size, boolean notModified, long start, long end) {
+        public long length() { return end - start; }
+    }
+    
+    @Transactional(readOnly = true)
+    public ReadPlan planRead(String token, Long ino, Long offset, Long length, Long knownVersion) {
+        CachedInode inode = lookupInode(token, ino);
+        if (inode == null || inode.isDirectory()) {
             return null;
         }
         
-        VtfsFile file = fileOpt.get();
-        if (offset >= file.getDataSize()) {
-            return new byte[0];
+        long version = inode.version();
+        long size = inode.dataSize();
+        if (knownVersion != null && knownVersion == version) {
+            return new ReadPlan(version, size, true, offset, offset);
         }
         
-        Long endOffset = Math.min(offset + length, file.getDataSize());
-        List<FileData> dataChunks = dataRepository.findByTokenAndInoAndOffsetRange(
-            token, ino, offset, endOffset
-        );
-        
-        if (dataChunks.isEmpty()) {
-            return new byte[0];
+        long start = Math.min(offset, size);
+        long end = Math.min(offset + length, size);
+        return new ReadPlan(version, size, false, start, end);
+    }
+    
+    /**
+     * Writes bytes [start, end) of the file to out. Exactly end - start bytes
+     * are written; missing blocks come out as zeros.
+     */
+    public void streamRange(String token, Long ino, long start, long end, OutputStream out) throws IOException {
+        blockStore.streamRange(token, ino, start, end, out);
+    }
+    
+    public byte[] readRange(String token, Long ino, long start, long end) throws IOException {
+        ByteArrayOutputStream out = new ByteArrayOutputStream((int) Math.max(end - start, 0));
+        streamRange(token, ino, start, end, out);
+        return out.toByteArray();
+    }
+    
+    /**
+     * Writes data and returns the new version of the file, or null if the
+     * inode does not exist or is a directory. With the inode cached and the
+     * Postgres backend this is one inode update plus one upsert per touched
+     * block, and no reads.
+     */
+    @Transactional
+    public Long writeFile(String token, Long ino, Long offset, byte[] data) {
+        CachedInode inode = lookupInode(token, ino);
+        if (inode == null || inode.isDirectory()) {
+            return null;
         }
         
-        byte[] result = new byte[(int)(endOffset - offset)];
+        // Size and version live on the inode row only, so one update covers
+        // every link. It also locks the row, so writes to one file take turns
+        // in the block store.
+        List<Object[]> updated = inodeRepository.applyWrite(token, ino, offset + data.length);
+        if (updated.isEmpty()) {
+            return null;
+        }
+        long version = ((Number) updated.get(0)[0]).longValue();
+        long size = ((Number) updated.get(0)[1]).longValue();
         
-        for (FileData chunk : dataChunks) {
-            long chunkStart = chunk.getOffset();
-            long chunkEnd = chunk.getOffset() + chunk.getData().length;
-            long readStart = Math.max(chunkStart, offset);
-            long readEnd = Math.min(chunkEnd, endOffset);
-            
-            int srcPos = (int)(readStart - chunkStart);
-            int len = (int)(readEnd - readStart);
-            int dstPos = (int)(readStart - offset);
-            
-            System.arraycopy(chunk.getData(), srcPos, result, dstPos, len);
+        if (data.length > 0) {
+            try {
+                blockStore.write(token, ino, offset, data);
+            } catch (IOException e) {
+                throw new UncheckedIOException(e);
+            }
         }
         
-        return result;
+        // Only size and version changed; the rest comes from the entry as it
+        // stands, not from the copy looked up before the row was locked
+        cache.update(cache.inodes(), new InodeKey(token, ino),
+                     old -> old != null ? old.withData(size, version) : null);
+        
+        // Writes are per inode, not per name, so the event carries no dirent
+        changeFeed.publish(token, "write", toFile(0L, "", inode.withData(size, version)));
+        return version;
     }
     
+    /**
+     * Outcome of a server-side copy: the destination's new version and the
+     * number of bytes copied, fewer than asked for if the source ends first.
+     */
+    public record CopyResult(long version, long copied) {}
+    
+    /**
+     * Copies a range from one file to another (or within one file) without
+     * the data passing through the client. Returns null if either inode
+     * does not exist or is a directory.
+     */
     @Transactional
-    public boolean writeFile(String token, Long ino, Long offset, byte[] data) {
-        Optional<VtfsFile> fileOpt = fileRepository.findByTokenAndIno(token, ino);
-        if (fileOpt.isEmpty() || fileOpt.get().isDirectory()) {
-            return false;
+    public CopyResult copyRange(String token, Long srcIno, Long srcOffset, Long dstIno, Long dstOffset, Long length) {
+        CachedInode src = lookupInode(token, srcIno);
+        CachedInode dst = lookupInode(token, dstIno);
+        if (src == null || dst == null || src.isDirectory() || dst.isDirectory()) {
+            return null;
         }
         
-        VtfsFile file = fileOpt.get();
-        
-        long writeEnd = offset + data.length;
-        List<FileData> overlappingChunks = dataRepository.findByTokenAndInoAndOffsetRange(
-            token, ino, offset, writeEnd
-        );
-        
-        for (FileData chunk : overlappingChunks) {
-            dataRepository.delete(chunk);
+        long copied = Math.max(0, Math.min(length, src.dataSize() - srcOffset));
+        if (copied == 0) {
+            return new CopyResult(dst.version(), 0);
         }
         
-        FileData fileData = new FileData(token, ino, offset, data);
-        fileData.setFile(file);
-        dataRepository.save(fileData);
+        // Locks the destination like a write does; the source is read as of now
+        List<Object[]> updated = inodeRepository.applyWrite(token, dstIno, dstOffset + copied);
+        if (updated.isEmpty()) {
+            return null;
+        }
+        long version = ((Number) updated.get(0)[0]).longValue();
+        long size = ((Number) updated.get(0)[1]).longValue();
         
-        Long newSize = Math.max(file.getDataSize(), writeEnd);
-        file.setDataSize(newSize);
-        fileRepository.save(file);
+        try {
+            blockStore.copy(token, srcIno, srcOffset, dstIno, dstOffset, copied);
+        } catch (IOException e) {
+            throw new UncheckedIOException(e);
+        }
         
-        return true;
+        cache.update(cache.inodes(), new InodeKey(token, dstIno),
+                     old -> old != null ? old.withData(size, version) : null);
+        changeFeed.publish(token, "write", toFile(0L, "", dst.withData(size, version)));
+        return new CopyResult(version, copied);
     }
     
     @Transactional
     public boolean deleteFile(String token, Long ino) {
-        // Находим ВСЕ записи с таким ino (hard links)
-        List<VtfsFile> allLinks = fileRepository.findByTokenAndInoIn(token, List.of(ino));
-        if (allLinks.isEmpty()) {
+        CachedInode inode = lookupInode(token, ino);
+        if (inode == null) {
             return false;
         }
         
-        VtfsFile file = allLinks.get(0);
-        if (file.isDirectory()) {
-            List<VtfsFile> children = fileRepository.findByTokenAndParentIno(token, ino);
-            if (!children.isEmpty()) {
+        if (inode.isDirectory()) {
+            Map<String, Long> children = cache.directories().get(new DirKey(token, ino));
+            boolean empty = children != null ? children.isEmpty()
+                                             : !direntRepository.existsByTokenAndParentIno(token, ino);
+            if (!empty) {
                 return false;
             }
         }
         
         // Удаляем все hard links с таким ino
-        fileRepository.deleteByTokenAndIno(token, ino);
+        List<Dirent> links = direntRepository.findByTokenAndIno(token, ino);
+        direntRepository.deleteByTokenAndIno(token, ino);
+        inodeRepository.deleteByTokenAndIno(token, ino);
+        
+        cache.update(cache.inodes(), new InodeKey(token, ino), old -> null);
+        if (inode.isDirectory()) {
+            cache.update(cache.directories(), new DirKey(token, ino), old -> null);
+        }
+        for (Dirent link : links) {
+            cache.update(cache.directories(), new DirKey(token, link.getParentIno()),
+                         old -> withoutEntry(old, link.getName()));
+            changeFeed.publish(token, "remove", toFile(link.getParentIno(), link.getName(), inode));
+        }
         
         // Удаляем данные файла (если это был файл, а не директория)
-        if (!file.isDirectory()) {
-            dataRepository.deleteByTokenAndIno(token, ino);
+        if (!inode.isDirectory()) {
+            blockStore.delete(token, ino);
         }
         
         return true;
@@ -142,65 +262,98 @@ public class VtfsService {
     
     @Transactional
     public VtfsFile createLink(String token, Long oldIno, Long parentIno, String name) {
-        Optional<VtfsFile> oldFileOpt = fileRepository.findByTokenAndIno(token, oldIno);
-        if (oldFileOpt.isEmpty() || oldFileOpt.get().isDirectory()) {
+        CachedInode inode = lookupInode(token, oldIno);
+        if (inode == null || inode.isDirectory()) {
             return null;
         }
         
-        if (fileRepository.existsByTokenAndParentInoAndName(token, parentIno, name)) {
+        if (direntRepository.insertIfAbsent(token, parentIno, name, oldIno) == 0) {
             return null;
         }
         
-        VtfsFile oldFile = oldFileOpt.get();
-        int newNlink = oldFile.getNlink() + 1;
-        
-        VtfsFile newFile = new VtfsFile(token, oldFile.getIno(), name, parentIno, oldFile.getMode());
-        newFile.setNlink(newNlink);
-        newFile.setDataSize(oldFile.getDataSize());
-        
-        VtfsFile saved = fileRepository.save(newFile);
-        
-        List<VtfsFile> allLinks = fileRepository.findByTokenAndInoIn(token, List.of(oldFile.getIno()));
-        for (VtfsFile link : allLinks) {
-            link.setNlink(newNlink);
-            fileRepository.save(link);
+        Integer nlink = inodeRepository.adjustNlink(token, oldIno, 1);
+        if (nlink == null) {
+            return null;
         }
         
-        return saved;
+        CachedInode linked = inode.withNlink(nlink);
+        cache.update(cache.inodes(), new InodeKey(token, oldIno),
+                     old -> old != null ? old.withNlink(nlink) : null);
+        cache.update(cache.directories(), new DirKey(token, parentIno), old -> withEntry(old, name, oldIno));
+        
+        VtfsFile link = toFile(parentIno, name, linked);
+        changeFeed.publish(token, "link", link);
+        return link;
     }
     
+    /**
+     * Removes the name parentIno/name of the inode, and the inode with its
+     * last name. The caller names the link: with several, any other choice
+     * would remove, and announce, a name the caller still has.
+     */
     @Transactional
-    public boolean unlink(String token, Long ino) {
-        // Находим ВСЕ записи с таким ino (hard links)
-        List<VtfsFile> allLinks = fileRepository.findByTokenAndInoIn(token, List.of(ino));
-        if (allLinks.isEmpty()) {
+    public boolean unlink(String token, Long ino, Long parentIno, String name) {
+        CachedInode inode = lookupInode(token, ino);
+        if (inode == null || direntRepository.deleteEntry(token, parentIno, name, ino) == 0) {
             return false;
         }
         
-        // Берем первую найденную запись для удаления
-        // В реальной системе нужно передавать parent_ino и name, но API принимает только ino
-        VtfsFile fileToDelete = allLinks.get(0);
-        Long fileIno = fileToDelete.getIno();
-        Long parentIno = fileToDelete.getParentIno();
-        String name = fileToDelete.getName();
-        int newNlink = fileToDelete.getNlink() - 1;
+        Integer nlink = inodeRepository.adjustNlink(token, ino, -1);
+        int remaining = nlink != null ? nlink : 0;
         
-        // Удаляем конкретную запись по уникальной комбинации token + parentIno + name
-        fileRepository.deleteByTokenAndParentInoAndName(token, parentIno, name);
-        
-        if (newNlink > 0) {
-            // Обновляем nlink для всех оставшихся hard links с таким же ino
-            List<VtfsFile> remainingLinks = fileRepository.findByTokenAndInoIn(token, List.of(fileIno));
-            for (VtfsFile link : remainingLinks) {
-                link.setNlink(newNlink);
-                fileRepository.save(link);
-            }
-        } else {
-            // Если это была последняя ссылка, удаляем данные файла
-            dataRepository.deleteByTokenAndIno(token, fileIno);
+        if (remaining <= 0) {
+            // Если это была последняя ссылка, удаляем inode и данные файла
+            inodeRepository.deleteByTokenAndIno(token, ino);
+            blockStore.delete(token, ino);
         }
         
+        CachedInode unlinked = inode.withNlink(remaining);
+        cache.update(cache.inodes(), new InodeKey(token, ino),
+                     old -> old != null && remaining > 0 ? old.withNlink(remaining) : null);
+        cache.update(cache.directories(), new DirKey(token, parentIno), old -> withoutEntry(old, name));
+        changeFeed.publish(token, "remove", toFile(parentIno, name, unlinked));
+        
         return true;
     }
+    
+    private CachedInode lookupInode(String token, Long ino) {
+        InodeKey key = new InodeKey(token, ino);
+        CachedInode cached = cache.inodes().get(key);
+        if (cached != null) {
+            return cached;
+        }
+        
+        long stamp = cache.inodes().snapshot(key);
+        Optional<Inode> inode = inodeRepository.findByTokenAndIno(token, ino);
+        if (inode.isEmpty()) {
+            return null;
+        }
+        CachedInode loaded = CachedInode.of(inode.get());
+        cache.inodes().fill(key, loaded, stamp);
+        return loaded;
+    }
+    
+    private static VtfsFile toFile(Long parentIno, String name, CachedInode inode) {
+        return new VtfsFile(inode.ino(), name, parentIno, inode.mode(), inode.nlink(),
+                            inode.dataSize(), inode.version());
+    }
+    
+    // Cached listings are only patched when present; a missing one stays missing
+    private static Map<String, Long> withEntry(Map<String, Long> entries, String name, Long ino) {
+        if (entries == null) {
+            return null;
+        }
+        Map<String, Long> updated = new HashMap<>(entries);
+        updated.put(name, ino);
+        return Map.copyOf(updated);
+    }
+    
+    private static Map<String, Long> withoutEntry(Map<String, Long> entries, String name) {
+        if (entries == null) {
+            return null;
+        }
+        Map<String, Long> updated = new HashMap<>(entries);
+        updated.remove(name);
+        return Map.copyOf(updated);
+    }
 }
-
@@ -0,0 +1,59 @@
+package com.vtfs.service;
+
+import net.jpountz.lz4.LZ4Compressor;
+import net.jpountz.lz4.LZ4Factory;
+import net.jpountz.lz4.LZ4SafeDecompressor;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.stereotype.Component;
+
+import java.util.Arrays;
+
+/**
+ * LZ4 block compression of request and response bodies. The kernel client
+ * uses the crypto API "lz4" algorithm, which produces raw LZ4 blocks without
+ * a frame header, so the uncompressed length travels as a separate parameter.
+ */
+@Component
+public class WireCodec {
+    public static final String LZ4 = "lz4";
+    
+    private final LZ4Compressor compressor = LZ4Factory.fastestInstance().fastCompressor();
+    private final LZ4SafeDecompressor decompressor = LZ4Factory.fastestInstance().safeDecompressor();
+    
+    @Value("${vtfs.compression.min-size:4096}")
+    private int minSize;
+    
+    // Larger bodies are streamed uncompressed instead of being buffered
+    @Value("${vtfs.compression.max-size:1048576}")
+    private int maxSize;
+    
+    public boolean worthCompressing(long length) {
+        return length >= minSize && length <= maxSize;
+    }
+    
+    /**
+     * Returns the compressed form of data, or null if data is below the size
+     * threshold or does not shrink.
+     */
+    public byte[] compress(byte[] data) {
+        if (data.length < minSize) {
+            return null;
+        }
+        
+        byte[] buffer = new byte[compressor.maxCompressedLength(data.length)];
+        int length = compressor.compress(data, 0, data.length, buffer, 0, buffer.length);
+        if (length >= data.length) {
+            return null;
+        }
+        return Arrays.copyOf(buffer, length);
+    }
+    
+    public byte[] decompress(byte[] data, int rawLength) {
+        byte[] result = new byte[rawLength];
+        int length = decompressor.decompress(data, 0, data.length, result, 0);
+        if (length != rawLength) {
+            throw new IllegalArgumentException("Decompressed " + length + " bytes, expected " + rawLength);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,61 @@
+package com.vtfs.storage;
+
+import java.util.LinkedHashMap;
+import java.util.Map;
+
+/**
+ * LRU of decompressed block contents keyed by (token, hash), bounded by
+ * total bytes. Contents never change under a hash, so entries need no
+ * invalidation, and a block shared by many files is cached once.
+ */
+final class BlockCache {
+    record Key(String token, String hash) {}
+    
+    private final long maxBytes;
+    private final LinkedHashMap<Key, byte[]> blocks = new LinkedHashMap<>(16, 0.75f, true);
+    private long bytes;
+    private long hits;
+    private long misses;
+    private long evictions;
+    
+    BlockCache(long maxBytes) {
+        this.maxBytes = maxBytes;
+    }
+    
+    synchronized byte[] get(Key key) {
+        byte[] block = blocks.get(key);
+        if (block != null) {
+            hits++;
+        } else {
+            misses++;
+        }
+        return block;
+    }
+    
+    synchronized void put(Key key, byte[] block) {
+        if (block.length > maxBytes) {
+            return;
+        }
+        byte[] previous = blocks.put(key, block);
+        if (previous != null) {
+            bytes -= previous.length;
+        }
+        bytes += block.length;
+        
+        var it = blocks.entrySet().iterator();
+        while (bytes > maxBytes && it.hasNext()) {
+            Map.Entry<Key, byte[]> eldest = it.next();
+            bytes -= eldest.getValue().length;
+            it.remove();
+            evictions++;
+        }
+    }
+    
+    synchronized void appendStats(StringBuilder out) {
+        out.append("block_cache_bytes=").append(bytes).append("\n");
+        out.append("block_cache_entries=").append(blocks.size()).append("\n");
+        out.append("block_cache_hits=").append(hits).append("\n");
+        out.append("block_cache_misses=").append(misses).append("\n");
+        out.append("block_cache_evictions=").append(evictions).append("\n");
+    }
+}
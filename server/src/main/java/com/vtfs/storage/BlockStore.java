@@ -0,0 +1,47 @@
+package com.vtfs.storage;
+
+import com.vtfs.model.FileData;
+
+import java.io.IOException;
+import java.io.OutputStream;
+
+/**
+ * Where file contents live. Inode and directory metadata always stay in
+ * Postgres; the backend only maps (token, ino, byte range) to bytes.
+ * Selected with vtfs.storage.backend.
+ *
+ * write and delete are called inside the service's transaction, after the
+ * inode row was locked, so they never race with another write to the same
+ * file. streamRange runs outside of it.
+ */
+public interface BlockStore {
+    // Same block layout for every backend
+    int BLOCK_SIZE = FileData.BLOCK_SIZE;
+    
+    void write(String token, long ino, long offset, byte[] data) throws IOException;
+    
+    /**
+     * Writes exactly end - start bytes of the file to out; holes come out as
+     * zeros.
+     */
+    void streamRange(String token, long ino, long start, long end, OutputStream out) throws IOException;
+    
+    void delete(String token, long ino);
+    
+    /**
+     * Overwrites length bytes of dstIno at dstOffset with the bytes of
+     * srcIno at srcOffset. If both are the same file the ranges do not
+     * overlap. Called like write, with the destination's inode row locked.
+     * The default copies through the heap; backends override it to copy
+     * whole blocks without reading them.
+     */
+    default void copy(String token, long srcIno, long srcOffset,
+                      long dstIno, long dstOffset, long length) throws IOException {
+        RangeCopy.bytes(this, token, srcIno, srcOffset, dstIno, dstOffset, length);
+    }
+    
+    /**
+     * Adds backend counters to /api/stats, per token when token is not null.
+     */
+    default void appendStats(String token, StringBuilder out) {}
+}
@@ -0,0 +1,261 @@
+package com.vtfs.storage;
+
+import com.github.luben.zstd.Zstd;
+import com.vtfs.model.Blob;
+import com.vtfs.repository.BlobRepository;
+import com.vtfs.repository.BlockRefRepository;
+import org.springframework.beans.factory.annotation.Autowired;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.boot.autoconfigure.condition.ConditionalOnProperty;
+import org.springframework.stereotype.Component;
+
+import java.io.IOException;
+import java.io.OutputStream;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.HashMap;
+import java.util.HashSet;
+import java.util.HexFormat;
+import java.util.List;
+import java.util.Map;
+import java.util.Set;
+
+/**
+ * Stores each distinct block content once per token. File blocks point at
+ * blobs keyed by the SHA-256 of their contents (vtfs_block_refs ->
+ * vtfs_blobs); blobs are reference counted and deleted with their last
+ * reference. Blobs are optionally zstd-compressed, and decompressed blocks
+ * are kept in a shared LRU so popular shared contents are read from memory.
+ *
+ * Deduplication is per token, so one tenant can never learn from timing
+ * or sizes whether another one stores the same data.
+ */
+@Component
+@ConditionalOnProperty(name = "vtfs.storage.backend", havingValue = "dedup")
+public class DedupBlockStore implements BlockStore {
+    // Blocks whose contents are fetched with one query while streaming
+    private static final int READ_BATCH = 16;
+    
+    @Autowired
+    private BlockRefRepository refRepository;
+    
+    @Autowired
+    private BlobRepository blobRepository;
+    
+    private final boolean compress;
+    private final int level;
+    private final BlockCache cache;
+    
+    public DedupBlockStore(@Value("${vtfs.storage.dedup.compression:zstd}") String compression,
+                           @Value("${vtfs.storage.dedup.level:3}") int level,
+                           @Value("${vtfs.storage.dedup.cache-bytes:67108864}") long cacheBytes) {
+        this.compress = "zstd".equalsIgnoreCase(compression);
+        this.level = level;
+        this.cache = new BlockCache(cacheBytes);
+    }
+    
+    /**
+     * Builds the new contents of every block the write touches, stores each
+     * under its hash and repoints the block, dropping the reference to what
+     * it held before.
+     */
+    @Override
+    public void write(String token, long ino, long offset, byte[] data) throws IOException {
+        long writeEnd = offset + data.length;
+        long firstBlock = offset / BLOCK_SIZE;
+        long lastBlock = (writeEnd - 1) / BLOCK_SIZE;
+        
+        Map<Long, String> oldHashes = new HashMap<>();
+        for (Object[] row : refRepository.findRefs(token, ino, firstBlock, lastBlock)) {
+            oldHashes.put(((Number) row[0]).longValue(), (String) row[1]);
+        }
+        
+        for (long blockNo = firstBlock; blockNo <= lastBlock; blockNo++) {
+            long blockStart = blockNo * BLOCK_SIZE;
+            int from = (int) Math.max(offset - blockStart, 0);
+            int to = (int) Math.min(writeEnd - blockStart, BLOCK_SIZE);
+            String oldHash = oldHashes.get(blockNo);
+            
+            byte[] block;
+            if (oldHash == null && from == 0) {
+                block = Arrays.copyOfRange(data, (int)(blockStart - offset), (int)(blockStart - offset) + to);
+            } else {
+                byte[] current = oldHash != null ? contents(token, List.of(oldHash)).get(oldHash) : new byte[0];
+                if (current == null) {
+                    throw new IOException("blob " + oldHash + " of inode " + ino + " is missing");
+                }
+                block = Arrays.copyOf(current, Math.max(current.length, to));
+                System.arraycopy(data, (int)(blockStart + from - offset), block, from, to - from);
+            }
+            
+            String hash = sha256(block);
+            if (hash.equals(oldHash)) {
+                continue;
+            }
+            
+            byte[] stored = block;
+            short codec = Blob.CODEC_NONE;
+            if (compress) {
+                byte[] packed = Zstd.compress(block, level);
+                if (packed.length < block.length) {
+                    stored = packed;
+                    codec = Blob.CODEC_ZSTD;
+                }
+            }
+            blobRepository.addRef(token, hash, codec, block.length, stored);
+            refRepository.upsert(token, ino, blockNo, hash);
+            cache.put(new BlockCache.Key(token, hash), block);
+            
+            if (oldHash != null) {
+                Integer remaining = blobRepository.dropRef(token, oldHash);
+                if (remaining != null && remaining <= 0) {
+                    blobRepository.deleteUnreferenced(token, List.of(oldHash));
+                }
+            }
+        }
+    }
+    
+    @Override
+    public void streamRange(String token, long ino, long start, long end, OutputStream out) throws IOException {
+        if (end <= start) {
+            return;
+        }
+        
+        List<Object[]> refs = refRepository.findRefs(token, ino, start / BLOCK_SIZE, (end - 1) / BLOCK_SIZE);
+        long position = start;
+        for (int i = 0; i < refs.size(); i += READ_BATCH) {
+            List<Object[]> batch = refs.subList(i, Math.min(i + READ_BATCH, refs.size()));
+            List<String> hashes = new ArrayList<>(batch.size());
+            for (Object[] ref : batch) {
+                hashes.add((String) ref[1]);
+            }
+            Map<String, byte[]> blocks = contents(token, hashes);
+            
+            for (Object[] ref : batch) {
+                byte[] block = blocks.get((String) ref[1]);
+                if (block == null) {
+                    throw new IOException("blob " + ref[1] + " of inode " + ino + " is missing");
+                }
+                long blockStart = ((Number) ref[0]).longValue() * BLOCK_SIZE;
+                long readStart = Math.max(blockStart, start);
+                long readEnd = Math.min(blockStart + block.length, end);
+                if (readEnd > readStart) {
+                    Holes.write(out, readStart - position);
+                    out.write(block, (int)(readStart - blockStart), (int)(readEnd - readStart));
+                    position = readEnd;
+                }
+            }
+        }
+        Holes.write(out, end - position);
+    }
+    
+    @Override
+    public void delete(String token, long ino) {
+        dropReferences(token, blobRepository.dropInodeRefs(token, ino));
+    }
+    
+    // Deletes the blobs among (hash, refcount) rows that lost their last reference
+    private void dropReferences(String token, List<Object[]> dropped) {
+        List<String> unreferenced = new ArrayList<>();
+        for (Object[] row : dropped) {
+            if (((Number) row[1]).intValue() <= 0) {
+                unreferenced.add((String) row[0]);
+            }
+        }
+        if (!unreferenced.isEmpty()) {
+            blobRepository.deleteUnreferenced(token, unreferenced);
+        }
+    }
+    
+    /**
+     * Whole blocks are copied by adding references to the source's blobs.
+     */
+    @Override
+    public void copy(String token, long srcIno, long srcOffset,
+                     long dstIno, long dstOffset, long length) throws IOException {
+        RangeCopy.blocks(this, token, srcIno, srcOffset, dstIno, dstOffset, length,
+            (srcBlock, dstBlock, count) -> {
+                dropReferences(token, blobRepository.dropBlockRefs(token, dstIno, dstBlock, dstBlock + count - 1));
+                blobRepository.shareRefs(token, srcIno, srcBlock, count, dstIno, dstBlock - srcBlock);
+            });
+    }
+    
+    /**
+     * Reports the token's dedup and compression ratios: logical bytes are
+     * what the files hold, unique bytes what is left after dedup, stored
+     * bytes what is on disk after compression.
+     */
+    @Override
+    public void appendStats(String token, StringBuilder out) {
+        cache.appendStats(out);
+        if (token == null) {
+            return;
+        }
+        
+        long logical = refRepository.logicalBytes(token);
+        Object[] unique = blobRepository.uniqueBytes(token).get(0);
+        long blobs = ((Number) unique[0]).longValue();
+        long uniqueBytes = ((Number) unique[1]).longValue();
+        long storedBytes = ((Number) unique[2]).longValue();
+        
+        out.append("dedup_blobs=").append(blobs).append("\n");
+        out.append("dedup_logical_bytes=").append(logical).append("\n");
+        out.append("dedup_unique_bytes=").append(uniqueBytes).append("\n");
+        out.append("dedup_stored_bytes=").append(storedBytes).append("\n");
+        out.append("dedup_ratio=").append(ratio(logical, uniqueBytes)).append("\n");
+        out.append("compression_ratio=").append(ratio(uniqueBytes, storedBytes)).append("\n");
+    }
+    
+    private static String ratio(long numerator, long denominator) {
+        return String.format("%.3f", denominator == 0 ? 1.0 : (double) numerator / denominator);
+    }
+    
+    /**
+     * Decompressed contents of the given blobs, from the cache where
+     * possible and from one query for the rest.
+     */
+    private Map<String, byte[]> contents(String token, List<String> hashes) throws IOException {
+        Map<String, byte[]> result = new HashMap<>();
+        Set<String> missing = new HashSet<>();
+        for (String hash : hashes) {
+            byte[] block = cache.get(new BlockCache.Key(token, hash));
+            if (block != null) {
+                result.put(hash, block);
+            } else {
+                missing.add(hash);
+            }
+        }
+        if (missing.isEmpty()) {
+            return result;
+        }
+        
+        for (Object[] row : blobRepository.findContents(token, missing)) {
+            String hash = (String) row[0];
+            short codec = ((Number) row[1]).shortValue();
+            int rawLength = ((Number) row[2]).intValue();
+            byte[] data = (byte[]) row[3];
+            
+            byte[] block;
+            if (codec == Blob.CODEC_ZSTD) {
+                block = Zstd.decompress(data, rawLength);
+            } else if (codec == Blob.CODEC_NONE) {
+                block = data;
+            } else {
+                throw new IOException("blob " + hash + " has unknown codec " + codec);
+            }
+            result.put(hash, block);
+            cache.put(new BlockCache.Key(token, hash), block);
+        }
+        return result;
+    }
+    
+    private static String sha256(byte[] block) {
+        try {
+            return HexFormat.of().formatHex(MessageDigest.getInstance("SHA-256").digest(block));
+        } catch (NoSuchAlgorithmException e) {
+            throw new IllegalStateException(e);
+        }
+    }
+}
@@ -0,0 +1,19 @@
+package com.vtfs.storage;
+
+import java.io.IOException;
+import java.io.OutputStream;
+
+// Missing blocks and gaps past the end of short blocks read as zeros
+final class Holes {
+    private static final byte[] ZEROS = new byte[8192];
+    
+    private Holes() {}
+    
+    static void write(OutputStream out, long count) throws IOException {
+        while (count > 0) {
+            int n = (int) Math.min(count, ZEROS.length);
+            out.write(ZEROS, 0, n);
+            count -= n;
+        }
+    }
+}
@@ -0,0 +1,120 @@
+package com.vtfs.storage;
+
+import com.vtfs.model.FileData;
+import com.vtfs.repository.FileDataRepository;
+import jakarta.persistence.EntityManager;
+import jakarta.persistence.PersistenceContext;
+import org.springframework.beans.factory.annotation.Autowired;
+import org.springframework.boot.autoconfigure.condition.ConditionalOnProperty;
+import org.springframework.stereotype.Component;
+import org.springframework.transaction.PlatformTransactionManager;
+import org.springframework.transaction.support.TransactionTemplate;
+
+import java.io.IOException;
+import java.io.OutputStream;
+import java.io.UncheckedIOException;
+import java.util.Iterator;
+import java.util.stream.Stream;
+
+/**
+ * Keeps blocks as BYTEA rows in vtfs_file_blocks. The default backend.
+ */
+@Component
+@ConditionalOnProperty(name = "vtfs.storage.backend", havingValue = "postgres", matchIfMissing = true)
+public class PostgresBlockStore implements BlockStore {
+    @Autowired
+    private FileDataRepository dataRepository;
+    
+    @PersistenceContext
+    private EntityManager entityManager;
+    
+    private final TransactionTemplate readOnlyTransaction;
+    
+    public PostgresBlockStore(PlatformTransactionManager transactionManager) {
+        this.readOnlyTransaction = new TransactionTemplate(transactionManager);
+        this.readOnlyTransaction.setReadOnly(true);
+    }
+    
+    /**
+     * Writes data into the blocks it overlaps. Each block is patched in
+     * place by the database, so bytes outside the range survive without the
+     * block being read here first.
+     */
+    @Override
+    public void write(String token, long ino, long offset, byte[] data) {
+        long writeEnd = offset + data.length;
+        long firstBlock = offset / BLOCK_SIZE;
+        long lastBlock = (writeEnd - 1) / BLOCK_SIZE;
+        
+        for (long blockNo = firstBlock; blockNo <= lastBlock; blockNo++) {
+            long blockStart = blockNo * BLOCK_SIZE;
+            int from = (int) Math.max(offset - blockStart, 0);
+            int to = (int) Math.min(writeEnd - blockStart, BLOCK_SIZE);
+            
+            byte[] patch = new byte[to - from];
+            System.arraycopy(data, (int)(blockStart + from - offset), patch, 0, patch.length);
+            byte[] fresh = new byte[to];
+            System.arraycopy(patch, 0, fresh, from, patch.length);
+            
+            dataRepository.upsertRange(token, ino, blockNo, from, patch, fresh);
+        }
+    }
+    
+    /**
+     * Pulls blocks through a JDBC cursor so only a few of them are on the
+     * heap at a time.
+     */
+    @Override
+    public void streamRange(String token, long ino, long start, long end, OutputStream out) throws IOException {
+        if (end <= start) {
+            return;
+        }
+        
+        try {
+            // Runs after the controller returned, so it needs its own transaction
+            readOnlyTransaction.executeWithoutResult(status -> {
+                long position = start;
+                try (Stream<FileData> blocks = dataRepository.streamBlocks(
+                        token, ino, start / BLOCK_SIZE, (end - 1) / BLOCK_SIZE)) {
+                    Iterator<FileData> it = blocks.iterator();
+                    while (it.hasNext()) {
+                        FileData block = it.next();
+                        long blockStart = block.getOffset();
+                        long readStart = Math.max(blockStart, start);
+                        long readEnd = Math.min(blockStart + block.getData().length, end);
+                        if (readEnd > readStart) {
+                            Holes.write(out, readStart - position);
+                            out.write(block.getData(), (int)(readStart - blockStart), (int)(readEnd - readStart));
+                            position = readEnd;
+                        }
+                        entityManager.detach(block);
+                    }
+                    Holes.write(out, end - position);
+                } catch (IOException e) {
+                    throw new UncheckedIOException(e);
+                }
+            });
+        } catch (UncheckedIOException e) {
+            throw e.getCause();
+        }
+    }
+    
+    @Override
+    public void delete(String token, long ino) {
+        dataRepository.deleteByTokenAndIno(token, ino);
+    }
+    
+    /**
+     * Whole blocks are copied row to row by the database, so their bytes
+     * never reach the server's heap.
+     */
+    @Override
+    public void copy(String token, long srcIno, long srcOffset,
+                     long dstIno, long dstOffset, long length) throws IOException {
+        RangeCopy.blocks(this, token, srcIno, srcOffset, dstIno, dstOffset, length,
+            (srcBlock, dstBlock, count) -> {
+                dataRepository.deleteBlocks(token, dstIno, dstBlock, dstBlock + count - 1);
+                dataRepository.copyBlocks(token, srcIno, srcBlock, count, dstIno, dstBlock - srcBlock);
+            });
+    }
+}
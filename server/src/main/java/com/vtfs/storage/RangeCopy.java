@@ -0,0 +1,56 @@
+package com.vtfs.storage;
+
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+
+/**
+ * Copies between two files of a token. Whole blocks that line up in both
+ * files can be handed to the backend to share or copy without leaving the
+ * database or disk; the partial blocks at the edges, and any range whose
+ * offsets are not block-aligned relative to each other, are read and
+ * written like ordinary data.
+ */
+final class RangeCopy {
+    // Bytes moved per read and write when copying through the heap
+    private static final int CHUNK = BlockStore.BLOCK_SIZE * 16;
+    
+    /**
+     * Makes blocks [dstBlock, dstBlock + count) of the destination hold what
+     * the source has at [srcBlock, srcBlock + count), holes included.
+     */
+    interface BlockCopier {
+        void copyBlocks(long srcBlock, long dstBlock, long count) throws IOException;
+    }
+    
+    private RangeCopy() {}
+    
+    static void bytes(BlockStore store, String token, long srcIno, long srcOffset,
+                      long dstIno, long dstOffset, long length) throws IOException {
+        for (long done = 0; done < length; ) {
+            int n = (int) Math.min(CHUNK, length - done);
+            ByteArrayOutputStream buffer = new ByteArrayOutputStream(n);
+            store.streamRange(token, srcIno, srcOffset + done, srcOffset + done + n, buffer);
+            store.write(token, dstIno, dstOffset + done, buffer.toByteArray());
+            done += n;
+        }
+    }
+    
+    static void blocks(BlockStore store, String token, long srcIno, long srcOffset,
+                       long dstIno, long dstOffset, long length, BlockCopier copier) throws IOException {
+        int blockSize = BlockStore.BLOCK_SIZE;
+        long dstEnd = dstOffset + length;
+        long firstBlock = (dstOffset + blockSize - 1) / blockSize;
+        long endBlock = dstEnd / blockSize;
+        if ((srcOffset - dstOffset) % blockSize != 0 || firstBlock >= endBlock) {
+            bytes(store, token, srcIno, srcOffset, dstIno, dstOffset, length);
+            return;
+        }
+        
+        long shift = (srcOffset - dstOffset) / blockSize;
+        long head = firstBlock * blockSize - dstOffset;
+        long tailStart = endBlock * blockSize;
+        bytes(store, token, srcIno, srcOffset, dstIno, dstOffset, head);
+        copier.copyBlocks(firstBlock + shift, firstBlock, endBlock - firstBlock);
+        bytes(store, token, srcIno, srcOffset + (tailStart - dstOffset), dstIno, tailStart, dstEnd - tailStart);
+    }
+}
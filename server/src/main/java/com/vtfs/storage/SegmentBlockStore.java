@@ -0,0 +1,446 @@
+package com.vtfs.storage;
+
+import com.vtfs.model.BlockExtent;
+import com.vtfs.repository.BlockExtentRepository;
+import jakarta.annotation.PreDestroy;
+import org.springframework.beans.factory.annotation.Autowired;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.boot.autoconfigure.condition.ConditionalOnProperty;
+import org.springframework.stereotype.Component;
+
+import java.io.EOFException;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.channels.Channels;
+import java.nio.channels.FileChannel;
+import java.nio.channels.WritableByteChannel;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.DirectoryStream;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.HashMap;
+import java.util.HexFormat;
+import java.util.List;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+
+/**
+ * Keeps file blocks in append-only segment files on the local disk, one
+ * directory per token, with the (segment, offset, length) of every live
+ * block indexed in vtfs_block_extents. Rewriting a block appends a new copy
+ * and repoints the index; the old copy becomes dead space.
+ *
+ * Layout: {dir}/{sha256(token)}/{segment_no}.seg, plus a TOKEN file naming
+ * the token the directory belongs to.
+ */
+@Component
+@ConditionalOnProperty(name = "vtfs.storage.backend", havingValue = "segment")
+public class SegmentBlockStore implements BlockStore {
+    record Extent(long blockNo, long segmentNo, long segmentOffset, int length) {}
+    
+    /**
+     * Sizes of the token's segment files and the number of the one being
+     * appended to, which is never compacted.
+     */
+    record SegmentFiles(long active, Map<Long, Long> sizes) {}
+    
+    private record RetiredSegment(String token, long segmentNo, long retiredAt) {}
+    
+    /**
+     * Segment files of one token. Appends are serialized on this object;
+     * reads use positional I/O on the shared read channels and need no lock.
+     */
+    private static final class TokenSegments {
+        final Path dir;
+        long segmentNo;
+        long position;
+        FileChannel appendChannel;
+        final Map<Long, FileChannel> readChannels = new ConcurrentHashMap<>();
+        
+        TokenSegments(Path dir) {
+            this.dir = dir;
+        }
+    }
+    
+    @Autowired
+    private BlockExtentRepository extentRepository;
+    
+    private final Path root;
+    private final long maxSegmentSize;
+    private final boolean fsync;
+    private final Map<String, TokenSegments> tokens = new ConcurrentHashMap<>();
+    // Emptied segments are deleted only after in-flight reads had time to finish
+    private final List<RetiredSegment> retired = new ArrayList<>();
+    
+    public SegmentBlockStore(@Value("${vtfs.storage.segment.dir:data/segments}") String dir,
+                             @Value("${vtfs.storage.segment.max-size:268435456}") long maxSegmentSize,
+                             @Value("${vtfs.storage.segment.fsync:true}") boolean fsync) throws IOException {
+        this.root = Paths.get(dir);
+        this.maxSegmentSize = maxSegmentSize;
+        this.fsync = fsync;
+        Files.createDirectories(root);
+    }
+    
+    /**
+     * Appends a new copy of every block the write touches and repoints the
+     * index at it. Partially covered blocks are read back from their current
+     * segment and patched first.
+     */
+    @Override
+    public void write(String token, long ino, long offset, byte[] data) throws IOException {
+        long writeEnd = offset + data.length;
+        long firstBlock = offset / BLOCK_SIZE;
+        long lastBlock = (writeEnd - 1) / BLOCK_SIZE;
+        TokenSegments segments = segments(token);
+        
+        Map<Long, BlockExtent> partial = new HashMap<>();
+        boolean firstPartial = offset % BLOCK_SIZE != 0;
+        boolean lastPartial = writeEnd % BLOCK_SIZE != 0;
+        if (firstPartial || lastPartial) {
+            for (BlockExtent extent : extentRepository.findExtents(token, ino,
+                    firstPartial ? firstBlock : lastBlock, lastPartial ? lastBlock : firstBlock)) {
+                partial.put(extent.getBlockNo(), extent);
+            }
+        }
+        
+        List<ByteBuffer> blocks = new ArrayList<>();
+        for (long blockNo = firstBlock; blockNo <= lastBlock; blockNo++) {
+            long blockStart = blockNo * BLOCK_SIZE;
+            int from = (int) Math.max(offset - blockStart, 0);
+            int to = (int) Math.min(writeEnd - blockStart, BLOCK_SIZE);
+            
+            BlockExtent old = partial.get(blockNo);
+            if (old == null && from == 0) {
+                // Nothing to preserve: append straight out of the request body
+                blocks.add(ByteBuffer.wrap(data, (int)(blockStart - offset), to));
+                continue;
+            }
+            byte[] current = old != null ? readExtent(segments, old) : new byte[0];
+            byte[] updated = Arrays.copyOf(current, Math.max(current.length, to));
+            System.arraycopy(data, (int)(blockStart + from - offset), updated, from, to - from);
+            blocks.add(ByteBuffer.wrap(updated));
+        }
+        
+        List<Extent> written = new ArrayList<>(blocks.size());
+        synchronized (segments) {
+            long blockNo = firstBlock;
+            for (ByteBuffer block : blocks) {
+                written.add(append(segments, blockNo++, block));
+            }
+            if (fsync) {
+                segments.appendChannel.force(false);
+            }
+        }
+        
+        // Index rows commit with the caller's transaction; on rollback the
+        // appended copies are simply dead space
+        for (Extent extent : written) {
+            extentRepository.upsert(token, ino, extent.blockNo(), extent.segmentNo(),
+                                    extent.segmentOffset(), extent.length());
+        }
+    }
+    
+    /**
+     * Copies the range out of the segment files with FileChannel.transferTo,
+     * merging blocks that were written back to back into a single transfer.
+     */
+    @Override
+    public void streamRange(String token, long ino, long start, long end, OutputStream out) throws IOException {
+        if (end <= start) {
+            return;
+        }
+        
+        TokenSegments segments = segments(token);
+        List<BlockExtent> extents = extentRepository.findExtents(
+            token, ino, start / BLOCK_SIZE, (end - 1) / BLOCK_SIZE);
+        WritableByteChannel target = Channels.newChannel(out);
+        
+        long position = start;
+        // Pending run of segment bytes that continue the output contiguously
+        long runSegment = -1;
+        long runOffset = 0;
+        long runLength = 0;
+        for (BlockExtent extent : extents) {
+            long blockStart = extent.getBlockNo() * BLOCK_SIZE;
+            long readStart = Math.max(blockStart, start);
+            long readEnd = Math.min(blockStart + extent.getLength(), end);
+            if (readEnd <= readStart) {
+                continue;
+            }
+            long segmentOffset = extent.getSegmentOffset() + (readStart - blockStart);
+            
+            boolean extendsRun = runLength > 0 && readStart == position
+                && extent.getSegmentNo() == runSegment && segmentOffset == runOffset + runLength;
+            if (!extendsRun) {
+                transfer(segments, runSegment, runOffset, runLength, target);
+                runLength = 0;
+                Holes.write(out, readStart - position);
+                runSegment = extent.getSegmentNo();
+                runOffset = segmentOffset;
+            }
+            runLength += readEnd - readStart;
+            position = readEnd;
+        }
+        transfer(segments, runSegment, runOffset, runLength, target);
+        Holes.write(out, end - position);
+    }
+    
+    @Override
+    public void delete(String token, long ino) {
+        extentRepository.deleteByTokenAndIno(token, ino);
+    }
+    
+    /**
+     * Whole blocks are copied by pointing the destination at the source's
+     * extents; nothing is appended. Compaction later relocates each file's
+     * extents on its own, which gives the two files separate copies again.
+     */
+    @Override
+    public void copy(String token, long srcIno, long srcOffset,
+                     long dstIno, long dstOffset, long length) throws IOException {
+        RangeCopy.blocks(this, token, srcIno, srcOffset, dstIno, dstOffset, length,
+            (srcBlock, dstBlock, count) -> {
+                extentRepository.deleteExtents(token, dstIno, dstBlock, dstBlock + count - 1);
+                extentRepository.shareExtents(token, srcIno, srcBlock, count, dstIno, dstBlock - srcBlock);
+            });
+    }
+    
+    /**
+     * Tokens with a segment directory, including ones not used since startup.
+     */
+    List<String> tokensOnDisk() throws IOException {
+        List<String> result = new ArrayList<>();
+        try (DirectoryStream<Path> dirs = Files.newDirectoryStream(root)) {
+            for (Path dir : dirs) {
+                Path tokenFile = dir.resolve("TOKEN");
+                if (Files.isRegularFile(tokenFile)) {
+                    result.add(Files.readString(tokenFile, StandardCharsets.UTF_8).strip());
+                }
+            }
+        }
+        return result;
+    }
+    
+    SegmentFiles segmentFiles(String token) throws IOException {
+        TokenSegments segments = segments(token);
+        long active;
+        synchronized (segments) {
+            active = segments.segmentNo;
+        }
+        
+        Map<Long, Long> sizes = new HashMap<>();
+        try (DirectoryStream<Path> files = Files.newDirectoryStream(segments.dir, "*.seg")) {
+            for (Path file : files) {
+                sizes.put(segmentNumber(file), Files.size(file));
+            }
+        }
+        return new SegmentFiles(active, sizes);
+    }
+    
+    /**
+     * Appends a copy of the block to the active segment. The caller must
+     * sync() before pointing the index at the copy.
+     */
+    Extent copy(String token, BlockExtent extent) throws IOException {
+        TokenSegments segments = segments(token);
+        ByteBuffer block = ByteBuffer.wrap(readExtent(segments, extent));
+        synchronized (segments) {
+            return append(segments, extent.getBlockNo(), block);
+        }
+    }
+    
+    void sync(String token) throws IOException {
+        TokenSegments segments = segments(token);
+        synchronized (segments) {
+            segments.appendChannel.force(false);
+        }
+    }
+    
+    /**
+     * Schedules a segment no live extent points at for deletion.
+     */
+    void retire(String token, long segmentNo) {
+        synchronized (retired) {
+            boolean known = retired.stream()
+                .anyMatch(segment -> segment.token().equals(token) && segment.segmentNo() == segmentNo);
+            if (!known) {
+                retired.add(new RetiredSegment(token, segmentNo, System.currentTimeMillis()));
+            }
+        }
+    }
+    
+    /**
+     * Deletes segments retired at least delayMs ago; returns how many. A
+     * segment that gained an extent meanwhile (a write that appended to it
+     * just before it rolled over and committed late) is kept.
+     */
+    int deleteRetired(long delayMs) throws IOException {
+        List<RetiredSegment> due = new ArrayList<>();
+        long cutoff = System.currentTimeMillis() - delayMs;
+        synchronized (retired) {
+            retired.removeIf(segment -> segment.retiredAt() <= cutoff && due.add(segment));
+        }
+        
+        int deleted = 0;
+        for (RetiredSegment segment : due) {
+            if (extentRepository.existsByTokenAndSegmentNo(segment.token(), segment.segmentNo())) {
+                continue;
+            }
+            TokenSegments segments = segments(segment.token());
+            closeQuietly(segments.readChannels.remove(segment.segmentNo()));
+            Files.deleteIfExists(segmentPath(segments, segment.segmentNo()));
+            deleted++;
+        }
+        return deleted;
+    }
+    
+    @PreDestroy
+    public void close() {
+        for (TokenSegments segments : tokens.values()) {
+            synchronized (segments) {
+                closeQuietly(segments.appendChannel);
+                segments.readChannels.values().forEach(SegmentBlockStore::closeQuietly);
+            }
+        }
+    }
+    
+    private TokenSegments segments(String token) throws IOException {
+        TokenSegments segments = tokens.get(token);
+        if (segments != null) {
+            return segments;
+        }
+        
+        synchronized (tokens) {
+            segments = tokens.get(token);
+            if (segments == null) {
+                segments = open(token);
+                tokens.put(token, segments);
+            }
+            return segments;
+        }
+    }
+    
+    // Resumes appending at the end of the newest segment of the token
+    private TokenSegments open(String token) throws IOException {
+        Path dir = root.resolve(directoryName(token));
+        Files.createDirectories(dir);
+        Path tokenFile = dir.resolve("TOKEN");
+        if (!Files.exists(tokenFile)) {
+            Files.writeString(tokenFile, token + "\n", StandardCharsets.UTF_8);
+        }
+        
+        TokenSegments segments = new TokenSegments(dir);
+        try (DirectoryStream<Path> files = Files.newDirectoryStream(dir, "*.seg")) {
+            for (Path file : files) {
+                segments.segmentNo = Math.max(segments.segmentNo, segmentNumber(file));
+            }
+        }
+        segments.appendChannel = openForAppend(segments);
+        segments.position = segments.appendChannel.size();
+        return segments;
+    }
+    
+    private Extent append(TokenSegments segments, long blockNo, ByteBuffer block) throws IOException {
+        int length = block.remaining();
+        if (segments.position > 0 && segments.position + length > maxSegmentSize) {
+            if (fsync) {
+                segments.appendChannel.force(false);
+            }
+            segments.appendChannel.close();
+            segments.segmentNo++;
+            segments.appendChannel = openForAppend(segments);
+            segments.position = 0;
+        }
+        
+        long offset = segments.position;
+        while (block.hasRemaining()) {
+            segments.position += segments.appendChannel.write(block, segments.position);
+        }
+        return new Extent(blockNo, segments.segmentNo, offset, length);
+    }
+    
+    private FileChannel openForAppend(TokenSegments segments) throws IOException {
+        return FileChannel.open(segmentPath(segments, segments.segmentNo),
+                                StandardOpenOption.CREATE, StandardOpenOption.WRITE);
+    }
+    
+    private FileChannel readChannel(TokenSegments segments, long segmentNo) throws IOException {
+        FileChannel channel = segments.readChannels.get(segmentNo);
+        if (channel == null) {
+            FileChannel opened = FileChannel.open(segmentPath(segments, segmentNo), StandardOpenOption.READ);
+            channel = segments.readChannels.putIfAbsent(segmentNo, opened);
+            if (channel == null) {
+                channel = opened;
+            } else {
+                opened.close();
+            }
+        }
+        return channel;
+    }
+    
+    private byte[] readExtent(TokenSegments segments, BlockExtent extent) throws IOException {
+        FileChannel channel = readChannel(segments, extent.getSegmentNo());
+        ByteBuffer buffer = ByteBuffer.allocate(extent.getLength());
+        long position = extent.getSegmentOffset();
+        while (buffer.hasRemaining()) {
+            int n = channel.read(buffer, position);
+            if (n < 0) {
+                throw new EOFException("segment " + extent.getSegmentNo() + " ends inside a block");
+            }
+            position += n;
+        }
+        return buffer.array();
+    }
+    
+    private void transfer(TokenSegments segments, long segmentNo, long offset, long length,
+                          WritableByteChannel target) throws IOException {
+        if (length <= 0) {
+            return;
+        }
+        FileChannel channel = readChannel(segments, segmentNo);
+        while (length > 0) {
+            long n = channel.transferTo(offset, length, target);
+            if (n <= 0) {
+                throw new EOFException("segment " + segmentNo + " ends inside a block");
+            }
+            offset += n;
+            length -= n;
+        }
+    }
+    
+    private static Path segmentPath(TokenSegments segments, long segmentNo) {
+        return segments.dir.resolve(String.format("%010d.seg", segmentNo));
+    }
+    
+    private static long segmentNumber(Path file) {
+        String name = file.getFileName().toString();
+        return Long.parseLong(name.substring(0, name.length() - ".seg".length()));
+    }
+    
+    // Tokens are arbitrary strings; hashing keeps directory names safe
+    private static String directoryName(String token) {
+        try {
+            byte[] digest = MessageDigest.getInstance("SHA-256").digest(token.getBytes(StandardCharsets.UTF_8));
+            return HexFormat.of().formatHex(digest);
+        } catch (NoSuchAlgorithmException e) {
+            throw new IllegalStateException(e);
+        }
+    }
+    
+    private static void closeQuietly(FileChannel channel) {
+        try {
+            if (channel != null) {
+                channel.close();
+            }
+        } catch (IOException e) {
+            // Continue anyway
+        }
+    }
+}
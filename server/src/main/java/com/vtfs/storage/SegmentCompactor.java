@@ -0,0 +1,236 @@
+package com.vtfs.storage;
+
+import com.vtfs.model.BlockExtent;
+import com.vtfs.repository.BlockExtentRepository;
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+import org.springframework.beans.factory.annotation.Autowired;
+import org.springframework.beans.factory.annotation.Value;
+import org.springframework.boot.autoconfigure.condition.ConditionalOnProperty;
+import org.springframework.scheduling.annotation.Scheduled;
+import org.springframework.stereotype.Component;
+import org.springframework.transaction.PlatformTransactionManager;
+import org.springframework.transaction.support.TransactionTemplate;
+
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.Comparator;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+
+/**
+ * Reclaims dead space in segment files and defragments files whose blocks
+ * are scattered, so reads keep turning into a few large transfers.
+ *
+ * Each run picks, per token, the closed segments with the lowest share of
+ * live bytes and copies their live blocks (in file order) to the active
+ * segment, then the files whose blocks form the most separate runs. Work
+ * per run is capped by vtfs.compaction.max-bytes-per-run and paced to
+ * vtfs.compaction.max-bytes-per-second, so a large backlog is worked off
+ * over several runs.
+ */
+@Component
+@ConditionalOnProperty(name = "vtfs.storage.backend", havingValue = "segment")
+public class SegmentCompactor {
+    private static final Logger log = LoggerFactory.getLogger(SegmentCompactor.class);
+    // Blocks copied between two syncs and index updates
+    private static final int BATCH_BLOCKS = 64;
+    
+    // Fragmentation of all tokens as seen by one run
+    private static final class Totals {
+        long segments;
+        long segmentBytes;
+        long liveBytes;
+        long liveBlocks;
+        long fragmentedInodes;
+        long fragments;
+    }
+    
+    @Autowired
+    private SegmentBlockStore store;
+    
+    @Autowired
+    private BlockExtentRepository extentRepository;
+    
+    private final TransactionTemplate transaction;
+    private final double minLiveRatio;
+    private final int defragMinBlocks;
+    private final double defragMaxRunRatio;
+    private final long maxBytesPerRun;
+    private final long maxBytesPerSecond;
+    private final long retireDelayMs;
+    
+    private volatile Totals lastTotals = new Totals();
+    private volatile long lastRunMillis;
+    
+    // Totals since startup
+    private volatile long runs;
+    private volatile long bytesRelocated;
+    private volatile long segmentsDeleted;
+    
+    // Budget and pacing of the current run
+    private long budget;
+    private long runStarted;
+    private long runBytes;
+    
+    public SegmentCompactor(PlatformTransactionManager transactionManager,
+                            @Value("${vtfs.compaction.min-live-ratio:0.5}") double minLiveRatio,
+                            @Value("${vtfs.compaction.defrag-min-blocks:8}") int defragMinBlocks,
+                            @Value("${vtfs.compaction.defrag-max-run-ratio:0.25}") double defragMaxRunRatio,
+                            @Value("${vtfs.compaction.max-bytes-per-run:268435456}") long maxBytesPerRun,
+                            @Value("${vtfs.compaction.max-bytes-per-second:33554432}") long maxBytesPerSecond,
+                            @Value("${vtfs.compaction.retire-delay-ms:60000}") long retireDelayMs) {
+        this.transaction = new TransactionTemplate(transactionManager);
+        this.minLiveRatio = minLiveRatio;
+        this.defragMinBlocks = defragMinBlocks;
+        this.defragMaxRunRatio = defragMaxRunRatio;
+        this.maxBytesPerRun = maxBytesPerRun;
+        this.maxBytesPerSecond = maxBytesPerSecond;
+        this.retireDelayMs = retireDelayMs;
+    }
+    
+    @Scheduled(initialDelayString = "${vtfs.compaction.interval-ms:60000}",
+               fixedDelayString = "${vtfs.compaction.interval-ms:60000}")
+    public void run() {
+        runStarted = System.nanoTime();
+        runBytes = 0;
+        budget = maxBytesPerRun;
+        
+        Totals totals = new Totals();
+        try {
+            for (String token : store.tokensOnDisk()) {
+                compactToken(token, totals);
+            }
+            segmentsDeleted += store.deleteRetired(retireDelayMs);
+        } catch (IOException | RuntimeException e) {
+            log.warn("Segment compaction stopped early", e);
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            return;
+        }
+        
+        lastTotals = totals;
+        runs++;
+        lastRunMillis = (System.nanoTime() - runStarted) / 1_000_000;
+    }
+    
+    private void compactToken(String token, Totals totals) throws IOException, InterruptedException {
+        SegmentBlockStore.SegmentFiles files = store.segmentFiles(token);
+        Map<Long, Long> live = new HashMap<>();
+        for (Object[] row : extentRepository.liveBytesBySegment(token)) {
+            live.put(((Number) row[0]).longValue(), ((Number) row[1]).longValue());
+            totals.liveBlocks += ((Number) row[2]).longValue();
+        }
+        
+        List<Long> candidates = new ArrayList<>();
+        for (Map.Entry<Long, Long> file : files.sizes().entrySet()) {
+            long segmentNo = file.getKey();
+            totals.segments++;
+            totals.segmentBytes += file.getValue();
+            totals.liveBytes += live.getOrDefault(segmentNo, 0L);
+            if (segmentNo != files.active() && liveRatio(live, file) < minLiveRatio) {
+                candidates.add(segmentNo);
+            }
+        }
+        
+        // Emptiest first: they free the most space per byte copied
+        candidates.sort(Comparator.comparingDouble(
+            segmentNo -> liveRatio(live, Map.entry(segmentNo, files.sizes().get(segmentNo)))));
+        for (long segmentNo : candidates) {
+            if (budget <= 0) {
+                break;
+            }
+            relocate(token, extentRepository.findByTokenAndSegmentNoOrderByInoAscBlockNoAsc(token, segmentNo));
+            if (!extentRepository.existsByTokenAndSegmentNo(token, segmentNo)) {
+                store.retire(token, segmentNo);
+            }
+        }
+        
+        List<Object[]> fragmented = extentRepository.fragmentedInodes(token);
+        totals.fragmentedInodes += fragmented.size();
+        for (Object[] row : fragmented) {
+            totals.fragments += ((Number) row[2]).longValue();
+        }
+        
+        fragmented.sort(Comparator.comparingLong(row -> -((Number) row[2]).longValue()));
+        for (Object[] row : fragmented) {
+            long blocks = ((Number) row[1]).longValue();
+            long pieces = ((Number) row[2]).longValue();
+            if (budget <= 0) {
+                break;
+            }
+            if (blocks < defragMinBlocks || pieces <= blocks * defragMaxRunRatio) {
+                continue;
+            }
+            relocate(token, extentRepository.findByTokenAndInoOrderByBlockNo(token, ((Number) row[0]).longValue()));
+        }
+    }
+    
+    private static double liveRatio(Map<Long, Long> live, Map.Entry<Long, Long> file) {
+        long size = file.getValue();
+        return size == 0 ? 0 : (double) live.getOrDefault(file.getKey(), 0L) / size;
+    }
+    
+    /**
+     * Copies the extents to the active segment in the given order and
+     * repoints the index at the copies in batches, syncing before each batch
+     * so the index never points at data that is not on disk.
+     */
+    private void relocate(String token, List<BlockExtent> extents) throws IOException, InterruptedException {
+        for (int i = 0; i < extents.size() && budget > 0; i += BATCH_BLOCKS) {
+            List<BlockExtent> batch = extents.subList(i, Math.min(i + BATCH_BLOCKS, extents.size()));
+            List<SegmentBlockStore.Extent> copies = new ArrayList<>(batch.size());
+            long bytes = 0;
+            for (BlockExtent extent : batch) {
+                copies.add(store.copy(token, extent));
+                bytes += extent.getLength();
+            }
+            store.sync(token);
+            
+            transaction.executeWithoutResult(status -> {
+                for (int j = 0; j < batch.size(); j++) {
+                    BlockExtent old = batch.get(j);
+                    SegmentBlockStore.Extent copy = copies.get(j);
+                    extentRepository.relocate(token, old.getIno(), old.getBlockNo(),
+                                              old.getSegmentNo(), old.getSegmentOffset(),
+                                              copy.segmentNo(), copy.segmentOffset());
+                }
+            });
+            
+            bytesRelocated += bytes;
+            budget -= bytes;
+            throttle(bytes);
+        }
+    }
+    
+    // Sleeps until the run's average rate is back under the limit
+    private void throttle(long bytes) throws InterruptedException {
+        runBytes += bytes;
+        if (maxBytesPerSecond <= 0) {
+            return;
+        }
+        long dueNanos = runBytes * 1_000_000_000L / maxBytesPerSecond;
+        long aheadMillis = (dueNanos - (System.nanoTime() - runStarted)) / 1_000_000;
+        if (aheadMillis > 0) {
+            Thread.sleep(aheadMillis);
+        }
+    }
+    
+    public void appendStats(StringBuilder out) {
+        Totals totals = lastTotals;
+        long dead = Math.max(totals.segmentBytes - totals.liveBytes, 0);
+        out.append("segments=").append(totals.segments).append("\n");
+        out.append("segment_bytes=").append(totals.segmentBytes).append("\n");
+        out.append("segment_live_bytes=").append(totals.liveBytes).append("\n");
+        out.append("segment_dead_ratio=").append(totals.segmentBytes == 0 ? "0.000"
+            : String.format("%.3f", (double) dead / totals.segmentBytes)).append("\n");
+        out.append("live_blocks=").append(totals.liveBlocks).append("\n");
+        out.append("fragmented_inodes=").append(totals.fragmentedInodes).append("\n");
+        out.append("fragments=").append(totals.fragments).append("\n");
+        out.append("compaction_runs=").append(runs).append("\n");
+        out.append("compaction_last_run_ms=").append(lastRunMillis).append("\n");
+        out.append("compaction_bytes_relocated=").append(bytesRelocated).append("\n");
+        out.append("compaction_segments_deleted=").append(segmentsDeleted).append("\n");
+    }
+}
@@ -0,0 +1,199 @@
+#include "blocks.h"
+#include <linux/crypto.h>
+#include <linux/hashtable.h>
+#include <linux/kobject.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+#include <linux/xxhash.h>
+
+#define VTFS_BLOCKS_HASH_BITS 16
+
+static DEFINE_HASHTABLE(block_table, VTFS_BLOCKS_HASH_BITS);
+// Also for the transform's scratch memory and the two buffers below
+static DEFINE_MUTEX(block_lock);
+static struct crypto_comp* block_comp; // NULL if the kernel has no lz4
+static char block_packed[VTFS_BLOCK_SIZE];
+static char block_plain[VTFS_BLOCK_SIZE];
+static struct kobject* vtfs_kobj;
+
+// What sysfs shows
+static u64 block_count;       // distinct blocks
+static u64 unique_bytes;      // their data, uncompressed
+static u64 stored_bytes;      // their data as held
+static u64 logical_bytes;     // data of every reference
+static u64 dedup_hits;        // references that found the block already there
+
+static bool block_matches(const struct vtfs_block* block, const char* data, size_t len) {
+  unsigned int dlen = len;
+  
+  if (block->len != len) {
+    return false;
+  }
+  if (!block->packed) {
+    return memcmp(block->data, data, len) == 0;
+  }
+  return crypto_comp_decompress(block_comp, block->data, block->stored, block_plain, &dlen) == 0 &&
+         dlen == len && memcmp(block_plain, data, len) == 0;
+}
+
+struct vtfs_block* vtfs_block_get(const char* data, size_t len, bool compress) {
+  u64 key = xxh64(data, len, 0);
+  struct vtfs_block* block;
+  unsigned int dlen = len - 1;
+  bool packed;
+  
+  if (len == 0 || len > VTFS_BLOCK_SIZE) {
+    return NULL;
+  }
+  
+  mutex_lock(&block_lock);
+  hash_for_each_possible(block_table, block, hash, key) {
+    if (block->key == key && block_matches(block, data, len)) {
+      block->refs++;
+      logical_bytes += len;
+      dedup_hits++;
+      mutex_unlock(&block_lock);
+      return block;
+    }
+  }
+  
+  // A destination one byte short of the input rejects incompressible data
+  packed = compress && block_comp && len > 1 &&
+           crypto_comp_compress(block_comp, data, len, block_packed, &dlen) == 0;
+  if (!packed) {
+    dlen = len;
+  }
+  block = kmalloc(struct_size(block, data, dlen), GFP_KERNEL);
+  if (!block) {
+    mutex_unlock(&block_lock);
+    return NULL;
+  }
+  block->key = key;
+  block->refs = 1;
+  block->len = len;
+  block->stored = dlen;
+  block->packed = packed;
+  memcpy(block->data, packed ? block_packed : data, dlen);
+  hash_add(block_table, &block->hash, key);
+  
+  block_count++;
+  unique_bytes += len;
+  stored_bytes += dlen;
+  logical_bytes += len;
+  mutex_unlock(&block_lock);
+  return block;
+}
+
+// Blocks never change, and LZ4 decompression keeps no state in the transform
+int vtfs_block_read(const struct vtfs_block* block, char* out) {
+  unsigned int dlen = block->len;
+  
+  if (!block->packed) {
+    memcpy(out, block->data, block->len);
+    return 0;
+  }
+  if (crypto_comp_decompress(block_comp, block->data, block->stored, out, &dlen) != 0 || dlen != block->len) {
+    return -EIO;
+  }
+  return 0;
+}
+
+void vtfs_block_put(struct vtfs_block* block) {
+  mutex_lock(&block_lock);
+  logical_bytes -= block->len;
+  if (--block->refs > 0) {
+    mutex_unlock(&block_lock);
+    return;
+  }
+  hash_del(&block->hash);
+  block_count--;
+  unique_bytes -= block->len;
+  stored_bytes -= block->stored;
+  mutex_unlock(&block_lock);
+  kfree(block);
+}
+
+// /sys/fs/vtfs/dedup/: one value per file
+
+static ssize_t show_u64(char* buf, const u64* value) {
+  u64 v;
+  
+  mutex_lock(&block_lock);
+  v = *value;
+  mutex_unlock(&block_lock);
+  return sysfs_emit(buf, "%llu\n", v);
+}
+
+#define VTFS_BLOCKS_ATTR(name, var) \
+  static ssize_t name##_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf) { \
+    return show_u64(buf, &var); \
+  } \
+  static struct kobj_attribute name##_attr = __ATTR_RO(name)
+
+VTFS_BLOCKS_ATTR(blocks, block_count);
+VTFS_BLOCKS_ATTR(unique_bytes, unique_bytes);
+VTFS_BLOCKS_ATTR(stored_bytes, stored_bytes);
+VTFS_BLOCKS_ATTR(logical_bytes, logical_bytes);
+VTFS_BLOCKS_ATTR(hits, dedup_hits);
+
+// Logical over unique bytes, two decimals
+static ssize_t ratio_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf) {
+  u64 ratio;
+  
+  mutex_lock(&block_lock);
+  ratio = unique_bytes ? div64_u64(logical_bytes * 100, unique_bytes) : 100;
+  mutex_unlock(&block_lock);
+  return sysfs_emit(buf, "%llu.%02llu\n", ratio / 100, ratio % 100);
+}
+static struct kobj_attribute ratio_attr = __ATTR_RO(ratio);
+
+static struct attribute* dedup_attrs[] = {
+  &blocks_attr.attr,
+  &unique_bytes_attr.attr,
+  &stored_bytes_attr.attr,
+  &logical_bytes_attr.attr,
+  &hits_attr.attr,
+  &ratio_attr.attr,
+  NULL,
+};
+
+static const struct attribute_group dedup_group = {
+  .name = "dedup",
+  .attrs = dedup_attrs,
+};
+
+int vtfs_blocks_register(void) {
+  int ret;
+  
+  vtfs_kobj = kobject_create_and_add("vtfs", fs_kobj);
+  if (!vtfs_kobj) {
+    return -ENOMEM;
+  }
+  ret = sysfs_create_group(vtfs_kobj, &dedup_group);
+  if (ret != 0) {
+    kobject_put(vtfs_kobj);
+    vtfs_kobj = NULL;
+    return ret;
+  }
+  
+  block_comp = crypto_alloc_comp("lz4", 0, 0);
+  if (IS_ERR(block_comp)) {
+    // Blocks are kept uncompressed then
+    block_comp = NULL;
+  }
+  return 0;
+}
+
+// Every mount is gone, and with them every block
+void vtfs_blocks_unregister(void) {
+  sysfs_remove_group(vtfs_kobj, &dedup_group);
+  kobject_put(vtfs_kobj);
+  vtfs_kobj = NULL;
+  if (block_comp) {
+    crypto_free_comp(block_comp);
+    block_comp = NULL;
+  }
+}
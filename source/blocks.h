@@ -0,0 +1,36 @@
+#ifndef VTFS_BLOCKS_H
+#define VTFS_BLOCKS_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+#define VTFS_BLOCK_SIZE 4096
+
+/*
+ * Content-addressed table of fixed-size data blocks shared by all mounts,
+ * for the dedup mount option. A block is found by the xxh64 of its bytes,
+ * confirmed byte for byte, and freed with its last reference. Blocks are
+ * immutable: a file that changes gets new ones. Totals are in sysfs under
+ * /sys/fs/vtfs/dedup/.
+ */
+struct vtfs_block {
+  struct hlist_node hash;
+  u64 key;
+  unsigned int refs;
+  u32 len;                  // bytes of file data, at most VTFS_BLOCK_SIZE
+  u32 stored;               // bytes in data
+  bool packed;              // data is LZ4
+  char data[];
+};
+
+int vtfs_blocks_register(void);
+void vtfs_blocks_unregister(void);
+
+// A reference to the block holding these len bytes, LZ4-compressed when new
+// and compress is set; NULL if memory runs out
+struct vtfs_block* vtfs_block_get(const char* data, size_t len, bool compress);
+// Copies the block's len bytes to out
+int vtfs_block_read(const struct vtfs_block* block, char* out);
+void vtfs_block_put(struct vtfs_block* block);
+
+#endif // VTFS_BLOCKS_H
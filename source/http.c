@@ -9,18 +9,38 @@
 #include <linux/printk.h>
 #include <linux/errno.h>
 #include <linux/stdarg.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/minmax.h>
+#include "vtfs_trace.h"
 
 const char *SERVER_IP = "127.0.0.1";
 const int SERVER_PORT = 8080;
 
+// A call turned away with 503 did nothing on the server and is sent again
+// after its Retry-After, at most VTFS_HTTP_BUSY_DELAY_MS at a time and
+// VTFS_HTTP_BUSY_WAIT_MS in all
+#define VTFS_HTTP_BUSY_DELAY_MS 1000U
+#define VTFS_HTTP_BUSY_WAIT_MS 5000U
+
 int fill_request(struct kvec *vec, const char *token, const char *method,
-                 size_t arg_size, va_list args) {
-  char *request_buffer = kzalloc(2048 + 64, GFP_KERNEL);
+                 size_t body_len, size_t arg_size, va_list args) {
+  size_t request_size = 256 + strlen(method) + strlen(token);
+  char *request_buffer;
+  va_list sizing;
+
+  va_copy(sizing, args);
+  for (int i = 0; i < arg_size * 2; i++) {
+    request_size += strlen(va_arg(sizing, char *)) + 1;
+  }
+  va_end(sizing);
+
+  request_buffer = kzalloc(request_size, GFP_KERNEL);
   if (request_buffer == 0) {
     return -ENOMEM;
   }
 
-  strcpy(request_buffer, "GET /api/");
+  strcpy(request_buffer, body_len > 0 ? "POST /api/" : "GET /api/");
   strcat(request_buffer, method);
 
   strcat(request_buffer, "?token=");
@@ -35,6 +55,12 @@ int fill_request(struct kvec *vec, const char *token, const char *method,
 
   strcat(request_buffer, " HTTP/1.1\r\nHost:");
   strcat(request_buffer, SERVER_IP);
+  if (body_len > 0) {
+    size_t used = strlen(request_buffer);
+    snprintf(request_buffer + used, request_size - used,
+             "\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu",
+             body_len);
+  }
   strcat(request_buffer, "\r\nConnection: close\r\n\r\n");
 
   memset(vec, 0, sizeof(struct kvec));
@@ -44,7 +70,9 @@ int fill_request(struct kvec *vec, const char *token, const char *method,
   return 0;
 }
 
-int receive_all(struct socket *sock, char *buffer, size_t buffer_size) {
+// Sets *first_byte_ns to when the first bytes arrived, if any did
+int receive_all(struct socket *sock, char *buffer, size_t buffer_size,
+                u64 *first_byte_ns) {
   struct msghdr hdr;
   struct kvec vec;
 
@@ -61,15 +89,21 @@ int receive_all(struct socket *sock, char *buffer, size_t buffer_size) {
     } else if (ret < 0) {
       return -4;
     }
+    if (read == 0) {
+      *first_byte_ns = ktime_get_ns();
+    }
     read += ret;
   }
 
   return read;
 }
 
+// A 503 sets *retry_after_ms from its Retry-After seconds, if it has them
 int64_t parse_http_response(char *raw_response, size_t raw_response_size,
-                            char *response, size_t response_size) {
+                            char *response, size_t response_size,
+                            unsigned int *retry_after_ms) {
   char *buffer = raw_response;
+  bool busy;
 
   {
     char *status_line = strsep(&buffer, "\r");
@@ -78,8 +112,9 @@ int64_t parse_http_response(char *raw_response, size_t raw_response_size,
       return -6;
     }
     char *status_code = strsep(&status_line, " ");
-    printk(KERN_INFO "Received response with status code %s\n", status_code);
-    if (strcmp(status_code, "200") != 0) {
+    pr_debug("Received response with status code %s\n", status_code);
+    busy = strcmp(status_code, "503") == 0;
+    if (strcmp(status_code, "200") != 0 && !busy) {
       return -5;
     }
   }
@@ -88,7 +123,7 @@ int64_t parse_http_response(char *raw_response, size_t raw_response_size,
 
   while (true) {
     if (buffer == 0) {
-      return -6;
+      return busy ? VTFS_HTTP_BUSY : -6;
     }
     char *header = strsep(&buffer, "\r");
     ++header;
@@ -101,9 +136,18 @@ int64_t parse_http_response(char *raw_response, size_t raw_response_size,
       if (error != 0) {
         return -6;
       }
-      printk(KERN_INFO "Received response with content length %d\n", length);
+      pr_debug("Received response with content length %d\n", length);
+    } else if (strncmp(header, "Retry-After: ", 13) == 0) {
+      unsigned int seconds;
+
+      if (kstrtouint(header + 13, 10, &seconds) == 0) {
+        *retry_after_ms = min(seconds, 3600U) * 1000;
+      }
     }
   }
+  if (busy) {
+    return VTFS_HTTP_BUSY;
+  }
   ++buffer;
 
   if (length == -1) {
@@ -132,11 +176,21 @@ int64_t parse_http_response(char *raw_response, size_t raw_response_size,
   return sizeof(int64_t) + length;
 }
 
-int64_t vtfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...) {
+/*
+ * One request/response exchange. Fills phase_ns with the duration of every
+ * phase it gets through and the byte counts of what went over the socket.
+ */
+static int64_t vtfs_http_exchange(const char *token, const char *method,
+                                  const char *body, size_t body_len,
+                                  char *response_buffer, size_t buffer_size,
+                                  size_t arg_size, va_list args,
+                                  u64 *phase_ns, size_t *sent, size_t *received,
+                                  unsigned int *retry_after_ms) {
   struct socket *sock;
   int64_t error;
+  u64 mark = ktime_get_ns();
+  u64 first_byte = 0;
+  u64 done;
 
   error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
   if (error < 0) {
@@ -154,12 +208,10 @@ int64_t vtfs_http_call(const char *token, const char *method,
     sock_release(sock);
     return -2;
   }
+  phase_ns[VTFS_PHASE_CONNECT] = ktime_get_ns() - mark;
 
-  struct kvec kvec;
-  va_list args;
-  va_start(args, arg_size);
-  error = fill_request(&kvec, token, method, arg_size, args);
-  va_end(args);
+  struct kvec kvec[2];
+  error = fill_request(&kvec[0], token, method, body_len, arg_size, args);
 
   if (error != 0) {
     kernel_sock_shutdown(sock, SHUT_RDWR);
@@ -170,14 +222,21 @@ int64_t vtfs_http_call(const char *token, const char *method,
   struct msghdr msg;
   memset(&msg, 0, sizeof(struct msghdr));
 
-  error = kernel_sendmsg(sock, &msg, &kvec, 1, kvec.iov_len);
-  kfree(kvec.iov_base);
+  kvec[1].iov_base = (void *)body;
+  kvec[1].iov_len = body_len;
+
+  mark = ktime_get_ns();
+  error = kernel_sendmsg(sock, &msg, kvec, body_len > 0 ? 2 : 1,
+                         kvec[0].iov_len + body_len);
+  kfree(kvec[0].iov_base);
 
   if (error < 0) {
     kernel_sock_shutdown(sock, SHUT_RDWR);
     sock_release(sock);
     return -3;
   }
+  *sent = error;
+  phase_ns[VTFS_PHASE_SEND] = ktime_get_ns() - mark;
 
   size_t raw_buffer_size = buffer_size + 1024;
   char *raw_response_buffer = kmalloc(raw_buffer_size, GFP_KERNEL);
@@ -186,7 +245,10 @@ int64_t vtfs_http_call(const char *token, const char *method,
     sock_release(sock);
     return -ENOMEM;
   }
-  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size);
+  mark = ktime_get_ns();
+  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size,
+                               &first_byte);
+  done = ktime_get_ns();
 
   kernel_sock_shutdown(sock, SHUT_RDWR);
   sock_release(sock);
@@ -195,14 +257,116 @@ int64_t vtfs_http_call(const char *token, const char *method,
     kfree(raw_response_buffer);
     return -4;
   }
+  *received = read_bytes;
+  if (first_byte != 0) {
+    phase_ns[VTFS_PHASE_WAIT] = first_byte - mark;
+    phase_ns[VTFS_PHASE_RECEIVE] = done - first_byte;
+  } else {
+    phase_ns[VTFS_PHASE_WAIT] = done - mark;
+  }
 
   error = parse_http_response(raw_response_buffer, read_bytes, response_buffer,
-                              buffer_size);
+                              buffer_size, retry_after_ms);
 
   kfree(raw_response_buffer);
   return error;
 }
 
+// One attempt of a call, recorded in stats and traced on its own
+static int64_t vtfs_http_attempt(struct vtfs_stats *stats, const char *token,
+                                 const char *method,
+                                 const char *body, size_t body_len,
+                                 char *response_buffer, size_t buffer_size,
+                                 size_t arg_size, va_list args,
+                                 unsigned int *retry_after_ms) {
+  u64 phase_ns[VTFS_PHASE_COUNT];
+  size_t sent = 0;
+  size_t received = 0;
+  u64 start = ktime_get_ns();
+  int64_t ret;
+
+  for (int i = 0; i < VTFS_PHASE_COUNT; i++) {
+    phase_ns[i] = VTFS_PHASE_SKIPPED;
+  }
+
+  trace_vtfs_http_request(method, body_len);
+  ret = vtfs_http_exchange(token, method, body, body_len, response_buffer,
+                           buffer_size, arg_size, args, phase_ns, &sent,
+                           &received, retry_after_ms);
+
+  phase_ns[VTFS_PHASE_TOTAL] = ktime_get_ns() - start;
+  vtfs_stats_http(stats, method, phase_ns, sent, received, ret < 0);
+  if (trace_vtfs_http_response_enabled()) {
+    u64 ns[VTFS_PHASE_COUNT];
+
+    for (int i = 0; i < VTFS_PHASE_COUNT; i++) {
+      ns[i] = phase_ns[i] == VTFS_PHASE_SKIPPED ? 0 : phase_ns[i];
+    }
+    trace_vtfs_http_response(method, ret, sent, received,
+                             ns[VTFS_PHASE_CONNECT], ns[VTFS_PHASE_SEND],
+                             ns[VTFS_PHASE_WAIT], ns[VTFS_PHASE_RECEIVE],
+                             ns[VTFS_PHASE_TOTAL]);
+  }
+  return ret;
+}
+
+static int64_t vtfs_http_vcall(struct vtfs_stats *stats, const char *token,
+                               const char *method,
+                               const char *body, size_t body_len,
+                               char *response_buffer, size_t buffer_size,
+                               size_t arg_size, va_list args) {
+  unsigned int waited = 0;
+  int64_t ret;
+
+  while (true) {
+    unsigned int delay = VTFS_HTTP_BUSY_DELAY_MS;
+    va_list attempt;
+
+    va_copy(attempt, args);
+    ret = vtfs_http_attempt(stats, token, method, body, body_len,
+                            response_buffer, buffer_size, arg_size, attempt,
+                            &delay);
+    va_end(attempt);
+    if (ret != VTFS_HTTP_BUSY || waited >= VTFS_HTTP_BUSY_WAIT_MS) {
+      return ret;
+    }
+    delay = clamp(delay, 10U, VTFS_HTTP_BUSY_DELAY_MS);
+    delay = min(delay, VTFS_HTTP_BUSY_WAIT_MS - waited);
+    pr_debug("Server busy, retrying %s in %u ms\n", method, delay);
+    msleep(delay);
+    waited += delay;
+  }
+}
+
+int64_t vtfs_http_call(struct vtfs_stats *stats, const char *token,
+                       const char *method,
+                       char *response_buffer, size_t buffer_size,
+                       size_t arg_size, ...) {
+  va_list args;
+  int64_t ret;
+
+  va_start(args, arg_size);
+  ret = vtfs_http_vcall(stats, token, method, NULL, 0, response_buffer,
+                        buffer_size, arg_size, args);
+  va_end(args);
+  return ret;
+}
+
+int64_t vtfs_http_post(struct vtfs_stats *stats, const char *token,
+                       const char *method,
+                       const char *body, size_t body_len,
+                       char *response_buffer, size_t buffer_size,
+                       size_t arg_size, ...) {
+  va_list args;
+  int64_t ret;
+
+  va_start(args, arg_size);
+  ret = vtfs_http_vcall(stats, token, method, body, body_len,
+                        response_buffer, buffer_size, arg_size, args);
+  va_end(args);
+  return ret;
+}
+
 static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 void encode(const char *src, char *dst) {
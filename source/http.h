@@ -2,10 +2,29 @@
 #define VTFS_HTTP_H
 
 #include <linux/inet.h>
+#include "stats.h"
 
-int64_t vtfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...);
+// Results of a call that got no response: no socket, connect, send or receive failed
+#define VTFS_HTTP_UNREACHABLE(ret) ((ret) <= -1 && (ret) >= -4)
+// The server stayed too busy (503) through every retry; it did nothing
+#define VTFS_HTTP_BUSY -8
+
+/*
+ * Timings of the call are recorded in `stats`, which may be NULL. A call
+ * the server turns away with 503 is sent again after its Retry-After, for
+ * a few seconds at most, before VTFS_HTTP_BUSY comes back.
+ */
+int64_t vtfs_http_call(struct vtfs_stats *stats, const char *token,
+                       const char *method,
+                       char *response_buffer, size_t buffer_size,
+                       size_t arg_size, ...);
+
+// Same as vtfs_http_call, but sends `body` as an octet-stream POST body
+int64_t vtfs_http_post(struct vtfs_stats *stats, const char *token,
+                       const char *method,
+                       const char *body, size_t body_len,
+                       char *response_buffer, size_t buffer_size,
+                       size_t arg_size, ...);
 
 void encode(const char *, char *);
 
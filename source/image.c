@@ -0,0 +1,730 @@
+#include "image.h"
+#include <linux/crc32.h>
+#include <linux/debugfs.h>
+#include <linux/fcntl.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+
+#define VTFS_RESTORE_HASH_BITS 14
+
+// Entries of the table being built by a checkpoint
+struct image_table {
+  char* buf;
+  size_t len;
+  size_t cap;
+  u32 entries;
+};
+
+// Ranges being collected, sorted and merged by ranges_sort
+struct image_ranges {
+  struct vtfs_image_range* r;
+  size_t count;
+  size_t cap;
+};
+
+/*
+ * Hands out page aligned space in the gaps between the ranges a checkpoint
+ * must not touch, in file order. A gap too small for one file is skipped
+ * for the rest of the checkpoint; the next one may use it.
+ */
+struct image_alloc {
+  const struct vtfs_image_range* busy;
+  size_t count;
+  size_t next;              // first busy range not yet behind pos
+  u64 pos;
+};
+
+// What a restore has created so far, by ino
+struct restore_node {
+  struct hlist_node hash;
+  ino_t ino;
+  struct vtfs_file* file;
+};
+
+static size_t entry_size(size_t name_len) {
+  return ALIGN(sizeof(struct vtfs_image_entry) + name_len, 8);
+}
+
+static int image_read_at(struct file* file, void* buf, size_t len, loff_t pos) {
+  while (len > 0) {
+    ssize_t n = kernel_read(file, buf, min_t(size_t, len, MAX_RW_COUNT), &pos);
+    if (n < 0) {
+      return n;
+    }
+    if (n == 0) {
+      return -EIO;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int image_write_at(struct file* file, const void* buf, size_t len, loff_t pos) {
+  while (len > 0) {
+    ssize_t n = kernel_write(file, buf, min_t(size_t, len, MAX_RW_COUNT), &pos);
+    if (n < 0) {
+      return n;
+    }
+    if (n == 0) {
+      return -EIO;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int ranges_add(struct image_ranges* rs, u64 off, u64 len) {
+  if (len == 0) {
+    return 0;
+  }
+  if (rs->count == rs->cap) {
+    size_t cap = max_t(size_t, rs->cap * 2, 64);
+    struct vtfs_image_range* r = kvmalloc_array(cap, sizeof(*r), GFP_KERNEL);
+    if (!r) {
+      return -ENOMEM;
+    }
+    if (rs->r) {
+      memcpy(r, rs->r, rs->count * sizeof(*r));
+      kvfree(rs->r);
+    }
+    rs->r = r;
+    rs->cap = cap;
+  }
+  rs->r[rs->count].off = off;
+  rs->r[rs->count].end = off + len;
+  rs->count++;
+  return 0;
+}
+
+static int range_cmp(const void* a, const void* b) {
+  const struct vtfs_image_range* x = a;
+  const struct vtfs_image_range* y = b;
+  
+  if (x->off != y->off) {
+    return x->off < y->off ? -1 : 1;
+  }
+  return 0;
+}
+
+// Sorts by offset and merges ranges that overlap or touch
+static void ranges_sort(struct image_ranges* rs) {
+  size_t out = 0;
+  
+  sort(rs->r, rs->count, sizeof(*rs->r), range_cmp, NULL);
+  for (size_t i = 0; i < rs->count; i++) {
+    if (out > 0 && rs->r[i].off <= rs->r[out - 1].end) {
+      rs->r[out - 1].end = max(rs->r[out - 1].end, rs->r[i].end);
+    } else {
+      rs->r[out++] = rs->r[i];
+    }
+  }
+  rs->count = out;
+}
+
+static u64 image_alloc(struct image_alloc* a, u64 len) {
+  u64 off;
+  
+  while (a->next < a->count) {
+    const struct vtfs_image_range* busy = &a->busy[a->next];
+    
+    if (busy->end > a->pos && busy->off < a->pos + len) {
+      a->pos = round_up(busy->end, PAGE_SIZE);
+    } else if (busy->end > a->pos) {
+      break;
+    }
+    a->next++;
+  }
+  off = a->pos;
+  a->pos = round_up(off + len, PAGE_SIZE);
+  return off;
+}
+
+// The caller holds map_lock
+static struct vtfs_image_extent* extent_find(struct vtfs_image* img, ino_t ino) {
+  struct vtfs_image_extent* ext;
+  
+  hash_for_each_possible(img->table, ext, hash, ino) {
+    if (ext->ino == ino) {
+      return ext;
+    }
+  }
+  return NULL;
+}
+
+static int extent_set(struct vtfs_image* img, ino_t ino, u64 off, u64 len) {
+  struct vtfs_image_extent* ext;
+  
+  mutex_lock(&img->map_lock);
+  ext = extent_find(img, ino);
+  if (!ext) {
+    ext = kmalloc(sizeof(*ext), GFP_KERNEL);
+    if (!ext) {
+      mutex_unlock(&img->map_lock);
+      return -ENOMEM;
+    }
+    ext->ino = ino;
+    hash_add(img->table, &ext->hash, ino);
+  }
+  ext->off = off;
+  ext->len = len;
+  ext->generation = img->generation;
+  mutex_unlock(&img->map_lock);
+  return 0;
+}
+
+bool vtfs_image_has(struct vtfs_image* img, ino_t ino) {
+  bool found;
+  
+  if (!vtfs_image_enabled(img)) {
+    return false;
+  }
+  mutex_lock(&img->map_lock);
+  found = extent_find(img, ino) != NULL;
+  mutex_unlock(&img->map_lock);
+  return found;
+}
+
+void vtfs_image_forget(struct vtfs_image* img, ino_t ino) {
+  struct vtfs_image_extent* ext;
+  
+  if (!vtfs_image_enabled(img)) {
+    return;
+  }
+  mutex_lock(&img->map_lock);
+  ext = extent_find(img, ino);
+  if (ext) {
+    hash_del(&ext->hash);
+    kfree(ext);
+  }
+  mutex_unlock(&img->map_lock);
+}
+
+// A checkpoint never writes over an extent in the table, so this needs no checkpoint lock
+int vtfs_image_read(struct vtfs_image* img, ino_t ino, size_t len, char** out) {
+  struct vtfs_image_extent* ext;
+  char* data;
+  u64 off;
+  int ret;
+  
+  mutex_lock(&img->map_lock);
+  ext = extent_find(img, ino);
+  if (!ext || ext->len != len) {
+    mutex_unlock(&img->map_lock);
+    return -ENOENT;
+  }
+  off = ext->off;
+  mutex_unlock(&img->map_lock);
+  
+  data = kmalloc(len, GFP_KERNEL);
+  if (!data) {
+    return -ENOMEM;
+  }
+  ret = image_read_at(img->file, data, len, off);
+  if (ret != 0) {
+    kfree(data);
+    return ret;
+  }
+  
+  mutex_lock(&img->map_lock);
+  img->paged_in += len;
+  mutex_unlock(&img->map_lock);
+  *out = data;
+  return 0;
+}
+
+// Checkpoint
+
+static int table_add(struct image_table* t, struct vtfs_file* file, ino_t parent_ino) {
+  size_t name_len = strlen(file->name);
+  size_t size = entry_size(name_len);
+  struct vtfs_image_entry* rec;
+  
+  if (t->len + size > t->cap) {
+    size_t cap = max(t->cap * 2, t->len + size + PAGE_SIZE);
+    char* buf = kvmalloc(cap, GFP_KERNEL);
+    if (!buf) {
+      return -ENOMEM;
+    }
+    if (t->buf) {
+      memcpy(buf, t->buf, t->len);
+      kvfree(t->buf);
+    }
+    t->buf = buf;
+    t->cap = cap;
+  }
+  
+  rec = (struct vtfs_image_entry*)(t->buf + t->len);
+  memset(rec, 0, size);
+  rec->ino = cpu_to_le64(file->ino);
+  rec->parent_ino = cpu_to_le64(parent_ino);
+  rec->size = cpu_to_le64(S_ISDIR(file->mode) ? 0 : file->data_size);
+  rec->mode = cpu_to_le32(file->mode);
+  rec->name_len = cpu_to_le16(name_len);
+  memcpy(rec + 1, file->name, name_len);
+  t->len += size;
+  t->entries++;
+  return 0;
+}
+
+// Pre-order, so that a restore meets every directory before its entries
+static int table_walk(struct image_table* t, struct vtfs_dir* dir, ino_t dir_ino) {
+  struct vtfs_file* file;
+  int ret = 0;
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    ret = table_add(t, file, dir_ino);
+    if (ret == 0 && file->dir_data) {
+      ret = table_walk(t, file->dir_data, file->ino);
+    }
+    if (ret != 0) {
+      break;
+    }
+  }
+  up_read(&dir->sem);
+  return ret;
+}
+
+/*
+ * Points rec at the image copy of its file's data, writing it where alloc
+ * finds room unless the image already holds the current one, and counts
+ * the data toward live_bytes the first time this checkpoint meets it.
+ */
+static int image_store(struct vtfs_image* img, struct vtfs_image_entry* rec, struct image_alloc* alloc, u64* live) {
+  ino_t ino = le64_to_cpu(rec->ino);
+  struct vtfs_image_extent* ext;
+  struct vtfs_file* file;
+  u64 off;
+  size_t len;
+  int ret;
+  
+  mutex_lock(&img->map_lock);
+  ext = extent_find(img, ino);
+  if (ext) {
+    if (ext->generation != img->generation) {
+      ext->generation = img->generation;
+      *live += ext->len;
+    }
+    rec->data_off = cpu_to_le64(ext->off);
+    rec->size = cpu_to_le64(ext->len);
+    mutex_unlock(&img->map_lock);
+    return 0;
+  }
+  mutex_unlock(&img->map_lock);
+  
+  // Held until the extent is in the table, so a write in between forgets it
+  ret = img->hold(img->ctx, ino, &file);
+  len = ret == 0 && file && file->data ? file->data_size : 0;
+  rec->size = cpu_to_le64(len);
+  if (len > 0) {
+    off = image_alloc(alloc, len);
+    ret = image_write_at(img->file, file->data, len, off);
+    if (ret == 0) {
+      *live += len;
+      rec->data_off = cpu_to_le64(off);
+      ret = extent_set(img, ino, off, len);
+    }
+  }
+  img->release(img->ctx, ino);
+  return ret;
+}
+
+// What a checkpoint must leave alone: the committed one and every extent in the table
+static int image_busy(struct vtfs_image* img, struct image_ranges* busy) {
+  struct vtfs_image_extent* ext;
+  int ret = 0;
+  int bkt;
+  
+  for (size_t i = 0; ret == 0 && i < img->committed_count; i++) {
+    ret = ranges_add(busy, img->committed[i].off, img->committed[i].end - img->committed[i].off);
+  }
+  mutex_lock(&img->map_lock);
+  hash_for_each(img->table, bkt, ext, hash) {
+    if (ret == 0) {
+      ret = ranges_add(busy, ext->off, ext->len);
+    }
+  }
+  mutex_unlock(&img->map_lock);
+  ranges_sort(busy);
+  return ret;
+}
+
+// What the checkpoint in t, with its table at table_off, uses
+static int image_used(struct image_table* t, u64 table_off, struct image_ranges* used) {
+  int ret = ranges_add(used, table_off, t->len);
+  
+  for (size_t at = 0; ret == 0 && at < t->len;) {
+    struct vtfs_image_entry* rec = (struct vtfs_image_entry*)(t->buf + at);
+    
+    if (S_ISREG(le32_to_cpu(rec->mode)) && rec->size != 0) {
+      ret = ranges_add(used, le64_to_cpu(rec->data_off), le64_to_cpu(rec->size));
+    }
+    at += entry_size(le16_to_cpu(rec->name_len));
+  }
+  ranges_sort(used);
+  return ret;
+}
+
+/*
+ * The checkpoint in used is on disk: it becomes the one to protect, the
+ * extents it left out go, and the file is cut back after its last range.
+ * Nothing reads a dropped extent: its file was gone before the walk.
+ */
+static void image_commit(struct vtfs_image* img, struct image_ranges* used) {
+  u64 end = used->count > 0 ? used->r[used->count - 1].end : 0;
+  struct vtfs_image_extent* ext;
+  struct hlist_node* tmp;
+  int bkt;
+  
+  kvfree(img->committed);
+  img->committed = used->r;
+  img->committed_count = used->count;
+  used->r = NULL;
+  
+  mutex_lock(&img->map_lock);
+  hash_for_each_safe(img->table, bkt, tmp, ext, hash) {
+    if (ext->generation != img->generation) {
+      hash_del(&ext->hash);
+      kfree(ext);
+    }
+  }
+  mutex_unlock(&img->map_lock);
+  
+  // A failure only leaves the space unused
+  end = max_t(u64, end, PAGE_SIZE);
+  if (end < i_size_read(file_inode(img->file))) {
+    vfs_truncate(&img->file->f_path, end);
+  }
+}
+
+/*
+ * Writes the whole tree: data first, then the table, then the header once
+ * both are on disk. Files changed while it runs may be caught half way;
+ * the one at unmount sees a quiet tree.
+ */
+int vtfs_image_checkpoint(struct vtfs_image* img) {
+  struct image_table t = { 0 };
+  struct image_ranges busy = { 0 };
+  struct image_ranges used = { 0 };
+  struct image_alloc alloc = { 0 };
+  struct vtfs_image_header hdr;
+  u64 table_off = 0;
+  u64 live = 0;
+  int ret;
+  
+  if (!vtfs_image_enabled(img)) {
+    return 0;
+  }
+  
+  mutex_lock(&img->lock);
+  ret = table_walk(&t, img->root, img->root_ino);
+  if (ret == 0) {
+    ret = image_busy(img, &busy);
+  }
+  
+  // Data goes into space nothing on disk refers to, past the header's page
+  alloc.busy = busy.r;
+  alloc.count = busy.count;
+  alloc.pos = PAGE_SIZE;
+  mutex_lock(&img->map_lock);
+  img->generation++;
+  mutex_unlock(&img->map_lock);
+  for (size_t at = 0; ret == 0 && at < t.len;) {
+    struct vtfs_image_entry* rec = (struct vtfs_image_entry*)(t.buf + at);
+    
+    if (S_ISREG(le32_to_cpu(rec->mode)) && rec->size != 0) {
+      ret = image_store(img, rec, &alloc, &live);
+    }
+    at += entry_size(le16_to_cpu(rec->name_len));
+  }
+  
+  if (ret == 0) {
+    table_off = image_alloc(&alloc, t.len);
+    ret = image_used(&t, table_off, &used);
+  }
+  if (ret == 0) {
+    ret = image_write_at(img->file, t.buf, t.len, table_off);
+  }
+  if (ret == 0) {
+    ret = vfs_fsync(img->file, 0);
+  }
+  if (ret == 0) {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, VTFS_IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.version = cpu_to_le32(VTFS_IMAGE_VERSION);
+    hdr.entries = cpu_to_le32(t.entries);
+    hdr.table_off = cpu_to_le64(table_off);
+    hdr.table_len = cpu_to_le64(t.len);
+    hdr.next_ino = cpu_to_le64(*img->next_ino);
+    hdr.generation = cpu_to_le64(img->generation);
+    hdr.table_crc = cpu_to_le32(crc32_le(0, t.buf, t.len));
+    ret = image_write_at(img->file, &hdr, sizeof(hdr), 0);
+  }
+  if (ret == 0) {
+    ret = vfs_fsync(img->file, 0);
+  }
+  if (ret == 0) {
+    image_commit(img, &used);
+  }
+  
+  mutex_lock(&img->map_lock);
+  img->image_bytes = i_size_read(file_inode(img->file));
+  if (ret == 0) {
+    img->live_bytes = live;
+  }
+  mutex_unlock(&img->map_lock);
+  mutex_unlock(&img->lock);
+  kvfree(used.r);
+  kvfree(busy.r);
+  kvfree(t.buf);
+  return ret;
+}
+
+// Restore
+
+static struct restore_node* restore_find(struct hlist_head* nodes, ino_t ino) {
+  struct restore_node* node;
+  
+  hlist_for_each_entry(node, &nodes[hash_min(ino, VTFS_RESTORE_HASH_BITS)], hash) {
+    if (node->ino == ino) {
+      return node;
+    }
+  }
+  return NULL;
+}
+
+static int restore_entry(struct vtfs_image* img, struct hlist_head* nodes, const struct vtfs_image_entry* rec, u64 image_size) {
+  ino_t ino = le64_to_cpu(rec->ino);
+  ino_t parent_ino = le64_to_cpu(rec->parent_ino);
+  umode_t mode = le32_to_cpu(rec->mode);
+  u64 size = le64_to_cpu(rec->size);
+  u64 data_off = le64_to_cpu(rec->data_off);
+  size_t name_len = le16_to_cpu(rec->name_len);
+  char name[VTFS_MAX_NAME];
+  struct restore_node* parent;
+  struct restore_node* node;
+  struct vtfs_dir* dir = img->root;
+  struct vtfs_file* file;
+  
+  if (name_len == 0 || name_len >= VTFS_MAX_NAME || ino == img->root_ino) {
+    return -EINVAL;
+  }
+  memcpy(name, rec + 1, name_len);
+  name[name_len] = '\0';
+  
+  if (parent_ino != img->root_ino) {
+    parent = restore_find(nodes, parent_ino);
+    if (!parent || !parent->file->dir_data) {
+      return -EINVAL;
+    }
+    dir = parent->file->dir_data;
+  }
+  
+  // A second entry of an ino is a hard link
+  node = restore_find(nodes, ino);
+  if (node) {
+    if (S_ISDIR(node->file->mode)) {
+      return -EINVAL;
+    }
+    return vtfs_link_file(img->root, dir, name, node->file) ? 0 : -EINVAL;
+  }
+  
+  if (!S_ISDIR(mode) && !S_ISREG(mode)) {
+    return -EINVAL;
+  }
+  if (size > 0 && (data_off < PAGE_SIZE || data_off > image_size || size > image_size - data_off)) {
+    return -EINVAL;
+  }
+  node = kmalloc(sizeof(*node), GFP_KERNEL);
+  if (!node) {
+    return -ENOMEM;
+  }
+  file = vtfs_create_file(dir, name, mode, ino);
+  if (!file) {
+    kfree(node);
+    return -EINVAL;
+  }
+  node->ino = ino;
+  node->file = file;
+  hlist_add_head(&node->hash, &nodes[hash_min(ino, VTFS_RESTORE_HASH_BITS)]);
+  
+  // The data stays in the image until the first access
+  if (size > 0) {
+    file->data_size = size;
+    return extent_set(img, ino, data_off, size);
+  }
+  return 0;
+}
+
+// The restored extents and table are what the committed checkpoint uses
+static int image_restored(struct vtfs_image* img, u64 table_off, u64 table_len) {
+  struct image_ranges used = { 0 };
+  int ret = ranges_add(&used, table_off, table_len);
+  
+  if (ret == 0) {
+    ret = image_busy(img, &used);
+  }
+  if (ret != 0) {
+    kvfree(used.r);
+    return ret;
+  }
+  img->committed = used.r;
+  img->committed_count = used.count;
+  return 0;
+}
+
+static int image_restore(struct vtfs_image* img) {
+  u64 image_size = i_size_read(file_inode(img->file));
+  struct vtfs_image_header hdr;
+  struct hlist_head* nodes;
+  struct restore_node* node;
+  struct hlist_node* tmp;
+  u64 table_off, table_len;
+  char* table;
+  int ret;
+  
+  // A new image gets its header with the first checkpoint
+  img->image_bytes = image_size;
+  if (image_size == 0) {
+    return 0;
+  }
+  
+  if (image_size < sizeof(hdr) || image_read_at(img->file, &hdr, sizeof(hdr), 0) != 0 ||
+      memcmp(hdr.magic, VTFS_IMAGE_MAGIC, sizeof(hdr.magic)) != 0 ||
+      le32_to_cpu(hdr.version) != VTFS_IMAGE_VERSION) {
+    return -EINVAL;
+  }
+  table_off = le64_to_cpu(hdr.table_off);
+  table_len = le64_to_cpu(hdr.table_len);
+  if (table_off > image_size || table_len > image_size - table_off) {
+    return -EINVAL;
+  }
+  
+  table = kvmalloc(table_len ? table_len : 1, GFP_KERNEL);
+  if (!table) {
+    return -ENOMEM;
+  }
+  ret = image_read_at(img->file, table, table_len, table_off);
+  if (ret == 0 && crc32_le(0, table, table_len) != le32_to_cpu(hdr.table_crc)) {
+    ret = -EINVAL;
+  }
+  nodes = kvcalloc(1 << VTFS_RESTORE_HASH_BITS, sizeof(*nodes), GFP_KERNEL);
+  if (!nodes) {
+    ret = -ENOMEM;
+  }
+  
+  for (size_t at = 0; ret == 0 && at < table_len;) {
+    const struct vtfs_image_entry* rec = (const struct vtfs_image_entry*)(table + at);
+    
+    if (table_len - at < sizeof(*rec) || table_len - at < entry_size(le16_to_cpu(rec->name_len))) {
+      ret = -EINVAL;
+      break;
+    }
+    ret = restore_entry(img, nodes, rec, image_size);
+    at += entry_size(le16_to_cpu(rec->name_len));
+  }
+  
+  if (nodes) {
+    for (int i = 0; i < 1 << VTFS_RESTORE_HASH_BITS; i++) {
+      hlist_for_each_entry_safe(node, tmp, &nodes[i], hash) {
+        kfree(node);
+      }
+    }
+    kvfree(nodes);
+  }
+  kvfree(table);
+  
+  if (ret == 0) {
+    *img->next_ino = max_t(ino_t, *img->next_ino, le64_to_cpu(hdr.next_ino));
+    img->generation = le64_to_cpu(hdr.generation);
+    ret = image_restored(img, table_off, table_len);
+  }
+  return ret;
+}
+
+// Any write to debugfs vtfs/<major:minor>/checkpoint takes a checkpoint
+static ssize_t checkpoint_write(struct file* file, const char __user* buf, size_t len, loff_t* ppos) {
+  int ret = vtfs_image_checkpoint(file->private_data);
+  
+  return ret != 0 ? ret : len;
+}
+
+static const struct file_operations checkpoint_fops = {
+  .owner = THIS_MODULE,
+  .open = simple_open,
+  .write = checkpoint_write,
+  .llseek = noop_llseek,
+};
+
+int vtfs_image_open(struct vtfs_image* img, const char* path, struct vtfs_dir* root, ino_t root_ino, ino_t* next_ino,
+                    int (*hold)(void* ctx, ino_t ino, struct vtfs_file** file),
+                    void (*release)(void* ctx, ino_t ino), void* ctx, struct dentry* dir) {
+  struct file* file;
+  int ret;
+  
+  mutex_init(&img->lock);
+  mutex_init(&img->map_lock);
+  hash_init(img->table);
+  img->file = NULL;
+  img->root = root;
+  img->root_ino = root_ino;
+  img->next_ino = next_ino;
+  img->hold = hold;
+  img->release = release;
+  img->ctx = ctx;
+  img->committed = NULL;
+  img->committed_count = 0;
+  img->generation = 0;
+  img->image_bytes = 0;
+  img->live_bytes = 0;
+  img->paged_in = 0;
+  
+  file = filp_open(path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+  if (IS_ERR(file)) {
+    return PTR_ERR(file);
+  }
+  if (!S_ISREG(file_inode(file)->i_mode)) {
+    filp_close(file, NULL);
+    return -EINVAL;
+  }
+  img->file = file;
+  
+  ret = image_restore(img);
+  if (ret != 0) {
+    vtfs_image_close(img);
+    return ret;
+  }
+  
+  debugfs_create_file("checkpoint", 0200, dir, img, &checkpoint_fops);
+  debugfs_create_u64("image_bytes", 0444, dir, &img->image_bytes);
+  debugfs_create_u64("image_live", 0444, dir, &img->live_bytes);
+  debugfs_create_u64("image_generation", 0444, dir, &img->generation);
+  debugfs_create_u64("image_paged_in", 0444, dir, &img->paged_in);
+  return 0;
+}
+
+// The debugfs files must be gone already
+void vtfs_image_close(struct vtfs_image* img) {
+  struct vtfs_image_extent* ext;
+  struct hlist_node* tmp;
+  int bkt;
+  
+  if (!vtfs_image_enabled(img)) {
+    return;
+  }
+  
+  hash_for_each_safe(img->table, bkt, tmp, ext, hash) {
+    hash_del(&ext->hash);
+    kfree(ext);
+  }
+  kvfree(img->committed);
+  img->committed = NULL;
+  img->committed_count = 0;
+  filp_close(img->file, NULL);
+  img->file = NULL;
+}
@@ -0,0 +1,112 @@
+#ifndef VTFS_IMAGE_H
+#define VTFS_IMAGE_H
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/hashtable.h>
+#include <linux/mutex.h>
+#include <linux/dcache.h>
+#include "vtfs_core.h"
+
+#define VTFS_IMAGE_MAGIC "VTFSIMG1"
+#define VTFS_IMAGE_VERSION 1
+#define VTFS_IMAGE_HASH_BITS 10
+
+/*
+ * On-disk checkpoint of a RAM mode mount (the image= mount option). A
+ * checkpoint writes the data of files changed since the last one, page
+ * aligned, then a table of every entry, all in space the previous
+ * checkpoint does not use, and commits by rewriting the header at offset
+ * 0, so a crash leaves the previous checkpoint intact. Space only the
+ * older one used is reused by the next, and the file is cut back after the
+ * last range in use. A mount restores the table at once and reads a file's
+ * data from the image on its first access. All integers are little endian.
+ */
+struct vtfs_image_header {
+  char magic[8];            // VTFS_IMAGE_MAGIC
+  __le32 version;
+  __le32 entries;
+  __le64 table_off;         // 0 for an image without a checkpoint
+  __le64 table_len;
+  __le64 next_ino;
+  __le64 generation;        // checkpoints written
+  __le32 table_crc;         // crc32_le of the table
+  __le32 reserved;
+};
+
+// One per directory entry, parents before children; the name follows and
+// the record is padded to 8 bytes
+struct vtfs_image_entry {
+  __le64 ino;
+  __le64 parent_ino;
+  __le64 size;
+  __le64 data_off;          // 0 if the file has no data
+  __le32 mode;
+  __le16 name_len;
+  __le16 reserved;
+};
+
+// A byte range of the image file
+struct vtfs_image_range {
+  u64 off;
+  u64 end;
+};
+
+// Where the image holds the current data of an ino
+struct vtfs_image_extent {
+  struct hlist_node hash;
+  ino_t ino;
+  u64 off;
+  u64 len;
+  u64 generation;           // last checkpoint that referred to it
+};
+
+struct vtfs_image {
+  struct mutex lock;        // one checkpoint at a time
+  struct mutex map_lock;    // table and the counters below
+  struct file* file;        // NULL when the mount has no image
+  DECLARE_HASHTABLE(table, VTFS_IMAGE_HASH_BITS);
+  struct vtfs_dir* root;
+  ino_t root_ino;
+  ino_t* next_ino;
+  /*
+   * Finds ino's file for a checkpoint and keeps its data from changing,
+   * resident, until release; *file is NULL if it is gone. release follows
+   * every hold, failed or not.
+   */
+  int (*hold)(void* ctx, ino_t ino, struct vtfs_file** file);
+  void (*release)(void* ctx, ino_t ino);
+  void* ctx;
+  // Table and data of the committed checkpoint, sorted; under lock
+  struct vtfs_image_range* committed;
+  size_t committed_count;
+  u64 generation;
+  u64 image_bytes;          // size of the image file
+  u64 live_bytes;           // data the last checkpoint refers to
+  u64 paged_in;             // bytes read on first access
+};
+
+/*
+ * Opens or creates the image at path and restores the tree it holds into
+ * root. -EINVAL for a file that is not a valid image.
+ */
+int vtfs_image_open(struct vtfs_image* img, const char* path, struct vtfs_dir* root, ino_t root_ino, ino_t* next_ino,
+                    int (*hold)(void* ctx, ino_t ino, struct vtfs_file** file),
+                    void (*release)(void* ctx, ino_t ino), void* ctx, struct dentry* dir);
+// Closes without a checkpoint
+void vtfs_image_close(struct vtfs_image* img);
+
+static inline bool vtfs_image_enabled(struct vtfs_image* img) {
+  return img->file != NULL;
+}
+
+int vtfs_image_checkpoint(struct vtfs_image* img);
+
+// Whether the image holds ino's current data
+bool vtfs_image_has(struct vtfs_image* img, ino_t ino);
+// Reads ino's len bytes from the image into a new buffer
+int vtfs_image_read(struct vtfs_image* img, ino_t ino, size_t len, char** out);
+// ino's data changed; the next checkpoint writes it again
+void vtfs_image_forget(struct vtfs_image* img, ino_t ino);
+
+#endif // VTFS_IMAGE_H
@@ -0,0 +1,806 @@
+#include "journal.h"
+#include <linux/crc32.h>
+#include <linux/debugfs.h>
+#include <linux/fcntl.h>
+#include <linux/file.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+// Records start past the header's page
+#define VTFS_JOURNAL_START PAGE_SIZE
+// Records shipped per round, and how many bytes of adjacent writes become one
+#define VTFS_JOURNAL_BATCH 64
+#define VTFS_JOURNAL_COALESCE (1 << 20)
+// Files whose refused changes are remembered for an fsync or close to report
+#define VTFS_JOURNAL_MAX_REFUSED 1024
+// Write data held for the server before appends wait for the thread
+#define VTFS_JOURNAL_MAX_QUEUED (64 << 20)
+// A fully shipped log this long starts over; so does the tail of a log with
+// this much shipped before its oldest queued record
+#define VTFS_JOURNAL_WRAP (64 << 20)
+#define VTFS_JOURNAL_RETRY_MS 100
+#define VTFS_JOURNAL_RETRY_MAX_MS 5000
+
+static size_t record_size(size_t len) {
+  return ALIGN(sizeof(struct vtfs_journal_record) + len, 8);
+}
+
+static u32 record_crc(const struct vtfs_journal_record* rec, const char* data, size_t len) {
+  struct vtfs_journal_record copy = *rec;
+  
+  copy.crc = 0;
+  return crc32_le(crc32_le(0, &copy, sizeof(copy)), data, len);
+}
+
+static int journal_read_at(struct file* file, void* buf, size_t len, loff_t pos) {
+  while (len > 0) {
+    ssize_t n = kernel_read(file, buf, min_t(size_t, len, MAX_RW_COUNT), &pos);
+    if (n < 0) {
+      return n;
+    }
+    if (n == 0) {
+      return -EIO;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int journal_write_at(struct file* file, const void* buf, size_t len, loff_t pos) {
+  while (len > 0) {
+    ssize_t n = kernel_write(file, buf, min_t(size_t, len, MAX_RW_COUNT), &pos);
+    if (n < 0) {
+      return n;
+    }
+    if (n == 0) {
+      return -EIO;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int journal_write_header(struct vtfs_journal* j, u64 shipped_seq, loff_t head) {
+  struct vtfs_journal_header hdr;
+  int ret;
+  
+  if (!vtfs_journal_durable(j)) {
+    return 0;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, VTFS_JOURNAL_MAGIC, sizeof(hdr.magic));
+  hdr.version = cpu_to_le32(VTFS_JOURNAL_VERSION);
+  hdr.shipped_seq = cpu_to_le64(shipped_seq);
+  hdr.head = cpu_to_le64(head);
+  ret = journal_write_at(j->file, &hdr, sizeof(hdr), 0);
+  if (ret == 0) {
+    ret = vfs_fsync(j->file, 1);
+  }
+  return ret;
+}
+
+// The caller holds queue_lock
+
+static struct vtfs_journal_pending* pending_find(struct vtfs_journal* j, ino_t ino) {
+  struct vtfs_journal_pending* p;
+  
+  hash_for_each_possible(j->pending, p, hash, ino) {
+    if (p->ino == ino) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// Takes *spare if ino has nothing queued yet
+static void pending_add(struct vtfs_journal* j, ino_t ino, struct vtfs_journal_pending** spare) {
+  struct vtfs_journal_pending* p = pending_find(j, ino);
+  
+  if (!p) {
+    p = *spare;
+    *spare = NULL;
+    p->ino = ino;
+    p->count = 0;
+    hash_add(j->pending, &p->hash, ino);
+  }
+  p->count++;
+}
+
+static void pending_drop(struct vtfs_journal* j, ino_t ino) {
+  struct vtfs_journal_pending* p = pending_find(j, ino);
+  
+  if (p && --p->count == 0) {
+    hash_del(&p->hash);
+    kfree(p);
+  }
+}
+
+static void journal_queue(struct vtfs_journal* j, struct vtfs_journal_entry* entry, struct vtfs_journal_pending** spare) {
+  spin_lock(&j->queue_lock);
+  list_add_tail(&entry->list, &j->queue);
+  pending_add(j, entry->ino, spare);
+  j->queued++;
+  j->queued_bytes += entry->len;
+  spin_unlock(&j->queue_lock);
+}
+
+static bool journal_has_work(struct vtfs_journal* j) {
+  return !list_empty(&j->queue);
+}
+
+static bool journal_has_ino(struct vtfs_journal* j, ino_t ino) {
+  bool found;
+  
+  spin_lock(&j->queue_lock);
+  found = pending_find(j, ino) != NULL;
+  spin_unlock(&j->queue_lock);
+  return found;
+}
+
+// A single write larger than the limit still goes in on an empty queue
+static bool journal_has_room(struct vtfs_journal* j, size_t len) {
+  return READ_ONCE(j->queued) == 0 || READ_ONCE(j->queued_bytes) + len <= VTFS_JOURNAL_MAX_QUEUED;
+}
+
+void vtfs_journal_wait_ino(struct vtfs_journal* j, ino_t ino) {
+  if (!vtfs_journal_enabled(j) || !journal_has_ino(j, ino)) {
+    return;
+  }
+  wake_up(&j->wait);
+  wait_event_timeout(j->shipped_wait, !journal_has_ino(j, ino) || READ_ONCE(j->stalled),
+                     msecs_to_jiffies(VTFS_JOURNAL_WAIT_MS));
+}
+
+void vtfs_journal_kick(struct vtfs_journal* j) {
+  if (j->thread) {
+    wake_up_process(j->thread);
+  }
+}
+
+void vtfs_journal_drain(struct vtfs_journal* j) {
+  if (!vtfs_journal_enabled(j) || !journal_has_work(j)) {
+    return;
+  }
+  wake_up(&j->wait);
+  wait_event_timeout(j->shipped_wait, !journal_has_work(j) || READ_ONCE(j->stalled),
+                     msecs_to_jiffies(VTFS_JOURNAL_WAIT_MS));
+}
+
+// The caller goes to the server itself, after everything logged before
+static int journal_bypass(struct vtfs_journal* j, int err) {
+  vtfs_journal_drain(j);
+  return err;
+}
+
+/*
+ * Group commit: one flush covers every record appended so far, so callers
+ * that queue up behind a flush find their record on disk already. Once a
+ * flush fails, no record after the last good one counts as durable: the
+ * file reports a writeback error only once.
+ */
+static int journal_commit(struct vtfs_journal* j, u64 seq) {
+  u64 target;
+  int ret = 0;
+  
+  if (!vtfs_journal_durable(j)) {
+    return 0;
+  }
+  mutex_lock(&j->sync_lock);
+  if (j->synced_seq < seq) {
+    mutex_lock(&j->lock);
+    target = j->last_seq;
+    ret = j->broken ? -EIO : 0;
+    mutex_unlock(&j->lock);
+    
+    if (ret == 0) {
+      ret = vfs_fsync(j->file, 1);
+    }
+    if (ret == 0) {
+      j->synced_seq = target;
+      j->commits++;
+    } else {
+      mutex_lock(&j->lock);
+      if (!j->broken) {
+        pr_warn("[vtfs]: journal flush failed, later changes go to the server directly\n");
+      }
+      j->broken = true;
+      mutex_unlock(&j->lock);
+    }
+  }
+  mutex_unlock(&j->sync_lock);
+  return ret;
+}
+
+/*
+ * Takes a record whose commit failed back off the queue, for the caller to
+ * send itself. False if the thread has picked it up already: it is on its
+ * way to the server then.
+ */
+static bool journal_cancel(struct vtfs_journal* j, struct vtfs_journal_entry* entry, u64 seq) {
+  spin_lock(&j->queue_lock);
+  // Until the thread picks it, only this caller may free the entry
+  if (seq <= j->picked_seq) {
+    spin_unlock(&j->queue_lock);
+    return false;
+  }
+  list_del(&entry->list);
+  pending_drop(j, entry->ino);
+  j->queued--;
+  j->queued_bytes -= entry->len;
+  spin_unlock(&j->queue_lock);
+  kvfree(entry);
+  return true;
+}
+
+int vtfs_journal_append(struct vtfs_journal* j, u32 op, ino_t ino, loff_t offset, const char* data, size_t len) {
+  static const char zeros[8];
+  struct vtfs_journal_record rec;
+  struct vtfs_journal_entry* entry;
+  struct vtfs_journal_pending* spare;
+  size_t size = record_size(len);
+  loff_t pos;
+  u64 seq;
+  int ret;
+  
+  if (!vtfs_journal_enabled(j)) {
+    return -ENODEV;
+  }
+  
+  // Past the queue limit appends wait for the thread, unless the server is down
+  wait_event_timeout(j->shipped_wait, journal_has_room(j, len) || READ_ONCE(j->stalled),
+                     msecs_to_jiffies(VTFS_JOURNAL_WAIT_MS));
+  if (!journal_has_room(j, len)) {
+    return journal_bypass(j, -EBUSY);
+  }
+  
+  entry = kvmalloc(struct_size(entry, data, len), GFP_KERNEL);
+  spare = kmalloc(sizeof(*spare), GFP_KERNEL);
+  if (!entry || !spare) {
+    kvfree(entry);
+    kfree(spare);
+    return journal_bypass(j, -ENOMEM);
+  }
+  entry->op = op;
+  entry->ino = ino;
+  entry->offset = offset;
+  entry->len = len;
+  memcpy(entry->data, data, len);
+  
+  mutex_lock(&j->lock);
+  if (j->broken) {
+    mutex_unlock(&j->lock);
+    kvfree(entry);
+    kfree(spare);
+    return journal_bypass(j, -EIO);
+  }
+  
+  seq = j->last_seq + 1;
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = cpu_to_le32(VTFS_JOURNAL_RECORD_MAGIC);
+  rec.seq = cpu_to_le64(seq);
+  rec.op = cpu_to_le32(op);
+  rec.ino = cpu_to_le64(ino);
+  rec.offset = cpu_to_le64(offset);
+  rec.len = cpu_to_le64(len);
+  rec.crc = cpu_to_le32(record_crc(&rec, data, len));
+  
+  // A failed append leaves the tail where it was, for the next one to overwrite.
+  // Shipped records before the head are gone over once there are enough of them
+  pos = j->tail;
+  if (pos >= j->head && j->head - VTFS_JOURNAL_START >= VTFS_JOURNAL_WRAP &&
+      VTFS_JOURNAL_START + size <= j->head) {
+    pos = VTFS_JOURNAL_START;
+  }
+  if (pos < j->head && pos + size > j->head) {
+    // Wrapped all the way round: the thread has to catch up first
+    mutex_unlock(&j->lock);
+    kvfree(entry);
+    kfree(spare);
+    return journal_bypass(j, -ENOSPC);
+  }
+  ret = 0;
+  if (vtfs_journal_durable(j)) {
+    ret = journal_write_at(j->file, &rec, sizeof(rec), pos);
+    if (ret == 0) {
+      ret = journal_write_at(j->file, data, len, pos + sizeof(rec));
+    }
+    if (ret == 0) {
+      ret = journal_write_at(j->file, zeros, size - sizeof(rec) - len, pos + sizeof(rec) + len);
+    }
+  }
+  if (ret != 0) {
+    mutex_unlock(&j->lock);
+    kvfree(entry);
+    kfree(spare);
+    return journal_bypass(j, ret);
+  }
+  
+  j->tail = pos + size;
+  j->last_seq = seq;
+  j->records++;
+  entry->seq = seq;
+  entry->pos = pos;
+  journal_queue(j, entry, &spare);
+  mutex_unlock(&j->lock);
+  kfree(spare);
+  
+  wake_up(&j->wait);
+  ret = journal_commit(j, seq);
+  if (ret != 0 && journal_cancel(j, entry, seq)) {
+    return journal_bypass(j, ret);
+  }
+  return 0;
+}
+
+// Shipping
+
+/*
+ * The end of the run of records starting at from that ship as one: a
+ * single record, or writes to one ino that follow each other on disk.
+ */
+static unsigned int journal_run(struct vtfs_journal_entry** batch, unsigned int from, unsigned int count, size_t* out_len) {
+  struct vtfs_journal_entry* first = batch[from];
+  size_t len = first->len;
+  unsigned int end = from + 1;
+  
+  if (first->op == VTFS_JOURNAL_WRITE) {
+    while (end < count && batch[end]->op == VTFS_JOURNAL_WRITE && batch[end]->ino == first->ino &&
+           batch[end]->offset == first->offset + len && len + batch[end]->len <= VTFS_JOURNAL_COALESCE) {
+      len += batch[end]->len;
+      end++;
+    }
+  }
+  *out_len = len;
+  return end;
+}
+
+static int journal_ship_run(struct vtfs_journal* j, struct vtfs_journal_entry** run, unsigned int count, size_t len) {
+  struct vtfs_journal_entry* first = run[0];
+  char* data;
+  size_t at = 0;
+  int ret;
+  
+  if (count == 1) {
+    return j->ship(j->ctx, first->op, first->ino, first->offset, first->data, first->len);
+  }
+  
+  data = kvmalloc(len, GFP_KERNEL);
+  if (!data) {
+    return -EIO;
+  }
+  for (unsigned int i = 0; i < count; i++) {
+    memcpy(data + at, run[i]->data, run[i]->len);
+    at += run[i]->len;
+  }
+  ret = j->ship(j->ctx, first->op, first->ino, first->offset, data, len);
+  kvfree(data);
+  return ret;
+}
+
+/*
+ * Remembers that the server refused a change to ino, for the next fsync or
+ * close of the file to report. Past VTFS_JOURNAL_MAX_REFUSED files only
+ * the log and journal_dropped tell.
+ */
+static void journal_refuse(struct vtfs_journal* j, ino_t ino, int err) {
+  struct vtfs_journal_refused* r = kmalloc(sizeof(*r), GFP_KERNEL);
+  struct vtfs_journal_refused* old;
+  
+  spin_lock(&j->queue_lock);
+  hash_for_each_possible(j->refused, old, hash, ino) {
+    if (old->ino == ino) {
+      // The first error stands until it is reported
+      spin_unlock(&j->queue_lock);
+      kfree(r);
+      return;
+    }
+  }
+  if (r && j->refused_count < VTFS_JOURNAL_MAX_REFUSED) {
+    r->ino = ino;
+    r->err = err;
+    hash_add(j->refused, &r->hash, ino);
+    j->refused_count++;
+    r = NULL;
+  }
+  spin_unlock(&j->queue_lock);
+  kfree(r);
+}
+
+int vtfs_journal_take_error(struct vtfs_journal* j, ino_t ino) {
+  struct vtfs_journal_refused* r;
+  int err = 0;
+  
+  if (!vtfs_journal_enabled(j)) {
+    return 0;
+  }
+  spin_lock(&j->queue_lock);
+  hash_for_each_possible(j->refused, r, hash, ino) {
+    if (r->ino == ino) {
+      err = r->err;
+      hash_del(&r->hash);
+      j->refused_count--;
+      kfree(r);
+      break;
+    }
+  }
+  spin_unlock(&j->queue_lock);
+  return err;
+}
+
+// Forgets the first count records of the queue, which the server has now
+static void journal_retire(struct vtfs_journal* j, struct vtfs_journal_entry** batch, unsigned int count) {
+  u64 seq = batch[count - 1]->seq;
+  struct vtfs_journal_entry* first;
+  loff_t head;
+  
+  spin_lock(&j->queue_lock);
+  for (unsigned int i = 0; i < count; i++) {
+    list_del(&batch[i]->list);
+    pending_drop(j, batch[i]->ino);
+    j->queued--;
+    j->queued_bytes -= batch[i]->len;
+  }
+  j->shipped += count;
+  j->batches++;
+  j->shipped_seq = seq;
+  spin_unlock(&j->queue_lock);
+  
+  for (unsigned int i = 0; i < count; i++) {
+    kvfree(batch[i]);
+  }
+  
+  // Appends queue under lock, so an empty queue means everything appended is shipped
+  mutex_lock(&j->lock);
+  spin_lock(&j->queue_lock);
+  first = list_first_entry_or_null(&j->queue, struct vtfs_journal_entry, list);
+  head = first ? first->pos : j->tail;
+  spin_unlock(&j->queue_lock);
+  if (!first && j->tail > VTFS_JOURNAL_WRAP) {
+    // Starts over; the header has to say so before anything goes there
+    if (journal_write_header(j, seq, VTFS_JOURNAL_START) == 0) {
+      j->persisted_seq = seq;
+      j->head = VTFS_JOURNAL_START;
+      j->tail = VTFS_JOURNAL_START;
+    }
+    mutex_unlock(&j->lock);
+    return;
+  }
+  mutex_unlock(&j->lock);
+  
+  // A crash before this ships the batch again on the next mount. Records
+  // before the old head stay until the header moves past them
+  if (journal_write_header(j, seq, head) == 0) {
+    mutex_lock(&j->lock);
+    j->persisted_seq = seq;
+    j->head = head;
+    mutex_unlock(&j->lock);
+  }
+}
+
+// -EIO if the server could not be reached; what was shipped before is retired
+static int journal_ship_batch(struct vtfs_journal* j) {
+  struct vtfs_journal_entry* batch[VTFS_JOURNAL_BATCH];
+  struct vtfs_journal_entry* entry;
+  unsigned int count = 0;
+  unsigned int done = 0;
+  int ret = 0;
+  
+  // Once picked, only this thread takes records off the queue, so they stay valid unlocked
+  spin_lock(&j->queue_lock);
+  list_for_each_entry(entry, &j->queue, list) {
+    batch[count++] = entry;
+    if (count == VTFS_JOURNAL_BATCH) {
+      break;
+    }
+  }
+  if (count > 0) {
+    j->picked_seq = max(j->picked_seq, batch[count - 1]->seq);
+  }
+  spin_unlock(&j->queue_lock);
+  
+  while (done < count) {
+    size_t len;
+    unsigned int end = journal_run(batch, done, count, &len);
+    
+    ret = journal_ship_run(j, batch + done, end - done, len);
+    if (ret == -EIO) {
+      break;
+    }
+    if (ret != 0) {
+      // Retrying would not help; later records may still apply. A run is
+      // one ino, whose next fsync or close gets the error
+      pr_warn("[vtfs]: server refused journaled op %u on ino %lu: %d\n", batch[done]->op, batch[done]->ino, ret);
+      journal_refuse(j, batch[done]->ino, ret);
+      spin_lock(&j->queue_lock);
+      j->dropped += end - done;
+      spin_unlock(&j->queue_lock);
+    }
+    done = end;
+  }
+  
+  if (done > 0) {
+    journal_retire(j, batch, done);
+  }
+  return ret == -EIO ? -EIO : 0;
+}
+
+static int journal_thread(void* data) {
+  struct vtfs_journal* j = data;
+  unsigned int backoff = 0;
+  
+  while (!kthread_should_stop()) {
+    if (backoff > 0) {
+      // Only a stop cuts a retry delay short
+      schedule_timeout_interruptible(msecs_to_jiffies(backoff));
+    } else {
+      wait_event_interruptible_timeout(j->wait, journal_has_work(j) || kthread_should_stop(), HZ);
+    }
+    if (kthread_should_stop() || !journal_has_work(j)) {
+      continue;
+    }
+    
+    if (journal_ship_batch(j) == -EIO) {
+      backoff = backoff ? min_t(unsigned int, backoff * 2, VTFS_JOURNAL_RETRY_MAX_MS) : VTFS_JOURNAL_RETRY_MS;
+      WRITE_ONCE(j->stalled, true);
+    } else {
+      backoff = 0;
+      WRITE_ONCE(j->stalled, false);
+    }
+    wake_up_all(&j->shipped_wait);
+  }
+  return 0;
+}
+
+// Mount
+
+/*
+ * Reads the record at pos into a new entry, if it is one that follows prev
+ * (any record does for a prev of 0). 1 if it is, 0 where the log ends.
+ */
+static int journal_read_record(struct vtfs_journal* j, loff_t pos, u64 size, u64 prev, struct vtfs_journal_entry** out) {
+  struct vtfs_journal_record rec;
+  struct vtfs_journal_entry* entry;
+  u64 seq;
+  u64 len;
+  u32 op;
+  
+  if (pos + sizeof(rec) > size || journal_read_at(j->file, &rec, sizeof(rec), pos) != 0 ||
+      le32_to_cpu(rec.magic) != VTFS_JOURNAL_RECORD_MAGIC) {
+    return 0;
+  }
+  seq = le64_to_cpu(rec.seq);
+  len = le64_to_cpu(rec.len);
+  op = le32_to_cpu(rec.op);
+  if ((prev != 0 && seq != prev + 1) || op < VTFS_JOURNAL_WRITE || op > VTFS_JOURNAL_LINK ||
+      (op == VTFS_JOURNAL_RMDIR && len != 0) || len > size - pos - sizeof(rec)) {
+    return 0;
+  }
+  
+  entry = kvmalloc(struct_size(entry, data, len), GFP_KERNEL);
+  if (!entry) {
+    return -ENOMEM;
+  }
+  if (journal_read_at(j->file, entry->data, len, pos + sizeof(rec)) != 0 ||
+      record_crc(&rec, entry->data, len) != le32_to_cpu(rec.crc)) {
+    kvfree(entry);
+    return 0;
+  }
+  entry->seq = seq;
+  entry->pos = pos;
+  entry->op = op;
+  entry->ino = le64_to_cpu(rec.ino);
+  entry->offset = le64_to_cpu(rec.offset);
+  entry->len = len;
+  *out = entry;
+  return 1;
+}
+
+/*
+ * Queues the records after the header's shipped_seq, reading from the
+ * header's head. The log ends at the first record that is torn, fails its
+ * checksum or does not follow the one before it, which is also where
+ * records of an earlier pass begin; if that is not at the start, the log
+ * may have wrapped and goes on from there.
+ */
+static int journal_replay(struct vtfs_journal* j) {
+  u64 size = i_size_read(j->file->f_mapping->host);
+  struct vtfs_journal_header hdr;
+  static const struct vtfs_journal_header zero;
+  loff_t pos;
+  bool wrapped = false;
+  u64 shipped_seq;
+  u64 prev = 0;
+  
+  // A new file, or a zeroed device, gets its header now
+  if (size < sizeof(hdr) || journal_read_at(j->file, &hdr, sizeof(hdr), 0) != 0 ||
+      memcmp(&hdr, &zero, sizeof(hdr)) == 0) {
+    j->tail = VTFS_JOURNAL_START;
+    j->head = VTFS_JOURNAL_START;
+    return journal_write_header(j, 0, VTFS_JOURNAL_START);
+  }
+  if (memcmp(hdr.magic, VTFS_JOURNAL_MAGIC, sizeof(hdr.magic)) != 0 ||
+      le32_to_cpu(hdr.version) != VTFS_JOURNAL_VERSION) {
+    return -EINVAL;
+  }
+  shipped_seq = le64_to_cpu(hdr.shipped_seq);
+  pos = le64_to_cpu(hdr.head);
+  if (pos < VTFS_JOURNAL_START || !IS_ALIGNED(pos, 8)) {
+    return -EINVAL;
+  }
+  
+  for (;;) {
+    struct vtfs_journal_entry* entry;
+    struct vtfs_journal_pending* spare;
+    int ret = journal_read_record(j, pos, size, prev, &entry);
+    
+    if (ret < 0) {
+      return ret;
+    }
+    if (ret == 0) {
+      if (wrapped || pos == VTFS_JOURNAL_START) {
+        break;
+      }
+      wrapped = true;
+      pos = VTFS_JOURNAL_START;
+      continue;
+    }
+    
+    prev = entry->seq;
+    pos += record_size(entry->len);
+    if (entry->seq <= shipped_seq) {
+      kvfree(entry);
+      continue;
+    }
+    
+    spare = kmalloc(sizeof(*spare), GFP_KERNEL);
+    if (!spare) {
+      kvfree(entry);
+      return -ENOMEM;
+    }
+    journal_queue(j, entry, &spare);
+    kfree(spare);
+    j->replayed++;
+  }
+  
+  j->last_seq = max(shipped_seq, prev);
+  j->synced_seq = j->last_seq;
+  j->shipped_seq = shipped_seq;
+  j->persisted_seq = shipped_seq;
+  if (list_empty(&j->queue)) {
+    // Nothing left to ship: start over right away, once the header says so
+    j->tail = VTFS_JOURNAL_START;
+    j->head = VTFS_JOURNAL_START;
+    return journal_write_header(j, shipped_seq, VTFS_JOURNAL_START);
+  }
+  j->tail = pos;
+  j->head = le64_to_cpu(hdr.head);
+  return 0;
+}
+
+int vtfs_journal_open(struct vtfs_journal* j, const char* path,
+                      int (*ship)(void* ctx, u32 op, ino_t ino, loff_t offset, const char* data, size_t len),
+                      void* ctx, struct dentry* dir) {
+  struct task_struct* thread;
+  struct file* file;
+  umode_t mode;
+  int ret;
+  
+  mutex_init(&j->lock);
+  mutex_init(&j->sync_lock);
+  spin_lock_init(&j->queue_lock);
+  INIT_LIST_HEAD(&j->queue);
+  hash_init(j->pending);
+  hash_init(j->refused);
+  j->refused_count = 0;
+  init_waitqueue_head(&j->wait);
+  init_waitqueue_head(&j->shipped_wait);
+  j->open = false;
+  j->file = NULL;
+  j->thread = NULL;
+  j->tail = VTFS_JOURNAL_START;
+  j->head = VTFS_JOURNAL_START;
+  j->last_seq = 0;
+  j->synced_seq = 0;
+  j->shipped_seq = 0;
+  j->persisted_seq = 0;
+  j->picked_seq = 0;
+  j->broken = false;
+  j->stalled = false;
+  j->ship = ship;
+  j->ctx = ctx;
+  j->queued = 0;
+  j->queued_bytes = 0;
+  j->records = 0;
+  j->commits = 0;
+  j->shipped = 0;
+  j->batches = 0;
+  j->dropped = 0;
+  j->replayed = 0;
+  
+  j->open = true;
+  if (path) {
+    file = filp_open(path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    if (IS_ERR(file)) {
+      j->open = false;
+      return PTR_ERR(file);
+    }
+    mode = file_inode(file)->i_mode;
+    if (!S_ISREG(mode) && !S_ISBLK(mode)) {
+      filp_close(file, NULL);
+      j->open = false;
+      return -EINVAL;
+    }
+    j->file = file;
+    
+    ret = journal_replay(j);
+    if (ret != 0) {
+      vtfs_journal_close(j);
+      return ret;
+    }
+  }
+  
+  thread = kthread_run(journal_thread, j, "vtfs-journal");
+  if (IS_ERR(thread)) {
+    vtfs_journal_close(j);
+    return PTR_ERR(thread);
+  }
+  j->thread = thread;
+  
+  debugfs_create_u64("journal_queued", 0444, dir, &j->queued);
+  debugfs_create_u64("journal_queued_bytes", 0444, dir, &j->queued_bytes);
+  debugfs_create_u64("journal_records", 0444, dir, &j->records);
+  debugfs_create_u64("journal_commits", 0444, dir, &j->commits);
+  debugfs_create_u64("journal_shipped", 0444, dir, &j->shipped);
+  debugfs_create_u64("journal_batches", 0444, dir, &j->batches);
+  debugfs_create_u64("journal_dropped", 0444, dir, &j->dropped);
+  debugfs_create_u64("journal_replayed", 0444, dir, &j->replayed);
+  return 0;
+}
+
+void vtfs_journal_stop(struct vtfs_journal* j) {
+  if (!j->thread) {
+    return;
+  }
+  vtfs_journal_drain(j);
+  kthread_stop(j->thread);
+  j->thread = NULL;
+}
+
+// Records still queued stay in the log for the next mount, if there is one
+void vtfs_journal_close(struct vtfs_journal* j) {
+  struct vtfs_journal_entry* entry;
+  struct vtfs_journal_entry* tmp;
+  struct vtfs_journal_pending* p;
+  struct vtfs_journal_refused* r;
+  struct hlist_node* node;
+  int bkt;
+  
+  if (!vtfs_journal_enabled(j)) {
+    return;
+  }
+  
+  if (!vtfs_journal_durable(j) && !list_empty(&j->queue)) {
+    pr_warn("[vtfs]: %llu changes never reached the server\n", j->queued);
+  }
+  list_for_each_entry_safe(entry, tmp, &j->queue, list) {
+    list_del(&entry->list);
+    kvfree(entry);
+  }
+  hash_for_each_safe(j->pending, bkt, node, p, hash) {
+    hash_del(&p->hash);
+    kfree(p);
+  }
+  hash_for_each_safe(j->refused, bkt, node, r, hash) {
+    hash_del(&r->hash);
+    kfree(r);
+  }
+  if (j->file) {
+    filp_close(j->file, NULL);
+    j->file = NULL;
+  }
+  j->open = false;
+}
@@ -0,0 +1,164 @@
+#ifndef VTFS_JOURNAL_H
+#define VTFS_JOURNAL_H
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/hashtable.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+
+#define VTFS_JOURNAL_MAGIC "VTFSJNL1"
+#define VTFS_JOURNAL_VERSION 3   // 2: UNLINK records carry the parent and name; 3: the header has head
+#define VTFS_JOURNAL_RECORD_MAGIC 0x524a5456 // "VTJR"
+#define VTFS_JOURNAL_HASH_BITS 8
+// Longest a caller waits for the thread to ship something
+#define VTFS_JOURNAL_WAIT_MS 5000
+
+// Operations the journal carries; everything else goes to the server directly
+#define VTFS_JOURNAL_WRITE 1
+#define VTFS_JOURNAL_UNLINK 2   // offset is the parent's ino, data the name
+#define VTFS_JOURNAL_RMDIR 3
+#define VTFS_JOURNAL_LINK 4     // offset is the new parent's ino, data the name
+
+/*
+ * Per-mount intent log of server mode changes (the journal= mount option),
+ * a file or a block device. An operation is appended, made durable by a
+ * group commit that covers every record appended before it, and
+ * acknowledged; a thread then ships the records to the server in order,
+ * in batches, retrying while the server is unreachable. A mount replays
+ * whatever the previous one left unshipped. Records live after the
+ * header's page; once everything is shipped the log starts over from
+ * there, and once the shipped records before the oldest queued one fill
+ * VTFS_JOURNAL_WRAP bytes, new ones go over them while the rest drains.
+ * All integers are little endian. Without journal= the same queue
+ * holds, in memory only, the changes made while the server is down.
+ */
+struct vtfs_journal_header {
+  char magic[8];            // VTFS_JOURNAL_MAGIC
+  __le32 version;
+  __le32 reserved;
+  __le64 shipped_seq;       // every record up to this one reached the server
+  __le64 head;              // replay starts here, at or before the oldest unshipped record
+};
+
+// Followed by len bytes of data for a write, padded to 8 bytes
+struct vtfs_journal_record {
+  __le32 magic;             // VTFS_JOURNAL_RECORD_MAGIC
+  __le32 crc;               // crc32_le of the record and data, with crc zero
+  __le64 seq;               // one more than the record before it
+  __le32 op;
+  __le32 reserved;
+  __le64 ino;
+  __le64 offset;
+  __le64 len;
+};
+
+// A record waiting to be shipped
+struct vtfs_journal_entry {
+  struct list_head list;
+  u64 seq;
+  loff_t pos;               // where the record is in the log
+  u32 op;
+  ino_t ino;
+  loff_t offset;
+  size_t len;
+  char data[];
+};
+
+// Records of one ino still queued
+struct vtfs_journal_pending {
+  struct hlist_node hash;
+  ino_t ino;
+  unsigned int count;
+};
+
+// An ino with a change the server refused, until an fsync or close reports it
+struct vtfs_journal_refused {
+  struct hlist_node hash;
+  ino_t ino;
+  int err;
+};
+
+struct vtfs_journal {
+  struct mutex lock;        // appends: tail, last_seq, broken, records
+  struct mutex sync_lock;   // one group commit at a time
+  spinlock_t queue_lock;    // the queue, pending, refused, shipped_seq, picked_seq and the counters
+  bool open;
+  struct file* file;        // NULL for a queue in memory only
+  struct list_head queue;   // unshipped records, oldest first
+  DECLARE_HASHTABLE(pending, VTFS_JOURNAL_HASH_BITS);
+  DECLARE_HASHTABLE(refused, VTFS_JOURNAL_HASH_BITS);
+  unsigned int refused_count;
+  loff_t tail;              // where the next record goes
+  loff_t head;              // the header's head; a wrapped tail stops short of it
+  u64 last_seq;             // last record appended
+  u64 synced_seq;           // last record on stable storage
+  u64 shipped_seq;          // last record the server took
+  u64 persisted_seq;        // shipped_seq as the header on disk has it
+  u64 picked_seq;           // last record the thread has taken up for shipping
+  bool broken;              // a commit failed; new changes bypass the journal
+  bool stalled;             // the server is unreachable, the thread is retrying
+  struct task_struct* thread;
+  wait_queue_head_t wait;   // the thread waits for records
+  wait_queue_head_t shipped_wait; // callers wait for the thread
+  // Sends one operation; -EIO if the server could not be reached
+  int (*ship)(void* ctx, u32 op, ino_t ino, loff_t offset, const char* data, size_t len);
+  void* ctx;
+  u64 records;              // appended since the mount
+  u64 commits;              // flushes to stable storage, under sync_lock
+  u64 queued;               // records and write bytes waiting
+  u64 queued_bytes;
+  u64 shipped;              // records the server took
+  u64 batches;
+  u64 dropped;              // records the server refused
+  u64 replayed;             // records found unshipped at mount
+};
+
+/*
+ * Opens or creates the journal at path, queues what the previous mount
+ * left unshipped and starts shipping; with a NULL path, starts an empty
+ * queue in memory. -EINVAL for a file that is not a journal.
+ */
+int vtfs_journal_open(struct vtfs_journal* j, const char* path,
+                      int (*ship)(void* ctx, u32 op, ino_t ino, loff_t offset, const char* data, size_t len),
+                      void* ctx, struct dentry* dir);
+// Ships what it can within VTFS_JOURNAL_WAIT_MS and stops the thread; the rest stays for the next mount
+void vtfs_journal_stop(struct vtfs_journal* j);
+// The debugfs files must be gone already
+void vtfs_journal_close(struct vtfs_journal* j);
+
+static inline bool vtfs_journal_enabled(struct vtfs_journal* j) {
+  return j->open;
+}
+
+// Whether appends survive a crash
+static inline bool vtfs_journal_durable(struct vtfs_journal* j) {
+  return j->file != NULL;
+}
+
+static inline bool vtfs_journal_idle(struct vtfs_journal* j) {
+  return !j->open || list_empty(&j->queue);
+}
+
+/*
+ * Logs one operation for the server and returns once it is durable, if
+ * the journal is on disk. Not 0 if the journal did not take it, or could
+ * not make it durable: what it holds has been shipped, or waited on, and
+ * the caller sends the operation to the server itself.
+ */
+int vtfs_journal_append(struct vtfs_journal* j, u32 op, ino_t ino, loff_t offset, const char* data, size_t len);
+// Waits until nothing of ino is queued, for at most VTFS_JOURNAL_WAIT_MS and
+// not at all while the server is unreachable
+void vtfs_journal_wait_ino(struct vtfs_journal* j, ino_t ino);
+// The same for the whole queue
+void vtfs_journal_drain(struct vtfs_journal* j);
+// The server is back: ships now instead of after the retry delay
+void vtfs_journal_kick(struct vtfs_journal* j);
+// The error of a change to ino the server refused since the last call, or 0
+int vtfs_journal_take_error(struct vtfs_journal* j, ino_t ino);
+
+#endif // VTFS_JOURNAL_H
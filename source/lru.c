@@ -0,0 +1,217 @@
+#include "lru.h"
+#include <linux/debugfs.h>
+#include <linux/slab.h>
+
+static struct vtfs_lru_entry* lru_find(struct vtfs_lru* lru, ino_t ino) {
+  struct vtfs_lru_entry* entry;
+  
+  hash_for_each_possible(lru->table, entry, hash, ino) {
+    if (entry->ino == ino) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Resident and charged bytes; the caller holds lock
+static u64 lru_used(struct vtfs_lru* lru) {
+  return lru->resident + (lru->charged ? READ_ONCE(*lru->charged) : 0);
+}
+
+static void lru_remove(struct vtfs_lru* lru, struct vtfs_lru_entry* entry) {
+  lru->resident -= entry->bytes;
+  if (entry->dirty) {
+    lru->dirty -= entry->bytes;
+  }
+  hash_del(&entry->hash);
+  list_del(&entry->order);
+  kfree(entry);
+}
+
+void vtfs_lru_set(struct vtfs_lru* lru, ino_t ino, size_t bytes) {
+  struct vtfs_lru_entry* entry;
+  
+  mutex_lock(&lru->lock);
+  entry = lru_find(lru, ino);
+  if (bytes == 0) {
+    if (entry) {
+      lru_remove(lru, entry);
+    }
+    mutex_unlock(&lru->lock);
+    return;
+  }
+  
+  if (!entry) {
+    entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+    if (!entry) {
+      // Not accounted, so never evicted; harmless
+      mutex_unlock(&lru->lock);
+      return;
+    }
+    entry->ino = ino;
+    entry->bytes = 0;
+    entry->dirty = false;
+    entry->kept = false;
+    hash_add(lru->table, &entry->hash, ino);
+    list_add_tail(&entry->order, &lru->order);
+  } else {
+    list_move_tail(&entry->order, &lru->order);
+  }
+  
+  lru->resident = lru->resident - entry->bytes + bytes;
+  if (entry->dirty) {
+    lru->dirty = lru->dirty - entry->bytes + bytes;
+  }
+  if (entry->bytes != bytes) {
+    entry->kept = false;
+  }
+  entry->bytes = bytes;
+  mutex_unlock(&lru->lock);
+}
+
+void vtfs_lru_touch(struct vtfs_lru* lru, ino_t ino) {
+  struct vtfs_lru_entry* entry;
+  
+  mutex_lock(&lru->lock);
+  entry = lru_find(lru, ino);
+  if (entry) {
+    list_move_tail(&entry->order, &lru->order);
+  }
+  mutex_unlock(&lru->lock);
+}
+
+void vtfs_lru_keep(struct vtfs_lru* lru, ino_t ino) {
+  struct vtfs_lru_entry* entry;
+  
+  mutex_lock(&lru->lock);
+  entry = lru_find(lru, ino);
+  if (entry) {
+    entry->kept = true;
+    list_move_tail(&entry->order, &lru->order);
+  }
+  mutex_unlock(&lru->lock);
+}
+
+void vtfs_lru_mark_dirty(struct vtfs_lru* lru, ino_t ino, bool dirty) {
+  struct vtfs_lru_entry* entry;
+  
+  mutex_lock(&lru->lock);
+  entry = lru_find(lru, ino);
+  if (entry && entry->dirty != dirty) {
+    entry->dirty = dirty;
+    if (dirty) {
+      lru->dirty += entry->bytes;
+    } else {
+      lru->dirty -= entry->bytes;
+    }
+  }
+  mutex_unlock(&lru->lock);
+}
+
+bool vtfs_lru_is_dirty(struct vtfs_lru* lru, ino_t ino) {
+  struct vtfs_lru_entry* entry;
+  bool dirty;
+  
+  mutex_lock(&lru->lock);
+  entry = lru_find(lru, ino);
+  dirty = entry && entry->dirty;
+  mutex_unlock(&lru->lock);
+  return dirty;
+}
+
+bool vtfs_lru_victim(struct vtfs_lru* lru, ino_t keep, size_t more, ino_t* out_ino, bool* out_dirty) {
+  struct vtfs_lru_entry* entry;
+  bool found = false;
+  
+  mutex_lock(&lru->lock);
+  if (lru->limit && lru_used(lru) + more > lru->limit) {
+    list_for_each_entry(entry, &lru->order, order) {
+      if (entry->ino != keep && !entry->kept) {
+        *out_ino = entry->ino;
+        *out_dirty = entry->dirty;
+        found = true;
+        break;
+      }
+    }
+  }
+  mutex_unlock(&lru->lock);
+  return found;
+}
+
+void vtfs_lru_evicted(struct vtfs_lru* lru, ino_t ino) {
+  struct vtfs_lru_entry* entry;
+  
+  mutex_lock(&lru->lock);
+  entry = lru_find(lru, ino);
+  if (entry) {
+    lru->evicted += entry->bytes;
+    lru_remove(lru, entry);
+  }
+  mutex_unlock(&lru->lock);
+}
+
+bool vtfs_lru_fits(struct vtfs_lru* lru, size_t more) {
+  bool fits;
+  
+  mutex_lock(&lru->lock);
+  fits = !lru->limit || lru_used(lru) + more <= lru->limit;
+  mutex_unlock(&lru->lock);
+  return fits;
+}
+
+u64 vtfs_lru_reclaimable(struct vtfs_lru* lru) {
+  u64 resident = READ_ONCE(lru->resident);
+  u64 dirty = READ_ONCE(lru->dirty);
+  
+  return resident > dirty ? resident - dirty : 0;
+}
+
+bool vtfs_lru_oldest_clean(struct vtfs_lru* lru, ino_t* out_ino) {
+  struct vtfs_lru_entry* entry;
+  bool found = false;
+  
+  mutex_lock(&lru->lock);
+  list_for_each_entry(entry, &lru->order, order) {
+    if (!entry->dirty && !entry->kept) {
+      *out_ino = entry->ino;
+      found = true;
+      break;
+    }
+  }
+  mutex_unlock(&lru->lock);
+  return found;
+}
+
+void vtfs_lru_init(struct vtfs_lru* lru, u64 limit, struct dentry* dir) {
+  mutex_init(&lru->lock);
+  hash_init(lru->table);
+  INIT_LIST_HEAD(&lru->order);
+  lru->limit = limit;
+  lru->resident = 0;
+  lru->dirty = 0;
+  lru->evicted = 0;
+  lru->charged = NULL;
+  
+  debugfs_create_u64("mem_limit", 0444, dir, &lru->limit);
+  debugfs_create_u64("mem_resident", 0444, dir, &lru->resident);
+  debugfs_create_u64("mem_dirty", 0444, dir, &lru->dirty);
+  debugfs_create_u64("mem_evicted", 0444, dir, &lru->evicted);
+}
+
+void vtfs_lru_charge(struct vtfs_lru* lru, const u64* bytes) {
+  lru->charged = bytes;
+}
+
+// The debugfs files must be gone already
+void vtfs_lru_destroy(struct vtfs_lru* lru) {
+  struct vtfs_lru_entry* entry;
+  struct vtfs_lru_entry* tmp;
+  
+  list_for_each_entry_safe(entry, tmp, &lru->order, order) {
+    hash_del(&entry->hash);
+    list_del(&entry->order);
+    kfree(entry);
+  }
+  lru->resident = 0;
+  lru->dirty = 0;
+}
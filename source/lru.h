@@ -0,0 +1,72 @@
+#ifndef VTFS_LRU_H
+#define VTFS_LRU_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/hashtable.h>
+#include <linux/mutex.h>
+#include <linux/dcache.h>
+
+#define VTFS_LRU_HASH_BITS 10
+
+/*
+ * Per-mount account of the file data held in memory, one entry per ino
+ * (all links of a file share one buffer), in least recently used order.
+ * With the mem_limit mount option a server mode mount evicts the oldest
+ * buffers once more than the limit is resident; RAM mode has no tier to
+ * evict to and refuses to grow past it. Bytes a mount holds elsewhere, e.g.
+ * compressed, can be charged against the limit too. The byte counters are in debugfs
+ * vtfs/<major:minor>/mem_{limit,resident,dirty,evicted}.
+ */
+struct vtfs_lru_entry {
+  struct hlist_node hash;
+  struct list_head order;
+  ino_t ino;
+  size_t bytes;
+  bool dirty;               // newer than the server's copy
+  bool kept;                // evicting it would free nothing, so it is no victim
+};
+
+struct vtfs_lru {
+  struct mutex lock;
+  DECLARE_HASHTABLE(table, VTFS_LRU_HASH_BITS);
+  struct list_head order;   // oldest first
+  u64 limit;                // 0 for no limit
+  u64 resident;
+  u64 dirty;
+  u64 evicted;              // total ever evicted
+  const u64* charged;       // other bytes counted against the limit, or NULL
+};
+
+void vtfs_lru_init(struct vtfs_lru* lru, u64 limit, struct dentry* dir);
+void vtfs_lru_destroy(struct vtfs_lru* lru);
+// The limit also covers *bytes, which the caller keeps up to date
+void vtfs_lru_charge(struct vtfs_lru* lru, const u64* bytes);
+
+// ino now holds bytes in memory and is the most recently used; 0 forgets it
+void vtfs_lru_set(struct vtfs_lru* lru, ino_t ino, size_t bytes);
+// ino becomes the most recently used and keeps its bytes
+void vtfs_lru_touch(struct vtfs_lru* lru, ino_t ino);
+// ino stays resident, and is no victim, until its size changes
+void vtfs_lru_keep(struct vtfs_lru* lru, ino_t ino);
+void vtfs_lru_mark_dirty(struct vtfs_lru* lru, ino_t ino, bool dirty);
+bool vtfs_lru_is_dirty(struct vtfs_lru* lru, ino_t ino);
+
+/*
+ * While more than the limit, less more bytes, is used, returns the least
+ * recently used ino other than keep, and whether it is dirty. The caller drops its
+ * buffer and reports it with vtfs_lru_evicted, or calls vtfs_lru_set or
+ * vtfs_lru_touch to keep it, which makes it the most recently used.
+ */
+bool vtfs_lru_victim(struct vtfs_lru* lru, ino_t keep, size_t more, ino_t* out_ino, bool* out_dirty);
+void vtfs_lru_evicted(struct vtfs_lru* lru, ino_t ino);
+
+// Whether growing resident data by more bytes stays within the limit, charges included
+bool vtfs_lru_fits(struct vtfs_lru* lru, size_t more);
+
+// Resident bytes that can be dropped without a flush; lockless, for the shrinker
+u64 vtfs_lru_reclaimable(struct vtfs_lru* lru);
+// The least recently used clean ino, whatever the limit
+bool vtfs_lru_oldest_clean(struct vtfs_lru* lru, ino_t* out_ino);
+
+#endif // VTFS_LRU_H
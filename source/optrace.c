@@ -0,0 +1,276 @@
+#include "optrace.h"
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+// Upper bound for optrace_entries, about 300 MiB of entries plus paths
+#define VTFS_OPTRACE_MAX_ENTRIES (1U << 22)
+
+// Escaped paths can double in size
+#define VTFS_OPTRACE_LINE_MAX (4 * PATH_MAX + 256)
+
+struct optrace_reader {
+  struct vtfs_optrace* trace;
+  size_t len;
+  size_t pos;
+  char line[VTFS_OPTRACE_LINE_MAX];
+};
+
+static char* optrace_path(struct dentry* dentry) {
+  char* buf;
+  char* path;
+  char* copy = NULL;
+  
+  if (!dentry) {
+    return NULL;
+  }
+  buf = __getname();
+  if (!buf) {
+    return NULL;
+  }
+  path = dentry_path_raw(dentry, buf, PATH_MAX);
+  if (!IS_ERR(path)) {
+    copy = kstrdup(path, GFP_KERNEL);
+  }
+  __putname(buf);
+  return copy;
+}
+
+static void optrace_entry_free(struct vtfs_optrace_entry* entry) {
+  kfree(entry->path);
+  kfree(entry->path2);
+  entry->path = NULL;
+  entry->path2 = NULL;
+}
+
+void vtfs_optrace_record(struct vtfs_optrace* trace, enum vtfs_op op, ino_t ino,
+                         loff_t offset, u64 len, long result, u64 start_ns, u64 latency_ns,
+                         const struct vtfs_optrace_call* call) {
+  struct vtfs_optrace_entry entry = {
+    .start_ns = start_ns,
+    .latency_ns = latency_ns,
+    .result = result,
+    .offset = offset,
+    .len = len,
+    .pid = task_pid_nr(current),
+    .ino = ino,
+    .op = op,
+  };
+  struct vtfs_optrace_entry victim = {};
+  
+  if (!vtfs_optrace_enabled(trace)) {
+    return;
+  }
+  if (call) {
+    entry.path = optrace_path(call->dentry);
+    entry.path2 = optrace_path(call->dentry2);
+    entry.offset2 = call->offset2;
+    entry.flags = call->flags;
+  }
+  
+  spin_lock(&trace->lock);
+  if (trace->capacity == 0) {
+    // Disabled while the paths were being built
+    victim = entry;
+  } else {
+    if (trace->count == trace->capacity) {
+      victim = trace->ring[trace->head];
+      trace->dropped++;
+    } else {
+      trace->count++;
+    }
+    trace->ring[trace->head] = entry;
+    trace->head = (trace->head + 1) % trace->capacity;
+  }
+  spin_unlock(&trace->lock);
+  
+  optrace_entry_free(&victim);
+}
+
+// Takes the oldest entry out of the ring; the caller frees its paths
+static bool optrace_pop(struct vtfs_optrace* trace, struct vtfs_optrace_entry* out) {
+  bool found = false;
+  
+  spin_lock(&trace->lock);
+  if (trace->count > 0) {
+    u32 oldest = (trace->head + trace->capacity - trace->count) % trace->capacity;
+    *out = trace->ring[oldest];
+    trace->ring[oldest].path = NULL;
+    trace->ring[oldest].path2 = NULL;
+    trace->count--;
+    found = true;
+  }
+  spin_unlock(&trace->lock);
+  return found;
+}
+
+// Appends path with backslash, tab and newline escaped, or "-" for none
+static size_t optrace_put_path(char* buf, size_t size, const char* path) {
+  size_t n = 0;
+  
+  if (!path) {
+    return scnprintf(buf, size, "-");
+  }
+  for (; *path && n + 2 < size; path++) {
+    switch (*path) {
+    case '\\':
+      buf[n++] = '\\';
+      buf[n++] = '\\';
+      break;
+    case '\t':
+      buf[n++] = '\\';
+      buf[n++] = 't';
+      break;
+    case '\n':
+      buf[n++] = '\\';
+      buf[n++] = 'n';
+      break;
+    default:
+      buf[n++] = *path;
+    }
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+/*
+ * One tab separated line per call:
+ *   start_ns pid op ino offset len offset2 flags result latency_ns path path2
+ */
+static size_t optrace_format(char* buf, size_t size, const struct vtfs_optrace_entry* e) {
+  size_t n;
+  
+  n = scnprintf(buf, size, "%llu\t%d\t%s\t%lu\t%lld\t%llu\t%lld\t%u\t%ld\t%llu\t",
+                e->start_ns, e->pid, vtfs_op_name(e->op), e->ino, e->offset, e->len,
+                e->offset2, e->flags, e->result, e->latency_ns);
+  n += optrace_put_path(buf + n, size - n, e->path);
+  n += scnprintf(buf + n, size - n, "\t");
+  n += optrace_put_path(buf + n, size - n, e->path2);
+  n += scnprintf(buf + n, size - n, "\n");
+  return n;
+}
+
+static int optrace_open(struct inode* inode, struct file* file) {
+  struct optrace_reader* reader = kvmalloc(sizeof(*reader), GFP_KERNEL);
+  
+  if (!reader) {
+    return -ENOMEM;
+  }
+  reader->trace = inode->i_private;
+  reader->len = 0;
+  reader->pos = 0;
+  file->private_data = reader;
+  return nonseekable_open(inode, file);
+}
+
+static int optrace_release(struct inode* inode, struct file* file) {
+  kvfree(file->private_data);
+  return 0;
+}
+
+/*
+ * Consumes entries, oldest first; returns 0 once the ring is empty. A line
+ * that does not fit is finished by the next read on the same file.
+ */
+static ssize_t optrace_read(struct file* file, char __user* buf, size_t count, loff_t* ppos) {
+  struct optrace_reader* reader = file->private_data;
+  size_t copied = 0;
+  
+  while (copied < count) {
+    size_t n;
+    
+    if (reader->pos == reader->len) {
+      struct vtfs_optrace_entry entry;
+      
+      if (!optrace_pop(reader->trace, &entry)) {
+        break;
+      }
+      reader->len = optrace_format(reader->line, sizeof(reader->line), &entry);
+      reader->pos = 0;
+      optrace_entry_free(&entry);
+    }
+    
+    n = min(reader->len - reader->pos, count - copied);
+    if (copy_to_user(buf + copied, reader->line + reader->pos, n)) {
+      return copied ? copied : -EFAULT;
+    }
+    reader->pos += n;
+    copied += n;
+  }
+  return copied;
+}
+
+static const struct file_operations optrace_fops = {
+  .owner = THIS_MODULE,
+  .open = optrace_open,
+  .release = optrace_release,
+  .read = optrace_read,
+};
+
+static int optrace_entries_get(void* data, u64* val) {
+  struct vtfs_optrace* trace = data;
+  *val = READ_ONCE(trace->capacity);
+  return 0;
+}
+
+// Replaces the ring, dropping what was in it; 0 turns recording off
+static int optrace_entries_set(void* data, u64 val) {
+  struct vtfs_optrace* trace = data;
+  struct vtfs_optrace_entry* ring = NULL;
+  struct vtfs_optrace_entry* old;
+  u32 old_capacity;
+  
+  if (val > VTFS_OPTRACE_MAX_ENTRIES) {
+    return -EINVAL;
+  }
+  if (val > 0) {
+    ring = kvcalloc(val, sizeof(*ring), GFP_KERNEL);
+    if (!ring) {
+      return -ENOMEM;
+    }
+  }
+  
+  spin_lock(&trace->lock);
+  old = trace->ring;
+  old_capacity = trace->capacity;
+  trace->ring = ring;
+  WRITE_ONCE(trace->capacity, val);
+  trace->head = 0;
+  trace->count = 0;
+  trace->dropped = 0;
+  spin_unlock(&trace->lock);
+  
+  for (u32 i = 0; i < old_capacity; i++) {
+    optrace_entry_free(&old[i]);
+  }
+  kvfree(old);
+  return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(optrace_entries_fops, optrace_entries_get, optrace_entries_set, "%llu\n");
+
+void vtfs_optrace_init(struct vtfs_optrace* trace, struct dentry* dir) {
+  spin_lock_init(&trace->lock);
+  trace->ring = NULL;
+  trace->capacity = 0;
+  trace->head = 0;
+  trace->count = 0;
+  trace->dropped = 0;
+  
+  debugfs_create_file("optrace", 0400, dir, trace, &optrace_fops);
+  debugfs_create_file_unsafe("optrace_entries", 0600, dir, trace, &optrace_entries_fops);
+  debugfs_create_u64("optrace_dropped", 0444, dir, &trace->dropped);
+}
+
+// The debugfs files must be gone already
+void vtfs_optrace_destroy(struct vtfs_optrace* trace) {
+  for (u32 i = 0; i < trace->capacity; i++) {
+    optrace_entry_free(&trace->ring[i]);
+  }
+  kvfree(trace->ring);
+  trace->ring = NULL;
+  trace->capacity = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef VTFS_OPTRACE_H
+#define VTFS_OPTRACE_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/dcache.h>
+#include "stats.h"
+
+/*
+ * Per-mount ring of recent VFS calls, for capturing a workload and replaying
+ * it elsewhere (bench/vtfs_replay.py). Off until a size is written to
+ * debugfs vtfs/<major:minor>/optrace_entries; reading vtfs/<major:minor>/optrace
+ * consumes the oldest entries. When the ring is full the oldest entry is
+ * overwritten and counted as dropped.
+ */
+struct vtfs_optrace_entry {
+  u64 start_ns;
+  u64 latency_ns;
+  long result;
+  loff_t offset;
+  loff_t offset2;
+  u64 len;
+  u32 flags;
+  pid_t pid;
+  ino_t ino;
+  enum vtfs_op op;
+  // Relative to the mount root; NULL when not applicable
+  char* path;
+  char* path2;
+};
+
+struct vtfs_optrace {
+  spinlock_t lock;
+  struct vtfs_optrace_entry* ring;
+  u32 capacity;
+  u32 head;
+  u32 count;
+  u64 dropped;
+};
+
+/*
+ * What the replayer needs beyond the tracepoint fields: the dentry the call
+ * acted on and, for link, copy and clone, the other one (link target or
+ * copy source) with its offset. flags is op specific: the mode for create
+ * and mkdir, f_flags for open, ia_valid for setattr, the copy or remap flags.
+ */
+struct vtfs_optrace_call {
+  struct dentry* dentry;
+  struct dentry* dentry2;
+  loff_t offset2;
+  u32 flags;
+};
+
+void vtfs_optrace_init(struct vtfs_optrace* trace, struct dentry* dir);
+void vtfs_optrace_destroy(struct vtfs_optrace* trace);
+
+static inline bool vtfs_optrace_enabled(struct vtfs_optrace* trace) {
+  return READ_ONCE(trace->capacity) != 0;
+}
+
+// May sleep; callers in RCU walk mode must not record
+void vtfs_optrace_record(struct vtfs_optrace* trace, enum vtfs_op op, ino_t ino,
+                         loff_t offset, u64 len, long result, u64 start_ns, u64 latency_ns,
+                         const struct vtfs_optrace_call* call);
+
+#endif // VTFS_OPTRACE_H
@@ -0,0 +1,283 @@
+#include "stats.h"
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+
+static const char* const op_names[VTFS_OP_COUNT] = {
+  [VTFS_OP_LOOKUP] = "lookup",
+  [VTFS_OP_ITERATE] = "iterate",
+  [VTFS_OP_CREATE] = "create",
+  [VTFS_OP_UNLINK] = "unlink",
+  [VTFS_OP_MKDIR] = "mkdir",
+  [VTFS_OP_RMDIR] = "rmdir",
+  [VTFS_OP_LINK] = "link",
+  [VTFS_OP_GETATTR] = "getattr",
+  [VTFS_OP_SETATTR] = "setattr",
+  [VTFS_OP_OPEN] = "open",
+  [VTFS_OP_READ] = "read",
+  [VTFS_OP_WRITE] = "write",
+  [VTFS_OP_COPY] = "copy_file_range",
+  [VTFS_OP_CLONE] = "remap_file_range",
+  [VTFS_OP_REVALIDATE] = "d_revalidate",
+};
+
+// Same names as the server endpoints
+static const char* const http_names[VTFS_HTTP_COUNT] = {
+  [VTFS_HTTP_LIST] = "list",
+  [VTFS_HTTP_CREATE] = "create",
+  [VTFS_HTTP_READ] = "read",
+  [VTFS_HTTP_WRITE] = "write",
+  [VTFS_HTTP_COPY] = "copy",
+  [VTFS_HTTP_DELETE] = "delete",
+  [VTFS_HTTP_MKDIR] = "mkdir",
+  [VTFS_HTTP_RMDIR] = "rmdir",
+  [VTFS_HTTP_LINK] = "link",
+  [VTFS_HTTP_UNLINK] = "unlink",
+  [VTFS_HTTP_CHANGES] = "changes",
+  [VTFS_HTTP_OTHER] = "other",
+};
+
+static const char* const phase_names[VTFS_PHASE_COUNT] = {
+  [VTFS_PHASE_CONNECT] = "connect",
+  [VTFS_PHASE_SEND] = "send",
+  [VTFS_PHASE_WAIT] = "wait",
+  [VTFS_PHASE_RECEIVE] = "receive",
+  [VTFS_PHASE_TOTAL] = "total",
+};
+
+static struct dentry* vtfs_debugfs_root;
+
+static void hist_add(struct vtfs_hist* hist, u64 ns, bool failed) {
+  int bucket = ns ? ilog2(ns) : 0;
+  
+  hist->count++;
+  if (failed) {
+    hist->errors++;
+  }
+  hist->sum_ns += ns;
+  if (ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+  hist->buckets[min(bucket, VTFS_HIST_BUCKETS - 1)]++;
+}
+
+static void hist_merge(struct vtfs_hist* into, const struct vtfs_hist* from) {
+  into->count += from->count;
+  into->errors += from->errors;
+  into->sum_ns += from->sum_ns;
+  into->max_ns = max(into->max_ns, from->max_ns);
+  for (int i = 0; i < VTFS_HIST_BUCKETS; i++) {
+    into->buckets[i] += from->buckets[i];
+  }
+}
+
+const char* vtfs_op_name(enum vtfs_op op) {
+  return op < VTFS_OP_COUNT ? op_names[op] : "unknown";
+}
+
+void vtfs_stats_op(struct vtfs_stats* stats, enum vtfs_op op, u64 ns, bool failed) {
+  struct vtfs_stats_cpu* cpu;
+  
+  if (!stats || !stats->cpu) {
+    return;
+  }
+  
+  cpu = get_cpu_ptr(stats->cpu);
+  hist_add(&cpu->ops[op], ns, failed);
+  put_cpu_ptr(stats->cpu);
+}
+
+static enum vtfs_http_method http_method(const char* method) {
+  for (int i = 0; i < VTFS_HTTP_OTHER; i++) {
+    if (strcmp(method, http_names[i]) == 0) {
+      return i;
+    }
+  }
+  return VTFS_HTTP_OTHER;
+}
+
+void vtfs_stats_http(struct vtfs_stats* stats, const char* method,
+                     const u64 phase_ns[VTFS_PHASE_COUNT],
+                     size_t sent, size_t received, bool failed) {
+  enum vtfs_http_method m;
+  struct vtfs_stats_cpu* cpu;
+  
+  if (!stats || !stats->cpu) {
+    return;
+  }
+  
+  m = http_method(method);
+  cpu = get_cpu_ptr(stats->cpu);
+  for (int phase = 0; phase < VTFS_PHASE_COUNT; phase++) {
+    if (phase_ns[phase] != VTFS_PHASE_SKIPPED) {
+      hist_add(&cpu->http[m][phase], phase_ns[phase], failed);
+    }
+  }
+  cpu->http_sent[m] += sent;
+  cpu->http_received[m] += received;
+  put_cpu_ptr(stats->cpu);
+}
+
+// Sums all CPUs; the caller frees the result
+static struct vtfs_stats_cpu* stats_sum(struct vtfs_stats* stats) {
+  struct vtfs_stats_cpu* sum;
+  int cpu;
+  
+  sum = kvzalloc(sizeof(*sum), GFP_KERNEL);
+  if (!sum) {
+    return NULL;
+  }
+  
+  for_each_possible_cpu(cpu) {
+    struct vtfs_stats_cpu* c = per_cpu_ptr(stats->cpu, cpu);
+    for (int op = 0; op < VTFS_OP_COUNT; op++) {
+      hist_merge(&sum->ops[op], &c->ops[op]);
+    }
+    for (int m = 0; m < VTFS_HTTP_COUNT; m++) {
+      for (int phase = 0; phase < VTFS_PHASE_COUNT; phase++) {
+        hist_merge(&sum->http[m][phase], &c->http[m][phase]);
+      }
+      sum->http_sent[m] += c->http_sent[m];
+      sum->http_received[m] += c->http_received[m];
+    }
+  }
+  return sum;
+}
+
+// Bucket bounds in bpftrace style: 512, 1K, 2K, ..., 1M, ..., 1G
+static void show_bound(struct seq_file* m, int shift) {
+  static const char units[] = " KMG";
+  int unit = min(shift / 10, 3);
+  
+  if (unit == 0) {
+    seq_printf(m, "%llu", 1ULL << shift);
+  } else {
+    seq_printf(m, "%llu%c", 1ULL << (shift - unit * 10), units[unit]);
+  }
+}
+
+/*
+ * One summary line, then one line per non-empty bucket:
+ *   name count=N errors=N avg_ns=N max_ns=N
+ *     [1K, 2K) N
+ */
+static void show_hist(struct seq_file* m, const char* name, const char* phase, const struct vtfs_hist* hist) {
+  if (hist->count == 0) {
+    return;
+  }
+  
+  seq_printf(m, "%s%s%s count=%llu errors=%llu avg_ns=%llu max_ns=%llu\n",
+             name, phase ? "." : "", phase ? phase : "",
+             hist->count, hist->errors, div64_u64(hist->sum_ns, hist->count), hist->max_ns);
+  for (int i = 0; i < VTFS_HIST_BUCKETS; i++) {
+    if (hist->buckets[i] == 0) {
+      continue;
+    }
+    seq_puts(m, "  [");
+    show_bound(m, i);
+    seq_puts(m, ", ");
+    if (i < VTFS_HIST_BUCKETS - 1) {
+      show_bound(m, i + 1);
+    } else {
+      seq_puts(m, "...");
+    }
+    seq_printf(m, ") %llu\n", hist->buckets[i]);
+  }
+}
+
+static int ops_show(struct seq_file* m, void* v) {
+  struct vtfs_stats_cpu* sum = stats_sum(m->private);
+  
+  if (!sum) {
+    return -ENOMEM;
+  }
+  for (int op = 0; op < VTFS_OP_COUNT; op++) {
+    show_hist(m, op_names[op], NULL, &sum->ops[op]);
+  }
+  kvfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ops);
+
+static int http_show(struct seq_file* m, void* v) {
+  struct vtfs_stats_cpu* sum = stats_sum(m->private);
+  
+  if (!sum) {
+    return -ENOMEM;
+  }
+  for (int method = 0; method < VTFS_HTTP_COUNT; method++) {
+    if (sum->http[method][VTFS_PHASE_TOTAL].count == 0) {
+      continue;
+    }
+    seq_printf(m, "%s bytes_sent=%llu bytes_received=%llu\n", http_names[method],
+               sum->http_sent[method], sum->http_received[method]);
+    for (int phase = 0; phase < VTFS_PHASE_COUNT; phase++) {
+      show_hist(m, http_names[method], phase_names[phase], &sum->http[method][phase]);
+    }
+  }
+  kvfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(http);
+
+/*
+ * Any write clears all counters of the mount. Calls recorded while the
+ * reset runs may be lost or half counted.
+ */
+static ssize_t reset_write(struct file* file, const char __user* buf, size_t len, loff_t* ppos) {
+  struct vtfs_stats* stats = file->private_data;
+  int cpu;
+  
+  for_each_possible_cpu(cpu) {
+    memset(per_cpu_ptr(stats->cpu, cpu), 0, sizeof(struct vtfs_stats_cpu));
+  }
+  return len;
+}
+
+static const struct file_operations reset_fops = {
+  .owner = THIS_MODULE,
+  .open = simple_open,
+  .write = reset_write,
+  .llseek = noop_llseek,
+};
+
+int vtfs_stats_init(struct vtfs_stats* stats, dev_t dev) {
+  char name[32];
+  
+  stats->dir = NULL;
+  stats->cpu = alloc_percpu(struct vtfs_stats_cpu);
+  if (!stats->cpu) {
+    return -ENOMEM;
+  }
+  
+  // Same as `mountpoint -d` prints for the mount
+  snprintf(name, sizeof(name), "%u:%u", MAJOR(dev), MINOR(dev));
+  stats->dir = debugfs_create_dir(name, vtfs_debugfs_root);
+  debugfs_create_file("ops", 0444, stats->dir, stats, &ops_fops);
+  debugfs_create_file("http", 0444, stats->dir, stats, &http_fops);
+  debugfs_create_file("reset", 0200, stats->dir, stats, &reset_fops);
+  return 0;
+}
+
+void vtfs_stats_destroy(struct vtfs_stats* stats) {
+  // Waits for reads of its files still running
+  debugfs_remove(stats->dir);
+  stats->dir = NULL;
+  free_percpu(stats->cpu);
+  stats->cpu = NULL;
+}
+
+void vtfs_stats_register(void) {
+  vtfs_debugfs_root = debugfs_create_dir("vtfs", NULL);
+}
+
+void vtfs_stats_unregister(void) {
+  debugfs_remove(vtfs_debugfs_root);
+  vtfs_debugfs_root = NULL;
+}
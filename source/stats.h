@@ -0,0 +1,101 @@
+#ifndef VTFS_STATS_H
+#define VTFS_STATS_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+
+// VFS entry points, each with its own latency histogram
+enum vtfs_op {
+  VTFS_OP_LOOKUP,
+  VTFS_OP_ITERATE,
+  VTFS_OP_CREATE,
+  VTFS_OP_UNLINK,
+  VTFS_OP_MKDIR,
+  VTFS_OP_RMDIR,
+  VTFS_OP_LINK,
+  VTFS_OP_GETATTR,
+  VTFS_OP_SETATTR,
+  VTFS_OP_OPEN,
+  VTFS_OP_READ,
+  VTFS_OP_WRITE,
+  VTFS_OP_COPY,
+  VTFS_OP_CLONE,
+  VTFS_OP_REVALIDATE,
+  VTFS_OP_COUNT,
+};
+
+// Server methods; unknown ones are counted as "other"
+enum vtfs_http_method {
+  VTFS_HTTP_LIST,
+  VTFS_HTTP_CREATE,
+  VTFS_HTTP_READ,
+  VTFS_HTTP_WRITE,
+  VTFS_HTTP_COPY,
+  VTFS_HTTP_DELETE,
+  VTFS_HTTP_MKDIR,
+  VTFS_HTTP_RMDIR,
+  VTFS_HTTP_LINK,
+  VTFS_HTTP_UNLINK,
+  VTFS_HTTP_CHANGES,
+  VTFS_HTTP_OTHER,
+  VTFS_HTTP_COUNT,
+};
+
+// Phases of one HTTP call. connect includes creating the socket, wait runs
+// from the end of the request to the first response byte, and total also
+// covers building the request and parsing the response.
+enum vtfs_http_phase {
+  VTFS_PHASE_CONNECT,
+  VTFS_PHASE_SEND,
+  VTFS_PHASE_WAIT,
+  VTFS_PHASE_RECEIVE,
+  VTFS_PHASE_TOTAL,
+  VTFS_PHASE_COUNT,
+};
+
+// Phase a failed call never reached
+#define VTFS_PHASE_SKIPPED U64_MAX
+
+// Bucket i counts latencies in [2^i, 2^(i+1)) ns, the last one everything longer
+#define VTFS_HIST_BUCKETS 32
+
+struct vtfs_hist {
+  u64 count;
+  u64 errors;
+  u64 sum_ns;
+  u64 max_ns;
+  u64 buckets[VTFS_HIST_BUCKETS];
+};
+
+struct vtfs_stats_cpu {
+  struct vtfs_hist ops[VTFS_OP_COUNT];
+  struct vtfs_hist http[VTFS_HTTP_COUNT][VTFS_PHASE_COUNT];
+  u64 http_sent[VTFS_HTTP_COUNT];
+  u64 http_received[VTFS_HTTP_COUNT];
+};
+
+// Counters of one mount, shown in debugfs under vtfs/<major:minor>/
+struct vtfs_stats {
+  struct vtfs_stats_cpu __percpu* cpu;
+  struct dentry* dir;
+};
+
+int vtfs_stats_init(struct vtfs_stats* stats, dev_t dev);
+void vtfs_stats_destroy(struct vtfs_stats* stats);
+
+// Records one call of op that took ns nanoseconds
+void vtfs_stats_op(struct vtfs_stats* stats, enum vtfs_op op, u64 ns, bool failed);
+
+// Name of the op in debugfs and in tracepoints
+const char* vtfs_op_name(enum vtfs_op op);
+
+// Records one HTTP call; phases it did not reach are VTFS_PHASE_SKIPPED
+void vtfs_stats_http(struct vtfs_stats* stats, const char* method,
+                     const u64 phase_ns[VTFS_PHASE_COUNT],
+                     size_t sent, size_t received, bool failed);
+
+void vtfs_stats_register(void);
+void vtfs_stats_unregister(void);
+
+#endif // VTFS_STATS_H
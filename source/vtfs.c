@@ -13,7 +13,27 @@
 #include <linux/rwsem.h>
 #include <linux/fcntl.h>
 #include <linux/byteorder/generic.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/crypto.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/hash.h>
 #include "http.h"
+#include "stats.h"
+#include "optrace.h"
+#include "lru.h"
+#include "blocks.h"
+#include "zstore.h"
+#include "image.h"
+#include "journal.h"
+#include "vtfs_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "vtfs_trace.h"
 
 #define MODULE_NAME "vtfs"
 
@@ -24,23 +44,30 @@ MODULE_DESCRIPTION("A simple FS kernel module");
 #define LOG(fmt, ...) pr_info("[" MODULE_NAME "]: " fmt, ##__VA_ARGS__)
 
 #define VTFS_ROOT_INO 100
-#define VTFS_MAX_NAME 256
-
-struct vtfs_file {
-  struct list_head list;
-  ino_t ino;
-  umode_t mode;
-  char name[VTFS_MAX_NAME];
-  struct vtfs_dir* dir_data;
-  char* data;
-  size_t data_size;
-  unsigned int nlink;
-};
 
-struct vtfs_dir {
-  struct list_head files;
-  struct rw_semaphore sem;
-};
+// Server error code for a conditional read whose version is still current
+#define VTFS_ERR_NOT_MODIFIED 304
+// New inodes start at this version on the server
+#define VTFS_INITIAL_VERSION 1
+// How long a validated cached copy is trusted without asking the server
+#define VTFS_REVALIDATE_INTERVAL HZ
+// Server error code for a change feed cursor that is no longer covered
+#define VTFS_ERR_STALE 116
+// Change feed long-poll parameters
+#define VTFS_CHANGES_POLL_MS 5000
+#define VTFS_CHANGES_RETRY_MS 1000
+#define VTFS_CHANGES_LIMIT 64
+#define VTFS_CHANGES_BUFFER 32768
+// Read responses start with version, file size and raw (uncompressed) length
+#define VTFS_READ_HEADER_SIZE 24
+// Bodies below this size are not worth compressing
+#define VTFS_DEFAULT_COMPRESS_MIN 4096
+// Buffers looked at per eviction pass; dirty ones the server refuses stay
+#define VTFS_EVICT_BATCH 64
+// Uncompressed data a RAM mode mount with compress=lz4 or dedup keeps without mem_limit
+#define VTFS_DEFAULT_HOT_LIMIT (64 << 20)
+// File data locks per mount, picked by ino
+#define VTFS_DATA_LOCK_BITS 6
 
 struct vtfs_fs_info {
   struct vtfs_dir root_dir;
@@ -48,11 +75,36 @@ struct vtfs_fs_info {
   char* token;
   bool use_server;
   struct super_block* sb;
+  struct task_struct* changes_thread;
+  long long changes_cursor; // last change feed event applied, -1 if unknown
+  bool changes_live;        // the feed is connected, cached data needs no revalidation
+  atomic64_t ns_gen;        // bumped whenever a remote change alters the namespace
+  struct crypto_comp* comp; // LZ4 transform for wire compression, NULL if disabled
+  struct mutex comp_lock;   // the transform's scratch memory is not reentrant
+  size_t compress_min;
+  struct vtfs_stats stats;  // per-CPU op and HTTP latencies, in debugfs
+  struct vtfs_optrace optrace; // recorded calls for replay, off by default
+  struct vtfs_lru lru;      // resident file data, evicted past mem_limit
+  struct vtfs_zstore zstore; // RAM mode data evicted from lru, compressed
+  struct vtfs_image image;  // RAM mode checkpoint, if mounted with image=
+  struct vtfs_journal journal; // server mode intent log, in memory without journal=
+  bool offline;             // the server is unreachable, see vtfs_server_failed
+  struct shrinker* shrinker; // drops clean file data under memory pressure
+  struct work_struct reclaim_work;
+  atomic_long_t reclaim_bytes; // asked for by the shrinker, not yet dropped
+  struct rw_semaphore data_sem[1 << VTFS_DATA_LOCK_BITS]; // see vtfs_data_sem
+  struct mutex send_lock[1 << VTFS_DATA_LOCK_BITS]; // see vtfs_send_lock
+  struct rw_semaphore ns_sem; // see vtfs_ns_sem
 };
 
-struct data_ptr_entry {
-  struct list_head list;
-  char* data;
+struct vtfs_mount_opts {
+  char* token;
+  bool compress;
+  size_t compress_min;
+  u64 mem_limit;
+  bool dedup;
+  char* image;
+  char* journal;
 };
 
 static struct inode* vtfs_get_inode(struct super_block* sb, const struct inode* dir, umode_t mode, int i_ino);
@@ -71,30 +123,37 @@ static ssize_t vtfs_read(struct file* filp, char __user* buffer, size_t len, lof
 static ssize_t vtfs_write(struct file* filp, const char __user* buffer, size_t len, loff_t* offset);
 static int vtfs_open(struct inode* inode, struct file* filp);
 static int vtfs_setattr(struct mnt_idmap* idmap, struct dentry* dentry, struct iattr* attr);
+static ssize_t vtfs_copy_file_range(struct file* file_in, loff_t pos_in, struct file* file_out, loff_t pos_out, size_t len, unsigned int flags);
+static loff_t vtfs_remap_file_range(struct file* file_in, loff_t pos_in, struct file* file_out, loff_t pos_out, loff_t len, unsigned int remap_flags);
 
 static struct inode_operations vtfs_inode_ops;
 static struct file_operations vtfs_dir_ops;
 static struct file_operations vtfs_file_ops;
 
-static struct vtfs_file* vtfs_find_file(struct vtfs_dir* dir, const char* name);
-static struct vtfs_file* vtfs_create_file(struct vtfs_dir* dir, const char* name, umode_t mode, ino_t ino);
-static int vtfs_remove_file(struct vtfs_dir* dir, const char* name);
-static void vtfs_cleanup_dir(struct vtfs_dir* dir);
 static struct vtfs_dir* vtfs_get_dir(struct super_block* sb, ino_t ino);
-static struct vtfs_file* vtfs_find_file_by_ino(struct vtfs_dir* dir, ino_t ino);
 static struct vtfs_file* vtfs_get_file_by_inode(struct inode* inode);
-static void vtfs_update_data_all(struct vtfs_dir* dir, ino_t ino, char* old_data, char* new_data, size_t new_size);
 
 // Server integration functions
 static int vtfs_server_create_file(struct vtfs_fs_info* info, ino_t parent_ino, const char* name, umode_t mode, ino_t* out_ino);
-static int vtfs_server_write_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, const char* data, size_t len);
-static int vtfs_server_read_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, size_t len, char* buffer, size_t* out_len);
+static int vtfs_server_write_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, const char* data, size_t len, u64* out_version);
+static int vtfs_server_read_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, size_t len, u64 known_version, char* buffer, size_t* out_len, u64* out_version, size_t* out_file_size);
+static int vtfs_server_revalidate(struct vtfs_fs_info* info, struct inode* inode, struct vtfs_file** filep, size_t needed);
+static int vtfs_flush_file(struct vtfs_fs_info* info, struct vtfs_file* file);
+static int vtfs_server_copy_range(struct vtfs_fs_info* info, ino_t src_ino, loff_t src_offset, ino_t dst_ino, loff_t dst_offset, size_t len, u64* out_version, size_t* out_copied);
 static int vtfs_server_delete_file(struct vtfs_fs_info* info, ino_t ino);
 static int vtfs_server_mkdir(struct vtfs_fs_info* info, ino_t parent_ino, const char* name, umode_t mode, ino_t* out_ino);
 static int vtfs_server_rmdir(struct vtfs_fs_info* info, ino_t ino);
 static int vtfs_server_link(struct vtfs_fs_info* info, ino_t old_ino, ino_t parent_ino, const char* name, unsigned int* out_nlink);
-static int vtfs_server_unlink(struct vtfs_fs_info* info, ino_t ino);
+static int vtfs_server_unlink(struct vtfs_fs_info* info, ino_t ino, ino_t parent_ino, const char* name);
 static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino);
+static int vtfs_server_poll_changes(struct vtfs_fs_info* info, unsigned int timeout_ms);
+static int vtfs_changes_thread(void* data);
+static int vtfs_d_revalidate(struct dentry* dentry, unsigned int flags);
+static int vtfs_timed_d_revalidate(struct dentry* dentry, unsigned int flags);
+
+static const struct dentry_operations vtfs_dentry_ops = {
+  .d_revalidate = vtfs_timed_d_revalidate,
+};
 
 static struct file_system_type vtfs_fs_type = {
   .name = "vtfs",
@@ -103,173 +162,6 @@ static struct file_system_type vtfs_fs_type = {
   .owner = THIS_MODULE,
 };
 
-static struct vtfs_file* vtfs_find_file_by_ino(struct vtfs_dir* dir, ino_t ino) {
-  struct vtfs_file* file;
-  
-  if (!dir) return NULL;
-  
-  down_read(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->ino == ino) {
-      up_read(&dir->sem);
-      return file;
-    }
-    if (file->dir_data) {
-      struct vtfs_file* found = vtfs_find_file_by_ino(file->dir_data, ino);
-      if (found) {
-        up_read(&dir->sem);
-        return found;
-      }
-    }
-  }
-  up_read(&dir->sem);
-  return NULL;
-}
-
-static struct vtfs_file* vtfs_find_file(struct vtfs_dir* dir, const char* name) {
-  struct vtfs_file* file;
-  if (!dir) return NULL;
-  
-  list_for_each_entry(file, &dir->files, list) {
-    if (!strcmp(file->name, name)) {
-      return file;
-    }
-  }
-  return NULL;
-}
-
-static struct vtfs_file* vtfs_create_file(struct vtfs_dir* dir, const char* name, umode_t mode, ino_t ino) {
-  struct vtfs_file* file;
-  
-  if (!dir || !name || strlen(name) >= VTFS_MAX_NAME) {
-    return NULL;
-  }
-  
-  down_write(&dir->sem);
-  if (vtfs_find_file(dir, name) != NULL) {
-    up_write(&dir->sem);
-    return NULL;
-  }
-  
-  file = kmalloc(sizeof(struct vtfs_file), GFP_KERNEL);
-  if (!file) {
-    up_write(&dir->sem);
-    return NULL;
-  }
-  
-  INIT_LIST_HEAD(&file->list);
-  file->ino = ino;
-  file->mode = mode;
-  strncpy(file->name, name, VTFS_MAX_NAME - 1);
-  file->name[VTFS_MAX_NAME - 1] = '\0';
-  file->dir_data = NULL;
-  file->data = NULL;
-  file->data_size = 0;
-  file->nlink = 1;
-  
-  if (S_ISDIR(mode)) {
-    file->dir_data = kmalloc(sizeof(struct vtfs_dir), GFP_KERNEL);
-    if (!file->dir_data) {
-      kfree(file);
-      up_write(&dir->sem);
-      return NULL;
-    }
-    INIT_LIST_HEAD(&file->dir_data->files);
-    init_rwsem(&file->dir_data->sem);
-  }
-  
-  list_add_tail(&file->list, &dir->files);
-  up_write(&dir->sem);
-  
-  return file;
-}
-
-static int vtfs_remove_file(struct vtfs_dir* dir, const char* name) {
-  struct vtfs_file* file;
-  
-  if (!dir || !name) return -ENOENT;
-  
-  down_write(&dir->sem);
-  file = vtfs_find_file(dir, name);
-  if (!file) {
-    up_write(&dir->sem);
-    return -ENOENT;
-  }
-  
-  list_del(&file->list);
-  up_write(&dir->sem);
-  
-  if (file->dir_data) {
-    vtfs_cleanup_dir(file->dir_data);
-    kfree(file->dir_data);
-  }
-  if (file->data) {
-    kfree(file->data);
-  }
-  kfree(file);
-  
-  return 0;
-}
-
-static void vtfs_cleanup_dir(struct vtfs_dir* dir) {
-  struct vtfs_file* file;
-  struct vtfs_file* tmp;
-  struct list_head data_list;
-  struct data_ptr_entry* data_entry;
-  struct data_ptr_entry* data_tmp;
-  char* data_ptr;
-  bool found;
-  
-  if (!dir) return;
-  
-  INIT_LIST_HEAD(&data_list);
-  down_read(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->data) {
-      found = false;
-      list_for_each_entry(data_entry, &data_list, list) {
-        if (data_entry->data == file->data) {
-          found = true;
-          break;
-        }
-      }
-      if (!found) {
-        data_entry = kmalloc(sizeof(struct data_ptr_entry), GFP_KERNEL);
-        if (data_entry) {
-          data_entry->data = file->data;
-          list_add_tail(&data_entry->list, &data_list);
-        }
-      }
-    }
-  }
-  up_read(&dir->sem);
-  
-  down_write(&dir->sem);
-  list_for_each_entry_safe(file, tmp, &dir->files, list) {
-    list_del(&file->list);
-    
-    if (file->dir_data) {
-      vtfs_cleanup_dir(file->dir_data);
-      kfree(file->dir_data);
-      file->dir_data = NULL;
-    }
-    
-    file->data = NULL;
-    
-    kfree(file);
-  }
-  up_write(&dir->sem);
-  
-  list_for_each_entry_safe(data_entry, data_tmp, &data_list, list) {
-    data_ptr = data_entry->data;
-    list_del(&data_entry->list);
-    kfree(data_entry);
-    if (data_ptr) {
-      kfree(data_ptr);
-    }
-  }
-}
-
 static struct vtfs_dir* vtfs_get_dir(struct super_block* sb, ino_t ino) {
   struct vtfs_fs_info* info;
   struct vtfs_file* file;
@@ -441,23 +333,140 @@ static int vtfs_iterate(struct file* filp, struct dir_context* ctx) {
   return 0;
 }
 
+// File data locks
+
+/*
+ * A file's buffer and size change, and its entries are freed, only under
+ * the write side of its data lock; using them takes the read side. The
+ * lock is picked by ino, so all links of a file share it and it outlives
+ * the entries: look the file up again once it is held. Eviction only
+ * tries the lock and leaves a buffer in use alone. Taken before any
+ * directory's sem. Reads and writes drop it for their round trips to the
+ * server, see vtfs_send_lock.
+ */
+static struct rw_semaphore* vtfs_data_sem(struct vtfs_fs_info* info, ino_t ino) {
+  return &info->data_sem[hash_min(ino, VTFS_DATA_LOCK_BITS)];
+}
+
+/*
+ * Orders the round trips of a file in server mode: a write's send, and
+ * the flush and fetch of a read, happen under this instead of the data
+ * lock, so the resident copy stays readable while they wait on the
+ * network. Picked by ino like the data lock and taken before it. Eviction
+ * leaves the buffer of a file in a round trip alone.
+ */
+static struct mutex* vtfs_send_lock(struct vtfs_fs_info* info, ino_t ino) {
+  return &info->send_lock[hash_min(ino, VTFS_DATA_LOCK_BITS)];
+}
+
+/*
+ * The VFS keeps local calls from freeing a directory another one is in,
+ * through the parents' inode locks, but the change feed thread takes no
+ * inode lock. So a call that looks up a vtfs_dir and uses it holds the
+ * read side of this lock throughout, and the feed holds the write side
+ * while it adds or frees entries. Taken before any data lock.
+ */
+static struct rw_semaphore* vtfs_ns_sem(struct super_block* sb) {
+  struct vtfs_fs_info* info = sb->s_fs_info;
+  
+  return &info->ns_sem;
+}
+
+// The two files of a copy, which may share a lock, in address order
+static void vtfs_data_lock_pair(struct vtfs_fs_info* info, ino_t a, ino_t b) {
+  struct rw_semaphore* first = vtfs_data_sem(info, a);
+  struct rw_semaphore* second = vtfs_data_sem(info, b);
+  
+  if (first > second) {
+    swap(first, second);
+  }
+  down_write(first);
+  if (second != first) {
+    down_write_nested(second, SINGLE_DEPTH_NESTING);
+  }
+}
+
+static void vtfs_data_unlock_pair(struct vtfs_fs_info* info, ino_t a, ino_t b) {
+  struct rw_semaphore* first = vtfs_data_sem(info, a);
+  struct rw_semaphore* second = vtfs_data_sem(info, b);
+  
+  up_write(first);
+  if (second != first) {
+    up_write(second);
+  }
+}
+
 // Server integration functions
 
+/*
+ * A server call failed. One that got no response at all means the server
+ * is down: the mount goes offline, and until the change feed gets through
+ * again every other call fails at once instead of waiting on a connect.
+ * Only the feed notices the server coming back, so without it a mount
+ * stays online.
+ */
+static int vtfs_server_failed(struct vtfs_fs_info* info, int64_t ret) {
+  if (VTFS_HTTP_UNREACHABLE(ret) && info->changes_thread && !READ_ONCE(info->offline)) {
+    WRITE_ONCE(info->offline, true);
+    LOG("server unreachable, working offline\n");
+  }
+  return -EIO;
+}
+
+static bool vtfs_offline(struct vtfs_fs_info* info) {
+  return READ_ONCE(info->offline);
+}
+
+static void vtfs_server_reached(struct vtfs_fs_info* info) {
+  if (vtfs_offline(info)) {
+    WRITE_ONCE(info->offline, false);
+    LOG("server is back, sending queued changes\n");
+    vtfs_journal_kick(&info->journal);
+  }
+}
+
+/*
+ * Hands a change to the journal thread: always with journal=, otherwise
+ * while offline and until what was queued then has been sent, so that
+ * nothing overtakes it. Not 0 if the caller sends the change itself.
+ */
+static int vtfs_defer(struct vtfs_fs_info* info, u32 op, ino_t ino, loff_t offset, const char* data, size_t len) {
+  if (!vtfs_journal_durable(&info->journal) && !vtfs_offline(info) && vtfs_journal_idle(&info->journal)) {
+    return -EAGAIN;
+  }
+  return vtfs_journal_append(&info->journal, op, ino, offset, data, len);
+}
+
+/*
+ * A change the caller sent itself failed with ret. If that is because the
+ * server is unreachable, as the call may just have found out, the change
+ * is queued like the ones made after it. 0 if it was.
+ */
+static int vtfs_defer_failed(struct vtfs_fs_info* info, int ret, u32 op, ino_t ino, loff_t offset, const char* data, size_t len) {
+  if (ret != -EIO || !vtfs_offline(info)) {
+    return ret;
+  }
+  return vtfs_journal_append(&info->journal, op, ino, offset, data, len);
+}
+
 static int vtfs_server_create_file(struct vtfs_fs_info* info, ino_t parent_ino, const char* name, umode_t mode, ino_t* out_ino) {
   char response[256];
   char parent_ino_str[32], mode_str[32];
   int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
   
   snprintf(parent_ino_str, sizeof(parent_ino_str), "%lu", parent_ino);
   snprintf(mode_str, sizeof(mode_str), "%o", mode & 0777);
   
-  ret = vtfs_http_call(info->token, "create", response, sizeof(response), 3,
+  ret = vtfs_http_call(&info->stats, info->token, "create", response, sizeof(response), 3,
                        "parent_ino", parent_ino_str,
                        "name", name,
                        "mode", mode_str);
   
   if (ret < 0 || ret < 8) {
-    return -EIO;
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = 0;
@@ -479,61 +488,109 @@ static int vtfs_server_create_file(struct vtfs_fs_info* info, ino_t parent_ino,
   return 0;
 }
 
-static int vtfs_server_write_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, const char* data, size_t len) {
+/*
+ * Compresses src with LZ4 if the mount enabled compression, src is large
+ * enough and the result is smaller. Returns the compressed length and sets
+ * *out to a buffer the caller frees, or returns 0 to send src as is.
+ */
+static size_t vtfs_compress(struct vtfs_fs_info* info, const char* src, size_t len, char** out) {
+  unsigned int dlen;
+  char* dst;
+  int ret;
+  
+  *out = NULL;
+  if (!info->comp || len < info->compress_min || len > UINT_MAX) {
+    return 0;
+  }
+  
+  dst = kmalloc(len, GFP_KERNEL);
+  if (!dst) {
+    return 0;
+  }
+  
+  // A destination one byte short of the input rejects incompressible data
+  dlen = len - 1;
+  mutex_lock(&info->comp_lock);
+  ret = crypto_comp_compress(info->comp, src, len, dst, &dlen);
+  mutex_unlock(&info->comp_lock);
+  
+  if (ret != 0 || dlen >= len) {
+    kfree(dst);
+    return 0;
+  }
+  
+  *out = dst;
+  return dlen;
+}
+
+// -EIO if the server could not be reached, -EREMOTEIO if it refused the write
+static int vtfs_server_write_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, const char* data, size_t len, u64* out_version) {
   char response[64];
-  char ino_str[32], offset_str[32];
-  char* encoded_data;
-  size_t encoded_len;
+  char ino_str[32], offset_str[32], raw_len_str[32];
+  char* packed;
+  size_t packed_len;
   int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
   
   if (len == 0) {
     return 0;
   }
   
-  encoded_len = ((len + 2) / 3) * 4 + 1;
-  encoded_data = kmalloc(encoded_len, GFP_KERNEL);
-  if (!encoded_data) {
-    return -ENOMEM;
-  }
-  
-  encode(data, encoded_data);
+  packed_len = vtfs_compress(info, data, len, &packed);
   
   snprintf(ino_str, sizeof(ino_str), "%lu", ino);
   snprintf(offset_str, sizeof(offset_str), "%lld", offset);
+  snprintf(raw_len_str, sizeof(raw_len_str), "%zu", len);
   
-  ret = vtfs_http_call(info->token, "write", response, sizeof(response), 3,
+  ret = vtfs_http_post(&info->stats, info->token, "write",
+                       packed ? packed : data, packed ? packed_len : len,
+                       response, sizeof(response), 4,
                        "ino", ino_str,
                        "offset", offset_str,
-                       "data", encoded_data);
+                       "enc", packed ? "lz4" : "none",
+                       "raw_len", raw_len_str);
   
-  kfree(encoded_data);
+  kfree(packed);
   
   if (ret < 0) {
-    return -EIO;
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = *(int64_t*)response;
   error_code = be64_to_cpu(error_code);
   
   if (error_code != 0) {
-    return -EIO;
+    return -EREMOTEIO;
+  }
+  
+  response[ret < sizeof(response) ? ret : sizeof(response) - 1] = '\0';
+  unsigned long long version;
+  // The write may have been applied; sending it again would not fix the answer
+  if (sscanf(response + 8, "%llu", &version) != 1) {
+    return -EREMOTEIO;
   }
   
+  *out_version = version;
   return 0;
 }
 
-static int vtfs_server_read_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, size_t len, char* buffer, size_t* out_len) {
+/*
+ * Reads a range of the file. With a non-zero known_version the read is
+ * conditional: if the server copy is still at that version nothing but the
+ * version header is sent back and 1 is returned instead of 0.
+ */
+static int vtfs_server_read_file(struct vtfs_fs_info* info, ino_t ino, loff_t offset, size_t len, u64 known_version, char* buffer, size_t* out_len, u64* out_version, size_t* out_file_size) {
   char* response;
-  char ino_str[32], offset_str[32], length_str[32];
+  char ino_str[32], offset_str[32], length_str[32], version_str[32];
   int64_t ret;
   size_t response_size;
-  
-  if (len == 0) {
-    *out_len = 0;
-    return 0;
+  if (vtfs_offline(info)) {
+    return -EIO;
   }
   
-  response_size = 8 + len + 1024;
+  response_size = 8 + VTFS_READ_HEADER_SIZE + len + 1024;
   response = kmalloc(response_size, GFP_KERNEL);
   if (!response) {
     return -ENOMEM;
@@ -542,104 +599,281 @@ static int vtfs_server_read_file(struct vtfs_fs_info* info, ino_t ino, loff_t of
   snprintf(ino_str, sizeof(ino_str), "%lu", ino);
   snprintf(offset_str, sizeof(offset_str), "%lld", offset);
   snprintf(length_str, sizeof(length_str), "%zu", len);
+  // Versions start at 1, so 0 makes the read unconditional
+  snprintf(version_str, sizeof(version_str), "%llu", known_version);
   
-  ret = vtfs_http_call(info->token, "read", response, response_size, 3,
+  ret = vtfs_http_call(&info->stats, info->token, "read", response, response_size, 5,
                        "ino", ino_str,
                        "offset", offset_str,
-                       "length", length_str);
+                       "length", length_str,
+                       "version", version_str,
+                       "accept", info->comp && len >= info->compress_min ? "lz4" : "none");
   
-  if (ret < 0) {
+  if (ret < 8 + VTFS_READ_HEADER_SIZE) {
     kfree(response);
-    return -EIO;
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = *(int64_t*)response;
   error_code = be64_to_cpu(error_code);
   
-  if (error_code != 0) {
+  if (error_code != 0 && error_code != VTFS_ERR_NOT_MODIFIED) {
     kfree(response);
     return -EIO;
   }
   
-  size_t data_len = ret - 8;
+  *out_version = be64_to_cpu(*(__be64*)(response + 8));
+  *out_file_size = be64_to_cpu(*(__be64*)(response + 16));
+  u64 raw_len = be64_to_cpu(*(__be64*)(response + 24));
+  
+  if (error_code == VTFS_ERR_NOT_MODIFIED) {
+    *out_len = 0;
+    kfree(response);
+    return 1;
+  }
+  
+  char* payload = response + 8 + VTFS_READ_HEADER_SIZE;
+  size_t data_len = ret - 8 - VTFS_READ_HEADER_SIZE;
+  
+  if (raw_len != 0) {
+    // LZ4 decompression keeps no state in the transform, no lock needed
+    unsigned int dlen = len;
+    if (!info->comp || raw_len > len ||
+        crypto_comp_decompress(info->comp, payload, data_len, buffer, &dlen) != 0 ||
+        dlen != raw_len) {
+      kfree(response);
+      return -EIO;
+    }
+    *out_len = dlen;
+    kfree(response);
+    return 0;
+  }
+  
   if (data_len > len) data_len = len;
-  memcpy(buffer, response + 8, data_len);
+  memcpy(buffer, payload, data_len);
   *out_len = data_len;
   
   kfree(response);
   return 0;
 }
 
-static int vtfs_server_delete_file(struct vtfs_fs_info* info, ino_t ino) {
-  char response[64];
-  char ino_str[32];
-  int64_t ret;
+/*
+ * Sets the version fields of file and of every other link of its ino, so
+ * that no link trusts a copy another one has seen go stale.
+ */
+static void vtfs_set_version(struct vtfs_fs_info* info, struct vtfs_file* file, u64 version, u64 data_version, unsigned long validated) {
+  // Most files have one link, which needs no walk
+  if (file->nlink > 1) {
+    vtfs_update_version_all(&info->root_dir, file->ino, version, data_version, validated);
+    return;
+  }
+  file->version = version;
+  file->data_version = data_version;
+  file->validated = validated;
+}
+
+/*
+ * vtfs_flush_file for a read, which sends a copy of the buffer with the
+ * data lock dropped. The caller holds the send lock, so no write comes in
+ * between; *filep is looked up again, NULL if the file went away.
+ */
+static int vtfs_flush_unlocked(struct vtfs_fs_info* info, struct inode* inode, struct vtfs_file** filep) {
+  struct rw_semaphore* sem = vtfs_data_sem(info, inode->i_ino);
+  struct vtfs_file* file = *filep;
+  size_t size = file->data_size;
+  char* copy;
+  u64 version;
+  int ret;
+  
+  if (size == 0) {
+    return vtfs_flush_file(info, file);
+  }
+  copy = kmemdup(file->data, size, GFP_KERNEL);
+  if (!copy) {
+    return -ENOMEM;
+  }
   
-  snprintf(ino_str, sizeof(ino_str), "%lu", ino);
+  up_write(sem);
+  ret = vtfs_server_write_file(info, inode->i_ino, 0, copy, size, &version);
+  down_write(sem);
+  kfree(copy);
   
-  ret = vtfs_http_call(info->token, "delete", response, sizeof(response), 1,
-                       "ino", ino_str);
+  file = *filep = vtfs_get_file_by_inode(inode);
+  if (!file) {
+    return -ENOENT;
+  }
+  if (ret != 0) {
+    return ret;
+  }
+  vtfs_set_version(info, file, version, 0, file->validated);
+  vtfs_lru_mark_dirty(&info->lru, file->ino, false);
+  return 0;
+}
+
+/*
+ * Makes the file's data mirror the server copy of at least `needed` bytes.
+ * A cached copy validated within VTFS_REVALIDATE_INTERVAL, or at any time
+ * while the change feed is connected, is used without a round trip; an
+ * older one is checked with a conditional read, which costs a header-only
+ * response while the version is unchanged. The caller holds the file's
+ * send lock and the write side of its data lock, and has waited for its
+ * journaled writes. The data lock is dropped for each round trip, so
+ * *filep is looked up again after it, NULL if the file went away, and an
+ * answer the file changed under is fetched again.
+ */
+static int vtfs_server_revalidate(struct vtfs_fs_info* info, struct inode* inode, struct vtfs_file** filep, size_t needed) {
+  struct rw_semaphore* sem = vtfs_data_sem(info, inode->i_ino);
+  struct vtfs_file* file = *filep;
+  bool cached;
+  
+  if (file->data && vtfs_lru_is_dirty(&info->lru, inode->i_ino)) {
+    int ret = vtfs_flush_unlocked(info, inode, filep);
+    if (ret != 0) {
+      return ret;
+    }
+    file = *filep;
+  }
   
-  if (ret < 0) {
-    return -EIO;
+  cached = file->data_version != 0 && file->data_version == file->version;
+  if (cached && (info->changes_live || time_before(jiffies, file->validated + VTFS_REVALIDATE_INTERVAL))) {
+    trace_vtfs_cache(inode->i_ino, false, false);
+    return 0;
   }
   
-  int64_t error_code = *(int64_t*)response;
-  error_code = be64_to_cpu(error_code);
+  size_t want = max3(needed, file->data_size, (size_t)1);
   
-  if (error_code != 0) {
-    return -EIO;
+  for (int attempt = 0; attempt < 3; attempt++) {
+    u64 seen_version = file->version;
+    size_t seen_size = file->data_size;
+    u64 known = cached ? file->data_version : 0;
+    char* server_data;
+    char* old_data;
+    size_t read_len;
+    size_t file_size;
+    u64 version;
+    int ret;
+    
+    server_data = kmalloc(want, GFP_KERNEL);
+    if (!server_data) {
+      return -ENOMEM;
+    }
+    
+    up_write(sem);
+    ret = vtfs_server_read_file(info, inode->i_ino, 0, want, known,
+                                server_data, &read_len, &version, &file_size);
+    down_write(sem);
+    
+    file = *filep = vtfs_get_file_by_inode(inode);
+    if (!file || ret < 0) {
+      kfree(server_data);
+      return file ? ret : -ENOENT;
+    }
+    // The change feed, or a local truncate, got in while the lock was down
+    if (file->version != seen_version || file->data_size != seen_size) {
+      kfree(server_data);
+      cached = file->data_version != 0 && file->data_version == file->version;
+      want = max3(needed, file->data_size, (size_t)1);
+      continue;
+    }
+    if (ret == 1) {
+      kfree(server_data);
+      trace_vtfs_cache(inode->i_ino, true, false);
+      vtfs_set_version(info, file, version, file->data_version, jiffies);
+      return 0;
+    }
+    
+    // The file grew since we last saw it, fetch it whole
+    if (file_size > want && attempt == 0) {
+      kfree(server_data);
+      want = file_size;
+      cached = false;
+      continue;
+    }
+    
+    old_data = file->data;
+    vtfs_update_data_all(&info->root_dir, inode->i_ino, old_data, server_data, read_len);
+    file->data = server_data;
+    file->data_size = read_len;
+    if (old_data) {
+      kfree(old_data);
+    }
+    
+    // Only a complete copy may be served without asking the server again
+    vtfs_set_version(info, file, version, (read_len == file_size) ? version : 0, jiffies);
+    inode->i_size = read_len;
+    trace_vtfs_cache(inode->i_ino, true, true);
+    return 0;
   }
   
-  return 0;
+  return -EIO;
 }
 
-static int vtfs_server_mkdir(struct vtfs_fs_info* info, ino_t parent_ino, const char* name, umode_t mode, ino_t* out_ino) {
-  char response[256];
-  char parent_ino_str[32], mode_str[32];
+/*
+ * Has the server copy a range between two files (or within one) itself, so
+ * no file data crosses the network.
+ */
+static int vtfs_server_copy_range(struct vtfs_fs_info* info, ino_t src_ino, loff_t src_offset, ino_t dst_ino, loff_t dst_offset, size_t len, u64* out_version, size_t* out_copied) {
+  char response[64];
+  char src_ino_str[32], src_offset_str[32], dst_ino_str[32], dst_offset_str[32], length_str[32];
+  unsigned long long version;
+  size_t copied;
   int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
   
-  snprintf(parent_ino_str, sizeof(parent_ino_str), "%lu", parent_ino);
-  snprintf(mode_str, sizeof(mode_str), "%o", mode & 0777);
+  snprintf(src_ino_str, sizeof(src_ino_str), "%lu", src_ino);
+  snprintf(src_offset_str, sizeof(src_offset_str), "%lld", src_offset);
+  snprintf(dst_ino_str, sizeof(dst_ino_str), "%lu", dst_ino);
+  snprintf(dst_offset_str, sizeof(dst_offset_str), "%lld", dst_offset);
+  snprintf(length_str, sizeof(length_str), "%zu", len);
   
-  ret = vtfs_http_call(info->token, "mkdir", response, sizeof(response), 3,
-                       "parent_ino", parent_ino_str,
-                       "name", name,
-                       "mode", mode_str);
+  ret = vtfs_http_call(&info->stats, info->token, "copy", response, sizeof(response), 5,
+                       "src_ino", src_ino_str,
+                       "src_offset", src_offset_str,
+                       "dst_ino", dst_ino_str,
+                       "dst_offset", dst_offset_str,
+                       "length", length_str);
   
-  if (ret < 0 || ret < 8) {
-    return -EIO;
+  if (ret < 8) {
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = *(int64_t*)response;
   error_code = be64_to_cpu(error_code);
   
+  if (error_code == EINVAL) {
+    return -EINVAL;
+  }
   if (error_code != 0) {
     return -EIO;
   }
   
-  unsigned long ino;
-  unsigned int dir_mode;
-  if (sscanf(response + 8, "%lu,%u", &ino, &dir_mode) != 2) {
+  response[ret < sizeof(response) ? ret : sizeof(response) - 1] = '\0';
+  if (sscanf(response + 8, "%llu,%zu", &version, &copied) != 2) {
     return -EIO;
   }
   
-  *out_ino = ino;
+  *out_version = version;
+  *out_copied = copied;
   return 0;
 }
 
-static int vtfs_server_rmdir(struct vtfs_fs_info* info, ino_t ino) {
+static int vtfs_server_delete_file(struct vtfs_fs_info* info, ino_t ino) {
   char response[64];
   char ino_str[32];
   int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
   
   snprintf(ino_str, sizeof(ino_str), "%lu", ino);
   
-  ret = vtfs_http_call(info->token, "rmdir", response, sizeof(response), 1,
+  ret = vtfs_http_call(&info->stats, info->token, "delete", response, sizeof(response), 1,
                        "ino", ino_str);
   
   if (ret < 0) {
-    return -EIO;
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = *(int64_t*)response;
@@ -652,64 +886,150 @@ static int vtfs_server_rmdir(struct vtfs_fs_info* info, ino_t ino) {
   return 0;
 }
 
+static int vtfs_server_mkdir(struct vtfs_fs_info* info, ino_t parent_ino, const char* name, umode_t mode, ino_t* out_ino) {
+  char response[256];
+  char parent_ino_str[32], mode_str[32];
+  int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
+  
+  snprintf(parent_ino_str, sizeof(parent_ino_str), "%lu", parent_ino);
+  snprintf(mode_str, sizeof(mode_str), "%o", mode & 0777);
+  
+  ret = vtfs_http_call(&info->stats, info->token, "mkdir", response, sizeof(response), 3,
+                       "parent_ino", parent_ino_str,
+                       "name", name,
+                       "mode", mode_str);
+  
+  if (ret < 0 || ret < 8) {
+    return vtfs_server_failed(info, ret);
+  }
+  
+  int64_t error_code = *(int64_t*)response;
+  error_code = be64_to_cpu(error_code);
+  
+  if (error_code != 0) {
+    return -EIO;
+  }
+  
+  unsigned long ino;
+  unsigned int dir_mode;
+  if (sscanf(response + 8, "%lu,%u", &ino, &dir_mode) != 2) {
+    return -EIO;
+  }
+  
+  *out_ino = ino;
+  return 0;
+}
+
+static int vtfs_server_rmdir(struct vtfs_fs_info* info, ino_t ino) {
+  char response[64];
+  char ino_str[32];
+  int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
+  
+  snprintf(ino_str, sizeof(ino_str), "%lu", ino);
+  
+  ret = vtfs_http_call(&info->stats, info->token, "rmdir", response, sizeof(response), 1,
+                       "ino", ino_str);
+  
+  if (ret < 0) {
+    return vtfs_server_failed(info, ret);
+  }
+  
+  int64_t error_code = *(int64_t*)response;
+  error_code = be64_to_cpu(error_code);
+  
+  if (error_code != 0) {
+    return -EREMOTEIO;
+  }
+  
+  return 0;
+}
+
 static int vtfs_server_link(struct vtfs_fs_info* info, ino_t old_ino, ino_t parent_ino, const char* name, unsigned int* out_nlink) {
   char response[256];
   char old_ino_str[32], parent_ino_str[32];
   int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
   
   snprintf(old_ino_str, sizeof(old_ino_str), "%lu", old_ino);
   snprintf(parent_ino_str, sizeof(parent_ino_str), "%lu", parent_ino);
   
-  ret = vtfs_http_call(info->token, "link", response, sizeof(response), 3,
+  ret = vtfs_http_call(&info->stats, info->token, "link", response, sizeof(response), 3,
                        "old_ino", old_ino_str,
                        "parent_ino", parent_ino_str,
                        "name", name);
   
-  if (ret < 0 || ret < 8) {
-    return -EIO;
+  if (ret < 0) {
+    return vtfs_server_failed(info, ret);
+  }
+  // A refusal, or an answer that makes no sense, would not change if sent again
+  if (ret < 8) {
+    return -EREMOTEIO;
   }
   
   int64_t error_code = *(int64_t*)response;
   error_code = be64_to_cpu(error_code);
   
   if (error_code != 0) {
-    return -EIO;
+    return -EREMOTEIO;
   }
   
+  response[ret < sizeof(response) ? ret : sizeof(response) - 1] = '\0';
   unsigned long ino;
   unsigned int nlink;
   if (sscanf(response + 8, "%lu,%u", &ino, &nlink) != 2) {
-    return -EIO;
+    return -EREMOTEIO;
   }
   
   *out_nlink = nlink;
   return 0;
 }
 
-static int vtfs_server_unlink(struct vtfs_fs_info* info, ino_t ino) {
+// Removes the link parent_ino/name of ino; the server keeps any other one
+static int vtfs_server_unlink(struct vtfs_fs_info* info, ino_t ino, ino_t parent_ino, const char* name) {
   char response[64];
-  char ino_str[32];
+  char ino_str[32], parent_ino_str[32];
   int64_t ret;
+  if (vtfs_offline(info)) {
+    return -EIO;
+  }
   
   snprintf(ino_str, sizeof(ino_str), "%lu", ino);
+  snprintf(parent_ino_str, sizeof(parent_ino_str), "%lu", parent_ino);
   
-  ret = vtfs_http_call(info->token, "unlink", response, sizeof(response), 1,
-                       "ino", ino_str);
+  ret = vtfs_http_call(&info->stats, info->token, "unlink", response, sizeof(response), 3,
+                       "ino", ino_str,
+                       "parent_ino", parent_ino_str,
+                       "name", name);
   
   if (ret < 0) {
-    return -EIO;
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = *(int64_t*)response;
   error_code = be64_to_cpu(error_code);
   
   if (error_code != 0) {
-    return -EIO;
+    return -EREMOTEIO;
   }
   
   return 0;
 }
 
+static umode_t vtfs_mode_from_server(unsigned int mode) {
+  if (mode >= 16384) {
+    return S_IFDIR | (mode & 0777);
+  }
+  return S_IFREG | (mode & 0777);
+}
+
 static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
   char* response;
   char parent_ino_str[32];
@@ -725,12 +1045,12 @@ static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
   
   snprintf(parent_ino_str, sizeof(parent_ino_str), "%lu", parent_ino);
   
-  ret = vtfs_http_call(info->token, "list", response, response_size, 1,
+  ret = vtfs_http_call(&info->stats, info->token, "list", response, response_size, 1,
                        "parent_ino", parent_ino_str);
   
   if (ret < 0) {
     kfree(response);
-    return -EIO;
+    return vtfs_server_failed(info, ret);
   }
   
   int64_t error_code = *(int64_t*)response;
@@ -749,6 +1069,7 @@ static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
     char name[VTFS_MAX_NAME];
     unsigned int mode;
     unsigned long data_size = 0;
+    unsigned long long version = 0;
     struct vtfs_dir* dir;
     struct vtfs_file* file;
     
@@ -756,7 +1077,7 @@ static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
     if (!end_line) break;
     *end_line = '\0';
     
-    int parse_result = sscanf(line, "%lu,%255[^,],%u,%lu", &ino, name, &mode, &data_size);
+    int parse_result = sscanf(line, "%lu,%255[^,],%u,%lu,%llu", &ino, name, &mode, &data_size, &version);
     
     if (parse_result < 3) {
       parse_result = sscanf(line, "%lu,%255[^,],%u", &ino, name, &mode);
@@ -764,11 +1085,7 @@ static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
     }
     
     if (parse_result >= 3) {
-      if (mode >= 16384) {
-        mode = S_IFDIR | (mode & 0777);
-      } else {
-        mode = S_IFREG | (mode & 0777);
-      }
+      mode = vtfs_mode_from_server(mode);
       dir = vtfs_get_dir(info->sb, parent_ino);
       if (!dir) {
         if (parent_ino == VTFS_ROOT_INO) {
@@ -787,6 +1104,7 @@ static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
         file = vtfs_create_file(dir, name, mode, ino);
         if (file) {
           file->data_size = data_size;
+          file->version = version;
           if (S_ISDIR(mode)) {
             vtfs_server_load_files(info, ino);
           }
@@ -802,6 +1120,278 @@ static int vtfs_server_load_files(struct vtfs_fs_info* info, ino_t parent_ino) {
   return 0;
 }
 
+// Change feed
+
+static void vtfs_apply_write(struct vtfs_fs_info* info, ino_t ino, size_t size, u64 version) {
+  struct vtfs_file* file;
+  char* old_data;
+  
+  down_write(vtfs_data_sem(info, ino));
+  file = vtfs_find_file_by_ino(&info->root_dir, ino);
+  // Our own writes come back with a version we already know
+  if (!file || version <= file->version) {
+    up_write(vtfs_data_sem(info, ino));
+    return;
+  }
+  
+  // Drop the cached copy; the next read fetches the new contents
+  old_data = file->data;
+  vtfs_update_data_all(&info->root_dir, ino, old_data, NULL, size);
+  vtfs_lru_set(&info->lru, ino, 0);
+  file->data = NULL;
+  file->data_size = size;
+  vtfs_set_version(info, file, version, 0, file->validated);
+  if (old_data) {
+    kfree(old_data);
+  }
+  up_write(vtfs_data_sem(info, ino));
+}
+
+static void vtfs_apply_create(struct vtfs_dir* dir, const char* name, ino_t ino, umode_t mode, size_t size, u64 version) {
+  struct vtfs_file* file;
+  
+  file = vtfs_create_file(dir, name, mode, ino);
+  if (file) {
+    file->data_size = size;
+    file->version = version;
+  }
+}
+
+static void vtfs_apply_link(struct vtfs_fs_info* info, struct vtfs_dir* dir, const char* name, ino_t ino) {
+  struct vtfs_file* main_file;
+  
+  down_write(vtfs_data_sem(info, ino));
+  main_file = vtfs_find_file_by_ino(&info->root_dir, ino);
+  if (main_file) {
+    vtfs_link_file(&info->root_dir, dir, name, main_file);
+  }
+  up_write(vtfs_data_sem(info, ino));
+}
+
+// Waits for the calls using the entry or its buffer, which may be the last link's.
+// The caller holds the write side of ns_sem, so no call is inside a directory it frees.
+static void vtfs_apply_remove(struct vtfs_fs_info* info, struct vtfs_dir* dir, const char* name, ino_t ino) {
+  struct vtfs_file* file;
+  struct vtfs_file* other;
+  
+  down_write(vtfs_data_sem(info, ino));
+  down_write(&dir->sem);
+  file = vtfs_find_file(dir, name);
+  if (!file || file->ino != ino || (file->dir_data && !list_empty(&file->dir_data->files))) {
+    up_write(&dir->sem);
+    up_write(vtfs_data_sem(info, ino));
+    return;
+  }
+  list_del(&file->list);
+  up_write(&dir->sem);
+  
+  if (file->dir_data) {
+    kfree(file->dir_data);
+  } else {
+    other = vtfs_find_file_by_ino(&info->root_dir, ino);
+    if (other) {
+      vtfs_update_nlink_all(&info->root_dir, ino, other->nlink - 1);
+    } else if (file->data) {
+      vtfs_lru_set(&info->lru, ino, 0);
+      kfree(file->data);
+    }
+  }
+  kfree(file);
+  up_write(vtfs_data_sem(info, ino));
+}
+
+/*
+ * Applies one "seq,op,ino,parent_ino,mode,size,version,name" event. Events
+ * caused by this mount find the tree already up to date and change nothing.
+ */
+static void vtfs_apply_change(struct vtfs_fs_info* info, char* line) {
+  long long seq;
+  char op[16];
+  unsigned long ino, parent_ino, size;
+  unsigned int mode;
+  unsigned long long version;
+  char name[VTFS_MAX_NAME];
+  struct vtfs_dir* dir;
+  bool exists;
+  
+  name[0] = '\0';
+  if (sscanf(line, "%lld,%15[^,],%lu,%lu,%u,%lu,%llu,%255[^\n]",
+             &seq, op, &ino, &parent_ino, &mode, &size, &version, name) < 7) {
+    return;
+  }
+  
+  if (strcmp(op, "write") == 0) {
+    vtfs_apply_write(info, ino, size, version);
+    return;
+  }
+  
+  if (name[0] == '\0') {
+    return;
+  }
+  
+  down_write(&info->ns_sem);
+  dir = vtfs_get_dir(info->sb, parent_ino);
+  if (!dir) {
+    up_write(&info->ns_sem);
+    return;
+  }
+  
+  down_read(&dir->sem);
+  exists = vtfs_find_file(dir, name) != NULL;
+  up_read(&dir->sem);
+  
+  if (strcmp(op, "create") == 0 && !exists) {
+    vtfs_apply_create(dir, name, ino, vtfs_mode_from_server(mode), size, version);
+  } else if (strcmp(op, "link") == 0 && !exists) {
+    vtfs_apply_link(info, dir, name, ino);
+  } else if (strcmp(op, "remove") == 0 && exists) {
+    vtfs_apply_remove(info, dir, name, ino);
+  } else {
+    up_write(&info->ns_sem);
+    return;
+  }
+  up_write(&info->ns_sem);
+  
+  atomic64_inc(&info->ns_gen);
+}
+
+/*
+ * Waits up to timeout_ms for changes made through other mounts of the same
+ * token and applies them. A negative cursor only fetches the current one.
+ */
+static int vtfs_server_poll_changes(struct vtfs_fs_info* info, unsigned int timeout_ms) {
+  char* response;
+  char since_str[32], timeout_str[32], limit_str[32];
+  int64_t ret;
+  long long cursor;
+  char* line;
+  char* end_line;
+  
+  response = kmalloc(VTFS_CHANGES_BUFFER + 1, GFP_KERNEL);
+  if (!response) {
+    return -ENOMEM;
+  }
+  
+  snprintf(since_str, sizeof(since_str), "%lld", info->changes_cursor);
+  snprintf(timeout_str, sizeof(timeout_str), "%u", timeout_ms);
+  snprintf(limit_str, sizeof(limit_str), "%d", VTFS_CHANGES_LIMIT);
+  
+  ret = vtfs_http_call(&info->stats, info->token, "changes", response, VTFS_CHANGES_BUFFER, 3,
+                       "since", since_str,
+                       "timeout", timeout_str,
+                       "limit", limit_str);
+  
+  if (ret < 8) {
+    kfree(response);
+    return vtfs_server_failed(info, ret);
+  }
+  
+  int64_t error_code = *(int64_t*)response;
+  error_code = be64_to_cpu(error_code);
+  
+  if (error_code != 0 && error_code != VTFS_ERR_STALE) {
+    kfree(response);
+    return -EIO;
+  }
+  
+  response[ret] = '\0';
+  line = response + 8;
+  end_line = strchr(line, '\n');
+  if (!end_line) {
+    kfree(response);
+    return -EIO;
+  }
+  *end_line = '\0';
+  if (kstrtoll(line, 10, &cursor) != 0) {
+    kfree(response);
+    return -EIO;
+  }
+  
+  if (error_code == VTFS_ERR_STALE && info->changes_cursor >= 0) {
+    // Missed events: distrust every cached copy. Namespace changes we
+    // missed stay invisible until remount.
+    LOG("change feed overflowed, dropping cached data\n");
+    vtfs_mark_all_stale(&info->root_dir);
+    atomic64_inc(&info->ns_gen);
+  }
+  
+  line = end_line + 1;
+  while ((end_line = strchr(line, '\n')) != NULL) {
+    *end_line = '\0';
+    vtfs_apply_change(info, line);
+    line = end_line + 1;
+  }
+  
+  info->changes_cursor = cursor;
+  info->changes_live = true;
+  kfree(response);
+  vtfs_server_reached(info);
+  return 0;
+}
+
+static int vtfs_changes_thread(void* data) {
+  struct vtfs_fs_info* info = data;
+  
+  while (!kthread_should_stop()) {
+    if (vtfs_server_poll_changes(info, VTFS_CHANGES_POLL_MS) != 0) {
+      info->changes_live = false;
+      schedule_timeout_interruptible(msecs_to_jiffies(VTFS_CHANGES_RETRY_MS));
+    }
+  }
+  
+  return 0;
+}
+
+/*
+ * Dentries are checked against the in-memory tree only after a remote change
+ * touched the namespace, so the common case stays in RCU walk mode.
+ */
+static int vtfs_d_revalidate(struct dentry* dentry, unsigned int flags) {
+  struct vtfs_fs_info* info = dentry->d_sb->s_fs_info;
+  struct dentry* parent;
+  struct vtfs_dir* dir;
+  struct vtfs_file* file;
+  unsigned long gen;
+  bool valid;
+  
+  if (!info || IS_ROOT(dentry)) {
+    return 1;
+  }
+  
+  gen = (unsigned long)atomic64_read(&info->ns_gen);
+  if (dentry->d_time == gen) {
+    return 1;
+  }
+  
+  if (flags & LOOKUP_RCU) {
+    return -ECHILD;
+  }
+  
+  down_read(vtfs_ns_sem(dentry->d_sb));
+  parent = dget_parent(dentry);
+  dir = vtfs_get_dir(dentry->d_sb, d_inode(parent)->i_ino);
+  dput(parent);
+  if (!dir) {
+    up_read(vtfs_ns_sem(dentry->d_sb));
+    return 0;
+  }
+  
+  down_read(&dir->sem);
+  file = vtfs_find_file(dir, dentry->d_name.name);
+  if (d_really_is_negative(dentry)) {
+    valid = file == NULL;
+  } else {
+    valid = file != NULL && file->ino == d_inode(dentry)->i_ino;
+  }
+  up_read(&dir->sem);
+  up_read(vtfs_ns_sem(dentry->d_sb));
+  
+  if (valid) {
+    dentry->d_time = gen;
+  }
+  return valid ? 1 : 0;
+}
+
 static int vtfs_create(
   struct mnt_idmap *idmap,
   struct inode *parent_inode, 
@@ -838,7 +1428,8 @@ static int vtfs_create(
   
   ino_t new_ino = 0;
   if (info->use_server) {
-    // Create file on server first
+    // Create file on server first, after the journaled changes, e.g. the unlink of this name
+    vtfs_journal_drain(&info->journal);
     int ret = vtfs_server_create_file(info, parent_inode->i_ino, name, file_mode, &new_ino);
     if (ret != 0) {
       return ret;
@@ -877,6 +1468,13 @@ static int vtfs_create(
     return -ENOMEM;
   }
   
+  if (info->use_server) {
+    // A fresh server inode is empty, so the (empty) local copy is current
+    file->version = VTFS_INITIAL_VERSION;
+    file->data_version = VTFS_INITIAL_VERSION;
+    file->validated = jiffies;
+  }
+  
   inode->i_op = &vtfs_inode_ops;
   inode->i_fop = &vtfs_file_ops;
   set_nlink(inode, 1);
@@ -903,158 +1501,263 @@ static struct vtfs_file* vtfs_get_file_by_inode(struct inode* inode) {
   return file;
 }
 
-static void vtfs_update_nlink_all(struct vtfs_dir* dir, ino_t ino, unsigned int nlink) {
-  struct vtfs_file* file;
-  
-  if (!dir) return;
-  
-  down_write(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->ino == ino) {
-      file->nlink = nlink;
-    }
-  }
-  up_write(&dir->sem);
-  
-  down_read(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->dir_data) {
-      vtfs_update_nlink_all(file->dir_data, ino, nlink);
+// Memory budget
+
+/*
+ * Writes a buffer back whole after a write the server did not take. The
+ * next read fetches the server's copy again, which may be longer.
+ */
+static int vtfs_flush_file(struct vtfs_fs_info* info, struct vtfs_file* file) {
+  u64 version;
+  int ret;
+  
+  if (file->data_size > 0) {
+    ret = vtfs_server_write_file(info, file->ino, 0, file->data, file->data_size, &version);
+    if (ret != 0) {
+      return ret;
     }
+    vtfs_set_version(info, file, version, 0, file->validated);
   }
-  up_read(&dir->sem);
+  vtfs_lru_mark_dirty(&info->lru, file->ino, false);
+  return 0;
 }
 
-static void vtfs_update_data_all(struct vtfs_dir* dir, ino_t ino, char* old_data, char* new_data, size_t new_size) {
-  struct vtfs_file* file;
-  
-  if (!dir) return;
-  
-  down_write(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->ino == ino && file->data == old_data) {
-      file->data = new_data;
-      file->data_size = new_size;
+/*
+ * Same as a remote write: the size stays, the next read fetches the data.
+ * The caller holds the write side of the file's data lock.
+ * In RAM mode the data goes to the compressed store instead, unless the
+ * image holds it unchanged; if that fails the buffer stays and becomes the
+ * most recently used, and if the data would not shrink it also stops being
+ * a victim.
+ */
+static size_t vtfs_mem_evict(struct vtfs_fs_info* info, struct vtfs_file* file) {
+  char* old_data = file->data;
+  size_t bytes = file->data_size;
+  
+  if (!info->use_server && !vtfs_image_has(&info->image, file->ino)) {
+    int ret = vtfs_zstore_put(&info->zstore, file->ino, old_data, bytes);
+    if (ret == -E2BIG) {
+      vtfs_lru_keep(&info->lru, file->ino);
+      return 0;
     }
-  }
-  up_write(&dir->sem);
-  
-  down_read(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->dir_data) {
-      vtfs_update_data_all(file->dir_data, ino, old_data, new_data, new_size);
+    if (ret != 0) {
+      vtfs_lru_set(&info->lru, file->ino, bytes);
+      return 0;
     }
   }
-  up_read(&dir->sem);
+  
+  vtfs_update_data_all(&info->root_dir, file->ino, old_data, NULL, file->data_size);
+  vtfs_set_version(info, file, file->version, 0, file->validated);
+  vtfs_lru_evicted(&info->lru, file->ino);
+  kfree(old_data);
+  return bytes;
 }
 
-static void vtfs_remove_all_by_ino(struct vtfs_dir* dir, ino_t ino) {
-  struct vtfs_file* file;
-  struct vtfs_file* tmp;
-  
-  if (!dir) return;
+// RAM mode: brings back the data of a file in the image or the compressed store
+static int vtfs_mem_unpack(struct vtfs_fs_info* info, struct vtfs_file* file) {
+  char* data;
+  int ret;
   
-  down_write(&dir->sem);
-  list_for_each_entry_safe(file, tmp, &dir->files, list) {
-    if (file->ino == ino) {
-      list_del(&file->list);
-      kfree(file);
-    }
+  if (info->use_server || file->data || file->data_size == 0) {
+    return 0;
   }
-  up_write(&dir->sem);
   
-  down_read(&dir->sem);
-  list_for_each_entry(file, &dir->files, list) {
-    if (file->dir_data) {
-      vtfs_remove_all_by_ino(file->dir_data, ino);
-    }
-  }
-  up_read(&dir->sem);
+  if (vtfs_image_has(&info->image, file->ino)) {
+    ret = vtfs_image_read(&info->image, file->ino, file->data_size, &data);
+  } else if (vtfs_zstore_enabled(&info->zstore)) {
+    ret = vtfs_zstore_take(&info->zstore, file->ino, file->data_size, &data);
+  } else {
+    return 0;
+  }
+  if (ret != 0) {
+    return ret;
+  }
+  vtfs_update_data_all(&info->root_dir, file->ino, NULL, data, file->data_size);
+  return 0;
+}
+
+// Forgets the data of ino once it has no links left or was truncated to nothing
+static void vtfs_mem_forget(struct vtfs_fs_info* info, ino_t ino) {
+  vtfs_lru_set(&info->lru, ino, 0);
+  vtfs_zstore_drop(&info->zstore, ino);
+  vtfs_image_forget(&info->image, ino);
+}
+
+/*
+ * Drops least recently used buffers other than keep's until the mount is
+ * back under mem_limit, with room for more bytes. Dirty ones are flushed
+ * first; one the server refuses, or one in use, stays and becomes the most
+ * recently used.
+ */
+static void vtfs_mem_shrink(struct vtfs_fs_info* info, ino_t keep, size_t more) {
+  ino_t ino;
+  bool dirty;
+  
+  for (int i = 0; i < VTFS_EVICT_BATCH && vtfs_lru_victim(&info->lru, keep, more, &ino, &dirty); i++) {
+    struct rw_semaphore* sem = vtfs_data_sem(info, ino);
+    struct vtfs_file* file;
+    
+    // Also fails for a lock the caller holds, e.g. the other file of a copy
+    if (!down_write_trylock(sem)) {
+      vtfs_lru_touch(&info->lru, ino);
+      continue;
+    }
+    // A write on its way to the server may still need the buffer; checked
+    // under the data lock, which the write retakes before it finishes
+    if (mutex_is_locked(vtfs_send_lock(info, ino))) {
+      up_write(sem);
+      vtfs_lru_touch(&info->lru, ino);
+      continue;
+    }
+    
+    file = vtfs_find_file_by_ino(&info->root_dir, ino);
+    // A write may have dirtied it since it was picked
+    dirty = vtfs_lru_is_dirty(&info->lru, ino);
+    if (!file || !file->data) {
+      vtfs_lru_set(&info->lru, ino, 0);
+    } else if (dirty && vtfs_flush_file(info, file) != 0) {
+      vtfs_lru_set(&info->lru, ino, file->data_size);
+    } else {
+      vtfs_mem_evict(info, file);
+    }
+    up_write(sem);
+  }
+}
+
+/*
+ * Reclaim runs with arbitrary locks held, a directory's sem among them
+ * (iterate faults in the user buffer under it), so the shrinker only asks
+ * for bytes and this work item drops clean buffers, oldest first. One a
+ * call is using stays; after a batch of those it gives up until the next
+ * scan rather than spin.
+ */
+static void vtfs_reclaim_work(struct work_struct* work) {
+  struct vtfs_fs_info* info = container_of(work, struct vtfs_fs_info, reclaim_work);
+  long target = atomic_long_xchg(&info->reclaim_bytes, 0);
+  long freed = 0;
+  int busy = 0;
+  ino_t ino;
+  
+  while (freed < target && busy < VTFS_EVICT_BATCH && vtfs_lru_oldest_clean(&info->lru, &ino)) {
+    struct rw_semaphore* sem = vtfs_data_sem(info, ino);
+    struct vtfs_file* file;
+    
+    if (!down_write_trylock(sem)) {
+      vtfs_lru_touch(&info->lru, ino);
+      busy++;
+      continue;
+    }
+    if (mutex_is_locked(vtfs_send_lock(info, ino))) {
+      up_write(sem);
+      vtfs_lru_touch(&info->lru, ino);
+      busy++;
+      continue;
+    }
+    
+    file = vtfs_find_file_by_ino(&info->root_dir, ino);
+    if (!file || !file->data) {
+      vtfs_lru_set(&info->lru, ino, 0);
+    } else if (!vtfs_lru_is_dirty(&info->lru, ino)) {
+      // Unless a write dirtied it since it was picked
+      freed += vtfs_mem_evict(info, file);
+    }
+    up_write(sem);
+  }
+}
+
+static unsigned long vtfs_shrink_count(struct shrinker* shrinker, struct shrink_control* sc) {
+  struct vtfs_fs_info* info = shrinker->private_data;
+  unsigned long pages = vtfs_lru_reclaimable(&info->lru) >> PAGE_SHIFT;
+  
+  return pages ? pages : SHRINK_EMPTY;
+}
+
+// Dirty buffers are left alone: writing them back needs the network
+static unsigned long vtfs_shrink_scan(struct shrinker* shrinker, struct shrink_control* sc) {
+  struct vtfs_fs_info* info = shrinker->private_data;
+  
+  atomic_long_add(sc->nr_to_scan << PAGE_SHIFT, &info->reclaim_bytes);
+  queue_work(system_unbound_wq, &info->reclaim_work);
+  return SHRINK_STOP;
+}
+
+// Accounts file's buffer after it was used or changed, then makes room;
+// the caller holds the file's data lock
+static void vtfs_mem_used(struct vtfs_fs_info* info, struct vtfs_file* file) {
+  vtfs_lru_set(&info->lru, file->ino, file->data ? file->data_size : 0);
+  if (info->use_server || vtfs_zstore_enabled(&info->zstore)) {
+    vtfs_mem_shrink(info, file->ino, 0);
+  }
+}
+
+/*
+ * Without compression RAM mode has no tier to evict to, so there mem_limit
+ * is a hard limit. With it, colder files are compressed to make room first;
+ * a mem_limit given at mount then caps the compressed data as well, while
+ * the default one only sizes the hot set.
+ */
+static int vtfs_mem_reserve(struct vtfs_fs_info* info, struct vtfs_file* file, size_t new_size) {
+  size_t held = file->data ? file->data_size : 0;
+  
+  if (info->use_server || new_size <= held) {
+    return 0;
+  }
+  if (vtfs_zstore_enabled(&info->zstore)) {
+    if (!info->lru.charged) {
+      return 0;
+    }
+    vtfs_mem_shrink(info, file->ino, new_size - held);
+  }
+  return vtfs_lru_fits(&info->lru, new_size - held) ? 0 : -ENOSPC;
 }
 
 static int vtfs_unlink(struct inode *parent_inode, struct dentry *child_dentry) {
+  struct vtfs_fs_info* info;
   struct vtfs_dir* dir;
-  struct vtfs_file* file;
-  struct vtfs_file* main_file;
   struct inode* inode;
   const char* name;
   ino_t file_ino;
   unsigned int new_nlink;
+  int ret;
   
   if (!parent_inode || !child_dentry) {
     return -EINVAL;
   }
   
+  info = parent_inode->i_sb->s_fs_info;
   dir = vtfs_get_dir(parent_inode->i_sb, parent_inode->i_ino);
-  if (!dir) {
+  if (!info || !dir) {
     return -ENOENT;
   }
   
   name = child_dentry->d_name.name;
   inode = child_dentry->d_inode;
-  
   if (!inode) {
     return -ENOENT;
   }
   
   file_ino = inode->i_ino;
-  
-  main_file = vtfs_get_file_by_inode(inode);
-  if (!main_file) {
-    return -ENOENT;
-  }
-  
-  down_write(&dir->sem);
-  file = vtfs_find_file(dir, name);
-  if (!file || file->ino != file_ino) {
-    up_write(&dir->sem);
-    return -ENOENT;
+  // The last link frees the buffer
+  down_write(vtfs_data_sem(info, file_ino));
+  ret = vtfs_unlink_file(&info->root_dir, dir, name, file_ino, &new_nlink);
+  if (ret == 0 && new_nlink == 0) {
+    vtfs_mem_forget(info, file_ino);
   }
-  
-  new_nlink = main_file->nlink - 1;
-  
-  char* data_to_free = NULL;
-  struct vtfs_dir* dir_data_to_free = NULL;
-  bool should_free_data = (new_nlink == 0);
-  
-  if (should_free_data) {
-    data_to_free = file->data;
-    dir_data_to_free = file->dir_data;
+  up_write(vtfs_data_sem(info, file_ino));
+  if (ret != 0) {
+    return ret;
   }
   
-  list_del(&file->list);
-  up_write(&dir->sem);
-  
-  struct vtfs_fs_info* info = parent_inode->i_sb->s_fs_info;
-  if (info) {
-    vtfs_update_nlink_all(&info->root_dir, file_ino, new_nlink);
-    
-    if (info->use_server) {
-      int ret = vtfs_server_unlink(info, file_ino);
-      if (ret != 0) {
-        // Continue anyway
-      }
+  if (info->use_server &&
+      vtfs_defer(info, VTFS_JOURNAL_UNLINK, file_ino, parent_inode->i_ino, name, strlen(name)) != 0) {
+    ret = vtfs_server_unlink(info, file_ino, parent_inode->i_ino, name);
+    if (ret != 0 &&
+        vtfs_defer_failed(info, ret, VTFS_JOURNAL_UNLINK, file_ino, parent_inode->i_ino, name, strlen(name)) != 0) {
+      // Continue anyway
     }
   }
   
   set_nlink(inode, new_nlink);
-  
-  kfree(file);
-  
-  if (should_free_data) {
-    if (info) {
-      vtfs_remove_all_by_ino(&info->root_dir, file_ino);
-    }
-    
-    if (dir_data_to_free) {
-      vtfs_cleanup_dir(dir_data_to_free);
-      kfree(dir_data_to_free);
-    }
-    if (data_to_free) {
-      kfree(data_to_free);
-    }
-  }
-  
   return 0;
 }
 
@@ -1088,6 +1791,7 @@ static int vtfs_mkdir(struct mnt_idmap *idmap, struct inode *parent_inode, struc
   
   ino_t new_ino = 0;
   if (info->use_server) {
+    vtfs_journal_drain(&info->journal);
     int ret = vtfs_server_mkdir(info, parent_inode->i_ino, name, dir_mode, &new_ino);
     if (ret != 0) {
       return ret;
@@ -1134,8 +1838,8 @@ static int vtfs_mkdir(struct mnt_idmap *idmap, struct inode *parent_inode, struc
 
 static int vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry) {
   struct vtfs_dir* dir;
-  struct vtfs_file* file;
-  const char* name;
+  ino_t file_ino;
+  int ret;
   
   if (!parent_inode || !child_dentry) {
     return -EINVAL;
@@ -1146,46 +1850,25 @@ static int vtfs_rmdir(struct inode *parent_inode, struct dentry *child_dentry) {
     return -ENOENT;
   }
   
-  name = child_dentry->d_name.name;
-  
-  down_write(&dir->sem);
-  file = vtfs_find_file(dir, name);
-  if (!file) {
-    up_write(&dir->sem);
-    return -ENOENT;
-  }
-  
-  if (!S_ISDIR(file->mode)) {
-    up_write(&dir->sem);
-    return -ENOTDIR;
-  }
-  
-  if (!file->dir_data || !list_empty(&file->dir_data->files)) {
-    up_write(&dir->sem);
-    return -ENOTEMPTY;
+  ret = vtfs_remove_dir(dir, child_dentry->d_name.name, &file_ino);
+  if (ret != 0) {
+    return ret;
   }
   
-  ino_t file_ino = file->ino;
-  list_del(&file->list);
-  up_write(&dir->sem);
-  
   struct vtfs_fs_info* info = parent_inode->i_sb->s_fs_info;
-  if (info && info->use_server) {
-    int ret = vtfs_server_rmdir(info, file_ino);
-    if (ret != 0) {
+  if (info && info->use_server &&
+      vtfs_defer(info, VTFS_JOURNAL_RMDIR, file_ino, 0, NULL, 0) != 0) {
+    ret = vtfs_server_rmdir(info, file_ino);
+    if (ret != 0 && vtfs_defer_failed(info, ret, VTFS_JOURNAL_RMDIR, file_ino, 0, NULL, 0) != 0) {
       // Continue anyway
     }
   }
   
-  if (file->dir_data) {
-    kfree(file->dir_data);
-  }
-  kfree(file);
-  
   return 0;
 }
 
 static int vtfs_link(struct dentry* old_dentry, struct inode* parent_dir, struct dentry* new_dentry) {
+  struct vtfs_fs_info* info;
   struct vtfs_dir* dir;
   struct vtfs_file* file;
   struct vtfs_file* new_file;
@@ -1205,62 +1888,44 @@ static int vtfs_link(struct dentry* old_dentry, struct inode* parent_dir, struct
     return -EPERM;
   }
   
-  file = vtfs_get_file_by_inode(inode);
-  if (!file) {
-    return -ENOENT;
-  }
-  
+  info = parent_dir->i_sb->s_fs_info;
   dir = vtfs_get_dir(parent_dir->i_sb, parent_dir->i_ino);
-  if (!dir) {
+  if (!info || !dir) {
     return -ENOENT;
   }
   
   name = new_dentry->d_name.name;
   
-  down_write(&dir->sem);
-  if (vtfs_find_file(dir, name) != NULL) {
-    up_write(&dir->sem);
-    return -EEXIST;
-  }
-  
-  new_file = kmalloc(sizeof(struct vtfs_file), GFP_KERNEL);
+  // The new entry shares the buffer, which must not go away meanwhile
+  down_write(vtfs_data_sem(info, inode->i_ino));
+  file = vtfs_get_file_by_inode(inode);
+  new_file = file ? vtfs_link_file(&info->root_dir, dir, name, file) : NULL;
   if (!new_file) {
-    up_write(&dir->sem);
-    return -ENOMEM;
-  }
-  
-  INIT_LIST_HEAD(&new_file->list);
-  new_file->ino = file->ino;
-  new_file->mode = file->mode;
-  strncpy(new_file->name, name, VTFS_MAX_NAME - 1);
-  new_file->name[VTFS_MAX_NAME - 1] = '\0';
-  new_file->dir_data = NULL;
-  new_file->data = file->data;
-  new_file->data_size = file->data_size;
-  
-  file->nlink++;
-  new_file->nlink = file->nlink;
-  set_nlink(inode, file->nlink);
-  
-  list_add_tail(&new_file->list, &dir->files);
-  up_write(&dir->sem);
-  
-  struct vtfs_fs_info* info = parent_dir->i_sb->s_fs_info;
-  if (info) {
-    vtfs_update_nlink_all(&info->root_dir, file->ino, file->nlink);
+    bool exists;
     
-    if (info->use_server) {
-      unsigned int server_nlink;
-      int ret = vtfs_server_link(info, file->ino, parent_dir->i_ino, name, &server_nlink);
-      if (ret == 0) {
-        // Update nlink from server response
-        file->nlink = server_nlink;
-        new_file->nlink = server_nlink;
-        set_nlink(inode, server_nlink);
-        vtfs_update_nlink_all(&info->root_dir, file->ino, server_nlink);
-      } else {
-        // Continue anyway
-      }
+    up_write(vtfs_data_sem(info, inode->i_ino));
+    if (!file) {
+      return -ENOENT;
+    }
+    down_read(&dir->sem);
+    exists = vtfs_find_file(dir, name) != NULL;
+    up_read(&dir->sem);
+    return exists ? -EEXIST : -ENOMEM;
+  }
+  set_nlink(inode, new_file->nlink);
+  up_write(vtfs_data_sem(info, inode->i_ino));
+  
+  if (info->use_server &&
+      vtfs_defer(info, VTFS_JOURNAL_LINK, inode->i_ino, parent_dir->i_ino, name, strlen(name)) != 0) {
+    unsigned int server_nlink;
+    vtfs_journal_drain(&info->journal);
+    int ret = vtfs_server_link(info, inode->i_ino, parent_dir->i_ino, name, &server_nlink);
+    if (ret == 0) {
+      // Update nlink from server response
+      set_nlink(inode, server_nlink);
+      vtfs_update_nlink_all(&info->root_dir, inode->i_ino, server_nlink);
+    } else if (vtfs_defer_failed(info, ret, VTFS_JOURNAL_LINK, inode->i_ino, parent_dir->i_ino, name, strlen(name)) != 0) {
+      // Continue anyway
     }
   }
   
@@ -1270,155 +1935,207 @@ static int vtfs_link(struct dentry* old_dentry, struct inode* parent_dir, struct
   return 0;
 }
 
-static ssize_t vtfs_read(struct file* filp, char __user* buffer, size_t len, loff_t* offset) {
-  struct inode* inode;
+/*
+ * Whether a read may copy out of file under the read side of its data
+ * lock alone: the RAM mode data is resident, or the server mode copy is
+ * complete and was validated recently enough.
+ */
+static bool vtfs_read_ready(struct vtfs_fs_info* info, struct vtfs_file* file) {
+  if (!info->use_server) {
+    return file->data || file->data_size == 0;
+  }
+  return file->data && file->data_version != 0 && file->data_version == file->version &&
+         (info->changes_live || time_before(jiffies, file->validated + VTFS_REVALIDATE_INTERVAL));
+}
+
+/*
+ * Makes the data of the file resident for a read of needed bytes. 1 if
+ * there is data to copy, 0 if not. The caller holds the write side of the
+ * data lock, since fetching the data replaces the buffer, and in server
+ * mode the send lock; *filep is looked up again after a round trip.
+ */
+static int vtfs_read_prepare(struct vtfs_fs_info* info, struct inode* inode, struct vtfs_file** filep, size_t needed) {
   struct vtfs_file* file;
-  ssize_t ret;
-  size_t to_read;
+  int ret;
   
-  if (!filp || !filp->f_path.dentry) {
-    return -EINVAL;
+  // Load data from server if the cached copy is missing or outdated
+  if (info->use_server) {
+    ret = vtfs_server_revalidate(info, inode, filep, needed);
+    file = *filep;
+    if (!file) {
+      return 0;
+    }
+    if (ret != 0 && vtfs_offline(info) &&
+        !(file->data && file->data_version != 0 && file->data_version == file->version) &&
+        !(file->data && vtfs_lru_is_dirty(&info->lru, inode->i_ino))) {
+      // Offline only a complete copy is served: a partial one, or the zeros
+      // around a write made to one, would read as the file's contents
+      return -EIO;
+    }
+    if (ret != 0 && !file->data && file->data_size > 0) {
+      // Nothing cached to serve
+      return ret;
+    }
+  } else {
+    file = *filep;
+    ret = vtfs_mem_unpack(info, file);
+    if (ret != 0) {
+      return ret;
+    }
   }
   
-  inode = filp->f_path.dentry->d_inode;
-  if (!inode) {
-    return -EINVAL;
+  if (!file->data) {
+    return 0;
   }
+  vtfs_mem_used(info, file);
+  return 1;
+}
+
+/*
+ * Returns 1 with the read side of the data lock of inode held and *filep
+ * ready to copy out of, or 0 (nothing to copy) or an error without it. A
+ * resident, validated copy needs nothing more; otherwise the write side is
+ * taken to fetch or unpack the data, and the copy is checked again under it.
+ */
+static int vtfs_read_lock(struct vtfs_fs_info* info, struct inode* inode, size_t needed, struct vtfs_file** filep) {
+  struct rw_semaphore* sem = vtfs_data_sem(info, inode->i_ino);
+  struct mutex* send = vtfs_send_lock(info, inode->i_ino);
+  struct vtfs_file* file;
+  int ret;
   
+  down_read(sem);
   file = vtfs_get_file_by_inode(inode);
   if (!file) {
+    up_read(sem);
     return 0;
   }
+  if (vtfs_read_ready(info, file)) {
+    if (!file->data) {
+      up_read(sem);
+      return 0;
+    }
+    if (info->use_server) {
+      trace_vtfs_cache(inode->i_ino, false, false);
+    }
+    vtfs_mem_used(info, file);
+    *filep = file;
+    return 1;
+  }
+  up_read(sem);
   
-  struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
+  if (info->use_server) {
+    mutex_lock(send);
+    // Local writes the server has not taken yet go first, or the fetch would lose them
+    vtfs_journal_wait_ino(&info->journal, inode->i_ino);
+  }
+  down_write(sem);
+  file = vtfs_get_file_by_inode(inode);
+  ret = file ? vtfs_read_prepare(info, inode, &file, needed) : 0;
+  if (ret > 0) {
+    // Copying out only reads the buffer, other readers may do the same
+    downgrade_write(sem);
+    *filep = file;
+  } else {
+    up_write(sem);
+  }
+  if (info->use_server) {
+    mutex_unlock(send);
+  }
+  return ret;
+}
+
+static ssize_t vtfs_read(struct file* filp, char __user* buffer, size_t len, loff_t* offset) {
+  struct vtfs_fs_info* info;
+  struct inode* inode;
+  struct vtfs_file* file;
+  struct rw_semaphore* sem;
+  ssize_t ret;
+  size_t to_read;
   
-  // Load data from server if needed
-  if (info && info->use_server && (!file->data || *offset + len > file->data_size)) {
-    size_t needed = *offset + len;
-    if (needed > file->data_size || !file->data) {
-      char* server_data = kmalloc(needed, GFP_KERNEL);
-      if (server_data) {
-        size_t read_len;
-        int server_ret = vtfs_server_read_file(info, inode->i_ino, 0, needed, server_data, &read_len);
-        if (server_ret == 0 && read_len > 0) {
-          if (file->data) {
-            kfree(file->data);
-          }
-          file->data = server_data;
-          file->data_size = read_len;
-        } else {
-          kfree(server_data);
-        }
-      }
-    }
+  if (!filp || !filp->f_path.dentry) {
+    return -EINVAL;
   }
   
-  if (!file->data) {
-    return 0;
+  inode = filp->f_path.dentry->d_inode;
+  if (!inode) {
+    return -EINVAL;
   }
   
-  if (*offset >= file->data_size) {
+  info = inode->i_sb->s_fs_info;
+  if (!info) {
     return 0;
   }
   
-  to_read = len;
-  if (*offset + to_read > file->data_size) {
-    to_read = file->data_size - *offset;
+  ret = vtfs_read_lock(info, inode, *offset + len, &file);
+  if (ret <= 0) {
+    return ret;
   }
+  sem = vtfs_data_sem(info, inode->i_ino);
   
-  if (to_read == 0) {
-    return 0;
+  to_read = 0;
+  if (*offset < file->data_size) {
+    to_read = min_t(size_t, len, file->data_size - *offset);
   }
   
-  ret = copy_to_user(buffer, file->data + *offset, to_read);
-  if (ret) {
+  if (to_read > 0 && copy_to_user(buffer, file->data + *offset, to_read)) {
+    up_read(sem);
     return -EFAULT;
   }
+  up_read(sem);
   
   *offset += to_read;
   return to_read;
 }
 
-static ssize_t vtfs_write(struct file* filp, const char __user* buffer, size_t len, loff_t* offset) {
-  struct inode* inode;
+/*
+ * Makes a write to the local copy; in server mode vtfs_write_send takes it
+ * to the server afterwards. *whole tells whether the copy was complete, so
+ * that it may be flushed back whole. The caller holds the write side of
+ * the file's data lock.
+ */
+static ssize_t vtfs_write_locked(struct vtfs_fs_info* info, struct file* filp, struct inode* inode, const char* data, size_t len, loff_t* offset, bool* whole) {
   struct vtfs_file* file;
-  char* new_data;
   size_t new_size;
   ssize_t ret;
   
-  if (!filp || !filp->f_path.dentry) {
-    return -EINVAL;
-  }
-  
-  inode = filp->f_path.dentry->d_inode;
-  if (!inode) {
-    return -EINVAL;
-  }
-  
   file = vtfs_get_file_by_inode(inode);
   if (!file) {
     return -ENOENT;
   }
   
-  if (filp->f_flags & O_APPEND) {
-    *offset = file->data_size;
-  }
-  
-  new_size = *offset + len;
-  if (new_size > file->data_size || !file->data) {
-    char* old_data = file->data;
-    new_data = krealloc(file->data, new_size, GFP_KERNEL);
-    if (!new_data) {
-      return -ENOMEM;
-    }
-    if (file->data_size < *offset) {
-      memset(new_data + file->data_size, 0, *offset - file->data_size);
-    }
-    
-    struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
-    // For hard links: update all links if old_data exists
-    if (info && old_data && old_data != new_data) {
-      vtfs_update_data_all(&info->root_dir, inode->i_ino, old_data, new_data, new_size);
-      file = vtfs_get_file_by_inode(inode);
-      if (!file || !file->data) {
-        return -ENOMEM;
-      }
-    } else {
-      // New file or no hard links: just update this file
-      file->data = new_data;
-      file->data_size = new_size;
-    }
-  }
-  
-  if (!file->data) {
-    return -ENOMEM;
+  if (len == 0) {
+    return 0;
   }
   
-  // Copy data from user space first
-  char* temp_buffer = kmalloc(len, GFP_KERNEL);
-  if (!temp_buffer) {
-    return -ENOMEM;
+  if (filp->f_flags & O_APPEND) {
+    *offset = file->data_size;
   }
   
-  ret = copy_from_user(temp_buffer, buffer, len);
-  if (ret) {
-    kfree(temp_buffer);
-    return -EFAULT;
+  ret = vtfs_mem_unpack(info, file);
+  if (ret != 0) {
+    return ret;
   }
+  vtfs_image_forget(&info->image, inode->i_ino);
   
-  // Copy to file->data
-  memcpy(file->data + *offset, temp_buffer, len);
+  // Only a write onto a complete copy may later be flushed back whole
+  *whole = file->data_size == 0 || vtfs_lru_is_dirty(&info->lru, inode->i_ino) ||
+           (file->data && file->data_version != 0 && file->data_version == file->version);
   
-  // Send to server if in server mode
-  struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
-  if (info && info->use_server) {
-    int server_ret = vtfs_server_write_file(info, inode->i_ino, *offset, temp_buffer, len);
-    if (server_ret != 0) {
-      // Continue anyway - data is in memory
+  // Every hard link sees the grown buffer
+  new_size = *offset + len;
+  if (new_size > file->data_size || !file->data) {
+    new_size = max(new_size, file->data_size);
+    ret = vtfs_mem_reserve(info, file, new_size);
+    if (ret != 0) {
+      return ret;
+    }
+    if (vtfs_resize_data(&info->root_dir, file, new_size) != 0) {
+      return -ENOMEM;
     }
   }
   
-  kfree(temp_buffer);
+  memcpy(file->data + *offset, data, len);
+  vtfs_mem_used(info, file);
   
   *offset += len;
   inode->i_size = file->data_size;
@@ -1426,8 +2143,263 @@ static ssize_t vtfs_write(struct file* filp, const char __user* buffer, size_t l
   return len;
 }
 
-static int vtfs_getattr(struct mnt_idmap* idmap, const struct path* path, struct kstat* stat, u32 request_mask, unsigned int flags) {
-  struct inode* inode = d_inode(path->dentry);
+/*
+ * Sends a write vtfs_write_locked made, or queues it in the journal, and
+ * records the outcome in the file's versions. The caller holds the send
+ * lock, so the writes of a file reach the server in order, but not the
+ * data lock: it is taken only to record the outcome.
+ */
+static void vtfs_write_send(struct vtfs_fs_info* info, struct inode* inode, const char* data, size_t len, loff_t pos, bool whole) {
+  struct rw_semaphore* sem = vtfs_data_sem(info, inode->i_ino);
+  struct vtfs_file* file;
+  u64 new_version = 0;
+  bool queued;
+  int ret;
+  
+  // A journaled write gets there later, and until then a read waits for it
+  // before fetching the file again
+  ret = vtfs_defer(info, VTFS_JOURNAL_WRITE, inode->i_ino, pos, data, len);
+  queued = ret == 0;
+  if (!queued) {
+    ret = vtfs_server_write_file(info, inode->i_ino, pos, data, len, &new_version);
+    // Queued after all, as if the mount had been offline already
+    queued = ret != 0 && vtfs_defer_failed(info, ret, VTFS_JOURNAL_WRITE, inode->i_ino, pos, data, len) == 0;
+  }
+  
+  down_write(sem);
+  file = vtfs_get_file_by_inode(inode);
+  if (!file) {
+    // Removed while the write was on its way
+  } else if (queued) {
+    vtfs_set_version(info, file, file->version, 0, file->validated);
+  } else if (ret != 0) {
+    // Continue anyway - data is in memory; a complete copy is flushed by
+    // the next read or eviction, a partial one is dropped by the next read
+    vtfs_set_version(info, file, file->version, 0, file->validated);
+    if (whole && file->data) {
+      vtfs_lru_mark_dirty(&info->lru, inode->i_ino, true);
+    }
+  } else {
+    // The local copy stays current only if no one else wrote in between
+    bool still_current = file->data_version != 0 && file->data_version == file->version &&
+                   new_version == file->version + 1;
+    vtfs_set_version(info, file, new_version, still_current ? new_version : 0, jiffies);
+  }
+  up_write(sem);
+}
+
+static ssize_t vtfs_write(struct file* filp, const char __user* buffer, size_t len, loff_t* offset) {
+  struct vtfs_fs_info* info;
+  struct inode* inode;
+  struct mutex* send;
+  char* data;
+  bool whole = false;
+  ssize_t ret;
+  
+  if (!filp || !filp->f_path.dentry) {
+    return -EINVAL;
+  }
+  
+  inode = filp->f_path.dentry->d_inode;
+  if (!inode) {
+    return -EINVAL;
+  }
+  
+  info = inode->i_sb->s_fs_info;
+  if (!info) {
+    return -ENOMEM;
+  }
+  
+  // Copy data from user space first, a fault must not wait under the locks
+  data = memdup_user(buffer, len);
+  if (IS_ERR(data)) {
+    return PTR_ERR(data);
+  }
+  
+  send = vtfs_send_lock(info, inode->i_ino);
+  if (info->use_server) {
+    mutex_lock(send);
+  }
+  down_write(vtfs_data_sem(info, inode->i_ino));
+  ret = vtfs_write_locked(info, filp, inode, data, len, offset, &whole);
+  up_write(vtfs_data_sem(info, inode->i_ino));
+  if (ret > 0 && info->use_server) {
+    vtfs_write_send(info, inode, data, len, *offset - len, whole);
+  }
+  if (info->use_server) {
+    mutex_unlock(send);
+  }
+  
+  kfree(data);
+  return ret;
+}
+
+/*
+ * Copies up to len bytes between two files of one mount and returns how
+ * many were copied, fewer if the source ends first. In server mode the
+ * server copies the data itself and the destination's cached copy is
+ * dropped, to be fetched again on the next read; in RAM mode the bytes are
+ * copied in memory. The caller holds the data locks of both files.
+ */
+static ssize_t vtfs_copy_range_locked(struct vtfs_fs_info* info, struct inode* inode_in, loff_t pos_in, struct inode* inode_out, loff_t pos_out, size_t len) {
+  struct vtfs_file* src;
+  struct vtfs_file* dst;
+  size_t copied;
+  size_t new_size;
+  
+  src = vtfs_get_file_by_inode(inode_in);
+  dst = vtfs_get_file_by_inode(inode_out);
+  if (!src || !dst) {
+    return -ENOENT;
+  }
+  if (S_ISDIR(src->mode) || S_ISDIR(dst->mode)) {
+    return -EISDIR;
+  }
+  if (len == 0) {
+    return 0;
+  }
+  
+  if (info->use_server) {
+    u64 version;
+    char* old_data;
+    int ret;
+    
+    // The server copies what it has, so journaled writes go first
+    vtfs_journal_drain(&info->journal);
+    ret = vtfs_server_copy_range(info, inode_in->i_ino, pos_in, inode_out->i_ino, pos_out, len, &version, &copied);
+    if (ret != 0) {
+      return ret;
+    }
+    if (copied == 0) {
+      return 0;
+    }
+    
+    new_size = max(dst->data_size, (size_t)pos_out + copied);
+    old_data = dst->data;
+    vtfs_update_data_all(&info->root_dir, inode_out->i_ino, old_data, NULL, new_size);
+    dst->data = NULL;
+    dst->data_size = new_size;
+    // Taking the version now makes the change feed skip our own copy
+    vtfs_set_version(info, dst, version, 0, dst->validated);
+    vtfs_lru_set(&info->lru, inode_out->i_ino, 0);
+    kfree(old_data);
+    inode_out->i_size = new_size;
+    return copied;
+  }
+  
+  int ret = vtfs_mem_unpack(info, src);
+  if (ret == 0) {
+    ret = vtfs_mem_unpack(info, dst);
+  }
+  if (ret != 0) {
+    return ret;
+  }
+  vtfs_image_forget(&info->image, inode_out->i_ino);
+  if (!src->data || pos_in >= src->data_size) {
+    return 0;
+  }
+  copied = min(len, src->data_size - (size_t)pos_in);
+  
+  new_size = max(dst->data_size, (size_t)pos_out + copied);
+  if (new_size > dst->data_size || !dst->data) {
+    ret = vtfs_mem_reserve(info, dst, new_size);
+    if (ret != 0) {
+      return ret;
+    }
+    // Every link of the destination sees the new buffer and size; a copy
+    // within one file reads from the moved buffer through src
+    if (vtfs_resize_data(&info->root_dir, dst, new_size) != 0) {
+      return -ENOMEM;
+    }
+  }
+  
+  memmove(dst->data + pos_out, src->data + pos_in, copied);
+  vtfs_mem_used(info, dst);
+  inode_out->i_size = dst->data_size;
+  return copied;
+}
+
+static ssize_t vtfs_copy_range(struct inode* inode_in, loff_t pos_in, struct inode* inode_out, loff_t pos_out, size_t len) {
+  struct vtfs_fs_info* info = inode_in->i_sb->s_fs_info;
+  ssize_t ret;
+  
+  if (!info) {
+    return -ENOENT;
+  }
+  
+  vtfs_data_lock_pair(info, inode_in->i_ino, inode_out->i_ino);
+  ret = vtfs_copy_range_locked(info, inode_in, pos_in, inode_out, pos_out, len);
+  vtfs_data_unlock_pair(info, inode_in->i_ino, inode_out->i_ino);
+  return ret;
+}
+
+static ssize_t vtfs_copy_file_range(struct file* file_in, loff_t pos_in, struct file* file_out, loff_t pos_out, size_t len, unsigned int flags) {
+  struct inode* inode_in = file_inode(file_in);
+  struct inode* inode_out = file_inode(file_out);
+  
+  // Another vtfs mount may belong to another token or server
+  if (inode_in->i_sb != inode_out->i_sb) {
+    return -EXDEV;
+  }
+  
+  return vtfs_copy_range(inode_in, pos_in, inode_out, pos_out, len);
+}
+
+/*
+ * FICLONE and FICLONERANGE. The server shares whole blocks where the
+ * backend can, so this is the same operation as copy_file_range; dedupe
+ * requests are not supported.
+ */
+static loff_t vtfs_remap_file_range(struct file* file_in, loff_t pos_in, struct file* file_out, loff_t pos_out, loff_t len, unsigned int remap_flags) {
+  struct inode* inode_in = file_inode(file_in);
+  struct inode* inode_out = file_inode(file_out);
+  struct vtfs_fs_info* info = inode_in->i_sb->s_fs_info;
+  struct vtfs_file* src;
+  loff_t src_size;
+  
+  if (remap_flags & REMAP_FILE_DEDUP) {
+    return -EOPNOTSUPP;
+  }
+  if (inode_in->i_sb != inode_out->i_sb) {
+    return -EXDEV;
+  }
+  if (pos_in < 0 || pos_out < 0 || len < 0) {
+    return -EINVAL;
+  }
+  if (!info) {
+    return -ENOENT;
+  }
+  
+  down_read(vtfs_data_sem(info, inode_in->i_ino));
+  src = vtfs_get_file_by_inode(inode_in);
+  src_size = src ? src->data_size : 0;
+  up_read(vtfs_data_sem(info, inode_in->i_ino));
+  if (!src) {
+    return -ENOENT;
+  }
+  
+  // A zero length clones to the end of the source
+  if (len == 0) {
+    if (pos_in >= src_size) {
+      return 0;
+    }
+    len = src_size - pos_in;
+  }
+  // A range past the end of the source is cut short only when the caller allows it
+  if (pos_in + len > src_size && !(remap_flags & REMAP_FILE_CAN_SHORTEN)) {
+    return -EINVAL;
+  }
+  
+  if (inode_in == inode_out && pos_in < pos_out + len && pos_out < pos_in + len) {
+    return -EINVAL;
+  }
+  
+  return vtfs_copy_range(inode_in, pos_in, inode_out, pos_out, len);
+}
+
+static int vtfs_getattr(struct mnt_idmap* idmap, const struct path* path, struct kstat* stat, u32 request_mask, unsigned int flags) {
+  struct inode* inode = d_inode(path->dentry);
+  struct vtfs_fs_info* info;
   struct vtfs_file* file;
   
   if (!inode) {
@@ -1436,13 +2408,20 @@ static int vtfs_getattr(struct mnt_idmap* idmap, const struct path* path, struct
   
   generic_fillattr(idmap, request_mask, inode, stat);
   
+  info = inode->i_sb->s_fs_info;
+  if (!info) {
+    return 0;
+  }
+  
   // Update stat from file structure
+  down_read(vtfs_data_sem(info, inode->i_ino));
   file = vtfs_get_file_by_inode(inode);
   if (file) {
     stat->size = file->data_size;
     stat->nlink = file->nlink;
     stat->mode = file->mode;
   }
+  up_read(vtfs_data_sem(info, inode->i_ino));
   
   return 0;
 }
@@ -1455,102 +2434,357 @@ static int vtfs_setattr(struct mnt_idmap* idmap, struct dentry* dentry, struct i
   }
   
   if (attr->ia_valid & ATTR_SIZE) {
-    struct vtfs_file* file = vtfs_get_file_by_inode(inode);
-    if (file) {
-      char* old_data = file->data;
-      char* new_data = NULL;
-      
-      if (attr->ia_size < file->data_size) {
-        new_data = krealloc(file->data, attr->ia_size, GFP_KERNEL);
-        if (new_data) {
-          struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
-          if (info && old_data != new_data) {
-            vtfs_update_data_all(&info->root_dir, inode->i_ino, old_data, new_data, attr->ia_size);
-          } else {
-            file->data = new_data;
-            file->data_size = attr->ia_size;
-          }
-          inode->i_size = attr->ia_size;
-        }
-      } else if (attr->ia_size > file->data_size) {
-        new_data = krealloc(file->data, attr->ia_size, GFP_KERNEL);
-        if (new_data) {
-          memset(new_data + file->data_size, 0, attr->ia_size - file->data_size);
-          struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
-          if (info && old_data != new_data) {
-            vtfs_update_data_all(&info->root_dir, inode->i_ino, old_data, new_data, attr->ia_size);
-          } else {
-            file->data = new_data;
-            file->data_size = attr->ia_size;
-          }
+    struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
+    struct vtfs_file* file;
+    int ret = 0;
+    
+    if (!info) {
+      return -EINVAL;
+    }
+    down_write(vtfs_data_sem(info, inode->i_ino));
+    file = vtfs_get_file_by_inode(inode);
+    if (file && attr->ia_size != file->data_size) {
+      ret = vtfs_mem_unpack(info, file);
+      if (ret == 0) {
+        ret = vtfs_mem_reserve(info, file, attr->ia_size);
+      }
+      if (ret == 0) {
+        vtfs_image_forget(&info->image, file->ino);
+        vtfs_set_version(info, file, file->version, 0, file->validated);
+        if (vtfs_resize_data(&info->root_dir, file, attr->ia_size) == 0) {
           inode->i_size = attr->ia_size;
+          vtfs_mem_used(info, file);
         }
       }
     }
+    up_write(vtfs_data_sem(info, inode->i_ino));
+    if (ret != 0) {
+      return ret;
+    }
   }
   
   setattr_copy(idmap, inode, attr);
   return 0;
 }
 
-static struct inode_operations vtfs_inode_ops = {
-  .lookup = vtfs_lookup,
-  .getattr = vtfs_getattr,
-  .create = vtfs_create,
-  .unlink = vtfs_unlink,
-  .mkdir = vtfs_mkdir,
-  .rmdir = vtfs_rmdir,
-  .link = vtfs_link,
-  .setattr = vtfs_setattr,
-};
-
-static struct file_operations vtfs_dir_ops = {
-  .owner = THIS_MODULE,
-  .iterate_shared = vtfs_iterate,
-};
 
 static int vtfs_open(struct inode* inode, struct file* filp) {
-  if (filp->f_flags & O_TRUNC) {
-    struct vtfs_file* file = vtfs_get_file_by_inode(inode);
+  struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
+  
+  if ((filp->f_flags & O_TRUNC) && info) {
+    struct vtfs_file* file;
+    
+    down_write(vtfs_data_sem(info, inode->i_ino));
+    file = vtfs_get_file_by_inode(inode);
     if (file) {
-      char* old_data = file->data;
-      struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
-      
-      if (old_data) {
-        if (info) {
-          vtfs_update_data_all(&info->root_dir, inode->i_ino, old_data, NULL, 0);
-          file = vtfs_get_file_by_inode(inode);
-          if (file) {
-            file->data = NULL;
-            file->data_size = 0;
-          }
-        } else {
-          file->data = NULL;
-          file->data_size = 0;
-        }
-        kfree(old_data);
-      } else {
-        // File has no data yet, just ensure it's NULL
-        file->data = NULL;
-        file->data_size = 0;
-      }
+      // Drops the buffer of every link
+      vtfs_resize_data(&info->root_dir, file, 0);
+      vtfs_mem_forget(info, file->ino);
+      vtfs_set_version(info, file, file->version, 0, file->validated);
       inode->i_size = 0;
     }
+    up_write(vtfs_data_sem(info, inode->i_ino));
   }
   return 0;
 }
 
+/*
+ * The journal thread can only log a change the server refused; the next
+ * fsync or close of the file returns the error. An fsync first waits for
+ * the file's queued changes, like a read does.
+ */
+static int vtfs_fsync(struct file* filp, loff_t start, loff_t end, int datasync) {
+  struct inode* inode = file_inode(filp);
+  struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
+  
+  if (!info) {
+    return 0;
+  }
+  vtfs_journal_wait_ino(&info->journal, inode->i_ino);
+  return vtfs_journal_take_error(&info->journal, inode->i_ino);
+}
+
+static int vtfs_flush(struct file* filp, fl_owner_t id) {
+  struct inode* inode = file_inode(filp);
+  struct vtfs_fs_info* info = inode->i_sb->s_fs_info;
+  
+  return info ? vtfs_journal_take_error(&info->journal, inode->i_ino) : 0;
+}
+
+// Timed entry points: the VFS calls these, they record into the mount's
+// stats and fire the vtfs_op_start/vtfs_op_end tracepoints
+
+static inline struct vtfs_stats* vtfs_sb_stats(struct super_block* sb) {
+  struct vtfs_fs_info* info = sb->s_fs_info;
+  return info ? &info->stats : NULL;
+}
+
+static inline u64 vtfs_op_begin(enum vtfs_op op, ino_t ino, loff_t offset, size_t len) {
+  trace_vtfs_op_start(vtfs_op_name(op), ino, offset, len);
+  return ktime_get_ns();
+}
+
+// call describes the op for the replay ring; NULL leaves it out
+static inline void vtfs_op_end(struct super_block* sb, enum vtfs_op op, ino_t ino, loff_t offset, size_t len, long ret, bool failed, u64 start, const struct vtfs_optrace_call* call) {
+  struct vtfs_fs_info* info = sb->s_fs_info;
+  u64 ns = ktime_get_ns() - start;
+  trace_vtfs_op_end(vtfs_op_name(op), ino, offset, len, ret, ns);
+  vtfs_stats_op(vtfs_sb_stats(sb), op, ns, failed);
+  if (info && call && vtfs_optrace_enabled(&info->optrace)) {
+    vtfs_optrace_record(&info->optrace, op, ino, offset, len, ret, start, ns, call);
+  }
+}
+
+// Calls that look up a vtfs_dir hold the read side of vtfs_ns_sem around it
+static struct dentry* vtfs_timed_lookup(struct inode* parent_inode, struct dentry* child_dentry, unsigned int flag) {
+  u64 start = vtfs_op_begin(VTFS_OP_LOOKUP, parent_inode->i_ino, 0, 0);
+  struct dentry* ret;
+  
+  down_read(vtfs_ns_sem(parent_inode->i_sb));
+  ret = vtfs_lookup(parent_inode, child_dentry, flag);
+  up_read(vtfs_ns_sem(parent_inode->i_sb));
+  vtfs_op_end(parent_inode->i_sb, VTFS_OP_LOOKUP, parent_inode->i_ino, 0, 0, PTR_ERR_OR_ZERO(ret), IS_ERR(ret), start, &(struct vtfs_optrace_call){ .dentry = child_dentry });
+  return ret;
+}
+
+static int vtfs_timed_getattr(struct mnt_idmap* idmap, const struct path* path, struct kstat* stat, u32 request_mask, unsigned int flags) {
+  ino_t ino = d_inode(path->dentry)->i_ino;
+  u64 start = vtfs_op_begin(VTFS_OP_GETATTR, ino, 0, 0);
+  int ret = vtfs_getattr(idmap, path, stat, request_mask, flags);
+  vtfs_op_end(path->dentry->d_sb, VTFS_OP_GETATTR, ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = path->dentry });
+  return ret;
+}
+
+static int vtfs_timed_create(struct mnt_idmap* idmap, struct inode* parent_inode, struct dentry* child_dentry, umode_t mode, bool b) {
+  u64 start = vtfs_op_begin(VTFS_OP_CREATE, parent_inode->i_ino, 0, 0);
+  int ret;
+  
+  down_read(vtfs_ns_sem(parent_inode->i_sb));
+  ret = vtfs_create(idmap, parent_inode, child_dentry, mode, b);
+  up_read(vtfs_ns_sem(parent_inode->i_sb));
+  vtfs_op_end(parent_inode->i_sb, VTFS_OP_CREATE, parent_inode->i_ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = child_dentry, .flags = mode });
+  return ret;
+}
+
+static int vtfs_timed_unlink(struct inode* parent_inode, struct dentry* child_dentry) {
+  u64 start = vtfs_op_begin(VTFS_OP_UNLINK, parent_inode->i_ino, 0, 0);
+  int ret;
+  
+  down_read(vtfs_ns_sem(parent_inode->i_sb));
+  ret = vtfs_unlink(parent_inode, child_dentry);
+  up_read(vtfs_ns_sem(parent_inode->i_sb));
+  vtfs_op_end(parent_inode->i_sb, VTFS_OP_UNLINK, parent_inode->i_ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = child_dentry });
+  return ret;
+}
+
+static int vtfs_timed_mkdir(struct mnt_idmap* idmap, struct inode* parent_inode, struct dentry* child_dentry, umode_t mode) {
+  u64 start = vtfs_op_begin(VTFS_OP_MKDIR, parent_inode->i_ino, 0, 0);
+  int ret;
+  
+  down_read(vtfs_ns_sem(parent_inode->i_sb));
+  ret = vtfs_mkdir(idmap, parent_inode, child_dentry, mode);
+  up_read(vtfs_ns_sem(parent_inode->i_sb));
+  vtfs_op_end(parent_inode->i_sb, VTFS_OP_MKDIR, parent_inode->i_ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = child_dentry, .flags = mode });
+  return ret;
+}
+
+static int vtfs_timed_rmdir(struct inode* parent_inode, struct dentry* child_dentry) {
+  u64 start = vtfs_op_begin(VTFS_OP_RMDIR, parent_inode->i_ino, 0, 0);
+  int ret;
+  
+  down_read(vtfs_ns_sem(parent_inode->i_sb));
+  ret = vtfs_rmdir(parent_inode, child_dentry);
+  up_read(vtfs_ns_sem(parent_inode->i_sb));
+  vtfs_op_end(parent_inode->i_sb, VTFS_OP_RMDIR, parent_inode->i_ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = child_dentry });
+  return ret;
+}
+
+static int vtfs_timed_link(struct dentry* old_dentry, struct inode* parent_dir, struct dentry* new_dentry) {
+  ino_t ino = d_inode(old_dentry)->i_ino;
+  u64 start = vtfs_op_begin(VTFS_OP_LINK, ino, 0, 0);
+  int ret;
+  
+  down_read(vtfs_ns_sem(parent_dir->i_sb));
+  ret = vtfs_link(old_dentry, parent_dir, new_dentry);
+  up_read(vtfs_ns_sem(parent_dir->i_sb));
+  vtfs_op_end(parent_dir->i_sb, VTFS_OP_LINK, ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = new_dentry, .dentry2 = old_dentry });
+  return ret;
+}
+
+static int vtfs_timed_setattr(struct mnt_idmap* idmap, struct dentry* dentry, struct iattr* attr) {
+  ino_t ino = d_inode(dentry)->i_ino;
+  loff_t size = (attr->ia_valid & ATTR_SIZE) ? attr->ia_size : 0;
+  u64 start = vtfs_op_begin(VTFS_OP_SETATTR, ino, size, 0);
+  int ret = vtfs_setattr(idmap, dentry, attr);
+  vtfs_op_end(dentry->d_sb, VTFS_OP_SETATTR, ino, size, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = dentry, .flags = attr->ia_valid });
+  return ret;
+}
+
+static int vtfs_timed_iterate(struct file* filp, struct dir_context* ctx) {
+  struct inode* inode = file_inode(filp);
+  loff_t pos = ctx->pos;
+  u64 start = vtfs_op_begin(VTFS_OP_ITERATE, inode->i_ino, pos, 0);
+  int ret;
+  
+  down_read(vtfs_ns_sem(inode->i_sb));
+  ret = vtfs_iterate(filp, ctx);
+  up_read(vtfs_ns_sem(inode->i_sb));
+  vtfs_op_end(inode->i_sb, VTFS_OP_ITERATE, inode->i_ino, pos, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = filp->f_path.dentry });
+  return ret;
+}
+
+static int vtfs_timed_open(struct inode* inode, struct file* filp) {
+  u64 start = vtfs_op_begin(VTFS_OP_OPEN, inode->i_ino, 0, 0);
+  int ret = vtfs_open(inode, filp);
+  vtfs_op_end(inode->i_sb, VTFS_OP_OPEN, inode->i_ino, 0, 0, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = filp->f_path.dentry, .flags = filp->f_flags });
+  return ret;
+}
+
+static ssize_t vtfs_timed_read(struct file* filp, char __user* buffer, size_t len, loff_t* offset) {
+  struct inode* inode = file_inode(filp);
+  loff_t pos = *offset;
+  u64 start = vtfs_op_begin(VTFS_OP_READ, inode->i_ino, pos, len);
+  ssize_t ret = vtfs_read(filp, buffer, len, offset);
+  vtfs_op_end(inode->i_sb, VTFS_OP_READ, inode->i_ino, pos, len, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = filp->f_path.dentry });
+  return ret;
+}
+
+static ssize_t vtfs_timed_write(struct file* filp, const char __user* buffer, size_t len, loff_t* offset) {
+  struct inode* inode = file_inode(filp);
+  loff_t pos = *offset;
+  u64 start = vtfs_op_begin(VTFS_OP_WRITE, inode->i_ino, pos, len);
+  ssize_t ret = vtfs_write(filp, buffer, len, offset);
+  vtfs_op_end(inode->i_sb, VTFS_OP_WRITE, inode->i_ino, pos, len, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = filp->f_path.dentry });
+  return ret;
+}
+
+// Copies and clones are traced with the destination's inode and offset
+static ssize_t vtfs_timed_copy_file_range(struct file* file_in, loff_t pos_in, struct file* file_out, loff_t pos_out, size_t len, unsigned int flags) {
+  struct inode* inode = file_inode(file_out);
+  u64 start = vtfs_op_begin(VTFS_OP_COPY, inode->i_ino, pos_out, len);
+  ssize_t ret = vtfs_copy_file_range(file_in, pos_in, file_out, pos_out, len, flags);
+  vtfs_op_end(inode->i_sb, VTFS_OP_COPY, inode->i_ino, pos_out, len, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = file_out->f_path.dentry, .dentry2 = file_in->f_path.dentry, .offset2 = pos_in, .flags = flags });
+  return ret;
+}
+
+static loff_t vtfs_timed_remap_file_range(struct file* file_in, loff_t pos_in, struct file* file_out, loff_t pos_out, loff_t len, unsigned int remap_flags) {
+  struct inode* inode = file_inode(file_out);
+  u64 start = vtfs_op_begin(VTFS_OP_CLONE, inode->i_ino, pos_out, len);
+  loff_t ret = vtfs_remap_file_range(file_in, pos_in, file_out, pos_out, len, remap_flags);
+  vtfs_op_end(inode->i_sb, VTFS_OP_CLONE, inode->i_ino, pos_out, len, ret, ret < 0, start, &(struct vtfs_optrace_call){ .dentry = file_out->f_path.dentry, .dentry2 = file_in->f_path.dentry, .offset2 = pos_in, .flags = remap_flags });
+  return ret;
+}
+
+// -ECHILD only asks the VFS to leave RCU walk mode, it is not a failure.
+// Not recorded for replay: in RCU walk mode recording could sleep.
+static int vtfs_timed_d_revalidate(struct dentry* dentry, unsigned int flags) {
+  struct inode* inode = d_inode_rcu(dentry);
+  ino_t ino = inode ? inode->i_ino : 0;
+  u64 start = vtfs_op_begin(VTFS_OP_REVALIDATE, ino, 0, 0);
+  int ret = vtfs_d_revalidate(dentry, flags);
+  vtfs_op_end(dentry->d_sb, VTFS_OP_REVALIDATE, ino, 0, 0, ret, ret < 0 && ret != -ECHILD, start, NULL);
+  return ret;
+}
+
+static struct inode_operations vtfs_inode_ops = {
+  .lookup = vtfs_timed_lookup,
+  .getattr = vtfs_timed_getattr,
+  .create = vtfs_timed_create,
+  .unlink = vtfs_timed_unlink,
+  .mkdir = vtfs_timed_mkdir,
+  .rmdir = vtfs_timed_rmdir,
+  .link = vtfs_timed_link,
+  .setattr = vtfs_timed_setattr,
+};
+
+static struct file_operations vtfs_dir_ops = {
+  .owner = THIS_MODULE,
+  .iterate_shared = vtfs_timed_iterate,
+};
+
 static struct file_operations vtfs_file_ops = {
   .owner = THIS_MODULE,
-  .open = vtfs_open,
-  .read = vtfs_read,
-  .write = vtfs_write,
+  .open = vtfs_timed_open,
+  .read = vtfs_timed_read,
+  .write = vtfs_timed_write,
+  .copy_file_range = vtfs_timed_copy_file_range,
+  .remap_file_range = vtfs_timed_remap_file_range,
+  .fsync = vtfs_fsync,
+  .flush = vtfs_flush,
 };
 
+/*
+ * A checkpoint writes ino out: takes the write side of its data lock,
+ * which vtfs_image_release drops, and brings a cold RAM mode file back.
+ */
+static int vtfs_image_hold(void* ctx, ino_t ino, struct vtfs_file** file) {
+  struct vtfs_fs_info* info = ctx;
+  int ret;
+  
+  down_write(vtfs_data_sem(info, ino));
+  *file = vtfs_find_file_by_ino(&info->root_dir, ino);
+  if (!*file) {
+    return 0;
+  }
+  ret = vtfs_mem_unpack(info, *file);
+  if (ret == 0) {
+    vtfs_mem_used(info, *file);
+  }
+  return ret;
+}
+
+static void vtfs_image_release(void* ctx, ino_t ino) {
+  struct vtfs_fs_info* info = ctx;
+  
+  up_write(vtfs_data_sem(info, ino));
+}
+
+// Sends a journaled change; -EIO only if the server could not be reached
+static int vtfs_journal_ship(void* ctx, u32 op, ino_t ino, loff_t offset, const char* data, size_t len) {
+  struct vtfs_fs_info* info = ctx;
+  struct vtfs_file* file;
+  u64 version;
+  int ret;
+  
+  switch (op) {
+  case VTFS_JOURNAL_WRITE:
+    ret = vtfs_server_write_file(info, ino, offset, data, len, &version);
+    if (ret != 0) {
+      return ret;
+    }
+    // Taking the version now makes the change feed skip our own write
+    file = vtfs_find_file_by_ino(&info->root_dir, ino);
+    if (file && version > file->version) {
+      vtfs_set_version(info, file, version, file->data_version, file->validated);
+    }
+    return 0;
+  case VTFS_JOURNAL_RMDIR:
+    return vtfs_server_rmdir(info, ino);
+  case VTFS_JOURNAL_UNLINK:
+  case VTFS_JOURNAL_LINK: {
+    char name[VTFS_MAX_NAME];
+    unsigned int nlink;
+    
+    // offset is the parent's ino, data the name
+    if (len == 0 || len >= VTFS_MAX_NAME) {
+      return -EINVAL;
+    }
+    memcpy(name, data, len);
+    name[len] = '\0';
+    if (op == VTFS_JOURNAL_UNLINK) {
+      return vtfs_server_unlink(info, ino, offset, name);
+    }
+    return vtfs_server_link(info, ino, offset, name, &nlink);
+  }
+  }
+  return -EINVAL;
+}
+
 static int vtfs_fill_super(struct super_block *sb, void *data, int silent) {
   struct vtfs_fs_info* info;
   struct inode* inode;
-  const char* token = (const char*)data;
+  struct vtfs_mount_opts* opts = data;
+  const char* token = opts->token;
   
   
   info = kmalloc(sizeof(struct vtfs_fs_info), GFP_KERNEL);
@@ -1558,9 +2792,15 @@ static int vtfs_fill_super(struct super_block *sb, void *data, int silent) {
     return -ENOMEM;
   }
   
-  INIT_LIST_HEAD(&info->root_dir.files);
-  init_rwsem(&info->root_dir.sem);
+  vtfs_init_dir(&info->root_dir);
   info->next_ino = 200;
+  info->changes_thread = NULL;
+  info->changes_cursor = -1;
+  info->changes_live = false;
+  atomic64_set(&info->ns_gen, 1);
+  info->comp = NULL;
+  mutex_init(&info->comp_lock);
+  info->compress_min = opts->compress_min;
   // Check if token is valid: not NULL, not empty string
   info->use_server = false;
   info->token = NULL;
@@ -1578,14 +2818,71 @@ static int vtfs_fill_super(struct super_block *sb, void *data, int silent) {
     return -ENOMEM;
   }
   
+  if (vtfs_stats_init(&info->stats, sb->s_dev) != 0) {
+    if (info->token) {
+      kfree(info->token);
+    }
+    kfree(info);
+    return -ENOMEM;
+  }
+  vtfs_optrace_init(&info->optrace, info->stats.dir);
+  
+  // In RAM mode compress=lz4 compresses cold file data instead of the wire
+  u64 mem_limit = opts->mem_limit;
+  info->zstore.comp = NULL;
+  info->zstore.compress = false;
+  info->zstore.dedup = false;
+  if (!info->use_server && (opts->compress || opts->dedup)) {
+    if (vtfs_zstore_init(&info->zstore, opts->compress, opts->dedup, info->stats.dir) != 0) {
+      LOG("lz4 is not available, RAM compression disabled\n");
+    } else if (mem_limit == 0) {
+      mem_limit = VTFS_DEFAULT_HOT_LIMIT;
+    }
+  }
+  vtfs_lru_init(&info->lru, mem_limit, info->stats.dir);
+  if (vtfs_zstore_enabled(&info->zstore) && opts->mem_limit) {
+    vtfs_lru_charge(&info->lru, &info->zstore.stored_bytes);
+  }
+  info->image.file = NULL;
+  info->journal.open = false;
+  info->journal.file = NULL;
+  info->journal.thread = NULL;
+  info->offline = false;
+  info->shrinker = NULL;
+  INIT_WORK(&info->reclaim_work, vtfs_reclaim_work);
+  atomic_long_set(&info->reclaim_bytes, 0);
+  for (int i = 0; i < ARRAY_SIZE(info->data_sem); i++) {
+    init_rwsem(&info->data_sem[i]);
+    mutex_init(&info->send_lock[i]);
+  }
+  init_rwsem(&info->ns_sem);
+  
   sb->s_fs_info = info;
   info->sb = sb;
+  if (info->use_server) {
+    sb->s_d_op = &vtfs_dentry_ops;
+  }
+  
+  if (info->use_server && opts->compress) {
+    info->comp = crypto_alloc_comp("lz4", 0, 0);
+    if (IS_ERR(info->comp)) {
+      LOG("lz4 is not available, wire compression disabled\n");
+      info->comp = NULL;
+    }
+  }
   
   inode = vtfs_get_inode(sb, NULL, S_IFDIR | 0777, VTFS_ROOT_INO);
   if (inode == NULL) {
+    if (info->comp) {
+      crypto_free_comp(info->comp);
+    }
     if (info->token) {
       kfree(info->token);
     }
+    vtfs_stats_destroy(&info->stats);
+    vtfs_optrace_destroy(&info->optrace);
+    vtfs_lru_destroy(&info->lru);
+    vtfs_zstore_destroy(&info->zstore);
     kfree(info);
     return -ENOMEM;
   }
@@ -1595,15 +2892,36 @@ static int vtfs_fill_super(struct super_block *sb, void *data, int silent) {
   
   sb->s_root = d_make_root(inode);
   if (sb->s_root == NULL) {
+    if (info->comp) {
+      crypto_free_comp(info->comp);
+    }
     if (info->token) {
       kfree(info->token);
     }
+    vtfs_stats_destroy(&info->stats);
+    vtfs_optrace_destroy(&info->optrace);
+    vtfs_lru_destroy(&info->lru);
+    vtfs_zstore_destroy(&info->zstore);
     kfree(info);
     return -ENOMEM;
   }
   
+  // What the last mount journaled but did not ship goes to the server before the load;
+  // without journal= the queue only holds what is changed while offline
+  if (info->use_server) {
+    int ret = vtfs_journal_open(&info->journal, opts->journal, vtfs_journal_ship, info, info->stats.dir);
+    if (ret != 0) {
+      LOG("cannot open journal %s: %d\n", opts->journal ? opts->journal : "(memory)", ret);
+      return ret;
+    }
+    vtfs_journal_drain(&info->journal);
+    debugfs_create_bool("offline", 0444, info->stats.dir, &info->offline);
+  }
+  
   // Load files from server if in server mode
   if (info->use_server) {
+    // Take the feed cursor first so nothing changed during the load is missed
+    vtfs_server_poll_changes(info, 0);
     int ret = vtfs_server_load_files(info, VTFS_ROOT_INO);
     if (ret != 0) {
       // Continue anyway - empty filesystem
@@ -1617,6 +2935,32 @@ static int vtfs_fill_super(struct super_block *sb, void *data, int silent) {
       }
       up_read(&info->root_dir.sem);
     }
+    
+    info->changes_thread = kthread_run(vtfs_changes_thread, info, "vtfs-changes");
+    if (IS_ERR(info->changes_thread)) {
+      // Fall back to revalidating cached data by age
+      info->changes_thread = NULL;
+    }
+    
+    // Only server mode data can be dropped; without a shrinker it stays until mem_limit
+    info->shrinker = shrinker_alloc(0, "vtfs-%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+    if (info->shrinker) {
+      info->shrinker->count_objects = vtfs_shrink_count;
+      info->shrinker->scan_objects = vtfs_shrink_scan;
+      info->shrinker->private_data = info;
+      shrinker_register(info->shrinker);
+    }
+  }
+  
+  // Metadata comes back now, file data on first access
+  if (!info->use_server && opts->image) {
+    int ret = vtfs_image_open(&info->image, opts->image, &info->root_dir, VTFS_ROOT_INO, &info->next_ino,
+                              vtfs_image_hold, vtfs_image_release, info, info->stats.dir);
+    if (ret != 0) {
+      LOG("cannot restore %s: %d\n", opts->image, ret);
+      // kill_sb frees whatever was restored
+      return ret;
+    }
   }
   
   return 0;
@@ -1628,10 +2972,21 @@ static struct dentry* vtfs_mount(
   const char* dev_name,
   void* data
 ) {
-  // Parse mount options to extract token
-  // data contains "token=xxx" or NULL/empty for RAM mode
-  char* token = NULL;
-  
+  // Parse mount options: "token=xxx" selects server mode (absent or empty
+  // for RAM mode), "compress=lz4" and "compress_min=N" enable wire compression
+  // (in RAM mode, compression of cold file data), "mem_limit=N[KMG]" caps the
+  // file data kept in memory, "dedup" shares identical blocks of cold RAM mode data,
+  // "image=<path>" restores a RAM mode mount from a checkpoint and writes one at umount,
+  // "journal=<path>" logs server mode writes, unlinks and rmdirs to a file or block device
+  struct vtfs_mount_opts opts = {
+    .token = NULL,
+    .compress = false,
+    .compress_min = VTFS_DEFAULT_COMPRESS_MIN,
+    .mem_limit = 0,
+    .dedup = false,
+    .image = NULL,
+    .journal = NULL,
+  };
   
   if (data) {
     char* options = kstrdup((char*)data, GFP_KERNEL);
@@ -1640,32 +2995,44 @@ static struct dentry* vtfs_mount(
       char* key;
       char* value;
       
-      // Parse "token=value"
       while ((key = strsep(&opt, ",")) != NULL) {
         value = strchr(key, '=');
         if (value) {
           *value = '\0';
           value++;
-          if (strcmp(key, "token") == 0) {
-            token = kstrdup(value, GFP_KERNEL);
-            break;
+          if (strcmp(key, "token") == 0 && !opts.token) {
+            opts.token = kstrdup(value, GFP_KERNEL);
+          } else if (strcmp(key, "compress") == 0) {
+            opts.compress = strcmp(value, "lz4") == 0;
+          } else if (strcmp(key, "compress_min") == 0) {
+            unsigned long compress_min;
+            if (kstrtoul(value, 10, &compress_min) == 0) {
+              opts.compress_min = compress_min;
+            }
+          } else if (strcmp(key, "mem_limit") == 0) {
+            opts.mem_limit = memparse(value, NULL);
+          } else if (strcmp(key, "image") == 0 && !opts.image) {
+            opts.image = kstrdup(value, GFP_KERNEL);
+          } else if (strcmp(key, "journal") == 0 && !opts.journal) {
+            opts.journal = kstrdup(value, GFP_KERNEL);
           }
+        } else if (strcmp(key, "dedup") == 0) {
+          opts.dedup = true;
         }
       }
       kfree(options);
     }
   }
   
-  if (!token) {
-  }
-  
-  // Pass token as data to vtfs_fill_super
-  struct dentry* ret = mount_nodev(fs_type, flags, token, vtfs_fill_super);
+  // Pass options to vtfs_fill_super
+  struct dentry* ret = mount_nodev(fs_type, flags, &opts, vtfs_fill_super);
   
   // Free token after mount (vtfs_fill_super will kstrdup it if needed)
-  if (token) {
-    kfree(token);
+  if (opts.token) {
+    kfree(opts.token);
   }
+  kfree(opts.image);
+  kfree(opts.journal);
   
   if (ret == NULL) {
   } else {
@@ -1682,12 +3049,32 @@ static void vtfs_kill_sb(struct super_block* sb) {
   
   info = sb->s_fs_info;
   if (info) {
+    if (info->changes_thread) {
+      kthread_stop(info->changes_thread);
+    }
+    vtfs_journal_stop(&info->journal);
+    if (info->shrinker) {
+      shrinker_free(info->shrinker);
+    }
+    cancel_work_sync(&info->reclaim_work);
+    if (vtfs_image_checkpoint(&info->image) != 0) {
+      LOG("checkpoint failed, the image keeps the previous one\n");
+    }
     if (!info->use_server) {
       vtfs_cleanup_dir(&info->root_dir);
     }
+    if (info->comp) {
+      crypto_free_comp(info->comp);
+    }
     if (info->token) {
       kfree(info->token);
     }
+    vtfs_stats_destroy(&info->stats);
+    vtfs_optrace_destroy(&info->optrace);
+    vtfs_lru_destroy(&info->lru);
+    vtfs_zstore_destroy(&info->zstore);
+    vtfs_image_close(&info->image);
+    vtfs_journal_close(&info->journal);
     kfree(info);
     sb->s_fs_info = NULL;
   }
@@ -1695,8 +3082,18 @@ static void vtfs_kill_sb(struct super_block* sb) {
 }
 
 static int __init vtfs_init(void) {
-  int ret = register_filesystem(&vtfs_fs_type);
+  vtfs_stats_register();
+  
+  int ret = vtfs_blocks_register();
+  if (ret != 0) {
+    vtfs_stats_unregister();
+    return ret;
+  }
+  
+  ret = register_filesystem(&vtfs_fs_type);
   if (ret != 0) {
+    vtfs_blocks_unregister();
+    vtfs_stats_unregister();
     return ret;
   }
   
@@ -1705,6 +3102,8 @@ static int __init vtfs_init(void) {
 
 static void __exit vtfs_exit(void) {
   unregister_filesystem(&vtfs_fs_type);
+  vtfs_blocks_unregister();
+  vtfs_stats_unregister();
 }
 
 module_init(vtfs_init);
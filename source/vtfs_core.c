@@ -0,0 +1,431 @@
+#include "vtfs_core.h"
+
+void vtfs_init_dir(struct vtfs_dir* dir) {
+  INIT_LIST_HEAD(&dir->files);
+  init_rwsem(&dir->sem);
+}
+
+struct vtfs_file* vtfs_find_file_by_ino(struct vtfs_dir* dir, ino_t ino) {
+  struct vtfs_file* file;
+  
+  if (!dir) return NULL;
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->ino == ino) {
+      up_read(&dir->sem);
+      return file;
+    }
+    if (file->dir_data) {
+      struct vtfs_file* found = vtfs_find_file_by_ino(file->dir_data, ino);
+      if (found) {
+        up_read(&dir->sem);
+        return found;
+      }
+    }
+  }
+  up_read(&dir->sem);
+  return NULL;
+}
+
+struct vtfs_file* vtfs_find_file(struct vtfs_dir* dir, const char* name) {
+  struct vtfs_file* file;
+  if (!dir) return NULL;
+  
+  list_for_each_entry(file, &dir->files, list) {
+    if (!strcmp(file->name, name)) {
+      return file;
+    }
+  }
+  return NULL;
+}
+
+// A detached entry with one link and no data
+static struct vtfs_file* vtfs_alloc_file(const char* name, umode_t mode, ino_t ino) {
+  struct vtfs_file* file;
+  
+  file = kmalloc(sizeof(struct vtfs_file), GFP_KERNEL);
+  if (!file) {
+    return NULL;
+  }
+  
+  INIT_LIST_HEAD(&file->list);
+  file->ino = ino;
+  file->mode = mode;
+  strncpy(file->name, name, VTFS_MAX_NAME - 1);
+  file->name[VTFS_MAX_NAME - 1] = '\0';
+  file->dir_data = NULL;
+  file->data = NULL;
+  file->data_size = 0;
+  file->nlink = 1;
+  file->version = 0;
+  file->data_version = 0;
+  file->validated = 0;
+  return file;
+}
+
+struct vtfs_file* vtfs_create_file(struct vtfs_dir* dir, const char* name, umode_t mode, ino_t ino) {
+  struct vtfs_file* file;
+  
+  if (!dir || !name || strlen(name) >= VTFS_MAX_NAME) {
+    return NULL;
+  }
+  
+  down_write(&dir->sem);
+  if (vtfs_find_file(dir, name) != NULL) {
+    up_write(&dir->sem);
+    return NULL;
+  }
+  
+  file = vtfs_alloc_file(name, mode, ino);
+  if (!file) {
+    up_write(&dir->sem);
+    return NULL;
+  }
+  
+  if (S_ISDIR(mode)) {
+    file->dir_data = kmalloc(sizeof(struct vtfs_dir), GFP_KERNEL);
+    if (!file->dir_data) {
+      kfree(file);
+      up_write(&dir->sem);
+      return NULL;
+    }
+    vtfs_init_dir(file->dir_data);
+  }
+  
+  list_add_tail(&file->list, &dir->files);
+  up_write(&dir->sem);
+  
+  return file;
+}
+
+struct vtfs_file* vtfs_link_file(struct vtfs_dir* root, struct vtfs_dir* dir, const char* name, struct vtfs_file* target) {
+  struct vtfs_file* file;
+  
+  if (!dir || !name || !target || strlen(name) >= VTFS_MAX_NAME) {
+    return NULL;
+  }
+  
+  down_write(&dir->sem);
+  if (vtfs_find_file(dir, name) != NULL) {
+    up_write(&dir->sem);
+    return NULL;
+  }
+  
+  file = vtfs_alloc_file(name, target->mode, target->ino);
+  if (!file) {
+    up_write(&dir->sem);
+    return NULL;
+  }
+  
+  file->data = target->data;
+  file->data_size = target->data_size;
+  file->nlink = target->nlink;
+  file->version = target->version;
+  file->data_version = target->data_version;
+  file->validated = target->validated;
+  
+  list_add_tail(&file->list, &dir->files);
+  up_write(&dir->sem);
+  
+  vtfs_update_nlink_all(root, target->ino, target->nlink + 1);
+  return file;
+}
+
+int vtfs_unlink_file(struct vtfs_dir* root, struct vtfs_dir* dir, const char* name, ino_t ino, unsigned int* out_nlink) {
+  struct vtfs_file* file;
+  unsigned int new_nlink;
+  
+  if (!dir || !name) return -ENOENT;
+  
+  down_write(&dir->sem);
+  file = vtfs_find_file(dir, name);
+  if (!file || file->ino != ino) {
+    up_write(&dir->sem);
+    return -ENOENT;
+  }
+  
+  new_nlink = file->nlink - 1;
+  list_del(&file->list);
+  up_write(&dir->sem);
+  
+  vtfs_update_nlink_all(root, ino, new_nlink);
+  
+  if (new_nlink == 0) {
+    vtfs_remove_all_by_ino(root, ino);
+    
+    if (file->dir_data) {
+      vtfs_cleanup_dir(file->dir_data);
+      kfree(file->dir_data);
+    }
+    if (file->data) {
+      kfree(file->data);
+    }
+  }
+  kfree(file);
+  
+  if (out_nlink) {
+    *out_nlink = new_nlink;
+  }
+  return 0;
+}
+
+int vtfs_remove_dir(struct vtfs_dir* dir, const char* name, ino_t* out_ino) {
+  struct vtfs_file* file;
+  
+  if (!dir || !name) return -ENOENT;
+  
+  down_write(&dir->sem);
+  file = vtfs_find_file(dir, name);
+  if (!file) {
+    up_write(&dir->sem);
+    return -ENOENT;
+  }
+  
+  if (!S_ISDIR(file->mode)) {
+    up_write(&dir->sem);
+    return -ENOTDIR;
+  }
+  
+  if (!file->dir_data || !list_empty(&file->dir_data->files)) {
+    up_write(&dir->sem);
+    return -ENOTEMPTY;
+  }
+  
+  list_del(&file->list);
+  up_write(&dir->sem);
+  
+  if (out_ino) {
+    *out_ino = file->ino;
+  }
+  kfree(file->dir_data);
+  kfree(file);
+  return 0;
+}
+
+int vtfs_remove_file(struct vtfs_dir* dir, const char* name) {
+  struct vtfs_file* file;
+  
+  if (!dir || !name) return -ENOENT;
+  
+  down_write(&dir->sem);
+  file = vtfs_find_file(dir, name);
+  if (!file) {
+    up_write(&dir->sem);
+    return -ENOENT;
+  }
+  
+  list_del(&file->list);
+  up_write(&dir->sem);
+  
+  if (file->dir_data) {
+    vtfs_cleanup_dir(file->dir_data);
+    kfree(file->dir_data);
+  }
+  if (file->data) {
+    kfree(file->data);
+  }
+  kfree(file);
+  
+  return 0;
+}
+
+// Frees the entries of dir and below, collecting their buffers in data_list
+static void vtfs_cleanup_entries(struct vtfs_dir* dir, struct list_head* data_list) {
+  struct vtfs_file* file;
+  struct vtfs_file* tmp;
+  struct data_ptr_entry* data_entry;
+  bool found;
+  
+  down_write(&dir->sem);
+  list_for_each_entry_safe(file, tmp, &dir->files, list) {
+    list_del(&file->list);
+    
+    if (file->data) {
+      found = false;
+      list_for_each_entry(data_entry, data_list, list) {
+        if (data_entry->data == file->data) {
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        data_entry = kmalloc(sizeof(struct data_ptr_entry), GFP_KERNEL);
+        if (data_entry) {
+          data_entry->data = file->data;
+          list_add_tail(&data_entry->list, data_list);
+        }
+      }
+    }
+    
+    if (file->dir_data) {
+      vtfs_cleanup_entries(file->dir_data, data_list);
+      kfree(file->dir_data);
+      file->dir_data = NULL;
+    }
+    
+    file->data = NULL;
+    
+    kfree(file);
+  }
+  up_write(&dir->sem);
+}
+
+/*
+ * Links of one file may sit in different directories, so buffers are
+ * collected over the whole subtree and each is freed once at the end.
+ */
+void vtfs_cleanup_dir(struct vtfs_dir* dir) {
+  struct list_head data_list;
+  struct data_ptr_entry* data_entry;
+  struct data_ptr_entry* data_tmp;
+  char* data_ptr;
+  
+  if (!dir) return;
+  
+  INIT_LIST_HEAD(&data_list);
+  vtfs_cleanup_entries(dir, &data_list);
+  
+  list_for_each_entry_safe(data_entry, data_tmp, &data_list, list) {
+    data_ptr = data_entry->data;
+    list_del(&data_entry->list);
+    kfree(data_entry);
+    if (data_ptr) {
+      kfree(data_ptr);
+    }
+  }
+}
+
+int vtfs_resize_data(struct vtfs_dir* root, struct vtfs_file* file, size_t new_size) {
+  char* old_data = file->data;
+  char* new_data = NULL;
+  
+  if (old_data && new_size == file->data_size) {
+    return 0;
+  }
+  
+  // An empty file keeps no buffer at all
+  if (new_size > 0) {
+    new_data = krealloc(old_data, new_size, GFP_KERNEL);
+    if (!new_data) {
+      return -ENOMEM;
+    }
+    if (!old_data) {
+      memset(new_data, 0, new_size);
+    } else if (new_size > file->data_size) {
+      memset(new_data + file->data_size, 0, new_size - file->data_size);
+    }
+  }
+  
+  vtfs_update_data_all(root, file->ino, old_data, new_data, new_size);
+  if (!new_data && old_data) {
+    kfree(old_data);
+  }
+  return 0;
+}
+
+void vtfs_update_nlink_all(struct vtfs_dir* dir, ino_t ino, unsigned int nlink) {
+  struct vtfs_file* file;
+  
+  if (!dir) return;
+  
+  down_write(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->ino == ino) {
+      file->nlink = nlink;
+    }
+  }
+  up_write(&dir->sem);
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->dir_data) {
+      vtfs_update_nlink_all(file->dir_data, ino, nlink);
+    }
+  }
+  up_read(&dir->sem);
+}
+
+void vtfs_update_data_all(struct vtfs_dir* dir, ino_t ino, char* old_data, char* new_data, size_t new_size) {
+  struct vtfs_file* file;
+  
+  if (!dir) return;
+  
+  down_write(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->ino == ino && file->data == old_data) {
+      file->data = new_data;
+      file->data_size = new_size;
+    }
+  }
+  up_write(&dir->sem);
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->dir_data) {
+      vtfs_update_data_all(file->dir_data, ino, old_data, new_data, new_size);
+    }
+  }
+  up_read(&dir->sem);
+}
+
+void vtfs_update_version_all(struct vtfs_dir* dir, ino_t ino, u64 version, u64 data_version, unsigned long validated) {
+  struct vtfs_file* file;
+  
+  if (!dir) return;
+  
+  down_write(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->ino == ino) {
+      file->version = version;
+      file->data_version = data_version;
+      file->validated = validated;
+    }
+  }
+  up_write(&dir->sem);
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->dir_data) {
+      vtfs_update_version_all(file->dir_data, ino, version, data_version, validated);
+    }
+  }
+  up_read(&dir->sem);
+}
+
+void vtfs_remove_all_by_ino(struct vtfs_dir* dir, ino_t ino) {
+  struct vtfs_file* file;
+  struct vtfs_file* tmp;
+  
+  if (!dir) return;
+  
+  down_write(&dir->sem);
+  list_for_each_entry_safe(file, tmp, &dir->files, list) {
+    if (file->ino == ino) {
+      list_del(&file->list);
+      kfree(file);
+    }
+  }
+  up_write(&dir->sem);
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    if (file->dir_data) {
+      vtfs_remove_all_by_ino(file->dir_data, ino);
+    }
+  }
+  up_read(&dir->sem);
+}
+
+void vtfs_mark_all_stale(struct vtfs_dir* dir) {
+  struct vtfs_file* file;
+  
+  down_read(&dir->sem);
+  list_for_each_entry(file, &dir->files, list) {
+    file->data_version = 0;
+    if (file->dir_data) {
+      vtfs_mark_all_stale(file->dir_data);
+    }
+  }
+  up_read(&dir->sem);
+}
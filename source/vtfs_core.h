@@ -0,0 +1,69 @@
+#ifndef VTFS_CORE_H
+#define VTFS_CORE_H
+
+#include "vtfs_shim.h"
+
+/*
+ * The in-memory namespace: a tree of directories, each a list of entries
+ * under its own rw_semaphore. A hard link is one more entry with the same
+ * ino; all entries of an ino share the data buffer, size, link count and
+ * version fields, and every change to them goes to each entry.
+ * Nothing here knows about super blocks, inodes or the server, so the same
+ * file builds into the module and into userspace (make core).
+ */
+
+#define VTFS_MAX_NAME 256
+
+struct vtfs_file {
+  struct list_head list;
+  ino_t ino;
+  umode_t mode;
+  char name[VTFS_MAX_NAME];
+  struct vtfs_dir* dir_data;
+  char* data;
+  size_t data_size;
+  unsigned int nlink;
+  u64 version;            // last known server version
+  u64 data_version;       // server version `data` mirrors, 0 if none
+  unsigned long validated; // jiffies of the last successful validation
+};
+
+struct vtfs_dir {
+  struct list_head files;
+  struct rw_semaphore sem;
+};
+
+struct data_ptr_entry {
+  struct list_head list;
+  char* data;
+};
+
+void vtfs_init_dir(struct vtfs_dir* dir);
+
+// The caller holds dir->sem
+struct vtfs_file* vtfs_find_file(struct vtfs_dir* dir, const char* name);
+// Searches the whole subtree; returns the first entry of ino
+struct vtfs_file* vtfs_find_file_by_ino(struct vtfs_dir* dir, ino_t ino);
+
+// NULL if the name is taken, too long or memory runs out
+struct vtfs_file* vtfs_create_file(struct vtfs_dir* dir, const char* name, umode_t mode, ino_t ino);
+// Adds a link to target under dir and bumps the link count of every entry
+struct vtfs_file* vtfs_link_file(struct vtfs_dir* root, struct vtfs_dir* dir, const char* name, struct vtfs_file* target);
+// Removes the entry name of ino; frees the data with the last link
+int vtfs_unlink_file(struct vtfs_dir* root, struct vtfs_dir* dir, const char* name, ino_t ino, unsigned int* out_nlink);
+// Removes an empty directory
+int vtfs_remove_dir(struct vtfs_dir* dir, const char* name, ino_t* out_ino);
+// Removes one entry and everything it owns; only for entries without links
+int vtfs_remove_file(struct vtfs_dir* dir, const char* name);
+// Frees every entry of the subtree, each shared data buffer once
+void vtfs_cleanup_dir(struct vtfs_dir* dir);
+
+// Grows or shrinks the data of file and all its links; new bytes are zero
+int vtfs_resize_data(struct vtfs_dir* root, struct vtfs_file* file, size_t new_size);
+void vtfs_update_nlink_all(struct vtfs_dir* dir, ino_t ino, unsigned int nlink);
+void vtfs_update_data_all(struct vtfs_dir* dir, ino_t ino, char* old_data, char* new_data, size_t new_size);
+void vtfs_update_version_all(struct vtfs_dir* dir, ino_t ino, u64 version, u64 data_version, unsigned long validated);
+void vtfs_remove_all_by_ino(struct vtfs_dir* dir, ino_t ino);
+void vtfs_mark_all_stale(struct vtfs_dir* dir);
+
+#endif // VTFS_CORE_H
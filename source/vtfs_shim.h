@@ -0,0 +1,110 @@
+#ifndef VTFS_SHIM_H
+#define VTFS_SHIM_H
+
+/*
+ * The kernel facilities vtfs_core.c uses. In the module these are the real
+ * headers; in userspace (make core) they are mapped onto libc and pthreads
+ * so the namespace code can be benchmarked and fuzzed without insmod.
+ */
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/list.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+
+#else
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef unsigned short umode_t;
+
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define krealloc(ptr, size, flags) realloc(ptr, size)
+#define kfree(ptr) free(ptr)
+
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+struct list_head {
+  struct list_head* next;
+  struct list_head* prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head* list) {
+  list->next = list;
+  list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head* entry, struct list_head* head) {
+  entry->prev = head->prev;
+  entry->next = head;
+  head->prev->next = entry;
+  head->prev = entry;
+}
+
+static inline void list_del(struct list_head* entry) {
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  entry->next = NULL;
+  entry->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head* head) {
+  return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_for_each_entry(pos, head, member)                            \
+  for (pos = list_entry((head)->next, __typeof__(*pos), member);          \
+       &pos->member != (head);                                            \
+       pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member)                    \
+  for (pos = list_entry((head)->next, __typeof__(*pos), member),          \
+       n = list_entry(pos->member.next, __typeof__(*pos), member);        \
+       &pos->member != (head);                                            \
+       pos = n, n = list_entry(n->member.next, __typeof__(*n), member))
+
+struct rw_semaphore {
+  pthread_rwlock_t lock;
+};
+
+static inline void init_rwsem(struct rw_semaphore* sem) {
+  pthread_rwlock_init(&sem->lock, NULL);
+}
+
+static inline void down_read(struct rw_semaphore* sem) {
+  pthread_rwlock_rdlock(&sem->lock);
+}
+
+static inline void up_read(struct rw_semaphore* sem) {
+  pthread_rwlock_unlock(&sem->lock);
+}
+
+static inline void down_write(struct rw_semaphore* sem) {
+  pthread_rwlock_wrlock(&sem->lock);
+}
+
+static inline void up_write(struct rw_semaphore* sem) {
+  pthread_rwlock_unlock(&sem->lock);
+}
+
+#endif // __KERNEL__
+
+#endif // VTFS_SHIM_H
@@ -0,0 +1,149 @@
+/*
+ * Tracepoints of the vtfs module, under events/vtfs/ in tracefs and as
+ * tracepoint:vtfs:* in perf and bpftrace. See vtfs_latency.bt.
+ *
+ * vtfs.c defines CREATE_TRACE_POINTS before including this header; every
+ * other file includes it plainly.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vtfs
+
+#if !defined(VTFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define VTFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/string.h>
+
+// Longest op or method name kept in an event
+#define VTFS_TRACE_NAME_LEN 20
+
+DECLARE_EVENT_CLASS(vtfs_op_class,
+  TP_PROTO(const char* op, unsigned long ino, long long offset, size_t len),
+  TP_ARGS(op, ino, offset, len),
+  TP_STRUCT__entry(
+    __array(char, op, VTFS_TRACE_NAME_LEN)
+    __field(unsigned long, ino)
+    __field(long long, offset)
+    __field(size_t, len)
+  ),
+  TP_fast_assign(
+    strscpy(__entry->op, op, VTFS_TRACE_NAME_LEN);
+    __entry->ino = ino;
+    __entry->offset = offset;
+    __entry->len = len;
+  ),
+  TP_printk("op=%s ino=%lu offset=%lld len=%zu",
+            __entry->op, __entry->ino, __entry->offset, __entry->len)
+);
+
+// A VFS entry point was called; ino is the parent directory for namespace ops
+DEFINE_EVENT(vtfs_op_class, vtfs_op_start,
+  TP_PROTO(const char* op, unsigned long ino, long long offset, size_t len),
+  TP_ARGS(op, ino, offset, len)
+);
+
+// A VFS entry point returned result after latency_ns
+TRACE_EVENT(vtfs_op_end,
+  TP_PROTO(const char* op, unsigned long ino, long long offset, size_t len, long result, u64 latency_ns),
+  TP_ARGS(op, ino, offset, len, result, latency_ns),
+  TP_STRUCT__entry(
+    __array(char, op, VTFS_TRACE_NAME_LEN)
+    __field(unsigned long, ino)
+    __field(long long, offset)
+    __field(size_t, len)
+    __field(long, result)
+    __field(u64, latency_ns)
+  ),
+  TP_fast_assign(
+    strscpy(__entry->op, op, VTFS_TRACE_NAME_LEN);
+    __entry->ino = ino;
+    __entry->offset = offset;
+    __entry->len = len;
+    __entry->result = result;
+    __entry->latency_ns = latency_ns;
+  ),
+  TP_printk("op=%s ino=%lu offset=%lld len=%zu result=%ld latency_ns=%llu",
+            __entry->op, __entry->ino, __entry->offset, __entry->len,
+            __entry->result, __entry->latency_ns)
+);
+
+// A server call is about to connect; body_len is 0 for GET requests
+TRACE_EVENT(vtfs_http_request,
+  TP_PROTO(const char* method, size_t body_len),
+  TP_ARGS(method, body_len),
+  TP_STRUCT__entry(
+    __array(char, method, VTFS_TRACE_NAME_LEN)
+    __field(size_t, body_len)
+  ),
+  TP_fast_assign(
+    strscpy(__entry->method, method, VTFS_TRACE_NAME_LEN);
+    __entry->body_len = body_len;
+  ),
+  TP_printk("method=%s body_len=%zu", __entry->method, __entry->body_len)
+);
+
+/*
+ * A server call finished. result is the byte count of the response payload
+ * or a negative error from the HTTP client; phases it did not reach are 0.
+ */
+TRACE_EVENT(vtfs_http_response,
+  TP_PROTO(const char* method, long result, size_t sent, size_t received,
+           u64 connect_ns, u64 send_ns, u64 wait_ns, u64 receive_ns, u64 total_ns),
+  TP_ARGS(method, result, sent, received, connect_ns, send_ns, wait_ns, receive_ns, total_ns),
+  TP_STRUCT__entry(
+    __array(char, method, VTFS_TRACE_NAME_LEN)
+    __field(long, result)
+    __field(size_t, sent)
+    __field(size_t, received)
+    __field(u64, connect_ns)
+    __field(u64, send_ns)
+    __field(u64, wait_ns)
+    __field(u64, receive_ns)
+    __field(u64, total_ns)
+  ),
+  TP_fast_assign(
+    strscpy(__entry->method, method, VTFS_TRACE_NAME_LEN);
+    __entry->result = result;
+    __entry->sent = sent;
+    __entry->received = received;
+    __entry->connect_ns = connect_ns;
+    __entry->send_ns = send_ns;
+    __entry->wait_ns = wait_ns;
+    __entry->receive_ns = receive_ns;
+    __entry->total_ns = total_ns;
+  ),
+  TP_printk("method=%s result=%ld sent=%zu received=%zu connect_ns=%llu send_ns=%llu wait_ns=%llu receive_ns=%llu total_ns=%llu",
+            __entry->method, __entry->result, __entry->sent, __entry->received,
+            __entry->connect_ns, __entry->send_ns, __entry->wait_ns,
+            __entry->receive_ns, __entry->total_ns)
+);
+
+/*
+ * Outcome of checking a file's cached data before a read: served without
+ * asking the server (hit), confirmed by a conditional read (revalidated),
+ * or fetched (miss).
+ */
+TRACE_EVENT(vtfs_cache,
+  TP_PROTO(unsigned long ino, bool round_trip, bool fetched),
+  TP_ARGS(ino, round_trip, fetched),
+  TP_STRUCT__entry(
+    __field(unsigned long, ino)
+    __field(bool, round_trip)
+    __field(bool, fetched)
+  ),
+  TP_fast_assign(
+    __entry->ino = ino;
+    __entry->round_trip = round_trip;
+    __entry->fetched = fetched;
+  ),
+  TP_printk("ino=%lu result=%s", __entry->ino,
+            __entry->fetched ? "miss" : __entry->round_trip ? "revalidated" : "hit")
+);
+
+#endif // VTFS_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE vtfs_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,285 @@
+#include "zstore.h"
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/math.h>
+
+static struct vtfs_zstore_entry* zstore_find(struct vtfs_zstore* zs, ino_t ino) {
+  struct vtfs_zstore_entry* entry;
+  
+  hash_for_each_possible(zs->table, entry, hash, ino) {
+    if (entry->ino == ino) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void zstore_unlink(struct vtfs_zstore* zs, struct vtfs_zstore_entry* entry) {
+  hash_del(&entry->hash);
+  zs->files--;
+  zs->raw_bytes -= entry->len;
+  zs->stored_bytes -= entry->stored;
+}
+
+static void zstore_free(struct vtfs_zstore_entry* entry) {
+  if (entry->blocks) {
+    for (size_t i = 0; i < DIV_ROUND_UP(entry->len, VTFS_BLOCK_SIZE); i++) {
+      vtfs_block_put(entry->blocks[i]);
+    }
+    kfree(entry->blocks);
+  } else {
+    kfree(entry->data);
+  }
+  kfree(entry);
+}
+
+// References a block for every VTFS_BLOCK_SIZE bytes of data; NULL if memory runs out
+static struct vtfs_block** zstore_split(struct vtfs_zstore* zs, const char* data, size_t len, size_t* out_stored) {
+  size_t count = DIV_ROUND_UP(len, VTFS_BLOCK_SIZE);
+  struct vtfs_block** blocks = kmalloc_array(count, sizeof(*blocks), GFP_KERNEL);
+  size_t stored = 0;
+  
+  if (!blocks) {
+    return NULL;
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t offset = i * VTFS_BLOCK_SIZE;
+    
+    blocks[i] = vtfs_block_get(data + offset, min_t(size_t, len - offset, VTFS_BLOCK_SIZE), zs->compress);
+    if (!blocks[i]) {
+      while (i-- > 0) {
+        vtfs_block_put(blocks[i]);
+      }
+      kfree(blocks);
+      return NULL;
+    }
+    stored += blocks[i]->stored;
+  }
+  *out_stored = stored;
+  return blocks;
+}
+
+// Makes a compressed copy; -E2BIG if it would not be smaller
+static int zstore_compress(struct vtfs_zstore* zs, const char* data, size_t len, char** out, size_t* out_len) {
+  unsigned int dlen = len - 1;
+  char* scratch;
+  char* packed;
+  u64 start;
+  int ret;
+  
+  if (len < 2 || len > UINT_MAX) {
+    return -E2BIG;
+  }
+  
+  // A destination one byte short of the input rejects incompressible data
+  scratch = kmalloc(dlen, GFP_KERNEL);
+  if (!scratch) {
+    return -ENOMEM;
+  }
+  start = ktime_get_ns();
+  ret = crypto_comp_compress(zs->comp, data, len, scratch, &dlen);
+  zs->compress_ns += ktime_get_ns() - start;
+  zs->compressed++;
+  if (ret != 0) {
+    kfree(scratch);
+    return -E2BIG;
+  }
+  
+  // krealloc keeps a large buffer when shrinking, so copy to one of the right size
+  packed = kmemdup(scratch, dlen, GFP_KERNEL);
+  kfree(scratch);
+  if (!packed) {
+    return -ENOMEM;
+  }
+  *out = packed;
+  *out_len = dlen;
+  return 0;
+}
+
+int vtfs_zstore_put(struct vtfs_zstore* zs, ino_t ino, const char* data, size_t len) {
+  struct vtfs_zstore_entry* entry;
+  struct vtfs_zstore_entry* old;
+  int ret;
+  
+  entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+  if (!entry) {
+    return -ENOMEM;
+  }
+  entry->ino = ino;
+  entry->len = len;
+  entry->blocks = NULL;
+  
+  mutex_lock(&zs->lock);
+  if (zs->dedup) {
+    u64 start = ktime_get_ns();
+    
+    entry->blocks = zstore_split(zs, data, len, &entry->stored);
+    zs->compress_ns += ktime_get_ns() - start;
+    zs->compressed++;
+    if (!entry->blocks) {
+      mutex_unlock(&zs->lock);
+      kfree(entry);
+      return -ENOMEM;
+    }
+    entry->data = NULL;
+  } else {
+    ret = zstore_compress(zs, data, len, &entry->data, &entry->stored);
+    if (ret != 0) {
+      // Kept raw it would take as much memory here as where it is
+      if (ret == -E2BIG) {
+        zs->incompressible++;
+      }
+      mutex_unlock(&zs->lock);
+      kfree(entry);
+      return ret;
+    }
+  }
+  
+  old = zstore_find(zs, ino);
+  if (old) {
+    zstore_unlink(zs, old);
+  }
+  hash_add(zs->table, &entry->hash, ino);
+  zs->files++;
+  zs->raw_bytes += entry->len;
+  zs->stored_bytes += entry->stored;
+  mutex_unlock(&zs->lock);
+  
+  if (old) {
+    zstore_free(old);
+  }
+  return 0;
+}
+
+int vtfs_zstore_take(struct vtfs_zstore* zs, ino_t ino, size_t len, char** out) {
+  struct vtfs_zstore_entry* entry;
+  unsigned int dlen = len;
+  char* data;
+  u64 start;
+  int ret = 0;
+  
+  mutex_lock(&zs->lock);
+  entry = zstore_find(zs, ino);
+  if (!entry || entry->len != len) {
+    mutex_unlock(&zs->lock);
+    return -ENOENT;
+  }
+  data = kmalloc(len, GFP_KERNEL);
+  if (!data) {
+    mutex_unlock(&zs->lock);
+    return -ENOMEM;
+  }
+  // LZ4 decompression keeps no state in the transform
+  start = ktime_get_ns();
+  if (entry->blocks) {
+    for (size_t i = 0; ret == 0 && i < DIV_ROUND_UP(len, VTFS_BLOCK_SIZE); i++) {
+      ret = vtfs_block_read(entry->blocks[i], data + i * VTFS_BLOCK_SIZE);
+    }
+  } else if (crypto_comp_decompress(zs->comp, entry->data, entry->stored, data, &dlen) != 0 || dlen != len) {
+    ret = -EIO;
+  }
+  zs->decompress_ns += ktime_get_ns() - start;
+  zs->decompressed++;
+  if (ret != 0) {
+    mutex_unlock(&zs->lock);
+    kfree(data);
+    return ret;
+  }
+  zstore_unlink(zs, entry);
+  mutex_unlock(&zs->lock);
+  
+  zstore_free(entry);
+  *out = data;
+  return 0;
+}
+
+void vtfs_zstore_drop(struct vtfs_zstore* zs, ino_t ino) {
+  struct vtfs_zstore_entry* entry;
+  
+  if (!vtfs_zstore_enabled(zs)) {
+    return;
+  }
+  
+  mutex_lock(&zs->lock);
+  entry = zstore_find(zs, ino);
+  if (entry) {
+    zstore_unlink(zs, entry);
+  }
+  mutex_unlock(&zs->lock);
+  
+  if (entry) {
+    zstore_free(entry);
+  }
+}
+
+/*
+ * files=N raw_bytes=N stored_bytes=N ratio=R.RR
+ * compressed=N incompressible=N compress_ns=N decompressed=N decompress_ns=N
+ */
+static int compression_show(struct seq_file* m, void* v) {
+  struct vtfs_zstore* zs = m->private;
+  u64 ratio;
+  
+  mutex_lock(&zs->lock);
+  ratio = zs->stored_bytes ? div64_u64(zs->raw_bytes * 100, zs->stored_bytes) : 100;
+  seq_printf(m, "files=%llu raw_bytes=%llu stored_bytes=%llu ratio=%llu.%02llu\n",
+             zs->files, zs->raw_bytes, zs->stored_bytes, ratio / 100, ratio % 100);
+  seq_printf(m, "compressed=%llu incompressible=%llu compress_ns=%llu decompressed=%llu decompress_ns=%llu\n",
+             zs->compressed, zs->incompressible, zs->compress_ns, zs->decompressed, zs->decompress_ns);
+  mutex_unlock(&zs->lock);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(compression);
+
+int vtfs_zstore_init(struct vtfs_zstore* zs, bool compress, bool dedup, struct dentry* dir) {
+  mutex_init(&zs->lock);
+  hash_init(zs->table);
+  zs->files = 0;
+  zs->raw_bytes = 0;
+  zs->stored_bytes = 0;
+  zs->compressed = 0;
+  zs->compress_ns = 0;
+  zs->incompressible = 0;
+  zs->decompressed = 0;
+  zs->decompress_ns = 0;
+  
+  zs->comp = NULL;
+  zs->compress = compress;
+  zs->dedup = dedup;
+  
+  // Blocks are compressed by the block table
+  if (compress && !dedup) {
+    zs->comp = crypto_alloc_comp("lz4", 0, 0);
+    if (IS_ERR(zs->comp)) {
+      zs->comp = NULL;
+      zs->compress = false;
+      return -ENOENT;
+    }
+  }
+  debugfs_create_file("compression", 0444, dir, zs, &compression_fops);
+  return 0;
+}
+
+void vtfs_zstore_destroy(struct vtfs_zstore* zs) {
+  struct vtfs_zstore_entry* entry;
+  struct hlist_node* tmp;
+  int bkt;
+  
+  if (!vtfs_zstore_enabled(zs)) {
+    return;
+  }
+  
+  hash_for_each_safe(zs->table, bkt, tmp, entry, hash) {
+    hash_del(&entry->hash);
+    zstore_free(entry);
+  }
+  if (zs->comp) {
+    crypto_free_comp(zs->comp);
+    zs->comp = NULL;
+  }
+  zs->compress = false;
+  zs->dedup = false;
+}
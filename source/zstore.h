@@ -0,0 +1,66 @@
+#ifndef VTFS_ZSTORE_H
+#define VTFS_ZSTORE_H
+
+#include <linux/types.h>
+#include <linux/hashtable.h>
+#include <linux/mutex.h>
+#include <linux/dcache.h>
+#include <linux/crypto.h>
+#include "blocks.h"
+
+#define VTFS_ZSTORE_HASH_BITS 10
+
+/*
+ * Per-mount store for the data of cold RAM mode files, LZ4-compressed
+ * through the crypto API, one entry per ino. Data that does not compress
+ * is not taken and stays in memory. With dedup the data is cut into blocks shared with
+ * every other file and mount instead (see blocks.h). A file's buffer moves
+ * here when it falls out of the hot set (mem_limit, see lru.h) and back
+ * into memory on its next access, so a write never touches shared blocks.
+ * debugfs vtfs/<major:minor>/compression shows the ratio and the time spent.
+ */
+struct vtfs_zstore_entry {
+  struct hlist_node hash;
+  ino_t ino;
+  char* data;               // LZ4
+  size_t stored;            // bytes held in data
+  size_t len;               // the file's bytes, uncompressed
+  struct vtfs_block** blocks; // with dedup, instead of data
+};
+
+struct vtfs_zstore {
+  struct mutex lock;        // also for the transform's scratch memory
+  DECLARE_HASHTABLE(table, VTFS_ZSTORE_HASH_BITS);
+  struct crypto_comp* comp; // whole buffers, without dedup
+  bool compress;
+  bool dedup;
+  u64 files;
+  u64 raw_bytes;            // uncompressed size of everything stored
+  u64 stored_bytes;         // with dedup, shared blocks count for every file; charged to mem_limit
+  u64 compressed;           // buffers ever compressed, and the time it took
+  u64 compress_ns;
+  u64 incompressible;       // buffers not taken, as they would not shrink
+  u64 decompressed;
+  u64 decompress_ns;
+};
+
+// -ENOENT if compression without dedup finds no lz4; the store stays unusable then
+int vtfs_zstore_init(struct vtfs_zstore* zs, bool compress, bool dedup, struct dentry* dir);
+// The debugfs files must be gone already
+void vtfs_zstore_destroy(struct vtfs_zstore* zs);
+
+static inline bool vtfs_zstore_enabled(struct vtfs_zstore* zs) {
+  return zs->compress || zs->dedup;
+}
+
+/*
+ * Stores a copy of len bytes of ino's data, which the caller frees once
+ * nothing points to it. -E2BIG if the copy would be no smaller, -ENOMEM;
+ * nothing is stored then.
+ */
+int vtfs_zstore_put(struct vtfs_zstore* zs, ino_t ino, const char* data, size_t len);
+// Hands ino's data back in a new buffer of len bytes and forgets it
+int vtfs_zstore_take(struct vtfs_zstore* zs, ino_t ino, size_t len, char** out);
+void vtfs_zstore_drop(struct vtfs_zstore* zs, ino_t ino);
+
+#endif // VTFS_ZSTORE_H
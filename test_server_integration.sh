@@ -8,6 +8,8 @@ MODULE_NAME="vtfs"
 MOUNT_POINT="/mnt/vtfs"
 SERVER_URL="http://127.0.0.1:8080/api"
 TOKEN="test_persistence_$(date +%s)"
+# "Остановка" сервера для теста журнала: соединения с ним сбрасываются
+SERVER_BLOCK="-p tcp -d 127.0.0.1 --dport 8080 -j REJECT --reject-with tcp-reset"
 
 RED='\033[0;31m'
 GREEN='\033[0;32m'
@@ -15,6 +17,7 @@ YELLOW='\033[1;33m'
 NC='\033[0m'
 
 cleanup() {
+    iptables -D OUTPUT $SERVER_BLOCK 2>/dev/null || true
     umount "$MOUNT_POINT" 2>/dev/null || true
     rmmod "$MODULE_NAME" 2>/dev/null || true
     rm -rf "$MOUNT_POINT" 2>/dev/null || true
@@ -35,7 +38,7 @@ fi
 trap cleanup EXIT
 
 # Проверка доступности сервера
-echo "[1/10] Проверка доступности сервера..."
+echo "[1/12] Проверка доступности сервера..."
 if ! curl -s "$SERVER_URL/list?token=$TOKEN&parent_ino=100" > /dev/null 2>&1; then
     echo -e "${YELLOW}⚠️  Сервер недоступен${NC}"
     echo "Запустите сервер: cd server && mvn spring-boot:run"
@@ -46,7 +49,7 @@ echo -e "${GREEN}✅ Сервер доступен${NC}"
 echo ""
 
 # Компиляция модуля
-echo "[2/10] Компиляция модуля..."
+echo "[2/12] Компиляция модуля..."
 make clean >/dev/null 2>&1 || true
 if ! make >/dev/null 2>&1; then
     echo -e "${RED}❌ Ошибка компиляции${NC}"
@@ -59,7 +62,7 @@ echo ""
 mkdir -p "$MOUNT_POINT"
 
 # Монтирование в Server режиме
-echo "[3/10] Монтирование в Server режиме..."
+echo "[3/12] Монтирование в Server режиме..."
 insmod "$MODULE_NAME.ko" 2>/dev/null || true
 if ! mount -t vtfs none "$MOUNT_POINT" -o token="$TOKEN"; then
     echo -e "${RED}❌ Ошибка монтирования${NC}"
@@ -69,7 +72,7 @@ echo -e "${GREEN}✅ Монтирование успешно${NC}"
 echo ""
 
 # Создание файлов и директорий
-echo "[4/10] Создание файлов и директорий..."
+echo "[4/12] Создание файлов и директорий..."
 echo "test_data_1" > "$MOUNT_POINT/file1.txt"
 echo "test_data_2" > "$MOUNT_POINT/file2.txt"
 mkdir "$MOUNT_POINT/test_dir"
@@ -78,7 +81,7 @@ echo -e "${GREEN}✅ Файлы созданы${NC}"
 echo ""
 
 # Проверка что файлы созданы
-echo "[5/10] Проверка созданных файлов..."
+echo "[5/12] Проверка созданных файлов..."
 if [ ! -f "$MOUNT_POINT/file1.txt" ] || [ ! -f "$MOUNT_POINT/file2.txt" ] || [ ! -f "$MOUNT_POINT/test_dir/file3.txt" ]; then
     echo -e "${RED}❌ Файлы не найдены${NC}"
     exit 1
@@ -96,7 +99,7 @@ echo -e "${GREEN}✅ Данные корректны${NC}"
 echo ""
 
 # Размонтирование
-echo "[6/10] Размонтирование..."
+echo "[6/12] Размонтирование..."
 umount "$MOUNT_POINT" || true
 sleep 1
 rmmod "$MODULE_NAME" 2>/dev/null || true
@@ -105,7 +108,7 @@ echo -e "${GREEN}✅ Размонтирование успешно${NC}"
 echo ""
 
 # Повторное монтирование
-echo "[7/10] Повторное монтирование..."
+echo "[7/12] Повторное монтирование..."
 insmod "$MODULE_NAME.ko" 2>/dev/null || true
 if ! mount -t vtfs none "$MOUNT_POINT" -o token="$TOKEN"; then
     echo -e "${RED}❌ Ошибка повторного монтирования${NC}"
@@ -115,7 +118,7 @@ echo -e "${GREEN}✅ Повторное монтирование успешно$
 echo ""
 
 # Проверка сохраненных данных
-echo "[8/10] Проверка сохраненных данных..."
+echo "[8/12] Проверка сохраненных данных..."
 if [ ! -f "$MOUNT_POINT/file1.txt" ]; then
     echo -e "${RED}❌ file1.txt не найден после перемонтирования${NC}"
     exit 1
@@ -139,7 +142,7 @@ echo -e "${GREEN}✅ Все файлы найдены${NC}"
 echo ""
 
 # Проверка содержимого файлов
-echo "[9/10] Проверка содержимого файлов..."
+echo "[9/12] Проверка содержимого файлов..."
 RESTORED_DATA1=$(cat "$MOUNT_POINT/file1.txt")
 RESTORED_DATA2=$(cat "$MOUNT_POINT/file2.txt")
 RESTORED_DATA3=$(cat "$MOUNT_POINT/test_dir/file3.txt")
@@ -161,8 +164,64 @@ fi
 echo -e "${GREEN}✅ Все данные восстановлены корректно${NC}"
 echo ""
 
+# Содержимое файла корневой директории на сервере, в обход модуля
+server_cat() {
+    local entry
+    entry=$(curl -s "$SERVER_URL/list?token=$TOKEN&parent_ino=100" | tail -c +9 | grep "^[0-9]*,$1,") || return 1
+    curl -s "$SERVER_URL/read?token=$TOKEN&ino=$(echo "$entry" | cut -d, -f1)&offset=0&length=$(echo "$entry" | cut -d, -f4)" | tail -c +33
+}
+
+# Журнал: изменения, сделанные пока сервер недоступен, доходят до него
+echo "[10/12] Журнал: изменения при недоступном сервере..."
+if ! command -v iptables >/dev/null 2>&1; then
+    echo -e "${YELLOW}⚠️  iptables не найден, пропускаем тест журнала${NC}"
+else
+    JOURNAL_DIR=$(mktemp -d)
+    JOURNAL="$JOURNAL_DIR/vtfs.journal"
+    umount "$MOUNT_POINT"
+    sleep 1
+    if ! mount -t vtfs none "$MOUNT_POINT" -o token="$TOKEN",journal="$JOURNAL"; then
+        echo -e "${RED}❌ Ошибка монтирования с журналом${NC}"
+        exit 1
+    fi
+    
+    iptables -I OUTPUT $SERVER_BLOCK
+    echo "journal_data_1" > "$MOUNT_POINT/file1.txt"
+    rm "$MOUNT_POINT/file2.txt"
+    # Без сервера журнал отдает записи только при следующем монтировании
+    umount "$MOUNT_POINT"
+    sleep 1
+    iptables -D OUTPUT $SERVER_BLOCK
+    echo -e "${GREEN}✅ Изменения приняты в журнал${NC}"
+    echo ""
+    
+    echo "[11/12] Журнал: воспроизведение после перемонтирования..."
+    if ! mount -t vtfs none "$MOUNT_POINT" -o token="$TOKEN",journal="$JOURNAL"; then
+        echo -e "${RED}❌ Ошибка повторного монтирования с журналом${NC}"
+        exit 1
+    fi
+    SERVER_DATA1=$(server_cat file1.txt || true)
+    if [ "$SERVER_DATA1" != "journal_data_1" ]; then
+        echo -e "${RED}❌ Запись из журнала не дошла до сервера: '$SERVER_DATA1'${NC}"
+        exit 1
+    fi
+    if server_cat file2.txt >/dev/null; then
+        echo -e "${RED}❌ Удаление из журнала не дошло до сервера${NC}"
+        exit 1
+    fi
+    if [ "$(cat "$MOUNT_POINT/file1.txt")" != "journal_data_1" ] || [ -e "$MOUNT_POINT/file2.txt" ]; then
+        echo -e "${RED}❌ После воспроизведения журнала дерево не совпадает${NC}"
+        exit 1
+    fi
+    umount "$MOUNT_POINT"
+    sleep 1
+    rm -rf "$JOURNAL_DIR"
+    echo -e "${GREEN}✅ Журнал воспроизведен, изменения на сервере${NC}"
+fi
+echo ""
+
 # Итоги
-echo "[10/10] Итоги тестирования..."
+echo "[12/12] Итоги тестирования..."
 echo -e "${GREEN}✅ Все тесты пройдены успешно!${NC}"
 echo ""
 echo "=========================================="
@@ -174,6 +233,7 @@ echo "  ✅ Файлы создаются на сервере"
 echo "  ✅ Данные сохраняются на сервере"
 echo "  ✅ Данные загружаются при монтировании"
 echo "  ✅ Данные переживают размонтирование"
+echo "  ✅ Журнал доносит изменения, сделанные без сервера"
 echo ""
 echo "Для проверки после перезагрузки системы:"
 echo "  1. Перезагрузите Ubuntu"
@@ -42,7 +42,7 @@ fi
 trap cleanup EXIT
 
 # Компиляция модуля
-echo "[1/8] Компиляция модуля..."
+echo "[1/9] Компиляция модуля..."
 make clean >/dev/null 2>&1 || true
 if ! make >/dev/null 2>&1; then
     echo -e "${RED}❌ Ошибка компиляции${NC}"
@@ -57,7 +57,7 @@ mkdir -p "$MOUNT_POINT"
 # ==========================================
 # ТЕСТ 1: RAM РЕЖИМ (без токена)
 # ==========================================
-echo "[2/8] Тест RAM режима..."
+echo "[2/9] Тест RAM режима..."
 insmod "$MODULE_NAME.ko" 2>/dev/null || true
 mount -t vtfs none "$MOUNT_POINT" -o token=""
 if [ $? -eq 0 ]; then
@@ -89,10 +89,84 @@ else
 fi
 echo ""
 
+# ==========================================
+# ТЕСТ 1б: RAM РЕЖИМ С ОБРАЗОМ (image=)
+# ==========================================
+echo "[3/9] Тест RAM режима с образом..."
+IMAGE_DIR=$(mktemp -d)
+IMAGE="$IMAGE_DIR/vtfs.img"
+IMAGE_SUMS="$IMAGE_DIR/sums"
+
+# Контрольные суммы всех файлов (жесткая ссылка входит дважды)
+image_sums() {
+    (cd "$MOUNT_POINT" && find . -type f | sort | xargs -r sha256sum)
+}
+
+# Перемонтирует с образом и сравнивает содержимое с сохраненным
+image_remount_check() {
+    image_sums > "$IMAGE_SUMS"
+    umount "$MOUNT_POINT"
+    sleep 1
+    if ! mount -t vtfs none "$MOUNT_POINT" -o image="$IMAGE"; then
+        echo -e "${RED}❌ Образ: ошибка монтирования ($1)${NC}"
+        return 1
+    fi
+    if ! image_sums | cmp -s - "$IMAGE_SUMS"; then
+        echo -e "${RED}❌ Образ: содержимое не совпадает ($1)${NC}"
+        return 1
+    fi
+    if [ "$(stat -c %i "$MOUNT_POINT/a.txt")" != "$(stat -c %i "$MOUNT_POINT/dir/link.txt")" ] ||
+       [ "$(stat -c %h "$MOUNT_POINT/a.txt")" != "2" ]; then
+        echo -e "${RED}❌ Образ: жесткая ссылка потеряна ($1)${NC}"
+        return 1
+    fi
+    echo -e "${GREEN}✅ Образ: данные восстановлены ($1)${NC}"
+}
+
+insmod "$MODULE_NAME.ko" 2>/dev/null || true
+if mount -t vtfs none "$MOUNT_POINT" -o image="$IMAGE"; then
+    echo "image_data_1" > "$MOUNT_POINT/a.txt"
+    head -c 1048576 /dev/urandom > "$MOUNT_POINT/big.bin"
+    mkdir -p "$MOUNT_POINT/dir/sub"
+    echo "nested_data" > "$MOUNT_POINT/dir/sub/nested.txt"
+    ln "$MOUNT_POINT/a.txt" "$MOUNT_POINT/dir/link.txt"
+    
+    # Первая контрольная точка
+    image_remount_check "1-я контрольная точка" || exit 1
+    
+    # Вторая: короче через ссылку, без большого файла; место первой еще занято
+    echo "short" > "$MOUNT_POINT/dir/link.txt"
+    rm "$MOUNT_POINT/big.bin"
+    echo "second_data" > "$MOUNT_POINT/dir/sub/second.txt"
+    image_remount_check "2-я контрольная точка" || exit 1
+    SIZE_SECOND=$(stat -c %s "$IMAGE")
+    
+    # Третья ложится в освободившееся место, образ обрезается
+    echo "third_data" >> "$MOUNT_POINT/dir/sub/nested.txt"
+    image_remount_check "3-я контрольная точка" || exit 1
+    if [ "$(stat -c %s "$IMAGE")" -lt "$SIZE_SECOND" ]; then
+        echo -e "${GREEN}✅ Образ: место переиспользовано, файл обрезан${NC}"
+    else
+        echo -e "${RED}❌ Образ: файл не уменьшился ($(stat -c %s "$IMAGE") >= $SIZE_SECOND)${NC}"
+        exit 1
+    fi
+    
+    umount "$MOUNT_POINT"
+    sleep 1
+    if lsmod | grep -q "^$MODULE_NAME "; then
+        rmmod "$MODULE_NAME"
+    fi
+else
+    echo -e "${RED}❌ Образ: ошибка монтирования${NC}"
+    exit 1
+fi
+rm -rf "$IMAGE_DIR"
+echo ""
+
 # ==========================================
 # ТЕСТ 2: SERVER РЕЖИМ (с токеном)
 # ==========================================
-echo "[3/8] Проверка доступности сервера..."
+echo "[4/9] Проверка доступности сервера..."
 if ! curl -s "$SERVER_URL/list?token=test&parent_ino=100" >/dev/null 2>&1; then
     echo -e "${YELLOW}⚠️  Сервер недоступен, пропускаем тест сервера${NC}"
     echo "   Запустите сервер: cd server && mvn spring-boot:run"
@@ -102,7 +176,7 @@ fi
 echo -e "${GREEN}✅ Сервер доступен${NC}"
 echo ""
 
-echo "[4/8] Тест Server режима..."
+echo "[5/9] Тест Server режима..."
 TOKEN="test_$(date +%s)"
 insmod "$MODULE_NAME.ko" 2>/dev/null || true
 mount -t vtfs none "$MOUNT_POINT" -o token="$TOKEN"
@@ -123,6 +197,14 @@ if [ $? -eq 0 ]; then
         echo -e "${RED}❌ Server режим: файл не создан${NC}"
     fi
     
+    # Копирование на стороне сервера (copy_file_range)
+    cp --reflink=auto "$MOUNT_POINT/test_server.txt" "$MOUNT_POINT/test_server_copy.txt" 2>/dev/null || true
+    if [ "$(cat "$MOUNT_POINT/test_server_copy.txt" 2>/dev/null)" = "test_server_data" ]; then
+        echo -e "${GREEN}✅ Server режим: файл скопирован${NC}"
+    else
+        echo -e "${RED}❌ Server режим: копия не совпадает${NC}"
+    fi
+    
     # Создание директории
     mkdir "$MOUNT_POINT/test_dir"
     if [ -d "$MOUNT_POINT/test_dir" ]; then
@@ -142,7 +224,7 @@ if [ $? -eq 0 ]; then
     
     # Проверка персистентности
     echo ""
-    echo "[5/8] Проверка персистентности данных..."
+    echo "[6/9] Проверка персистентности данных..."
     sleep 1
     insmod "$MODULE_NAME.ko" 2>/dev/null || true
     mount -t vtfs none "$MOUNT_POINT" -o token="$TOKEN"
@@ -171,7 +253,7 @@ echo ""
 # ==========================================
 # ТЕСТ 3: ПЕРЕКЛЮЧЕНИЕ РЕЖИМОВ
 # ==========================================
-echo "[6/8] Тест переключения режимов..."
+echo "[7/9] Тест переключения режимов..."
 insmod "$MODULE_NAME.ko" 2>/dev/null || true
 
 # RAM -> Server
@@ -221,10 +303,10 @@ echo ""
 # ==========================================
 # ИТОГИ
 # ==========================================
-echo "[7/8] Итоги тестирования..."
+echo "[8/9] Итоги тестирования..."
 echo -e "${GREEN}✅ Все тесты пройдены успешно!${NC}"
 echo ""
-echo "[8/8] Очистка..."
+echo "[9/9] Очистка..."
 cleanup
 echo -e "${GREEN}✅ Очистка завершена${NC}"
 echo ""